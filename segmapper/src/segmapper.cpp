@@ -57,7 +57,8 @@ SegMapper::SegMapper(ros::NodeHandle& n) : nh_(n) {
     if (needs_normal_estimation) {
       normal_estimator = NormalEstimator::create(
           segmatch_worker_params_.segmatch_params.normal_estimator_type,
-          segmatch_worker_params_.segmatch_params.radius_for_normal_estimation_m);
+          segmatch_worker_params_.segmatch_params.radius_for_normal_estimation_m,
+          segmatch_worker_params_.segmatch_params.normal_estimator_num_threads);
     }
     local_maps_.emplace_back(
         segmatch_worker_params_.segmatch_params.local_map_params, std::move(normal_estimator));
@@ -123,6 +124,7 @@ void SegMapper::publishMapThread() {
     MapCloud local_maps;
     for (size_t i = 0u; i < local_maps_.size(); ++i) {
       std::unique_lock<std::mutex> map_lock(local_maps_mutexes_[i]);
+      local_maps_[i].applyPendingTransformations();
       local_maps += local_maps_[i].getFilteredPoints();
       map_lock.unlock();
     }
@@ -353,18 +355,6 @@ void SegMapper::segMatchThread() {
         }
         BENCHMARK_STOP("SM.ProcessLoopClosure.ProcessLocalMap");
 
-        MapCloud local_maps;
-        for (size_t i = 0u; i < local_maps_.size(); ++i) {
-          std::unique_lock<std::mutex> map_lock(local_maps_mutexes_[i]);
-          local_maps += local_maps_[i].getFilteredPoints();
-          map_lock.unlock();
-        }
-        sensor_msgs::PointCloud2 msg;
-        laser_slam_ros::convert_to_point_cloud_2_msg(
-            local_maps,
-            params_.world_frame, &msg);
-        local_map_pub_.publish(msg);
-
         // Update the Segmatch object.
         std::vector<Trajectory> updated_trajectories;
         for (const auto& worker: laser_slam_workers_) {
@@ -386,6 +376,24 @@ void SegMapper::segMatchThread() {
           worker->setLockScanCallback(false);
         }
 
+        // Publish the local maps once the workers are running again, since the deferred local
+        // map transformations must be applied first. If the local maps are not published, the
+        // transformations are applied when the points are needed, e.g. at the next update.
+        if (laser_slam_worker_params_.publish_local_map) {
+          MapCloud local_maps;
+          for (size_t i = 0u; i < local_maps_.size(); ++i) {
+            std::unique_lock<std::mutex> map_lock(local_maps_mutexes_[i]);
+            local_maps_[i].applyPendingTransformations();
+            local_maps += local_maps_[i].getFilteredPoints();
+            map_lock.unlock();
+          }
+          sensor_msgs::PointCloud2 msg;
+          laser_slam_ros::convert_to_point_cloud_2_msg(
+              local_maps,
+              params_.world_frame, &msg);
+          local_map_pub_.publish(msg);
+        }
+
         n_loops++;
         LOG(INFO) << "That was the loop number " << n_loops << ".";
       }
@@ -407,9 +415,13 @@ void SegMapper::segMatchThread() {
 
 bool SegMapper::saveMapServiceCall(segmapper::SaveMap::Request& request,
                                    segmapper::SaveMap::Response& response) {
+  std::unique_lock<std::mutex> map_lock(local_maps_mutexes_.front());
+  local_maps_.front().applyPendingTransformations();
+  MapCloud local_map;
+  local_map += local_maps_.front().getFilteredPoints();
+  map_lock.unlock();
   try {
-    pcl::io::savePCDFileASCII(request.filename.data,
-                              local_maps_.front().getFilteredPoints());
+    pcl::io::savePCDFileASCII(request.filename.data, local_map);
   }
   catch (const std::runtime_error& e) {
     ROS_ERROR_STREAM("Unable to save: " << e.what());
@@ -423,6 +435,7 @@ bool SegMapper::saveLocalMapServiceCall(segmapper::SaveMap::Request& request,
   // TODO this is saving only the local map of worker ID 0.
   std::unique_lock<std::mutex> map_lock(local_maps_mutexes_[0]);
   MapCloud local_map;
+  local_maps_[0].applyPendingTransformations();
   local_map += local_maps_[0].getFilteredPoints();
   map_lock.unlock();
   try {
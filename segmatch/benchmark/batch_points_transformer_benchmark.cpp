@@ -0,0 +1,109 @@
+// Compares the transformation of the segment clouds after a loop closure, as performed by
+// SegmentedCloud::updateSegments, with pcl::transformPointCloud applied to each cloud and with the
+// BatchPointsTransformer using either the scalar kernel or the AVX2 kernel.
+//
+// Usage: batch_points_transformer_benchmark [num_segments] [points_per_segment] [num_repetitions]
+//  - num_segments: Number of segments. Each segment has a point cloud and a reconstruction of
+//    the same size, and a compressed reconstruction with a tenth of the points.
+//  - points_per_segment: Number of points in the point cloud of each segment.
+//  - num_repetitions: Number of times the clouds are transformed by each method.
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <Eigen/Geometry>
+#include <glog/logging.h>
+#include <pcl/common/transforms.h>
+
+#include "benchmark_utilities.hpp"
+#include "segmatch/batch_points_transformer.hpp"
+#include "segmatch/common.hpp"
+
+using namespace segmatch;
+using namespace segmatch::benchmark;
+
+namespace {
+
+PointCloud createRandomCloud(const size_t num_points, std::mt19937& random_engine) {
+  std::uniform_real_distribution<float> uniform(-50.0f, 50.0f);
+  PointCloud cloud;
+  cloud.reserve(num_points);
+  for (size_t i = 0u; i < num_points; ++i) {
+    cloud.push_back(PclPoint(uniform(random_engine), uniform(random_engine),
+                             uniform(random_engine)));
+  }
+  return cloud;
+}
+
+// Transformation slightly different for every segment, as after a loop closure.
+Eigen::Matrix4f createTransformation(const size_t segment_index) {
+  Eigen::Affine3f transformation(Eigen::AngleAxisf(1e-4f * segment_index,
+                                                   Eigen::Vector3f::UnitZ()));
+  transformation.translation() << 0.01f * segment_index, 0.5f, 0.0f;
+  return transformation.matrix();
+}
+
+void printTime(const std::string& name, const double time_s, const size_t num_repetitions,
+               const double reference_time_s) {
+  std::cout << std::left << std::setw(14) << name << std::right << std::fixed <<
+      std::setprecision(3) << std::setw(12) << time_s / num_repetitions * 1e3 <<
+      std::setw(12) << reference_time_s / time_s << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = true;
+
+  const size_t num_segments = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000u;
+  const size_t points_per_segment = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 500u;
+  const size_t num_repetitions = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 20u;
+  CHECK_GT(num_segments, 0u);
+  CHECK_GT(num_repetitions, 0u);
+
+  std::mt19937 random_engine(42u);
+  std::vector<PointCloud> clouds;
+  std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f>> transformations;
+  clouds.reserve(3u * num_segments);
+  size_t num_points = 0u;
+  for (size_t i = 0u; i < num_segments; ++i) {
+    for (const size_t cloud_size : { points_per_segment, points_per_segment,
+                                     points_per_segment / 10u }) {
+      clouds.push_back(createRandomCloud(cloud_size, random_engine));
+      transformations.push_back(createTransformation(i));
+      num_points += cloud_size;
+    }
+  }
+  std::cout << num_segments << " segments, " << num_points << " points." << std::endl;
+  std::cout << std::left << std::setw(14) << "Method" << std::right << std::setw(12) <<
+      "Time [ms]" << std::setw(12) << "Speedup" << std::endl;
+
+  Clock::time_point start = Clock::now();
+  for (size_t r = 0u; r < num_repetitions; ++r) {
+    for (size_t i = 0u; i < clouds.size(); ++i) {
+      pcl::transformPointCloud(clouds[i], clouds[i], transformations[i]);
+    }
+  }
+  const double pcl_time_s = getElapsedSeconds(start);
+  printTime("PCL", pcl_time_s, num_repetitions, pcl_time_s);
+
+  for (const bool force_scalar : { true, false }) {
+    start = Clock::now();
+    for (size_t r = 0u; r < num_repetitions; ++r) {
+      BatchPointsTransformer points_transformer(force_scalar);
+      for (size_t i = 0u; i < clouds.size(); ++i) {
+        points_transformer.add(transformations[i], clouds[i]);
+      }
+      points_transformer.run();
+    }
+    printTime(force_scalar ? "Batch scalar" : "Batch", getElapsedSeconds(start), num_repetitions,
+              pcl_time_s);
+  }
+
+  return 0;
+}
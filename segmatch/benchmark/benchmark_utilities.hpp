@@ -0,0 +1,22 @@
+#ifndef SEGMATCH_BENCHMARK_UTILITIES_HPP_
+#define SEGMATCH_BENCHMARK_UTILITIES_HPP_
+
+#include <chrono>
+
+namespace segmatch {
+namespace benchmark {
+
+/// \brief Clock used for timing the benchmarks.
+typedef std::chrono::steady_clock Clock;
+
+/// \brief Gets the time elapsed since a time point.
+/// \param start The time point.
+/// \returns The elapsed time in seconds.
+inline double getElapsedSeconds(const Clock::time_point& start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace benchmark
+} // namespace segmatch
+
+#endif // SEGMATCH_BENCHMARK_UTILITIES_HPP_
@@ -0,0 +1,230 @@
+// Compares the recall and the query latency of the approximate descriptor indices with the exact
+// search on the segments of an exported database.
+//
+// Usage: descriptor_index_benchmark <database> [knn_feature_dim] [k] [num_queries]
+//                                   [normalize_eigen_for_knn]
+//  - database: Segment archive ("*.bin") or prefix of the CSV files written by
+//    segmatch::database::exportSegmentsAndFeatures(). CSV files are converted to an archive next
+//    to them first.
+//  - knn_feature_dim: Number of rotation invariant feature values used as descriptor.
+//  - k: Number of neighbours searched.
+//  - num_queries: Number of segments held out of the index and used as queries.
+//  - normalize_eigen_for_knn: If 1, the first 7 values are scaled by the inverse of the
+//    max_eigen_features_values of the launch files, as done by the classifier.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "benchmark_utilities.hpp"
+#include "segmatch/database.hpp"
+#include "segmatch/descriptor_indices/hnsw_index.hpp"
+#include "segmatch/descriptor_indices/ivfpq_index.hpp"
+#include "segmatch/descriptor_indices/log_structured_kdtree_index.hpp"
+#include "segmatch/segment_archive.hpp"
+
+using namespace segmatch;
+using namespace segmatch::benchmark;
+
+namespace {
+
+// Value of the ClassifierParams::max_eigen_features_values in the launch files.
+constexpr double kMaxEigenFeaturesValues[] = { 2493.5, 186681.0, 188389.0, 0.3304, 188388.0,
+                                               1.0899, 0.9987 };
+constexpr size_t kNumEigenFeatures = sizeof(kMaxEigenFeaturesValues) / sizeof(double);
+
+struct Dataset {
+  std::vector<Id> segment_ids;
+  std::vector<Eigen::VectorXf> descriptors;
+  std::vector<Eigen::VectorXf> queries;
+};
+
+// Load the descriptors of the last views of the segments and hold out the queries. The
+// descriptors are computed like in OpenCvRandomForest::computeKnnDescriptor().
+bool loadDataset(const std::string& archive_filename, const size_t knn_feature_dim,
+                 const size_t num_queries, const bool normalize_eigen_for_knn,
+                 Dataset* dataset) {
+  CHECK(!normalize_eigen_for_knn || knn_feature_dim >= kNumEigenFeatures) <<
+      "Normalizing the eigenvalue features requires at least " << kNumEigenFeatures <<
+      " values.";
+  Eigen::VectorXf inverted_max_eigen(kNumEigenFeatures);
+  for (size_t i = 0u; i < kNumEigenFeatures; ++i) {
+    inverted_max_eigen[i] = static_cast<float>(1.0 / kMaxEigenFeaturesValues[i]);
+  }
+
+  SegmentArchiveReader reader;
+  if (!reader.open(archive_filename)) return false;
+  SegmentedCloud segmented_cloud(false);
+  reader.readSegmentedCloud(&segmented_cloud, false);
+
+  std::vector<std::pair<Id, Eigen::VectorXf>> descriptors;
+  for (const auto& id_segment : segmented_cloud) {
+    if (id_segment.second.empty()) continue;
+    const Features& features = id_segment.second.getLastView().features;
+    if (features.empty()) continue;
+    const auto values = features.getRotationInvariantValues();
+    CHECK_GE(static_cast<size_t>(values.size()), knn_feature_dim) <<
+        "The descriptors have less than knn_feature_dim rotation invariant values.";
+    Eigen::VectorXf descriptor = values.leftCols(knn_feature_dim).transpose().cast<float>();
+    if (normalize_eigen_for_knn) {
+      descriptor.head(kNumEigenFeatures) =
+          descriptor.head(kNumEigenFeatures).cwiseProduct(inverted_max_eigen);
+    }
+    descriptors.emplace_back(id_segment.first, descriptor);
+  }
+  if (descriptors.size() <= num_queries) {
+    LOG(ERROR) << "Not enough described segments: " << descriptors.size() << ".";
+    return false;
+  }
+
+  std::mt19937 random_engine(42u);
+  std::shuffle(descriptors.begin(), descriptors.end(), random_engine);
+  for (size_t i = 0u; i < descriptors.size(); ++i) {
+    if (i < num_queries) {
+      dataset->queries.push_back(descriptors[i].second);
+    } else {
+      dataset->segment_ids.push_back(descriptors[i].first);
+      dataset->descriptors.push_back(descriptors[i].second);
+    }
+  }
+  return true;
+}
+
+double buildIndex(const Dataset& dataset, DescriptorIndex* index) {
+  const Clock::time_point start = Clock::now();
+  for (size_t i = 0u; i < dataset.segment_ids.size(); ++i) {
+    index->insert(dataset.segment_ids[i], dataset.descriptors[i]);
+  }
+  return getElapsedSeconds(start);
+}
+
+// Run the queries on an index. Returns the mean latency of a query in seconds.
+double runQueries(const Dataset& dataset, const DescriptorIndex& index, const size_t k,
+                  std::vector<std::vector<Id>>* neighbours) {
+  neighbours->resize(dataset.queries.size());
+  std::vector<float> squared_distances;
+  const Clock::time_point start = Clock::now();
+  for (size_t i = 0u; i < dataset.queries.size(); ++i) {
+    index.knn(dataset.queries[i], k, &(*neighbours)[i], &squared_distances);
+  }
+  return getElapsedSeconds(start) / static_cast<double>(dataset.queries.size());
+}
+
+double computeRecall(const std::vector<std::vector<Id>>& exact_neighbours,
+                     const std::vector<std::vector<Id>>& neighbours) {
+  size_t num_expected = 0u;
+  size_t num_found = 0u;
+  for (size_t i = 0u; i < exact_neighbours.size(); ++i) {
+    const std::unordered_set<Id> found(neighbours[i].begin(), neighbours[i].end());
+    num_expected += exact_neighbours[i].size();
+    for (const Id segment_id : exact_neighbours[i]) num_found += found.count(segment_id);
+  }
+  return num_expected == 0u ? 1.0 : static_cast<double>(num_found) / num_expected;
+}
+
+void printResult(const std::string& index_name, const std::string& parameter,
+                 const double build_time_s, const double query_time_s, const double recall) {
+  std::cout << std::left << std::setw(22) << index_name << std::setw(18) << parameter <<
+      std::right << std::fixed << std::setprecision(3) << std::setw(12) << build_time_s <<
+      std::setw(14) << query_time_s * 1e6 << std::setw(10) << recall << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = true;
+
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <segments.bin | CSV prefix> [knn_feature_dim] [k] " <<
+        "[num_queries] [normalize_eigen_for_knn]" << std::endl;
+    return 1;
+  }
+  const std::string database_path = argv[1];
+  const size_t knn_feature_dim = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 7u;
+  const size_t k = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 25u;
+  const size_t num_queries = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 1000u;
+  const bool normalize_eigen_for_knn = argc > 5 ? std::atoi(argv[5]) != 0 : true;
+  CHECK_GT(knn_feature_dim, 0u);
+
+  std::string archive_filename = database_path;
+  const std::string kArchiveExtension = ".bin";
+  if (database_path.size() < kArchiveExtension.size() ||
+      database_path.compare(database_path.size() - kArchiveExtension.size(),
+                            kArchiveExtension.size(), kArchiveExtension) != 0) {
+    archive_filename = database_path + "_segments.bin";
+    if (!database::convertCsvToSegmentsArchive(database_path, archive_filename)) return 1;
+  }
+
+  Dataset dataset;
+  if (!loadDataset(archive_filename, knn_feature_dim, num_queries, normalize_eigen_for_knn,
+                   &dataset)) {
+    return 1;
+  }
+  std::cout << dataset.segment_ids.size() << " descriptors of dimension " << knn_feature_dim <<
+      ", " << dataset.queries.size() << " queries, k = " << k << "." << std::endl;
+  std::cout << std::left << std::setw(22) << "Index" << std::setw(18) << "Parameter" <<
+      std::right << std::setw(12) << "Build [s]" << std::setw(14) << "Query [us]" <<
+      std::setw(10) << "Recall" << std::endl;
+
+  // The exact search gives the ground truth.
+  std::vector<std::vector<Id>> exact_neighbours;
+  {
+    LogStructuredKdTreeIndex index(knn_feature_dim);
+    const double build_time_s = buildIndex(dataset, &index);
+    const double query_time_s = runQueries(dataset, index, k, &exact_neighbours);
+    printResult("LogStructuredKdTree", "-", build_time_s, query_time_s, 1.0);
+  }
+
+  std::vector<std::vector<Id>> neighbours;
+  {
+    HnswIndex index(knn_feature_dim, 16u, 100u, k);
+    const double build_time_s = buildIndex(dataset, &index);
+    for (const size_t ef_search : { k, 2u * k, 4u * k, 8u * k, 16u * k }) {
+      index.setEfSearch(ef_search);
+      const double query_time_s = runQueries(dataset, index, k, &neighbours);
+      printResult("Hnsw", "ef_search=" + std::to_string(ef_search), build_time_s, query_time_s,
+                  computeRecall(exact_neighbours, neighbours));
+    }
+  }
+
+  {
+    // About sqrt(n) lists, which balances the cost of finding the lists and of scanning them.
+    const size_t num_lists = std::max<size_t>(
+        1u, static_cast<size_t>(std::sqrt(static_cast<double>(dataset.segment_ids.size()))));
+    // Like the classifier, re-rank the candidates with exact descriptors stored outside the
+    // index. Without them only the codes are searched.
+    std::unordered_map<Id, size_t> descriptor_indices;
+    for (size_t i = 0u; i < dataset.segment_ids.size(); ++i) {
+      descriptor_indices[dataset.segment_ids[i]] = i;
+    }
+    const DescriptorLookup descriptor_lookup = [&](const Id segment_id) {
+      return dataset.descriptors[descriptor_indices.at(segment_id)];
+    };
+    for (const bool re_rank : { true, false }) {
+      IvfPqIndex index(knn_feature_dim, num_lists, 1u, std::min<size_t>(8u, knn_feature_dim),
+                       re_rank ? descriptor_lookup : DescriptorLookup());
+      const double build_time_s = buildIndex(dataset, &index);
+      for (const size_t num_probes : { 1u, 2u, 4u, 8u, 16u, 32u }) {
+        if (num_probes > num_lists) break;
+        index.setNumProbes(num_probes);
+        const double query_time_s = runQueries(dataset, index, k, &neighbours);
+        printResult(std::string(re_rank ? "IvfPq" : "IvfPq codes") + " lists=" +
+                    std::to_string(num_lists), "num_probes=" + std::to_string(num_probes),
+                    build_time_s, query_time_s, computeRecall(exact_neighbours, neighbours));
+      }
+    }
+  }
+
+  return 0;
+}
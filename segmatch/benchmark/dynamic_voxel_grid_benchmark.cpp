@@ -0,0 +1,257 @@
+// Measures the per-scan latency of the DynamicVoxelGrid insertion on a local map that follows a
+// robot driving through a synthetic environment. The incremental insertion is compared with a
+// reference implementation of the merge path used before it, which rebuilds the voxels and the
+// centroid clouds on every scan.
+//
+// Usage: dynamic_voxel_grid_benchmark [num_scans] [points_per_scan] [radius_m] [voxel_size_m]
+//  - num_scans: Number of scans inserted. The statistics ignore the scans inserted before the
+//    robot traveled radius_m, while the local map is still growing.
+//  - points_per_scan: Number of points in each scan.
+//  - radius_m: Radius of the local map around the robot.
+//  - voxel_size_m: Edge length of the voxels.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "benchmark_utilities.hpp"
+#include "segmatch/common.hpp"
+#include "segmatch/impl/dynamic_voxel_grid.hpp"
+
+using namespace segmatch;
+using namespace segmatch::benchmark;
+
+namespace {
+
+typedef DynamicVoxelGrid<PclPoint, MapPoint> VoxelGrid;
+
+// Distance traveled by the robot between two scans.
+constexpr float kStepM = 0.5f;
+// Distance of the walls on each side of the road and their height.
+constexpr float kWallsDistanceM = 8.0f;
+constexpr float kWallsHeightM = 4.0f;
+// Standard deviation of the measurement noise.
+constexpr float kNoiseM = 0.02f;
+
+// Create a scan of a straight road with a wall on each side. The points are denser close to the
+// sensor, as for a rotating LiDAR.
+PointCloud createScan(const float robot_x, const size_t num_points, const float radius_m,
+                      std::mt19937& random_engine) {
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  std::normal_distribution<float> noise(0.0f, kNoiseM);
+  PointCloud scan;
+  scan.reserve(num_points);
+  while (scan.size() < num_points) {
+    const float range = 1.0f + (radius_m - 1.0f) * uniform(random_engine) * uniform(random_engine);
+    const float angle = 2.0f * static_cast<float>(M_PI) * uniform(random_engine);
+    PclPoint point(robot_x + range * std::cos(angle), range * std::sin(angle), 0.0f);
+    if (std::abs(point.y) > kWallsDistanceM) {
+      // The ray hits a wall.
+      const float wall_y = std::copysign(kWallsDistanceM, point.y);
+      point.x = robot_x + (point.x - robot_x) * wall_y / point.y;
+      point.y = wall_y;
+      point.z = kWallsHeightM * uniform(random_engine);
+    }
+    point.x += noise(random_engine);
+    point.y += noise(random_engine);
+    point.z += noise(random_engine);
+    scan.push_back(point);
+  }
+  return scan;
+}
+
+// Reference implementation of the merge path. The voxels are stored in a vector sorted by voxel
+// index. Every insertion merges them with the sorted new points into newly allocated containers,
+// thus its cost is proportional to the size of the map.
+class MergeVoxelGrid {
+ public:
+  MergeVoxelGrid(const VoxelGrid& indexing_grid, const uint32_t min_points_per_voxel)
+    : indexing_grid_(indexing_grid), min_points_per_voxel_(min_points_per_voxel) {
+  }
+
+  std::vector<int> insert(const PointCloud& new_cloud) {
+    std::vector<std::pair<uint64_t, uint32_t>> new_points;
+    new_points.reserve(new_cloud.size());
+    for (size_t i = 0u; i < new_cloud.size(); ++i) {
+      new_points.emplace_back(indexing_grid_.getIndexOf(new_cloud[i]), i);
+    }
+    std::sort(new_points.begin(), new_points.end());
+
+    std::vector<int> created_voxel_indices;
+    std::vector<Voxel> new_voxels;
+    MapCloud new_active_centroids;
+    MapCloud new_inactive_centroids;
+    new_voxels.reserve(voxels_.size() + new_cloud.size());
+    new_active_centroids.reserve(active_centroids_.size() + new_cloud.size());
+    new_inactive_centroids.reserve(inactive_centroids_.size() + new_cloud.size());
+
+    auto p_it = new_points.cbegin();
+    auto v_it = voxels_.cbegin();
+    while (p_it != new_points.cend() || v_it != voxels_.cend()) {
+      Voxel voxel;
+      MapPoint centroid;
+      centroid.getVector3fMap().setZero();
+      if (p_it == new_points.cend() || (v_it != voxels_.cend() && v_it->index <= p_it->first)) {
+        voxel = *v_it;
+        centroid = voxel.num_points >= min_points_per_voxel_ ?
+            active_centroids_[voxel.centroid_index] : inactive_centroids_[voxel.centroid_index];
+        centroid.getVector3fMap() *= static_cast<float>(voxel.num_points);
+        ++v_it;
+      } else {
+        voxel.index = p_it->first;
+        voxel.num_points = 0u;
+      }
+
+      const uint32_t old_num_points = voxel.num_points;
+      for (; p_it != new_points.cend() && p_it->first == voxel.index; ++p_it) {
+        centroid.getVector3fMap() += new_cloud[p_it->second].getVector3fMap();
+        ++voxel.num_points;
+      }
+      centroid.getVector3fMap() /= static_cast<float>(voxel.num_points);
+
+      if (voxel.num_points >= min_points_per_voxel_) {
+        voxel.centroid_index = new_active_centroids.size();
+        new_active_centroids.push_back(centroid);
+        if (old_num_points < min_points_per_voxel_) {
+          created_voxel_indices.push_back(voxel.centroid_index);
+        }
+      } else {
+        voxel.centroid_index = new_inactive_centroids.size();
+        new_inactive_centroids.push_back(centroid);
+      }
+      new_voxels.push_back(voxel);
+    }
+
+    voxels_ = std::move(new_voxels);
+    active_centroids_ = std::move(new_active_centroids);
+    inactive_centroids_ = std::move(new_inactive_centroids);
+    return created_voxel_indices;
+  }
+
+  // Remove the voxels further than radius_m from the robot.
+  void removeFarVoxels(const float robot_x, const float radius_m) {
+    std::vector<Voxel> new_voxels;
+    MapCloud new_active_centroids;
+    MapCloud new_inactive_centroids;
+    for (const Voxel& voxel : voxels_) {
+      const bool is_active = voxel.num_points >= min_points_per_voxel_;
+      const MapPoint& centroid = is_active ? active_centroids_[voxel.centroid_index] :
+          inactive_centroids_[voxel.centroid_index];
+      if (isFar(centroid, robot_x, radius_m)) continue;
+      MapCloud& centroids = is_active ? new_active_centroids : new_inactive_centroids;
+      new_voxels.push_back(voxel);
+      new_voxels.back().centroid_index = centroids.size();
+      centroids.push_back(centroid);
+    }
+    voxels_ = std::move(new_voxels);
+    active_centroids_ = std::move(new_active_centroids);
+    inactive_centroids_ = std::move(new_inactive_centroids);
+  }
+
+  size_t getNumVoxels() const { return voxels_.size(); }
+
+  static bool isFar(const MapPoint& point, const float robot_x, const float radius_m) {
+    return (point.x - robot_x) * (point.x - robot_x) + point.y * point.y > radius_m * radius_m;
+  }
+
+ private:
+  struct Voxel {
+    uint64_t index;
+    uint32_t num_points;
+    size_t centroid_index;
+  };
+
+  const VoxelGrid& indexing_grid_;
+  const uint32_t min_points_per_voxel_;
+  std::vector<Voxel> voxels_;
+  MapCloud active_centroids_;
+  MapCloud inactive_centroids_;
+};
+
+// Print statistics of the per-scan latencies.
+void printLatencies(const std::string& name, std::vector<double> latencies_s,
+                    const size_t num_voxels) {
+  CHECK(!latencies_s.empty());
+  std::sort(latencies_s.begin(), latencies_s.end());
+  double sum_s = 0.0;
+  for (const double latency_s : latencies_s) sum_s += latency_s;
+  const auto get_percentile = [&](const double percentile) {
+    return latencies_s[static_cast<size_t>(percentile * (latencies_s.size() - 1u))];
+  };
+  std::cout << std::left << std::setw(14) << name << std::right << std::fixed <<
+      std::setprecision(3) << std::setw(12) << sum_s / latencies_s.size() * 1e3 <<
+      std::setw(12) << get_percentile(0.5) * 1e3 << std::setw(12) << get_percentile(0.95) * 1e3 <<
+      std::setw(12) << latencies_s.back() * 1e3 << std::setw(12) << num_voxels << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = true;
+
+  const size_t num_scans = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 300u;
+  const size_t points_per_scan = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100000u;
+  const float radius_m = argc > 3 ? std::strtof(argv[3], nullptr) : 30.0f;
+  const float voxel_size_m = argc > 4 ? std::strtof(argv[4], nullptr) : 0.1f;
+  const uint32_t kMinPointsPerVoxel = 2u;
+  CHECK_GT(radius_m, 1.0f);
+  CHECK_GT(voxel_size_m, 0.0f);
+  const size_t num_warm_up_scans = static_cast<size_t>(radius_m / kStepM);
+  CHECK_GT(num_scans, num_warm_up_scans) << "Too few scans for filling the local map.";
+
+  // Both implementations insert the same scans, created in advance.
+  std::mt19937 random_engine(42u);
+  std::vector<PointCloud> scans;
+  scans.reserve(num_scans);
+  for (size_t i = 0u; i < num_scans; ++i) {
+    scans.push_back(createScan(static_cast<float>(i) * kStepM, points_per_scan, radius_m,
+                               random_engine));
+  }
+  std::cout << num_scans << " scans of " << points_per_scan << " points, local map radius " <<
+      radius_m << " m, voxel size " << voxel_size_m << " m." << std::endl;
+  std::cout << std::left << std::setw(14) << "Insertion" << std::right << std::setw(12) <<
+      "Mean [ms]" << std::setw(12) << "Median [ms]" << std::setw(12) << "P95 [ms]" <<
+      std::setw(12) << "Max [ms]" << std::setw(12) << "Voxels" << std::endl;
+
+  // The voxels far from the robot are removed after each insertion, as done by the LocalMap. Only
+  // the insertions are timed.
+  {
+    VoxelGrid grid(voxel_size_m, kMinPointsPerVoxel);
+    std::vector<double> latencies_s;
+    for (size_t i = 0u; i < num_scans; ++i) {
+      const float robot_x = static_cast<float>(i) * kStepM;
+      const Clock::time_point start = Clock::now();
+      grid.insert(scans[i]);
+      if (i >= num_warm_up_scans) latencies_s.push_back(getElapsedSeconds(start));
+      grid.removeIf([&](const MapPoint& point) {
+        return MergeVoxelGrid::isFar(point, robot_x, radius_m);
+      });
+    }
+    printLatencies("Incremental", latencies_s, grid.getNumVoxels());
+  }
+
+  {
+    const VoxelGrid indexing_grid(voxel_size_m, kMinPointsPerVoxel);
+    MergeVoxelGrid grid(indexing_grid, kMinPointsPerVoxel);
+    std::vector<double> latencies_s;
+    for (size_t i = 0u; i < num_scans; ++i) {
+      const float robot_x = static_cast<float>(i) * kStepM;
+      const Clock::time_point start = Clock::now();
+      grid.insert(scans[i]);
+      if (i >= num_warm_up_scans) latencies_s.push_back(getElapsedSeconds(start));
+      grid.removeFarVoxels(robot_x, radius_m);
+    }
+    printLatencies("Merge", latencies_s, grid.getNumVoxels());
+  }
+
+  return 0;
+}
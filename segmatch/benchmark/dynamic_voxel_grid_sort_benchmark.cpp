@@ -0,0 +1,102 @@
+// Compares the radix sort and std::sort used for sorting the points inserted in a DynamicVoxelGrid
+// on synthetic scans of a 64-beam rotating LiDAR. Each scan is inserted in an empty grid, thus
+// the difference between the two insertion times is the difference between the sorting times.
+//
+// Usage: dynamic_voxel_grid_sort_benchmark [num_repetitions] [voxel_size_m]
+//  - num_repetitions: Number of insertions timed for each scan size and sorting algorithm.
+//  - voxel_size_m: Edge length of the voxels.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include <glog/logging.h>
+
+#include "benchmark_utilities.hpp"
+#include "segmatch/common.hpp"
+#include "segmatch/impl/dynamic_voxel_grid.hpp"
+
+using namespace segmatch;
+using namespace segmatch::benchmark;
+
+namespace {
+
+typedef DynamicVoxelGrid<PclPoint, MapPoint> VoxelGrid;
+typedef DynamicVoxelGrid<PclPoint, MapPoint, uint64_t, 20, 20, 20, false> StdSortVoxelGrid;
+
+// Geometry of the sensor and of the environment.
+constexpr size_t kNumBeams = 64u;
+constexpr float kMinElevationRad = -25.0f * static_cast<float>(M_PI) / 180.0f;
+constexpr float kMaxElevationRad = 3.0f * static_cast<float>(M_PI) / 180.0f;
+constexpr float kSensorHeightM = 1.8f;
+constexpr float kMaxRangeM = 80.0f;
+
+// Create a scan in the order in which the sensor measures the points. The beams pointing
+// downwards hit the ground, the others hit buildings at random distances.
+PointCloud createScan(const size_t num_points, std::mt19937& random_engine) {
+  std::uniform_real_distribution<float> building_range(10.0f, 50.0f);
+  std::normal_distribution<float> range_noise(1.0f, 0.01f);
+  PointCloud scan;
+  scan.reserve(num_points);
+  for (size_t i = 0u; i < num_points; ++i) {
+    const float azimuth = 2.0f * static_cast<float>(M_PI) * static_cast<float>(i) /
+        static_cast<float>(num_points);
+    const float elevation = kMinElevationRad + (kMaxElevationRad - kMinElevationRad) *
+        static_cast<float>(i % kNumBeams) / static_cast<float>(kNumBeams - 1u);
+    float range = elevation < 0.0f ?
+        std::min(kMaxRangeM, kSensorHeightM / std::tan(-elevation)) : building_range(random_engine);
+    range *= range_noise(random_engine);
+    scan.push_back(PclPoint(range * std::cos(elevation) * std::cos(azimuth),
+                            range * std::cos(elevation) * std::sin(azimuth),
+                            range * std::sin(elevation)));
+  }
+  return scan;
+}
+
+// Insert a scan in empty grids. Returns the mean time of an insertion in seconds.
+template <typename VoxelGridT>
+double timeInsertion(const PointCloud& scan, const float voxel_size_m,
+                     const size_t num_repetitions) {
+  double total_time_s = 0.0;
+  for (size_t i = 0u; i < num_repetitions; ++i) {
+    VoxelGridT grid(voxel_size_m, 1);
+    const Clock::time_point start = Clock::now();
+    grid.insert(scan);
+    total_time_s += getElapsedSeconds(start);
+  }
+  return total_time_s / static_cast<double>(num_repetitions);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = true;
+
+  const size_t num_repetitions = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20u;
+  const float voxel_size_m = argc > 2 ? std::strtof(argv[2], nullptr) : 0.1f;
+  CHECK_GT(num_repetitions, 0u);
+  CHECK_GT(voxel_size_m, 0.0f);
+
+  std::cout << "Mean insertion time over " << num_repetitions << " insertions, voxel size " <<
+      voxel_size_m << " m." << std::endl;
+  std::cout << std::right << std::setw(10) << "Points" << std::setw(16) << "std::sort [ms]" <<
+      std::setw(16) << "Radix [ms]" << std::setw(14) << "Saved [ms]" << std::endl;
+
+  std::mt19937 random_engine(42u);
+  for (const size_t num_points : { 100000u, 200000u, 300000u, 400000u, 500000u }) {
+    const PointCloud scan = createScan(num_points, random_engine);
+    const double std_sort_time_s =
+        timeInsertion<StdSortVoxelGrid>(scan, voxel_size_m, num_repetitions);
+    const double radix_sort_time_s =
+        timeInsertion<VoxelGrid>(scan, voxel_size_m, num_repetitions);
+    std::cout << std::setw(10) << num_points << std::fixed << std::setprecision(3) <<
+        std::setw(16) << std_sort_time_s * 1e3 << std::setw(16) << radix_sort_time_s * 1e3 <<
+        std::setw(14) << (std_sort_time_s - radix_sort_time_s) * 1e3 << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,158 @@
+// Measures the latency of the IncrementalSegmenter on a growing synthetic map, as in the tests of
+// the segmenter. Every update adds clumps of points and scattered points joining them, so that
+// new regions are grown and existing clusters are linked at every segmentation.
+//
+// Usage: incremental_segmenter_benchmark [num_updates] [points_per_update] [num_threads]
+//  - num_updates: Number of updates of the map, each followed by a segmentation.
+//  - points_per_update: Number of points added by each update.
+//  - num_threads: Number of threads of the parallel runs. Each policy also runs on one thread.
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "benchmark_utilities.hpp"
+#include "segmatch/common.hpp"
+#include "segmatch/points_neighbors_providers/kdtree_points_neighbors_provider.hpp"
+#include "segmatch/segmented_cloud.hpp"
+#include "segmatch/segmenters/incremental_segmenter.hpp"
+#include "segmatch/segmenters/region_growing_policy.hpp"
+
+using namespace segmatch;
+using namespace segmatch::benchmark;
+
+namespace {
+
+// Half size of the square area covered by the map.
+constexpr float kAreaHalfSizeM = 100.0f;
+// Number of points of each clump and standard deviation of their positions.
+constexpr size_t kPointsPerClump = 50u;
+constexpr float kClumpSigmaM = 1.0f;
+
+// A map growing at every update. The clumps are planar patches that are alternatively horizontal
+// and vertical, and a third of the points have a curvature too high for being seeds of the
+// smoothness constraints policy.
+class SyntheticMap {
+ public:
+  SyntheticMap() : random_engine_(42u) { }
+
+  // Add clumps containing most of the points and scatter the other points over the map.
+  void addPoints(const size_t num_points) {
+    std::uniform_real_distribution<float> position(-kAreaHalfSizeM, kAreaHalfSizeM);
+    std::normal_distribution<float> offset(0.0f, kClumpSigmaM);
+    const size_t num_clumps = num_points * 4u / 5u / kPointsPerClump;
+    for (size_t i = 0u; i < num_clumps; ++i) {
+      const float x = position(random_engine_);
+      const float y = position(random_engine_);
+      const Eigen::Vector3f patch_normal = i % 2u == 0u ? Eigen::Vector3f::UnitZ() :
+          Eigen::Vector3f::UnitX();
+      for (size_t j = 0u; j < kPointsPerClump; ++j) {
+        addPoint(x + offset(random_engine_), y + offset(random_engine_), patch_normal);
+      }
+    }
+    const size_t num_scattered_points = num_points - num_clumps * kPointsPerClump;
+    for (size_t i = 0u; i < num_scattered_points; ++i) {
+      addPoint(position(random_engine_), position(random_engine_),
+               i % 2u == 0u ? Eigen::Vector3f::UnitZ() : Eigen::Vector3f::UnitX());
+    }
+  }
+
+  MapCloud cloud;
+  PointNormals normals;
+
+ private:
+  void addPoint(const float x, const float y, const Eigen::Vector3f& patch_normal) {
+    std::normal_distribution<float> noise(0.0f, 0.05f);
+    std::uniform_real_distribution<float> curvature(0.0f, 0.3f);
+    MapPoint point;
+    point.x = x;
+    point.y = y;
+    point.z = noise(random_engine_);
+    cloud.push_back(point);
+    PclNormal normal;
+    normal.getNormalVector3fMap() = (patch_normal + Eigen::Vector3f(
+        noise(random_engine_), noise(random_engine_), noise(random_engine_))).normalized();
+    normal.curvature = curvature(random_engine_);
+    normals.push_back(normal);
+  }
+
+  std::mt19937 random_engine_;
+};
+
+// Segment the map after every update. Only the segmentation is timed.
+template <typename PolicyName>
+void runSegmenter(const std::string& policy_name, const SegmenterParameters& params,
+                  const size_t num_updates, const size_t points_per_update) {
+  IncrementalSegmenter<MapPoint, PolicyName> segmenter(params);
+  KdTreePointsNeighborsProvider<MapPoint> kdtree;
+  SyntheticMap map;
+  SegmentedCloud segmented_cloud;
+  std::vector<Id> segments;
+  std::vector<std::pair<Id, Id>> renamed_segments;
+  std::vector<double> latencies_s;
+  size_t num_renamed_segments = 0u;
+  for (size_t i = 0u; i < num_updates; ++i) {
+    map.addPoints(points_per_update);
+    kdtree.update(typename MapCloud::Ptr(&map.cloud, [](MapCloud* ptr) {}), { });
+    const Clock::time_point start = Clock::now();
+    segmenter.segment(map.normals, { }, map.cloud, kdtree, segmented_cloud, segments,
+                      renamed_segments);
+    latencies_s.push_back(getElapsedSeconds(start));
+    num_renamed_segments += renamed_segments.size();
+  }
+
+  std::sort(latencies_s.begin(), latencies_s.end());
+  double sum_s = 0.0;
+  for (const double latency_s : latencies_s) sum_s += latency_s;
+  std::cout << std::left << std::setw(22) << policy_name << std::right << std::setw(8) <<
+      params.num_threads << std::fixed << std::setprecision(3) << std::setw(12) <<
+      sum_s / latencies_s.size() * 1e3 <<
+      std::setw(12) << latencies_s[latencies_s.size() * 95u / 100u] * 1e3 <<
+      std::setw(12) << latencies_s.back() * 1e3 << std::setw(10) <<
+      segmented_cloud.getNumberOfValidSegments() << std::setw(10) << num_renamed_segments <<
+      std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = true;
+
+  const size_t num_updates = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100u;
+  const size_t points_per_update = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 5000u;
+  const int num_threads = argc > 3 ? std::atoi(argv[3]) : 4;
+  CHECK_GT(num_updates, 0u);
+  CHECK_GE(points_per_update, 2u * kPointsPerClump);
+  CHECK_GT(num_threads, 0);
+
+  SegmenterParameters params;
+  params.radius_for_growing = 0.4f;
+  params.min_cluster_size = 50;
+  params.max_cluster_size = 15000;
+  params.sc_smoothness_threshold_deg = 20.0f;
+  params.sc_curvature_threshold = 0.2f;
+  params.parallel_tile_size_m = 10.0f;
+
+  std::cout << num_updates << " updates of " << points_per_update << " points." << std::endl;
+  std::cout << std::left << std::setw(22) << "Policy" << std::right << std::setw(8) <<
+      "Threads" << std::setw(12) << "Mean [ms]" << std::setw(12) << "P95 [ms]" <<
+      std::setw(12) << "Max [ms]" << std::setw(10) << "Segments" << std::setw(10) <<
+      "Renamed" << std::endl;
+  for (const int threads : { 1, num_threads }) {
+    params.num_threads = threads;
+    runSegmenter<EuclideanDistance>("EuclideanDistance", params, num_updates, points_per_update);
+    runSegmenter<SmoothnessConstraints>("SmoothnessConstraints", params, num_updates,
+                                        points_per_update);
+    if (num_threads == 1) break;
+  }
+
+  return 0;
+}
@@ -0,0 +1,198 @@
+// Compares the points neighbors providers on the radius searches performed by the
+// IncrementalNormalEstimator when scattering the contributions of new points, and by the
+// IncrementalSegmenter when growing regions. The points are the voxel centroids of a synthetic
+// local map of a street, as stored by the LocalMap.
+//
+// Usage: points_neighbors_provider_benchmark [street_length_m] [voxel_size_m]
+//  - street_length_m: Length of the street covered by the local map.
+//  - voxel_size_m: Edge length of the voxels.
+//
+// Every provider is built from scratch on the whole map. Then the normals of all the points are
+// estimated on one thread and the map is segmented with the smoothness constraints policy, using
+// the same search radius for both. The time of the normal estimation includes the eigen
+// decomposition of the covariance matrices, which is the same for all the providers.
+
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "benchmark_utilities.hpp"
+#include "segmatch/common.hpp"
+#include "segmatch/dynamic_voxel_grid.hpp"
+#include "segmatch/normal_estimators/incremental_normal_estimator.hpp"
+#include "segmatch/points_neighbors_providers/incremental_kdtree_points_neighbors_provider.hpp"
+#include "segmatch/points_neighbors_providers/kdtree_points_neighbors_provider.hpp"
+#include "segmatch/points_neighbors_providers/octree_points_neighbors_provider.hpp"
+#include "segmatch/points_neighbors_providers/voxel_hash_points_neighbors_provider.hpp"
+#include "segmatch/segmented_cloud.hpp"
+#include "segmatch/segmenters/incremental_segmenter.hpp"
+#include "segmatch/segmenters/region_growing_policy.hpp"
+
+using namespace segmatch;
+using namespace segmatch::benchmark;
+
+namespace {
+
+typedef DynamicVoxelGrid<PclPoint, MapPoint> VoxelGrid;
+
+// Width of the street, height of the buildings and spacing of the poles and of the parked cars.
+constexpr float kStreetHalfWidthM = 8.0f;
+constexpr float kBuildingsHeightM = 6.0f;
+constexpr float kPolesSpacingM = 10.0f;
+constexpr float kCarsSpacingM = 7.0f;
+// Number of points sampled per square meter of surface, enough for filling all the voxels.
+constexpr float kPointsPerSquareMeter = 400.0f;
+
+// Samples points on the surfaces of a street: ground, building facades, poles and parked cars.
+class StreetSampler {
+ public:
+  explicit StreetSampler(PointCloud* cloud) : cloud_(cloud), random_engine_(42u) { }
+
+  // Samples a rectangle spanned by two orthogonal edges starting from a corner.
+  void addRectangle(const Eigen::Vector3f& corner, const Eigen::Vector3f& edge_1,
+                    const Eigen::Vector3f& edge_2) {
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    const size_t num_points = static_cast<size_t>(
+        edge_1.cross(edge_2).norm() * kPointsPerSquareMeter);
+    for (size_t i = 0u; i < num_points; ++i) {
+      const Eigen::Vector3f point = corner + edge_1 * uniform(random_engine_) +
+          edge_2 * uniform(random_engine_);
+      cloud_->push_back(PclPoint(point.x(), point.y(), point.z()));
+    }
+  }
+
+  // Samples the lateral faces and the top of a box standing on the ground.
+  void addBox(const float x, const float y, const float size_x, const float size_y,
+              const float size_z) {
+    const Eigen::Vector3f dx(size_x, 0.0f, 0.0f);
+    const Eigen::Vector3f dy(0.0f, size_y, 0.0f);
+    const Eigen::Vector3f dz(0.0f, 0.0f, size_z);
+    const Eigen::Vector3f corner(x, y, 0.0f);
+    addRectangle(corner, dx, dz);
+    addRectangle(corner + dy, dx, dz);
+    addRectangle(corner, dy, dz);
+    addRectangle(corner + dx, dy, dz);
+    addRectangle(corner + dz, dx, dy);
+  }
+
+ private:
+  PointCloud* cloud_;
+  std::mt19937 random_engine_;
+};
+
+PointCloud createStreet(const float street_length_m) {
+  PointCloud cloud;
+  StreetSampler sampler(&cloud);
+  const Eigen::Vector3f length(street_length_m, 0.0f, 0.0f);
+  sampler.addRectangle(Eigen::Vector3f(0.0f, -kStreetHalfWidthM, 0.0f), length,
+                       Eigen::Vector3f(0.0f, 2.0f * kStreetHalfWidthM, 0.0f));
+  for (const float y : { -kStreetHalfWidthM, kStreetHalfWidthM }) {
+    sampler.addRectangle(Eigen::Vector3f(0.0f, y, 0.0f), length,
+                         Eigen::Vector3f(0.0f, 0.0f, kBuildingsHeightM));
+  }
+  for (float x = 1.0f; x + 1.0f < street_length_m; x += kPolesSpacingM) {
+    sampler.addBox(x, -kStreetHalfWidthM + 1.0f, 0.2f, 0.2f, 4.0f);
+    sampler.addBox(x, kStreetHalfWidthM - 1.2f, 0.2f, 0.2f, 4.0f);
+  }
+  for (float x = 3.0f; x + 5.0f < street_length_m; x += kCarsSpacingM) {
+    sampler.addBox(x, -kStreetHalfWidthM + 2.0f, 4.5f, 1.8f, 1.5f);
+  }
+  return cloud;
+}
+
+typedef std::function<std::unique_ptr<PointsNeighborsProvider<MapPoint>>()> ProviderFactory;
+
+// Times the provider on the workloads of the normal estimator and of the segmenter.
+void runProvider(const std::string& provider_name, const ProviderFactory& create_provider,
+                 const float search_radius_m, const MapCloud& centroids) {
+  const MapCloud::ConstPtr centroids_ptr(&centroids, [](MapCloud const* ptr) {});
+  std::unique_ptr<PointsNeighborsProvider<MapPoint>> provider = create_provider();
+  Clock::time_point start = Clock::now();
+  provider->update(centroids_ptr, { }, { });
+  const double update_time_s = getElapsedSeconds(start);
+
+  std::vector<int> new_points_indices(centroids.size());
+  for (size_t i = 0u; i < centroids.size(); ++i) new_points_indices[i] = i;
+  IncrementalNormalEstimator normal_estimator(search_radius_m);
+  start = Clock::now();
+  normal_estimator.updateNormals(centroids, { }, new_points_indices, *provider);
+  const double normals_time_s = getElapsedSeconds(start);
+
+  SegmenterParameters params;
+  params.radius_for_growing = search_radius_m;
+  params.min_cluster_size = 50;
+  params.max_cluster_size = 15000;
+  params.sc_smoothness_threshold_deg = 4.0f;
+  params.sc_curvature_threshold = 0.05f;
+  IncrementalSegmenter<MapPoint, SmoothnessConstraints> segmenter(params);
+  MapCloud cloud = centroids;
+  SegmentedCloud segmented_cloud;
+  std::vector<Id> segments;
+  std::vector<std::pair<Id, Id>> renamed_segments;
+  start = Clock::now();
+  segmenter.segment(normal_estimator.getNormals(), { }, cloud, *provider, segmented_cloud,
+                    segments, renamed_segments);
+  const double segmentation_time_s = getElapsedSeconds(start);
+
+  std::cout << std::fixed << std::setprecision(2) << std::setw(10) << search_radius_m <<
+      "  " << std::left << std::setw(20) << provider_name << std::right << std::setprecision(3) <<
+      std::setw(14) << update_time_s * 1e3 << std::setw(14) << normals_time_s * 1e3 <<
+      std::setw(18) << segmentation_time_s * 1e3 << std::setw(10) <<
+      segmented_cloud.getNumberOfValidSegments() << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = true;
+
+  const float street_length_m = argc > 1 ? std::strtof(argv[1], nullptr) : 60.0f;
+  const float voxel_size_m = argc > 2 ? std::strtof(argv[2], nullptr) : 0.1f;
+  CHECK_GT(street_length_m, 10.0f);
+  CHECK_GT(voxel_size_m, 0.0f);
+
+  VoxelGrid voxel_grid(voxel_size_m, 1);
+  voxel_grid.insert(createStreet(street_length_m));
+  const MapCloud& centroids = voxel_grid.getActiveCentroids();
+  std::cout << centroids.size() << " voxel centroids, voxel size " << voxel_size_m << " m." <<
+      std::endl;
+  std::cout << std::setw(10) << "Radius [m]" << "  " << std::left << std::setw(20) <<
+      "Provider" << std::right << std::setw(14) << "Update [ms]" << std::setw(14) <<
+      "Normals [ms]" << std::setw(18) << "Segmentation [ms]" << std::setw(10) << "Segments" <<
+      std::endl;
+
+  const std::vector<std::pair<std::string, ProviderFactory>> providers = {
+    { "KdTree", []() {
+      return std::unique_ptr<PointsNeighborsProvider<MapPoint>>(
+          new KdTreePointsNeighborsProvider<MapPoint>());
+    } },
+    { "Octree", [&]() {
+      return std::unique_ptr<PointsNeighborsProvider<MapPoint>>(
+          new OctreePointsNeighborsProvider<MapPoint>(voxel_size_m));
+    } },
+    { "IncrementalKdTree", []() {
+      return std::unique_ptr<PointsNeighborsProvider<MapPoint>>(
+          new IncrementalKdTreePointsNeighborsProvider<MapPoint>());
+    } },
+    { "VoxelHash", [&]() {
+      return std::unique_ptr<PointsNeighborsProvider<MapPoint>>(
+          new VoxelHashPointsNeighborsProvider<PclPoint, MapPoint>(voxel_grid));
+    } }
+  };
+  for (const float search_radius_m : { 0.2f, 0.3f, 0.5f }) {
+    for (const auto& provider : providers) {
+      runProvider(provider.first, provider.second, search_radius_m, centroids);
+    }
+  }
+
+  return 0;
+}
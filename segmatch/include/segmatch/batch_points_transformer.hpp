@@ -0,0 +1,83 @@
+#ifndef SEGMATCH_BATCH_POINTS_TRANSFORMER_HPP_
+#define SEGMATCH_BATCH_POINTS_TRANSFORMER_HPP_
+
+#include <stddef.h>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+#include <pcl/point_cloud.h>
+
+namespace segmatch {
+
+/// \brief Applies rigid transformations to multiple point clouds in a single pass.
+/// Clouds are collected with add() and transformed in place by run(). Large batches are split
+/// between multiple threads, and points are transformed with an AVX2 kernel when the CPU supports
+/// it.
+/// \remark Only the X, Y, Z components of the points are modified. The points must start with
+/// the aligned X, Y, Z, _ block defined by \c PCL_ADD_POINT4D.
+class BatchPointsTransformer {
+ public:
+  /// \brief Initializes a new instance of BatchPointsTransformer.
+  /// \param force_scalar If true, the scalar kernel is used even if the CPU supports AVX2. Used
+  /// for comparing the kernels.
+  explicit BatchPointsTransformer(const bool force_scalar = false)
+    : force_scalar_(force_scalar) {
+  }
+
+  /// \brief Adds a point cloud to the batch.
+  /// \remark The cloud must not be resized until run() is called.
+  /// \param transformation The rigid transformation to be applied to the points.
+  /// \param cloud The point cloud that must be transformed.
+  template <typename PointT>
+  void add(const Eigen::Matrix4f& transformation, pcl::PointCloud<PointT>& cloud) {
+    static_assert(sizeof(PointT) % (4u * sizeof(float)) == 0u,
+                  "PointT must be composed of aligned blocks of four floats");
+    if (cloud.empty()) return;
+    add(transformation, reinterpret_cast<float*>(cloud.points.data()), cloud.size(),
+        sizeof(PointT) / sizeof(float));
+  }
+
+  /// \brief Adds a block of points to the batch.
+  /// \param transformation The rigid transformation to be applied to the points.
+  /// \param points_data Pointer to the coordinates of the first point. Must be 16-byte aligned.
+  /// \param num_points Number of points in the block.
+  /// \param stride Number of floats between the coordinates of consecutive points. Must be a
+  /// multiple of four.
+  void add(const Eigen::Matrix4f& transformation, float* points_data, size_t num_points,
+           size_t stride);
+
+  /// \brief Transforms all the points added to the batch and clears the batch.
+  void run();
+
+  /// \brief Gets the number of points in the batch.
+  /// \returns The number of points that will be transformed by run().
+  size_t getNumPoints() const { return num_points_; }
+
+ private:
+  // A block of points sharing the same transformation.
+  struct Job_ {
+    size_t transformation_index;
+    float* points_data;
+    size_t num_points;
+    size_t stride;
+  };
+
+  // Transforms points of a job in the range [begin, end).
+  void transformPoints_(const Job_& job, size_t begin, size_t end) const;
+
+  // Transformations and jobs in the batch.
+  std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f>> transformations_;
+  std::vector<Job_> jobs_;
+  size_t num_points_ = 0u;
+
+  // If true, the AVX2 kernel is never used.
+  bool force_scalar_;
+
+  // Minimum number of points assigned to each thread.
+  static constexpr size_t kMinPointsPerThread = 65536u;
+}; // class BatchPointsTransformer
+
+} // namespace segmatch
+
+#endif // SEGMATCH_BATCH_POINTS_TRANSFORMER_HPP_
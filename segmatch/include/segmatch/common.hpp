@@ -3,6 +3,7 @@
 
 #include <cstdint>
 #include <functional>
+#include <limits>
 #include <string>
 #include <utility>
 #include <vector>
@@ -52,6 +53,10 @@ const Id kNoId = -1;
 const Id kInvId = -2;
 const Id kUnassignedId = -3; // Used internally by the incremental segmenter.
 
+// Cluster ID of the points of the local map that have been detected as ground. These points are
+// skipped by the incremental segmenter.
+const uint32_t kGroundClusterId = std::numeric_limits<uint32_t>::max();
+
 // TODO(Renaud @ Daniel) this is probably not the best name but we need to have this format
 // Somewhere as the classifier output matches between two samples and the geometric also
 // takes pairs. It collides a bit with IdMatches. We can discuss that. I also added for
@@ -83,6 +83,24 @@ bool importFeatures(const std::string& filename,
                     const std::string& behavior_when_segment_has_features="abort");
 bool importMatches(const std::string& filename, UniqueIdMatches* matches_ptr);
 
+/// \brief Export the segments to a binary segment archive (See segment_archive.hpp). This is much
+/// faster and more compact than exporting them as CSV files.
+bool exportSegmentsArchive(const std::string& filename,
+                           const SegmentedCloud& segmented_cloud,
+                           bool export_all_views = true);
+bool importSegmentsArchive(const std::string& filename,
+                           SegmentedCloud* segmented_cloud_ptr);
+
+/// \brief Convert a segment archive to the "_segments.csv", "_features.csv" and
+/// "_timestamps.csv" files written by exportSegmentsAndFeatures() with all the views.
+bool convertSegmentsArchiveToCsv(const std::string& archive_filename,
+                                 const std::string& filename_prefix);
+/// \brief Convert the CSV files written by exportSegmentsAndFeatures() with all the views to a
+/// segment archive. The CSV files only contain the names of the values, the values are grouped in
+/// the features of the descriptors using them.
+bool convertCsvToSegmentsArchive(const std::string& filename_prefix,
+                                 const std::string& archive_filename);
+
 } // namespace database
 } // namespace segmatch
 
@@ -0,0 +1,80 @@
+#ifndef SEGMATCH_DESCRIPTOR_INDEX_HPP_
+#define SEGMATCH_DESCRIPTOR_INDEX_HPP_
+
+#include <functional>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "segmatch/common.hpp"
+
+namespace segmatch {
+
+/// \brief Matrix of segment IDs.
+typedef Eigen::Matrix<Id, Eigen::Dynamic, Eigen::Dynamic> IdMatrix;
+
+/// \brief Function returning the descriptor of a segment contained in an index. Indices that
+/// compress the descriptors use it to get their exact values, which are usually already stored by
+/// the caller. It must be safe to call it concurrently.
+typedef std::function<Eigen::VectorXf(Id)> DescriptorLookup;
+
+/// \brief Base class for nearest neighbours indices over segment descriptors. Descriptors are
+/// keyed by segment ID and can be inserted and removed at any time.
+/// \remark Implementations must allow concurrent calls to knn() as long as the index is not
+/// modified.
+class DescriptorIndex {
+ public:
+  /// \brief Finalizes an instance of the DescriptorIndex class.
+  virtual ~DescriptorIndex() = default;
+
+  /// \brief Insert the descriptor of a segment. If the segment is already in the index, its
+  /// descriptor is replaced.
+  virtual void insert(Id segment_id, const Eigen::VectorXf& descriptor) = 0;
+
+  /// \brief Remove the descriptor of a segment.
+  /// \returns True if the segment was in the index.
+  virtual bool remove(Id segment_id) = 0;
+
+  /// \brief Remove all the descriptors.
+  virtual void clear() = 0;
+
+  virtual bool contains(Id segment_id) const = 0;
+  virtual size_t size() const = 0;
+  virtual size_t getDimension() const = 0;
+
+  /// \brief Find the segments whose descriptors are the nearest to a query.
+  /// As with the libnabo search, descriptors whose distance to the query is zero are not
+  /// returned.
+  /// \param query The query descriptor.
+  /// \param k Maximum number of neighbours to find.
+  /// \param segment_ids IDs of the neighbours, from the nearest to the farthest.
+  /// \param squared_distances Squared distances of the neighbours to the query.
+  /// \returns The number of neighbours found.
+  virtual size_t knn(const Eigen::VectorXf& query, size_t k, std::vector<Id>* segment_ids,
+                     std::vector<float>* squared_distances) const = 0;
+
+  /// \brief Find the segments whose descriptors are the nearest to multiple queries. Large
+  /// batches are split between multiple threads.
+  /// \param queries The query descriptors, one per column.
+  /// \param k Maximum number of neighbours to find for each query.
+  /// \param segment_ids IDs of the neighbours. Column \c i contains the neighbours of query \c i,
+  /// from the nearest to the farthest, padded with \c kNoId when less than \c k neighbours are
+  /// found.
+  /// \param squared_distances Squared distances of the neighbours to the queries, padded with
+  /// infinity.
+  /// \param max_num_threads Maximum number of threads used for the search.
+  void knnBatch(const Eigen::MatrixXf& queries, size_t k, IdMatrix* segment_ids,
+                Eigen::MatrixXf* squared_distances, size_t max_num_threads) const;
+
+ private:
+  // Search the queries in the range [begin, end).
+  void knnRange(const Eigen::MatrixXf& queries, size_t k, size_t begin, size_t end,
+                IdMatrix* segment_ids, Eigen::MatrixXf* squared_distances) const;
+
+  // Minimum number of queries assigned to each thread.
+  static constexpr size_t kMinQueriesPerThread = 32u;
+}; // class DescriptorIndex
+
+} // namespace segmatch
+
+#endif // SEGMATCH_DESCRIPTOR_INDEX_HPP_
@@ -0,0 +1,32 @@
+#ifndef SEGMATCH_DESCRIPTOR_INDEX_FACTORY_HPP_
+#define SEGMATCH_DESCRIPTOR_INDEX_FACTORY_HPP_
+
+#include <memory>
+
+#include "segmatch/descriptor_indices/descriptor_index.hpp"
+#include "segmatch/parameters.hpp"
+
+namespace segmatch {
+
+/// \brief Factory class for descriptor indices.
+class DescriptorIndexFactory {
+ public:
+  /// \brief Initializes a new instance of the DescriptorIndexFactory class.
+  /// \param params The current parameters of the classifier.
+  DescriptorIndexFactory(const ClassifierParams& params);
+
+  /// \brief Creates an empty descriptor index for descriptors of dimension
+  /// \c params.knn_feature_dim.
+  /// \param descriptor_lookup Function returning the descriptors of the segments contained in the
+  /// index. Used only by the "IvfPq" index, see IvfPqIndex. Can be empty.
+  /// \returns Pointer to a new DescriptorIndex instance.
+  std::unique_ptr<DescriptorIndex> create(
+      const DescriptorLookup& descriptor_lookup = DescriptorLookup()) const;
+
+ private:
+  ClassifierParams params_;
+}; // class DescriptorIndexFactory
+
+} // namespace segmatch
+
+#endif // SEGMATCH_DESCRIPTOR_INDEX_FACTORY_HPP_
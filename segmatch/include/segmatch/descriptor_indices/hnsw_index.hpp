@@ -0,0 +1,110 @@
+#ifndef SEGMATCH_HNSW_INDEX_HPP_
+#define SEGMATCH_HNSW_INDEX_HPP_
+
+#include <stdint.h>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "segmatch/descriptor_indices/descriptor_index.hpp"
+
+namespace segmatch {
+
+/// \brief Approximate nearest neighbours index based on a Hierarchical Navigable Small World
+/// graph (Malkov and Yashunin, 2018).
+///
+/// Each descriptor is a node of a layered proximity graph. Queries descend greedily from the
+/// sparse top layer and explore the bottom layer with a beam of \c ef_search candidates, so their
+/// cost grows logarithmically with the number of descriptors, independently of the dimension.
+/// Removed descriptors stay in the graph to keep it connected but are never returned. The graph
+/// is rebuilt when more than half of its nodes have been removed.
+class HnswIndex : public DescriptorIndex {
+ public:
+  /// \brief Initializes a new instance of the HnswIndex class.
+  /// \param dimension Dimension of the descriptors.
+  /// \param max_links Maximum number of links of a node in the upper layers. Nodes of the bottom
+  /// layer have up to twice as many links.
+  /// \param ef_construction Number of candidates explored when inserting a descriptor.
+  /// \param ef_search Number of candidates explored when searching. Larger values increase the
+  /// recall and the search time.
+  HnswIndex(size_t dimension, size_t max_links, size_t ef_construction, size_t ef_search);
+
+  void insert(Id segment_id, const Eigen::VectorXf& descriptor) override;
+
+  bool remove(Id segment_id) override;
+
+  void clear() override;
+
+  bool contains(const Id segment_id) const override {
+    return node_of_segment_.find(segment_id) != node_of_segment_.end();
+  }
+  size_t size() const override { return node_of_segment_.size(); }
+  size_t getDimension() const override { return dimension_; }
+
+  size_t knn(const Eigen::VectorXf& query, size_t k, std::vector<Id>* segment_ids,
+             std::vector<float>* squared_distances) const override;
+
+  void setEfSearch(const size_t ef_search) { ef_search_ = ef_search; }
+
+ private:
+  typedef uint32_t NodeIndex;
+  // A node and its squared distance to a query.
+  typedef std::pair<float, NodeIndex> Candidate;
+
+  struct Node {
+    // ID of the segment, or kNoId if the descriptor has been removed.
+    Id segment_id;
+    // Links of the node in each of the layers it belongs to, starting from the bottom layer.
+    std::vector<std::vector<NodeIndex>> links;
+  };
+
+  const float* getDescriptor(const NodeIndex node) const {
+    return descriptors_.data() + node * dimension_;
+  }
+  float computeSquaredDistance(const float* query, NodeIndex node) const;
+
+  // Add a descriptor to the graph.
+  void addNode(Id segment_id, const float* descriptor);
+
+  // Follow the nearest neighbour from the entry point down to the specified layer.
+  NodeIndex searchGreedy(const float* query, size_t target_layer) const;
+
+  // Find the ef nearest nodes in a layer, starting from an entry point. Returns the candidates
+  // sorted by increasing distance.
+  std::vector<Candidate> searchLayer(const float* query, NodeIndex entry_point, size_t ef,
+                                     size_t layer) const;
+
+  // Select up to max_links neighbours among candidates sorted by increasing distance, preferring
+  // neighbours in diverse directions.
+  std::vector<NodeIndex> selectNeighbours(const std::vector<Candidate>& candidates,
+                                          size_t max_links) const;
+
+  size_t getMaxLinks(const size_t layer) const {
+    return layer == 0u ? 2u * max_links_ : max_links_;
+  }
+
+  // Build the graph again with only the descriptors that have not been removed.
+  void rebuild();
+
+  size_t dimension_;
+  size_t max_links_;
+  size_t ef_construction_;
+  size_t ef_search_;
+  // Normalization factor of the random layer of the nodes.
+  double level_multiplier_;
+  std::mt19937 random_engine_;
+
+  std::vector<Node> nodes_;
+  // Descriptors of the nodes, stored contiguously.
+  std::vector<float> descriptors_;
+  std::unordered_map<Id, NodeIndex> node_of_segment_;
+  size_t num_removed_ = 0u;
+
+  NodeIndex entry_point_ = 0u;
+  size_t top_layer_ = 0u;
+}; // class HnswIndex
+
+} // namespace segmatch
+
+#endif // SEGMATCH_HNSW_INDEX_HPP_
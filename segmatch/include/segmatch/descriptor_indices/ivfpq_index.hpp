@@ -0,0 +1,123 @@
+#ifndef SEGMATCH_IVFPQ_INDEX_HPP_
+#define SEGMATCH_IVFPQ_INDEX_HPP_
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "segmatch/descriptor_indices/descriptor_index.hpp"
+
+namespace segmatch {
+
+/// \brief Approximate nearest neighbours index which compresses the descriptors with an inverted
+/// file and product quantization (Jegou et al., 2011).
+///
+/// Descriptors are assigned to the nearest of \c num_lists coarse centroids. The residual to the
+/// centroid is split in \c num_subquantizers parts, each encoded with one byte. Queries visit the
+/// \c num_probes nearest lists and compute approximate distances with one lookup table per part.
+/// Only the codes are stored. If a descriptor lookup is given, the best candidates are re-ranked
+/// with their exact distances. Otherwise the approximate distances are returned, and descriptors
+/// identical to the query are only ignored if their quantization error is negligible.
+///
+/// The quantizers are trained on the first descriptors inserted. Until enough descriptors are
+/// available, they are stored uncompressed and searched by brute force. If a descriptor lookup is
+/// given, the quantizers are trained again on a sample of the indexed descriptors every time the
+/// size of the index doubles, so that they follow the distribution of the descriptors. Without a
+/// lookup they are never trained again.
+class IvfPqIndex : public DescriptorIndex {
+ public:
+  /// \brief Initializes a new instance of the IvfPqIndex class.
+  /// \param dimension Dimension of the descriptors.
+  /// \param num_lists Number of inverted lists.
+  /// \param num_probes Number of lists visited by a query.
+  /// \param num_subquantizers Number of parts of the descriptors, which is also the size of the
+  /// codes in bytes. Must not be larger than the dimension.
+  /// \param descriptor_lookup Function returning the descriptors of the indexed segments, used for
+  /// re-ranking the candidates and for training the quantizers again. Can be empty.
+  IvfPqIndex(size_t dimension, size_t num_lists, size_t num_probes, size_t num_subquantizers,
+             const DescriptorLookup& descriptor_lookup = DescriptorLookup());
+
+  void insert(Id segment_id, const Eigen::VectorXf& descriptor) override;
+
+  bool remove(Id segment_id) override;
+
+  void clear() override;
+
+  bool contains(const Id segment_id) const override {
+    return locations_.find(segment_id) != locations_.end();
+  }
+  size_t size() const override { return locations_.size(); }
+  size_t getDimension() const override { return dimension_; }
+
+  size_t knn(const Eigen::VectorXf& query, size_t k, std::vector<Id>* segment_ids,
+             std::vector<float>* squared_distances) const override;
+
+  void setNumProbes(const size_t num_probes) { num_probes_ = num_probes; }
+  bool isTrained() const { return is_trained_; }
+
+ private:
+  // Segments and codes assigned to a coarse centroid.
+  struct InvertedList {
+    std::vector<Id> segment_ids;
+    std::vector<uint8_t> codes;
+  };
+
+  // Position of the descriptor of a segment. Untrained descriptors are in the list kUntrained.
+  struct Location {
+    size_t list;
+    size_t position;
+  };
+
+  // Train the quantizers on the untrained descriptors and encode them.
+  void train();
+
+  // Train the quantizers on a sample of the indexed descriptors and encode all of them again.
+  void retrain();
+
+  // Train the coarse quantizer and the quantizers of the residuals on descriptors stored in
+  // columns.
+  void trainQuantizers(const Eigen::MatrixXf& descriptors);
+
+  // Encode a descriptor and append it to its inverted list.
+  void add(Id segment_id, const Eigen::VectorXf& descriptor);
+
+  size_t dimension_;
+  size_t num_lists_;
+  size_t num_probes_;
+  size_t num_subquantizers_;
+  DescriptorLookup descriptor_lookup_;
+  // Number of descriptors on which the quantizers are trained the first time.
+  size_t num_training_descriptors_;
+  // Size of the index when the quantizers have been trained the last time.
+  size_t num_descriptors_at_training_ = 0u;
+  // The part j of the descriptors contains the values in the range
+  // [subspace_offsets_[j], subspace_offsets_[j + 1]).
+  std::vector<size_t> subspace_offsets_;
+
+  bool is_trained_ = false;
+  // Coarse centroids, one per column.
+  Eigen::MatrixXf coarse_centroids_;
+  // Codebooks of the parts of the residuals. Codebook j has one codeword per column.
+  std::vector<Eigen::MatrixXf> codebooks_;
+  std::vector<InvertedList> lists_;
+
+  // Descriptors inserted before the quantizers are trained.
+  std::vector<Id> untrained_segment_ids_;
+  std::vector<Eigen::VectorXf> untrained_descriptors_;
+
+  std::unordered_map<Id, Location> locations_;
+
+  static constexpr size_t kUntrained = static_cast<size_t>(-1);
+  static constexpr size_t kNumCodewords = 256u;
+  static constexpr size_t kNumKMeansIterations = 20u;
+  // Growth of the index after which the quantizers are trained again.
+  static constexpr size_t kRetrainingGrowthFactor = 2u;
+  // Maximum number of descriptors sampled for training the quantizers again.
+  static constexpr size_t kMaxNumRetrainingDescriptors = 64u * kNumCodewords;
+  // Number of candidates re-ranked with exact distances for each neighbour searched.
+  static constexpr size_t kNumReRankedCandidatesPerNeighbour = 4u;
+}; // class IvfPqIndex
+
+} // namespace segmatch
+
+#endif // SEGMATCH_IVFPQ_INDEX_HPP_
@@ -0,0 +1,92 @@
+#ifndef SEGMATCH_LOG_STRUCTURED_KDTREE_INDEX_HPP_
+#define SEGMATCH_LOG_STRUCTURED_KDTREE_INDEX_HPP_
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Core>
+#include <nabo/nabo.h>
+
+#include "segmatch/common.hpp"
+#include "segmatch/descriptor_indices/descriptor_index.hpp"
+
+namespace segmatch {
+
+/// \brief Exact nearest neighbours index over segment descriptors that can be updated
+/// incrementally.
+///
+/// New descriptors are stored in a small buffer which is searched by brute force. When the buffer
+/// is full, it is merged with the smallest levels into a new level indexed by an immutable
+/// libnabo k-d tree, so that level \c i contains at most <tt>kBufferCapacity * 2^(i+1)</tt>
+/// descriptors (logarithmic method). Removed descriptors are only marked as removed and a level
+/// is compacted when more than half of its descriptors have been removed. The amortized cost of
+/// an update is thus logarithmic in the number of descriptors, instead of the cost of rebuilding
+/// a single tree.
+class LogStructuredKdTreeIndex : public DescriptorIndex {
+ public:
+  /// \brief Initializes a new instance of the LogStructuredKdTreeIndex class.
+  /// \param dimension Dimension of the descriptors.
+  explicit LogStructuredKdTreeIndex(size_t dimension);
+
+  // Prevent copy and assignment, as the k-d trees reference the descriptors of their level.
+  LogStructuredKdTreeIndex(const LogStructuredKdTreeIndex&) = delete;
+  LogStructuredKdTreeIndex& operator=(const LogStructuredKdTreeIndex&) = delete;
+
+  void insert(Id segment_id, const Eigen::VectorXf& descriptor) override;
+
+  bool remove(Id segment_id) override;
+
+  void clear() override;
+
+  bool contains(const Id segment_id) const override {
+    return locations_.find(segment_id) != locations_.end();
+  }
+  size_t size() const override { return locations_.size(); }
+  size_t getDimension() const override { return dimension_; }
+
+  size_t knn(const Eigen::VectorXf& query, size_t k, std::vector<Id>* segment_ids,
+             std::vector<float>* squared_distances) const override;
+
+ private:
+  // Descriptors indexed by one k-d tree. Removed descriptors have kNoId as ID.
+  struct Level {
+    Eigen::MatrixXf descriptors;
+    std::vector<Id> segment_ids;
+    size_t num_removed = 0u;
+    std::unique_ptr<Nabo::NNSearchF> kd_tree;
+  };
+
+  // Position of the descriptor of a segment.
+  struct Location {
+    int level;
+    size_t column;
+  };
+
+  // Merge the buffer with the smallest levels into a new level.
+  void flushBuffer();
+
+  // Replace the content of a level and rebuild its k-d tree.
+  void buildLevel(size_t level_index, Eigen::MatrixXf descriptors, std::vector<Id> segment_ids);
+
+  // Rebuild a level with only the descriptors that have not been removed.
+  void compactLevel(size_t level_index);
+
+  size_t dimension_;
+
+  // Descriptors that are not indexed by a k-d tree yet, one per column.
+  Eigen::MatrixXf buffer_;
+  std::vector<Id> buffer_segment_ids_;
+
+  // The levels are stored as pointers so that their k-d trees stay valid when levels are added.
+  std::vector<std::unique_ptr<Level>> levels_;
+
+  std::unordered_map<Id, Location> locations_;
+
+  static constexpr int kBufferLevel = -1;
+  static constexpr size_t kBufferCapacity = 256u;
+}; // class LogStructuredKdTreeIndex
+
+} // namespace segmatch
+
+#endif // SEGMATCH_LOG_STRUCTURED_KDTREE_INDEX_HPP_
@@ -70,6 +70,9 @@ class CNNDescriptor : public Descriptor {
 
   std::vector<float> voxel_mean_values_;
 
+  // Layout of the features written by the last call to describe().
+  const FeatureLayout* feature_layout_ = nullptr;
+
   segmatch::SegmentedCloud aligned_segments_;
 
   constexpr static float min_voxel_size_m_ = 0.1;
@@ -3,7 +3,11 @@
 
 #include <algorithm>
 #include <cmath>
+#include <deque>
+#include <functional>
+#include <list>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include <glog/logging.h>
@@ -21,6 +25,14 @@ namespace segmatch {
 /// downsampled view of the points and supports removing of voxels according to a predicate.
 /// The grid distinguishes between <em>active voxels</em> (voxels that contain a minimum number of
 /// points) and \e inactive voxels.
+/// Voxels are stored in a hash map indexed by their voxel index, so that insertions only touch the
+/// voxels hit by the new points. Centroids of voxels that become active are appended at the end of
+/// the active centroids cloud, thus insertions never change the relative order of existing
+/// centroids.
+/// Inactive voxels that are not hit by new points can be evicted according to an
+/// EvictionParameters policy, bounding the memory used by noisy measurements.
+/// Large insertions are sorted with a parallel radix sort, unless \c use_radix_sort is false, in
+/// which case std::sort is always used.
 /// \remark The class is \e not thread-safe. Concurrent access to the class results in undefined
 /// behavior.
 template<
@@ -29,12 +41,75 @@ template<
   typename IndexT = uint64_t,
   uint8_t bits_x = 20,
   uint8_t bits_y = 20,
-  uint8_t bits_z = 20>
+  uint8_t bits_z = 20,
+  bool use_radix_sort = true>
 class DynamicVoxelGrid {
  public:
   typedef typename pcl::PointCloud<InputPointT> InputCloud;
   typedef typename pcl::PointCloud<VoxelPointT> VoxelCloud;
 
+  /// \brief Structure-of-arrays storage for the coordinates of a set of centroids.
+  /// Used for the centroids of the \e inactive voxels, which are not exposed as a point cloud and
+  /// only need their position. Storing them separately makes bulk operations vectorizable and
+  /// reduces the memory used per inactive voxel.
+  struct CentroidsCoordinates {
+    /// \brief Gets the number of centroids.
+    inline size_t size() const { return x.size(); }
+
+    /// \brief Gets a point located at the specified centroid. Fields other than the coordinates
+    /// are default initialized.
+    inline VoxelPointT getPoint(const size_t index) const {
+      VoxelPointT point;
+      point.x = x[index];
+      point.y = y[index];
+      point.z = z[index];
+      return point;
+    }
+
+    /// \brief Sets the coordinates of the specified centroid.
+    inline void setPoint(const size_t index, const VoxelPointT& point) {
+      x[index] = point.x;
+      y[index] = point.y;
+      z[index] = point.z;
+    }
+
+    /// \brief Appends a centroid.
+    inline void push_back(const VoxelPointT& point) {
+      x.push_back(point.x);
+      y.push_back(point.y);
+      z.push_back(point.z);
+    }
+
+    /// \brief Resizes the storage.
+    inline void resize(const size_t size) {
+      x.resize(size);
+      y.resize(size);
+      z.resize(size);
+    }
+
+    /// \brief Removes all the centroids.
+    inline void clear() { resize(0u); }
+
+    /// \brief X, Y, Z components of the centroids.
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+  };
+
+  /// \brief Policy for evicting the \e inactive voxels. Active voxels are never evicted.
+  /// A value of zero disables the corresponding criterion.
+  struct EvictionParameters {
+    /// \brief Inactive voxels that have not been hit by the last \c max_inactive_age_scans
+    /// insertions are evicted.
+    uint32_t max_inactive_age_scans = 0u;
+    /// \brief Inactive voxels that have not been hit for more than \c max_inactive_age_ns
+    /// nanoseconds are evicted. Requires timestamps to be passed to insert().
+    int64_t max_inactive_age_ns = 0;
+    /// \brief Maximum number of voxels in the grid. If the limit is exceeded, the least recently
+    /// hit inactive voxels are evicted.
+    size_t max_voxels = 0u;
+  };
+
   static_assert(std::is_integral<IndexT>::value && std::is_unsigned<IndexT>::value,
                 "IndexT must be an unsigned integral type");
   static_assert(bits_x + bits_y + bits_z <= sizeof(IndexT) * 8,
@@ -66,9 +141,15 @@ class DynamicVoxelGrid {
     , min_corner_(origin_offset_ - grid_size_ / 2.0f)
     , max_corner_(origin_offset_ + grid_size_ / 2.0f)
     , active_centroids_(new VoxelCloud())
-    , inactive_centroids_(new VoxelCloud())
+    , inactive_centroids_()
     , pose_transformation_()
-    , indexing_transformation_() {
+    , indexing_transformation_()
+    , indexing_rotation_(Eigen::Matrix3f::Identity())
+    , indexing_translation_(Eigen::Vector3f::Zero())
+    , pending_transformation_()
+    , has_pending_transformation_(false)
+    , eviction_params_()
+    , scans_count_(0u) {
 
     // Validate inputs.
     CHECK_GT(resolution, 0.0f);
@@ -89,19 +170,35 @@ class DynamicVoxelGrid {
     , max_corner_(std::move(other.max_corner_))
     , active_centroids_(std::move(other.active_centroids_))
     , inactive_centroids_(std::move(other.inactive_centroids_))
+    , active_voxels_(std::move(other.active_voxels_))
+    , inactive_voxels_(std::move(other.inactive_voxels_))
+    , inactive_voxels_by_age_(std::move(other.inactive_voxels_by_age_))
+    , inactive_ages_(std::move(other.inactive_ages_))
     , voxels_(std::move(other.voxels_))
+    , tiles_(std::move(other.tiles_))
     , pose_transformation_(std::move(other.pose_transformation_))
-    , indexing_transformation_(std::move(other.indexing_transformation_)) {
+    , indexing_transformation_(std::move(other.indexing_transformation_))
+    , indexing_rotation_(other.indexing_rotation_)
+    , indexing_translation_(other.indexing_translation_)
+    , pending_transformation_(std::move(other.pending_transformation_))
+    , has_pending_transformation_(other.has_pending_transformation_)
+    , eviction_params_(other.eviction_params_)
+    , scans_count_(other.scans_count_)
+    , scans_timestamps_(std::move(other.scans_timestamps_)) {
   }
 
   /// \brief Inserts a point cloud in the voxel grid.
   /// Inserting new points updates the X, Y, Z coordinates of the points, but leaves any extra
   /// fields untouched.
+  /// After the insertion, inactive voxels are evicted according to the eviction parameters.
   /// \remark Insertion invalidates any reference to the centroids.
   /// \param new_cloud The new points that must be inserted in the grid.
+  /// \param timestamp_ns Time at which the points were acquired. Only used for time-based
+  /// eviction.
   /// \returns Indices of the centroids of the voxels that have become \e active after the
-  /// insertion.
-  std::vector<int> insert(const InputCloud& new_cloud);
+  /// insertion, in increasing order. Centroids that were already active keep their indices and
+  /// the created ones are appended after them.
+  std::vector<int> insert(const InputCloud& new_cloud, int64_t timestamp_ns = 0);
 
   /// \brief Result of a removal operation.
   /// \remark Enabled only for predicates of the form: <tt>bool p(const VoxelPointT&)</tt>
@@ -117,15 +214,58 @@ class DynamicVoxelGrid {
   template <typename Func>
   RemovalResult<Func> removeIf(Func predicate);
 
+  /// \brief Removes from the grid a set of voxels satisfying the given predicate, evaluating the
+  /// predicate only in the regions of the grid that can contain voxels to be removed.
+  /// Voxels are bucketed in cubic tiles, and the predicate is not evaluated for the centroids of
+  /// the tiles for which \c may_remove_region returns false.
+  /// \remark Removal invalidates any reference to the centroids.
+  /// \param predicate The predicate selecting the centroids that must be removed.
+  /// \param may_remove_region Function of the form
+  /// <tt>bool f(const Eigen::Vector3f& center, float radius)</tt>. It must return false only if
+  /// the predicate is false for every point inside the specified sphere.
+  /// \returns Vector indicating, for each active voxel index, if the centroid has been removed or
+  /// not.
+  template <typename Func, typename RegionFunc>
+  RemovalResult<Func> removeIf(Func predicate, RegionFunc may_remove_region);
+
   /// \brief Compute the index of the voxel containing the specified point.
   template<typename PointXYZ_>
   IndexT getIndexOf(const PointXYZ_& point) const;
 
+  /// \brief Gets the index of the voxel owning an active centroid.
+  /// \param centroid_index Index of the centroid in the active centroids cloud.
+  /// \returns The voxel index.
+  inline IndexT getVoxelIndexOfActiveCentroid(const size_t centroid_index) const {
+    return active_voxels_[centroid_index]->first;
+  }
+
+  /// \brief Computes the coordinates of a voxel in the grid.
+  /// \param voxel_index The index of the voxel.
+  /// \returns The position of the voxel along each axis of the grid, in number of voxels.
+  inline Eigen::Vector3i getVoxelCoordinates(const IndexT voxel_index) const {
+    return Eigen::Vector3i(static_cast<int>(voxel_index & (n_voxels_x - 1u)),
+                           static_cast<int>((voxel_index >> bits_x) & (n_voxels_y - 1u)),
+                           static_cast<int>(voxel_index >> (bits_x + bits_y)));
+  }
+
+  /// \brief Gets the edge length of the voxels.
+  inline float getResolution() const { return resolution_; }
+
   /// \brief Apply a pose transformation to the voxel grid.
+  /// The transformation of the centroids is deferred until the next call to insert(), removeIf()
+  /// or applyPendingTransformation(), thus transforming the grid multiple times only requires a
+  /// single pass over the centroids.
   /// \remark Multiple transformations are cumulative.
   /// \param transformation The transformation to be applied to the grid.
   void transform(const kindr::minimal::QuatTransformationTemplate<float>& transformation);
 
+  /// \brief Apply to the centroids the transformations deferred by transform(). The centroids
+  /// cannot be accessed until the pending transformations are applied.
+  void applyPendingTransformation();
+
+  /// \brief Checks if transformations deferred by transform() still have to be applied.
+  inline bool hasPendingTransformation() const { return has_pending_transformation_; }
+
   /// \brief Clears the dynamic voxel grid, removing all the points it contains and resetting the
   /// transformations.
   void clear();
@@ -133,75 +273,141 @@ class DynamicVoxelGrid {
   /// \brief Returns a reference to the centroids of the active voxels.
   /// \remark Modifying the X, Y, Z components of the points in the returned cloud results in
   /// undefined behavior.
+  /// \remark The grid must not have pending transformations.
   /// \returns The centroids of the active voxels.
-  inline VoxelCloud& getActiveCentroids() const { return *active_centroids_; }
+  inline VoxelCloud& getActiveCentroids() const {
+    CHECK(!has_pending_transformation_) << "The pending transformation must be applied first.";
+    return *active_centroids_;
+  }
 
   /// \brief Returns a reference to the centroids of the inactive voxels.
-  /// \remark Modifying the X, Y, Z components of the points in the returned cloud results in
-  /// undefined behavior.
-  /// \returns The centroids of the inactive voxels.
-  inline VoxelCloud& getInactiveCentroids() const { return *inactive_centroids_; }
+  /// \remark The grid must not have pending transformations.
+  /// \returns The coordinates of the centroids of the inactive voxels.
+  inline const CentroidsCoordinates& getInactiveCentroids() const {
+    CHECK(!has_pending_transformation_) << "The pending transformation must be applied first.";
+    return inactive_centroids_;
+  }
+
+  /// \brief Sets the policy used for evicting inactive voxels. The policy is applied at the next
+  /// insertion.
+  /// \param params The eviction parameters.
+  void setEvictionParameters(const EvictionParameters& params) { eviction_params_ = params; }
+
+  /// \brief Gets the number of voxels in the grid, including inactive voxels.
+  size_t getNumVoxels() const { return voxels_.size(); }
+
+  /// \brief Estimates the memory used by the grid.
+  /// \returns The approximate number of bytes allocated for storing the voxels and the centroids.
+  size_t getMemoryUsage() const;
 
   /// \brief Dump informations about the voxels contained in the grid.
   void dumpVoxels() const;
 
  private:
-  // A point with its voxel index.
+  // The index of a point with its voxel index. Sorting these pairs avoids moving whole points.
   struct IndexedPoint_ {
-    IndexedPoint_(const InputPointT& point, const IndexT& voxel_index)
-      : point(point), voxel_index(voxel_index) {
-    }
-
-    InputPointT point;
     IndexT voxel_index;
+    uint32_t point_index;
   };
   typedef std::vector<IndexedPoint_> IndexedPoints_;
 
   // A voxel in the grid.
   struct Voxel_ {
     Voxel_()
-      : centroid(nullptr), index(0), num_points(0) {
+      : centroid_index(0u), num_points(0u) {
     }
 
-    Voxel_(VoxelPointT* centroid, const IndexT& index, const uint32_t num_points)
-      : centroid(centroid), index(index), num_points(num_points) {
-    }
-
-    Voxel_(const Voxel_& other)
-      : centroid(other.centroid), index(other.index), num_points(other.num_points) {
-    }
-
-    VoxelPointT* centroid;
-    IndexT index;
+    // Index of the centroid in the active or inactive centroids cloud, depending on the number of
+    // points in the voxel.
+    size_t centroid_index;
     uint32_t num_points;
   };
+  typedef std::unordered_map<IndexT, Voxel_> Voxels_;
+  typedef typename Voxels_::value_type VoxelEntry_;
 
-  // The data necessary to construct a voxel.
-  struct VoxelData_ {
-    Voxel_* old_voxel;
-    typename IndexedPoints_::iterator points_begin;
-    typename IndexedPoints_::iterator points_end;
+  // An inactive voxel and the last insertion that hit it.
+  struct InactiveVoxelAge_ {
+    uint32_t last_hit;
+    VoxelEntry_* voxel_entry;
   };
+  typedef std::list<InactiveVoxelAge_> InactiveVoxelsByAge_;
+
+  // Voxels are bucketed in cubic tiles containing 2^tile_bits voxels per side. Tiles store
+  // pointers to the voxels, which are stable since the voxels map is node based.
+  static constexpr uint8_t tile_bits = 3u;
+  typedef std::unordered_map<IndexT, std::vector<VoxelEntry_*>> Tiles_;
+
+  // Compute the index of the tile containing a voxel.
+  IndexT getTileIndexOf_(IndexT voxel_index) const;
+
+  // Compute the center and the radius of a sphere containing all the points of a tile.
+  void getTileBoundingSphere_(IndexT tile_index, Eigen::Vector3f& center, float& radius) const;
 
   // Compute the voxel indices of a point cloud and sort the points in increasing voxel index
   // order.
   IndexedPoints_ indexAndSortPoints_(const InputCloud& points) const;
 
-  // Create a voxel staring from the data about the point it contains and insert it in the voxels
-  // and centroids vectors. Returns true if the new points inserted triggered the voxel.
-  bool createVoxel_(const IndexT index, const VoxelData_& data, std::vector<Voxel_>& new_voxels,
-                    VoxelCloud& new_active_centroids, VoxelCloud& new_inactive_centroids);
+  // Compute the voxel indices of a point cloud. Points are processed in blocks so that the
+  // transformation, the bounds checks and the quantization are vectorized.
+  void indexPoints_(const InputCloud& points, IndexedPoints_& indexed_points) const;
 
-  // Removes the centroids at the specified pointers. The pointers must be sorted in increasing
-  // order.
-  std::vector<bool> removeCentroids_(VoxelCloud& target_cloud, std::vector<VoxelPointT*> to_remove);
+  // Sort indexed points in increasing voxel index order using a parallel LSD radix sort. Small
+  // inputs fall back to std::sort, as all inputs do if use_radix_sort is false.
+  static void sortIndexedPoints_(IndexedPoints_& indexed_points);
+
+  // Update a voxel with the points in the range [points_begin, points_end), moving its centroid
+  // to the active centroids if the voxel reached the required number of points. Returns true if
+  // the new points triggered the voxel.
+  bool updateVoxel_(VoxelEntry_& voxel_entry, const InputCloud& points,
+                    typename IndexedPoints_::const_iterator points_begin,
+                    typename IndexedPoints_::const_iterator points_end);
+
+  // Evict the inactive voxels according to the eviction parameters. Returns the number of evicted
+  // voxels.
+  size_t evictInactiveVoxels_(int64_t timestamp_ns);
+
+  // Removes the inactive voxels owning the specified inactive centroids.
+  void removeInactiveVoxels_(std::vector<size_t>& centroid_indices);
+
+  // Appends a centroid to the inactive centroids, as the most recently hit inactive voxel.
+  void addInactiveCentroid_(VoxelEntry_& voxel_entry, const VoxelPointT& centroid);
+
+  // Removes the centroid at the specified position from the inactive centroids by swapping it
+  // with the last inactive centroid.
+  void removeInactiveCentroid_(size_t centroid_index);
+
+  // Removes from the target centroids the ones marked for removal, preserving the order of the
+  // remaining centroids.
+  template <typename CentroidsT>
+  void removeCentroids_(CentroidsT& target_centroids, std::vector<VoxelEntry_*>& target_voxels,
+                        const std::vector<bool>& is_removed, size_t first_removed_index);
+
+  // Copy a centroid to another position of the same container.
+  static void copyCentroid_(VoxelCloud& centroids, size_t from_index, size_t to_index);
+  static void copyCentroid_(CentroidsCoordinates& centroids, size_t from_index, size_t to_index);
 
   // The centroids of the voxels containing enough points.
   std::unique_ptr<VoxelCloud> active_centroids_;
-  std::unique_ptr<VoxelCloud> inactive_centroids_;
 
-  // The voxels in the point cloud.
-  std::vector<Voxel_> voxels_;
+  // The centroids of the other voxels.
+  CentroidsCoordinates inactive_centroids_;
+
+  // The voxels owning each active and inactive centroid.
+  std::vector<VoxelEntry_*> active_voxels_;
+  std::vector<VoxelEntry_*> inactive_voxels_;
+
+  // The inactive voxels ordered from the least to the most recently hit, so that eviction only
+  // visits the voxels it evicts. A voxel hit again is moved to the back of the list.
+  InactiveVoxelsByAge_ inactive_voxels_by_age_;
+
+  // The position of each inactive centroid in inactive_voxels_by_age_.
+  std::vector<typename InactiveVoxelsByAge_::iterator> inactive_ages_;
+
+  // The voxels in the point cloud, indexed by voxel index.
+  Voxels_ voxels_;
+
+  // The voxels in each tile, indexed by tile index.
+  Tiles_ tiles_;
 
   // Properties of the grid.
   const float resolution_;
@@ -213,6 +419,12 @@ class DynamicVoxelGrid {
   static constexpr IndexT n_voxels_y = (IndexT(1) << bits_y);
   static constexpr IndexT n_voxels_z = (IndexT(1) << bits_z);
 
+  // The radix sort only processes the bits used by the voxel indices, thus the number of passes
+  // is determined at compile time by the bits per dimension.
+  static constexpr uint8_t n_index_bits = bits_x + bits_y + bits_z;
+  static constexpr uint8_t n_radix_bits = 8u;
+  static constexpr uint8_t n_radix_passes = (n_index_bits + n_radix_bits - 1u) / n_radix_bits;
+
   // Variables needed for conversion from world coordinates to voxel index.
   const Eigen::Vector3f grid_size_;
   const Eigen::Vector3f origin_offset_;
@@ -222,13 +434,27 @@ class DynamicVoxelGrid {
   float world_to_grid_;
   kindr::minimal::QuatTransformationTemplate<float> pose_transformation_;
   kindr::minimal::QuatTransformationTemplate<float> indexing_transformation_;
+
+  // Rotation and translation of the indexing transformation, cached for batch indexing.
+  Eigen::Matrix3f indexing_rotation_;
+  Eigen::Vector3f indexing_translation_;
+
+  // Transformation that still has to be applied to the centroids.
+  kindr::minimal::QuatTransformationTemplate<float> pending_transformation_;
+  bool has_pending_transformation_;
+
+  // Eviction policy, number of insertions and timestamps of the recent insertions.
+  EvictionParameters eviction_params_;
+  uint32_t scans_count_;
+  std::deque<std::pair<uint32_t, int64_t>> scans_timestamps_;
 }; // class DynamicVoxelGrid
 
 // Short name macros for Dynamic Voxel Grid (DVG) template declaration and
 // specification.
 #define _DVG_TEMPLATE_DECL_ typename InputPointT, typename VoxelPointT, typename IndexT, uint8_t \
-  bits_x, uint8_t bits_y, uint8_t bits_z
-#define _DVG_TEMPLATE_SPEC_ InputPointT, VoxelPointT, IndexT, bits_x, bits_y, bits_z
+  bits_x, uint8_t bits_y, uint8_t bits_z, bool use_radix_sort
+#define _DVG_TEMPLATE_SPEC_ InputPointT, VoxelPointT, IndexT, bits_x, bits_y, bits_z, \
+  use_radix_sort
 
 //=================================================================================================
 //    DynamicVoxelGrid public methods implementation
@@ -238,51 +464,96 @@ template<_DVG_TEMPLATE_DECL_>
 template <typename Func>
 inline DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::RemovalResult<Func>
 DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::removeIf(Func predicate) {
-  // Setup iterators
-  auto v_read = voxels_.begin();
-  const auto v_end = voxels_.end();
-
-  // Returns a reference to the point cloud containing the centroid of the
-  // specified voxel.
-  std::vector<VoxelPointT*> active_centroids_to_remove;
-  std::vector<VoxelPointT*> inactive_centroids_to_remove;
-  auto get_centroids_container_for = [&](const Voxel_& voxel)
-      -> std::vector<VoxelPointT*>& {
-    if (voxel.num_points >= min_points_per_voxel_) {
-      return active_centroids_to_remove;
-    } else {
-      return inactive_centroids_to_remove;
-    }
-  };
+  return removeIf(predicate, [](const Eigen::Vector3f& center, float radius) { return true; });
+}
 
-  // Remove the voxels and collect the pointers of the centroids that must be
+template<_DVG_TEMPLATE_DECL_>
+template <typename Func, typename RegionFunc>
+inline DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::RemovalResult<Func>
+DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::removeIf(Func predicate, RegionFunc may_remove_region) {
+  applyPendingTransformation();
+  std::vector<bool> is_active_removed(active_centroids_->size(), false);
+  size_t first_active_removed = active_centroids_->size();
+  std::vector<size_t> removed_inactive_indices;
+  std::vector<IndexT> removed_voxel_indices;
+
+  // Evaluate the predicate only for the voxels in the tiles that can contain voxels to be
   // removed.
-  while(v_read != v_end && !predicate(*(v_read->centroid)))
-    ++v_read;
-
-  if (v_read == v_end)
-    return std::vector<bool>(active_centroids_->size(), false);
-  auto v_write = v_read;
-  get_centroids_container_for(*v_read).push_back(v_read->centroid);
-  ++v_read;
-
-  for(; v_read != v_end; ++v_read) {
-    if(!predicate(*(v_read->centroid))) {
-      // Copy the centroid, updating the pointer from the voxel.
-      *v_write = *v_read;
-      v_write->centroid -= get_centroids_container_for(*v_read).size();
-      ++v_write;
+  Eigen::Vector3f tile_center;
+  float tile_radius;
+  for (auto tile_it = tiles_.begin(); tile_it != tiles_.end(); ) {
+    getTileBoundingSphere_(tile_it->first, tile_center, tile_radius);
+    if (!may_remove_region(tile_center, tile_radius)) {
+      ++tile_it;
+      continue;
+    }
+
+    std::vector<VoxelEntry_*>& tile_voxels = tile_it->second;
+    size_t write_index = 0u;
+    for (VoxelEntry_* voxel_entry : tile_voxels) {
+      const Voxel_& voxel = voxel_entry->second;
+      const bool is_active = voxel.num_points >= min_points_per_voxel_;
+      if (is_active ? predicate((*active_centroids_)[voxel.centroid_index]) :
+          predicate(inactive_centroids_.getPoint(voxel.centroid_index))) {
+        // Mark the centroid for removal. The voxel is erased after the centroids have been
+        // compacted.
+        if (is_active) {
+          is_active_removed[voxel.centroid_index] = true;
+          first_active_removed = std::min(first_active_removed, voxel.centroid_index);
+        } else {
+          removed_inactive_indices.push_back(voxel.centroid_index);
+        }
+        removed_voxel_indices.push_back(voxel_entry->first);
+      } else {
+        tile_voxels[write_index++] = voxel_entry;
+      }
+    }
+
+    tile_voxels.resize(write_index);
+    if (tile_voxels.empty()) {
+      tile_it = tiles_.erase(tile_it);
     } else {
-      // Keep track of the voxels that need to be deleted.
-      get_centroids_container_for(*v_read).push_back(v_read->centroid);
+      ++tile_it;
     }
   }
 
-  voxels_.erase(v_write, v_end);
+  // Remove the centroids and the voxels. The order of the inactive centroids is not relevant, so
+  // they are removed by swapping them with the last ones, starting from the back.
+  removeCentroids_(*active_centroids_, active_voxels_, is_active_removed, first_active_removed);
+  std::sort(removed_inactive_indices.begin(), removed_inactive_indices.end(),
+            std::greater<size_t>());
+  for (const size_t centroid_index : removed_inactive_indices) {
+    removeInactiveCentroid_(centroid_index);
+  }
+  for (const IndexT voxel_index : removed_voxel_indices) voxels_.erase(voxel_index);
+
+  return is_active_removed;
+}
+
+//=================================================================================================
+//    DynamicVoxelGrid private methods implementation
+//=================================================================================================
+
+template<_DVG_TEMPLATE_DECL_>
+template <typename CentroidsT>
+inline void DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::removeCentroids_(
+    CentroidsT& target_centroids, std::vector<VoxelEntry_*>& target_voxels,
+    const std::vector<bool>& is_removed, const size_t first_removed_index) {
+  // Centroids before the first removed one don't move. Compact the remaining ones, updating the
+  // positions stored in their voxels.
+  size_t write_index = first_removed_index;
+  for (size_t read_index = first_removed_index; read_index < target_centroids.size();
+       ++read_index) {
+    if (!is_removed[read_index]) {
+      copyCentroid_(target_centroids, read_index, write_index);
+      target_voxels[write_index] = target_voxels[read_index];
+      target_voxels[write_index]->second.centroid_index = write_index;
+      ++write_index;
+    }
+  }
 
-  // Actually remove centroids
-  removeCentroids_(*inactive_centroids_, inactive_centroids_to_remove);
-  return removeCentroids_(*active_centroids_, active_centroids_to_remove);
+  target_centroids.resize(write_index);
+  target_voxels.resize(write_index);
 }
 
 } // namespace segmatch
@@ -19,7 +19,43 @@ struct FeatureValue {
   FeatureValueType value = 0.0;
 };
 
+/// \brief Layout of a feature: the name of the feature and the names of its values.
+/// Layouts are registered once and shared by all the \c Features storing the same feature, so
+/// that the values of a feature can be stored without their names.
+class FeatureLayout {
+ public:
+  /// \brief Get the layout with the specified names, registering it if it does not exist yet.
+  /// This function is thread safe. The returned reference stays valid until the program exits.
+  /// \remark Looking up a layout requires comparing strings. Descriptors should get their layout
+  /// once and keep the reference.
+  static const FeatureLayout& get(const std::string& name,
+                                  const std::vector<std::string>& value_names);
+
+  const std::string& getName() const { return name_; }
+  const std::vector<std::string>& getValueNames() const { return value_names_; }
+  size_t size() const { return value_names_.size(); }
+
+  /// \brief Find the index of a value from its name.
+  /// \returns True if the layout contains a value with the given name.
+  bool findValueIndex(const std::string& value_name, size_t* index) const;
+
+  /// \brief Indices of the values that do not depend on the orientation of the segment.
+  const std::vector<size_t>& getRotationInvariantIndices() const {
+    return rotation_invariant_indices_;
+  }
+  bool isRotationInvariant() const { return rotation_invariant_indices_.size() == size(); }
+
+ private:
+  FeatureLayout(const std::string& name, const std::vector<std::string>& value_names);
+
+  std::string name_;
+  std::vector<std::string> value_names_;
+  std::vector<size_t> rotation_invariant_indices_;
+}; // class FeatureLayout
+
 /// \brief A feature can be composed of any number of values, each with its own name.
+/// \remark This class is convenient for building features by name, but adding values is slow.
+/// Descriptors should rather use a \c FeatureLayout and \c Features::setFeature().
 class Feature {
  public:
   Feature() {}
@@ -27,7 +63,7 @@ class Feature {
   explicit Feature(const std::string& name) : name_(name) {}
 
   size_t size() const { return feature_values_.size(); }
-  bool empty() { return feature_values_.empty(); }
+  bool empty() const { return feature_values_.empty(); }
   const FeatureValue& at(const size_t& index) const { return feature_values_.at(index); }
   void clear() { feature_values_.clear(); }
   void push_back(const FeatureValue& value) {
@@ -46,29 +82,65 @@ class Feature {
 }; // class Feature
 
 /// \brief A collection of features.
+/// The values of all the features are stored contiguously, in the order in which the features
+/// were added. The names are only stored once, in the \c FeatureLayout of each feature.
 class Features {
  public:
   Features() {}
-  Features& operator+= (const Features& rhs) {
-    this->features_.insert(this->features_.end(), rhs.features_.begin(), rhs.features_.end());
-    return *this;
-  }
-  void push_back(const Feature& feature) { features_.push_back(feature); }
-  size_t size() const { return features_.size(); }
-  const Feature& at(const size_t& index) const { return features_.at(index); }
-  void clear() { features_.clear(); }
+  Features& operator+= (const Features& rhs);
+
+  /// \brief Set the values of a feature. If a feature with the same name exists, it is replaced.
+  /// \param layout Layout of the feature.
+  /// \param values Pointer to the \c layout.size() values of the feature.
+  void setFeature(const FeatureLayout& layout, const FeatureValueType* values);
+
+  /// \brief Adds a feature, registering its layout if needed.
+  void push_back(const Feature& feature);
+  /// \brief Number of features.
+  size_t size() const { return slices_.size(); }
+  /// \brief Copy a feature with the names of its values.
+  Feature at(const size_t& index) const;
+  const FeatureLayout& getLayout(const size_t index) const { return *slices_.at(index).layout; }
+  void clear();
   void clearByName(const std::string& name);
-  bool empty() { return features_.empty(); }
+  bool empty() const { return slices_.empty(); }
   void replaceByName(const Feature& new_feature);
 
-  size_t sizeWhenFlattened() const;
-  std::vector<FeatureValueType> asVectorOfValues() const;
+  size_t sizeWhenFlattened() const { return values_.size(); }
+  /// \brief Gets the values of all the features, without copying them.
+  const std::vector<FeatureValueType>& getValues() const { return values_; }
+  std::vector<FeatureValueType> asVectorOfValues() const { return values_; }
   Eigen::MatrixXd asEigenMatrix() const;
   Features rotationInvariantFeaturesOnly() const;
   std::vector<std::string> asVectorOfNames() const;
 
+  /// \brief Gets the values of the rotation invariant features, without copying them.
+  /// This is equivalent to \c rotationInvariantFeaturesOnly().asEigenMatrix().
+  Eigen::Map<const Eigen::Matrix<FeatureValueType, 1, Eigen::Dynamic>>
+  getRotationInvariantValues() const {
+    const std::vector<FeatureValueType>& values =
+        num_rotation_variant_values_ == 0u ? values_ : rotation_invariant_values_;
+    return Eigen::Map<const Eigen::Matrix<FeatureValueType, 1, Eigen::Dynamic>>(
+        values.data(), values.size());
+  }
+
  private:
-  std::vector<Feature> features_;
+  struct Slice {
+    const FeatureLayout* layout;
+    size_t offset;
+  };
+
+  void appendFeature(const FeatureLayout& layout, const FeatureValueType* values);
+  void eraseSlice(size_t index);
+  void updateRotationInvariantValues();
+
+  std::vector<Slice> slices_;
+  std::vector<FeatureValueType> values_;
+
+  // Number of values that are not rotation invariant. When it is zero, which is the case for all
+  // the descriptors of this library, the rotation invariant values are the values themselves.
+  size_t num_rotation_variant_values_ = 0u;
+  std::vector<FeatureValueType> rotation_invariant_values_;
 }; // class Features
 
 } // namespace segmatch
@@ -4,7 +4,12 @@
 #include "segmatch/dynamic_voxel_grid.hpp"
 
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <type_traits>
 #include <vector>
 
@@ -15,6 +20,7 @@
 #include <pcl/point_types.h>
 #include <pcl/PointIndices.h>
 
+#include "segmatch/batch_points_transformer.hpp"
 #include "segmatch/common.hpp"
 
 namespace segmatch {
@@ -27,58 +33,50 @@ extern template class DynamicVoxelGrid<PclPoint, MapPoint>;
 //=================================================================================================
 
 template<_DVG_TEMPLATE_DECL_>
-std::vector<int> DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::insert(const InputCloud& new_cloud) {
+std::vector<int> DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::insert(const InputCloud& new_cloud,
+                                                              const int64_t timestamp_ns) {
+  BENCHMARK_BLOCK("SM.UpdateLocalMap.AddNewPoints.InsertInDVG");
   std::vector<int> created_voxel_indices;
-  if (new_cloud.empty()) return created_voxel_indices;
+  ++scans_count_;
+  if (new_cloud.empty()) {
+    evictInactiveVoxels_(timestamp_ns);
+    return created_voxel_indices;
+  }
+  applyPendingTransformation();
   created_voxel_indices.reserve(new_cloud.size());
   IndexedPoints_ new_points = indexAndSortPoints_(new_cloud);
 
-  // Create containers and reserve space to prevent reallocation
-  std::vector<Voxel_> new_voxels;
-  std::unique_ptr<VoxelCloud> new_active_centroids(new VoxelCloud());
-  std::unique_ptr<VoxelCloud> new_inactive_centroids(new VoxelCloud());
-  new_voxels.reserve(voxels_.size() + new_cloud.size());
-  new_active_centroids->reserve(active_centroids_->size() + new_cloud.size());
-  new_inactive_centroids->reserve(inactive_centroids_->size() + new_cloud.size());
-
-  // Setup iterators
-  auto p_it = new_points.begin();
-  auto v_it = voxels_.begin();
-  const auto p_end = new_points.end();
-  const auto v_end = voxels_.end();
-
-  // Merge points updating the affected voxels.
-  while (!(p_it == p_end && v_it == v_end)) {
-    VoxelData_ voxel_data = { nullptr, p_it, p_it};
-    IndexT voxel_index;
-
-    // Use the next voxel if it has the upcoming index.
-    if ((p_it == p_end) || (v_it != v_end && v_it->index <= p_it->voxel_index)) {
-      voxel_index = v_it->index;
-      voxel_data.old_voxel = &(*v_it);
-      ++v_it;
-    } else {
-      voxel_index = p_it->voxel_index;
-    }
-
-    // Gather all the points that belong to the current voxel
+  // Update only the voxels hit by the new points. Voxels triggered by the insertion are appended
+  // to the active centroids in increasing voxel index order, so the indices of the created
+  // centroids are sorted.
+  size_t num_touched_voxels = 0u;
+  auto p_it = new_points.cbegin();
+  const auto p_end = new_points.cend();
+  while (p_it != p_end) {
+    // Gather all the points that belong to the current voxel.
+    const IndexT voxel_index = p_it->voxel_index;
+    const auto points_begin = p_it;
     while (p_it != p_end && p_it->voxel_index == voxel_index) {
       ++p_it;
     }
-    voxel_data.points_end = p_it;
 
-    // Create the voxel
-    if (createVoxel_(voxel_index, voxel_data, new_voxels,
-                     *new_active_centroids, *new_inactive_centroids)) {
-      created_voxel_indices.push_back(new_active_centroids->size()-1);
+    // Register new voxels in their tile.
+    auto insertion_result = voxels_.emplace(voxel_index, Voxel_());
+    VoxelEntry_& voxel_entry = *insertion_result.first;
+    if (insertion_result.second) {
+      tiles_[getTileIndexOf_(voxel_index)].push_back(&voxel_entry);
+    }
+
+    if (updateVoxel_(voxel_entry, new_cloud, points_begin, p_it)) {
+      created_voxel_indices.push_back(active_centroids_->size() - 1u);
     }
+    ++num_touched_voxels;
   }
 
-  // Done! Save the new voxels and return the indices of the triggered
-  // voxels.
-  voxels_= std::move(new_voxels);
-  active_centroids_ = std::move(new_active_centroids);
-  inactive_centroids_ = std::move(new_inactive_centroids);
+  BENCHMARK_RECORD_VALUE("SM.UpdateLocalMap.AddNewPoints.TouchedVoxels", num_touched_voxels);
+
+  // Evicting inactive voxels doesn't change the indices of the active centroids.
+  evictInactiveVoxels_(timestamp_ns);
   return created_voxel_indices;
 }
 
@@ -87,13 +85,16 @@ template<typename PointXYZ_>
 inline IndexT DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::getIndexOf(const PointXYZ_& point) const {
   static_assert(pcl::traits::has_xyz<PointXYZ_>::value,
                 "PointXYZ_ must be a structure containing XYZ coordinates");
-  // TODO: One could pack indexing transformation, offsetting and scaling in a single
-  // transformation. min_corner and max_corner would need to be transformed as well in order
-  // to allow checks. Since it would decrease readability significantly, this should be done only
-  // if optimization is really necessary.
 
-  // Transform the point back to the grid frame for hashing.
-  Eigen::Vector3f transformed_coords = indexing_transformation_.transform(point.getVector3fMap());
+  // Transform the point back to the grid frame for hashing. This must match the computation
+  // performed in indexPoints_().
+  const Eigen::Vector3f coords = point.getVector3fMap();
+  Eigen::Vector3f transformed_coords;
+  for (size_t i = 0u; i < 3u; ++i) {
+    transformed_coords[i] = coords.x() * indexing_rotation_(i, 0) +
+        coords.y() * indexing_rotation_(i, 1) + coords.z() * indexing_rotation_(i, 2) +
+        indexing_translation_[i];
+  }
 
   // Ensure that the transformed point lies inside the grid.
   CHECK(min_corner_(0) <= transformed_coords.x() && transformed_coords.x() < max_corner_(0));
@@ -115,13 +116,13 @@ void DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::transform(
   // Update transforms
   pose_transformation_ = transformation * pose_transformation_;
   indexing_transformation_ = pose_transformation_.inverse();
+  indexing_rotation_ = indexing_transformation_.getRotationMatrix();
+  indexing_translation_ = indexing_transformation_.getPosition();
 
-  // Transform point clouds in-place
-  for(auto centroids : { std::ref(active_centroids_), std::ref(inactive_centroids_)}) {
-    for (auto& point : *centroids.get()) {
-      point.getVector3fMap() = transformation.transform(point.getVector3fMap());
-    }
-  }
+  // Defer the transformation of the centroids until the grid is modified or the transformation
+  // is explicitly applied.
+  pending_transformation_ = transformation * pending_transformation_;
+  has_pending_transformation_ = true;
 }
 
 template<_DVG_TEMPLATE_DECL_>
@@ -129,17 +130,90 @@ void DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::clear() {
   // Reset transformations.
   pose_transformation_.setIdentity();
   indexing_transformation_.setIdentity();
+  indexing_rotation_.setIdentity();
+  indexing_translation_.setZero();
+  pending_transformation_.setIdentity();
+  has_pending_transformation_ = false;
 
   // Clear points and voxels.
   active_centroids_->clear();
-  inactive_centroids_->clear();
+  inactive_centroids_.clear();
+  active_voxels_.clear();
+  inactive_voxels_.clear();
+  inactive_voxels_by_age_.clear();
+  inactive_ages_.clear();
   voxels_.clear();
+  tiles_.clear();
+  scans_count_ = 0u;
+  scans_timestamps_.clear();
+}
+
+template<_DVG_TEMPLATE_DECL_>
+void DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::applyPendingTransformation() {
+  if (!has_pending_transformation_) return;
+  BENCHMARK_BLOCK("SM.TransformLocalMap.ApplyDeferredTransformDVG");
+  const kindr::minimal::QuatTransformationTemplate<float>& transformation =
+      pending_transformation_;
+
+  // Transform point clouds in-place
+  BatchPointsTransformer points_transformer;
+  points_transformer.add(transformation.getTransformationMatrix(), *active_centroids_);
+  points_transformer.run();
+
+  // Inactive centroids are stored as separate coordinate arrays, transform them in vectorized
+  // blocks.
+  constexpr size_t kBlockSize = 256u;
+  typedef Eigen::Array<float, Eigen::Dynamic, 1, 0, kBlockSize, 1> FloatBlock;
+  const Eigen::Matrix3f rotation = transformation.getRotationMatrix();
+  const Eigen::Vector3f translation = transformation.getPosition();
+  std::array<FloatBlock, 3> transformed_coords;
+  for (size_t block_start = 0u; block_start < inactive_centroids_.size();
+       block_start += kBlockSize) {
+    const size_t block_size = std::min(kBlockSize, inactive_centroids_.size() - block_start);
+    std::array<Eigen::Map<Eigen::ArrayXf>, 3> coords = {{
+        Eigen::Map<Eigen::ArrayXf>(inactive_centroids_.x.data() + block_start, block_size),
+        Eigen::Map<Eigen::ArrayXf>(inactive_centroids_.y.data() + block_start, block_size),
+        Eigen::Map<Eigen::ArrayXf>(inactive_centroids_.z.data() + block_start, block_size) }};
+    for (size_t i = 0u; i < 3u; ++i) {
+      transformed_coords[i] = coords[0] * rotation(i, 0) + coords[1] * rotation(i, 1) +
+          coords[2] * rotation(i, 2) + translation[i];
+    }
+    for (size_t i = 0u; i < 3u; ++i) coords[i] = transformed_coords[i];
+  }
+
+  pending_transformation_.setIdentity();
+  has_pending_transformation_ = false;
+}
+
+template<_DVG_TEMPLATE_DECL_>
+size_t DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::getMemoryUsage() const {
+  // Each node of the hash maps stores the value and a pointer to the next node.
+  const size_t voxels_bytes = voxels_.size() * (sizeof(VoxelEntry_) + sizeof(void*)) +
+      voxels_.bucket_count() * sizeof(void*);
+  size_t tiles_bytes = tiles_.bucket_count() * sizeof(void*);
+  for (const auto& tile : tiles_) {
+    tiles_bytes += sizeof(typename Tiles_::value_type) + sizeof(void*) +
+        tile.second.capacity() * sizeof(VoxelEntry_*);
+  }
+  const size_t centroids_bytes = active_centroids_->points.capacity() * sizeof(VoxelPointT) +
+      active_voxels_.capacity() * sizeof(VoxelEntry_*) +
+      inactive_centroids_.x.capacity() * 3u * sizeof(float) +
+      inactive_voxels_.capacity() * sizeof(VoxelEntry_*) +
+      inactive_ages_.capacity() * sizeof(typename InactiveVoxelsByAge_::iterator);
+  // Each node of the age list stores the value and two pointers.
+  const size_t ages_bytes = inactive_voxels_by_age_.size() *
+      (sizeof(InactiveVoxelAge_) + 2u * sizeof(void*));
+  return voxels_bytes + tiles_bytes + centroids_bytes + ages_bytes;
 }
 
 template<_DVG_TEMPLATE_DECL_>
 void DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::dumpVoxels() const {
-  for (const Voxel_& v : voxels_) {
-    LOG(INFO) << "Voxel " << uint32_t(v.index) << ": " << v.num_points << " " <<  *(v.centroid);
+  CHECK(!has_pending_transformation_) << "The pending transformation must be applied first.";
+  for (const auto& v : voxels_) {
+    const VoxelPointT centroid = v.second.num_points >= min_points_per_voxel_ ?
+        (*active_centroids_)[v.second.centroid_index] :
+        inactive_centroids_.getPoint(v.second.centroid_index);
+    LOG(INFO) << "Voxel " << uint32_t(v.first) << ": " << v.second.num_points << " " << centroid;
   }
 }
 
@@ -151,89 +225,368 @@ template<_DVG_TEMPLATE_DECL_>
 inline typename DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::IndexedPoints_
 DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::indexAndSortPoints_(const InputCloud& points) const {
   IndexedPoints_ indexed_points;
-  indexed_points.reserve(points.size());
-  for (const auto& point : points) {
-    indexed_points.emplace_back(point, getIndexOf(point));
+  BENCHMARK_START("SM.UpdateLocalMap.AddNewPoints.InsertInDVG.IndexPoints");
+  indexPoints_(points, indexed_points);
+  BENCHMARK_STOP("SM.UpdateLocalMap.AddNewPoints.InsertInDVG.IndexPoints");
+
+  BENCHMARK_START("SM.UpdateLocalMap.AddNewPoints.InsertInDVG.SortPoints");
+  sortIndexedPoints_(indexed_points);
+  BENCHMARK_STOP("SM.UpdateLocalMap.AddNewPoints.InsertInDVG.SortPoints");
+  return indexed_points;
+}
+
+template<_DVG_TEMPLATE_DECL_>
+inline void DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::indexPoints_(
+    const InputCloud& points, IndexedPoints_& indexed_points) const {
+  constexpr int kBlockSize = 256;
+  typedef Eigen::Array<float, kBlockSize, 1> FloatBlock;
+  typedef Eigen::Array<IndexT, kBlockSize, 1> IndexBlock;
+
+  // Strides of the Y and Z coordinates in the voxel indices.
+  const IndexT stride_y = n_voxels_x;
+  const IndexT stride_z = n_voxels_x * n_voxels_y;
+
+  indexed_points.resize(points.size());
+  std::array<FloatBlock, 3> coords;
+  std::array<FloatBlock, 3> transformed_coords;
+  IndexBlock voxel_indices;
+
+  for (size_t block_start = 0u; block_start < points.size(); block_start += kBlockSize) {
+    // Gather the coordinates of the block. The last block is padded with copies of its first
+    // point so that vectorized operations don't need to handle partial blocks.
+    const size_t block_size = std::min<size_t>(kBlockSize, points.size() - block_start);
+    for (size_t i = 0u; i < kBlockSize; ++i) {
+      const InputPointT& point = points[block_start + (i < block_size ? i : 0u)];
+      coords[0][i] = point.x;
+      coords[1][i] = point.y;
+      coords[2][i] = point.z;
+    }
+
+    // Transform the points back to the grid frame and ensure that they lie inside the grid.
+    for (size_t i = 0u; i < 3u; ++i) {
+      transformed_coords[i] = coords[0] * indexing_rotation_(i, 0) +
+          coords[1] * indexing_rotation_(i, 1) + coords[2] * indexing_rotation_(i, 2) +
+          indexing_translation_[i];
+      CHECK((transformed_coords[i] >= min_corner_(i)).all() &&
+            (transformed_coords[i] < max_corner_(i)).all());
+    }
+
+    // Compute the voxel indices of the points.
+    voxel_indices =
+        ((transformed_coords[0] + indexing_offset_[0]) * world_to_grid_).template cast<IndexT>() +
+        ((transformed_coords[1] + indexing_offset_[1]) * world_to_grid_).template cast<IndexT>() *
+        stride_y +
+        ((transformed_coords[2] + indexing_offset_[2]) * world_to_grid_).template cast<IndexT>() *
+        stride_z;
+
+    for (size_t i = 0u; i < block_size; ++i) {
+      indexed_points[block_start + i].voxel_index = voxel_indices[i];
+      indexed_points[block_start + i].point_index = block_start + i;
+    }
+  }
+}
+
+template<_DVG_TEMPLATE_DECL_>
+inline void DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::sortIndexedPoints_(
+    IndexedPoints_& indexed_points) {
+  constexpr size_t kMinPointsForRadixSort = 4096u;
+  constexpr size_t kMinPointsPerThread = 32768u;
+  constexpr size_t kNumBuckets = size_t(1u) << n_radix_bits;
+  constexpr IndexT kBucketMask = IndexT(kNumBuckets - 1u);
+  typedef std::array<size_t, kNumBuckets> Histogram;
+
+  const size_t num_points = indexed_points.size();
+  if (!use_radix_sort || num_points < kMinPointsForRadixSort) {
+    std::sort(indexed_points.begin(), indexed_points.end(),
+              [](const IndexedPoint_& a, const IndexedPoint_& b) {
+      return a.voxel_index < b.voxel_index;
+    });
+    return;
   }
 
-  auto predicate = [](const IndexedPoint_& a, const IndexedPoint_& b) {
-    return a.voxel_index < b.voxel_index;
+  // Split the points in contiguous chunks, one per thread. The same threads run all the passes
+  // and synchronize on a barrier after counting and after scattering the points.
+  const size_t num_threads = std::max<size_t>(1u, std::min<size_t>(
+      std::thread::hardware_concurrency(), num_points / kMinPointsPerThread));
+  const size_t chunk_size = (num_points + num_threads - 1u) / num_threads;
+  std::mutex mutex;
+  std::condition_variable condition;
+  size_t num_waiting_threads = 0u;
+  size_t barrier_generation = 0u;
+  auto wait_for_all_threads = [&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    const size_t generation = barrier_generation;
+    if (++num_waiting_threads == num_threads) {
+      num_waiting_threads = 0u;
+      ++barrier_generation;
+      condition.notify_all();
+    } else {
+      condition.wait(lock, [&]() { return barrier_generation != generation; });
+    }
   };
-  std::sort(indexed_points.begin(), indexed_points.end(), predicate);
 
-  return indexed_points;
+  IndexedPoints_ buffer(num_points);
+  std::vector<Histogram> histograms(num_threads);
+  size_t num_scatters = 0u;
+  auto sort_chunk = [&](const size_t t) {
+    const size_t begin = std::min(num_points, t * chunk_size);
+    const size_t end = std::min(num_points, (t + 1u) * chunk_size);
+    IndexedPoints_* source = &indexed_points;
+    IndexedPoints_* destination = &buffer;
+    for (uint8_t pass = 0u; pass < n_radix_passes; ++pass) {
+      const uint8_t shift = pass * n_radix_bits;
+
+      // Count the occurrences of each digit in the chunk.
+      Histogram& histogram = histograms[t];
+      histogram.fill(0u);
+      for (size_t i = begin; i < end; ++i) {
+        ++histogram[((*source)[i].voxel_index >> shift) & kBucketMask];
+      }
+      wait_for_all_threads();
+
+      // Convert the counts to the write offsets of the chunk. Skip the pass if all the points
+      // share the same digit, which is the case for the most significant bits of points close to
+      // each other.
+      bool is_pass_needed = true;
+      Histogram offsets;
+      size_t offset = 0u;
+      for (size_t bucket = 0u; bucket < kNumBuckets; ++bucket) {
+        const size_t bucket_begin = offset;
+        for (size_t other_t = 0u; other_t < num_threads; ++other_t) {
+          if (other_t == t) offsets[bucket] = offset;
+          offset += histograms[other_t][bucket];
+        }
+        if (offset - bucket_begin == num_points) is_pass_needed = false;
+      }
+
+      // Scatter the points. Chunks are processed in order, thus the sort is stable.
+      if (is_pass_needed) {
+        for (size_t i = begin; i < end; ++i) {
+          (*destination)[offsets[((*source)[i].voxel_index >> shift) & kBucketMask]++] =
+              (*source)[i];
+        }
+        std::swap(source, destination);
+        if (t == 0u) ++num_scatters;
+      }
+      wait_for_all_threads();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1u);
+  for (size_t t = 1u; t < num_threads; ++t) threads.emplace_back(sort_chunk, t);
+  sort_chunk(0u);
+  for (auto& thread : threads) thread.join();
+  if (num_scatters % 2u == 1u) indexed_points.swap(buffer);
 }
 
 template<_DVG_TEMPLATE_DECL_>
-inline bool DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::createVoxel_(
-    const IndexT index, const VoxelData_& data,
-    std::vector<Voxel_>& new_voxels, VoxelCloud& new_active_centroids,
-    VoxelCloud& new_inactive_centroids) {
+inline bool DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::updateVoxel_(
+    VoxelEntry_& voxel_entry, const InputCloud& points,
+    typename IndexedPoints_::const_iterator points_begin,
+    typename IndexedPoints_::const_iterator points_end) {
+  Voxel_& voxel = voxel_entry.second;
   VoxelPointT centroid;
   auto centroid_map = centroid.getVector3fMap();
-  uint32_t old_points_count = 0u;
-  uint32_t new_points_count = std::distance(data.points_begin, data.points_end);
+  const uint32_t old_points_count = voxel.num_points;
+  const uint32_t new_points_count = std::distance(points_begin, points_end);
+  const uint32_t total_points_count = old_points_count + new_points_count;
+  const bool was_active = old_points_count >= min_points_per_voxel_;
+  const bool is_active = total_points_count >= min_points_per_voxel_;
 
   // Add contribution from the existing voxel.
-  if (data.old_voxel != nullptr) {
-    centroid = *(data.old_voxel->centroid);
-    old_points_count = data.old_voxel->num_points;
-    if (new_points_count != 0u) {
-      centroid_map *= static_cast<float>(old_points_count);
-    }
+  if (old_points_count != 0u) {
+    centroid = was_active ? (*active_centroids_)[voxel.centroid_index] :
+        inactive_centroids_.getPoint(voxel.centroid_index);
+    centroid_map *= static_cast<float>(old_points_count);
   }
-  uint32_t total_points_count = old_points_count + new_points_count;
 
   // Add contribution from the new points.
-  if (new_points_count != 0u) {
-    for (auto it = data.points_begin; it != data.points_end; ++it) {
-      centroid_map += it->point.getVector3fMap();
+  for (auto it = points_begin; it != points_end; ++it) {
+    centroid_map += points[it->point_index].getVector3fMap();
+  }
+  centroid_map /= static_cast<float>(total_points_count);
+  voxel.num_points = total_points_count;
+
+  // Update the centroid in place if the voxel doesn't change state.
+  if (old_points_count != 0u && was_active == is_active) {
+    if (is_active) {
+      (*active_centroids_)[voxel.centroid_index] = centroid;
+    } else {
+      inactive_centroids_.setPoint(voxel.centroid_index, centroid);
+      const auto age_it = inactive_ages_[voxel.centroid_index];
+      age_it->last_hit = scans_count_;
+      inactive_voxels_by_age_.splice(inactive_voxels_by_age_.end(), inactive_voxels_by_age_,
+                                     age_it);
     }
-    centroid_map /= static_cast<float>(total_points_count);
+    return false;
   }
 
-  // Save centroid to the correct point cloud.
-  VoxelPointT* centroid_pointer;
-  bool is_new_voxel = false;
-  if (total_points_count >= min_points_per_voxel_) {
-    new_active_centroids.push_back(centroid);
-    centroid_pointer = &new_active_centroids.back();
-    is_new_voxel = (old_points_count < min_points_per_voxel_);
+  // Otherwise move the centroid to the end of the correct point cloud.
+  if (old_points_count != 0u) removeInactiveCentroid_(voxel.centroid_index);
+  if (is_active) {
+    voxel.centroid_index = active_centroids_->size();
+    active_centroids_->push_back(centroid);
+    active_voxels_.push_back(&voxel_entry);
   } else {
-    new_inactive_centroids.push_back(centroid);
-    centroid_pointer = &new_inactive_centroids.back();
+    addInactiveCentroid_(voxel_entry, centroid);
+  }
+  return is_active;
+}
+
+template<_DVG_TEMPLATE_DECL_>
+inline size_t DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::evictInactiveVoxels_(
+    const int64_t timestamp_ns) {
+  BENCHMARK_BLOCK("SM.UpdateLocalMap.AddNewPoints.InsertInDVG.EvictVoxels");
+
+  // Inactive voxels last hit before this insertion are too old.
+  uint32_t min_last_hit = 0u;
+  if (eviction_params_.max_inactive_age_scans != 0u &&
+      scans_count_ >= eviction_params_.max_inactive_age_scans) {
+    min_last_hit = scans_count_ - eviction_params_.max_inactive_age_scans + 1u;
+  }
+  if (eviction_params_.max_inactive_age_ns != 0) {
+    // Keep track of the insertions performed during the maximum age.
+    scans_timestamps_.emplace_back(scans_count_, timestamp_ns);
+    while (scans_timestamps_.front().second + eviction_params_.max_inactive_age_ns <
+           timestamp_ns) {
+      scans_timestamps_.pop_front();
+    }
+    min_last_hit = std::max(min_last_hit, scans_timestamps_.front().first);
+  }
+
+  // Evict the voxels that are too old. They are at the front of the age list.
+  std::vector<size_t> evicted_centroid_indices;
+  auto age_it = inactive_voxels_by_age_.cbegin();
+  while (age_it != inactive_voxels_by_age_.cend() && age_it->last_hit < min_last_hit) {
+    evicted_centroid_indices.push_back(age_it->voxel_entry->second.centroid_index);
+    ++age_it;
+  }
+  const size_t num_evicted_by_age = evicted_centroid_indices.size();
+
+  // If the grid is still too big, evict the next least recently hit voxels.
+  size_t num_evicted_by_size = 0u;
+  const size_t num_remaining_voxels = voxels_.size() - num_evicted_by_age;
+  if (eviction_params_.max_voxels != 0u && num_remaining_voxels > eviction_params_.max_voxels) {
+    const size_t num_excess_voxels = num_remaining_voxels - eviction_params_.max_voxels;
+    while (age_it != inactive_voxels_by_age_.cend() && num_evicted_by_size < num_excess_voxels) {
+      evicted_centroid_indices.push_back(age_it->voxel_entry->second.centroid_index);
+      ++age_it;
+      ++num_evicted_by_size;
+    }
   }
 
-  new_voxels.emplace_back(centroid_pointer, index, total_points_count);
-  return is_new_voxel;
+  removeInactiveVoxels_(evicted_centroid_indices);
+
+  BENCHMARK_RECORD_VALUE("SM.UpdateLocalMap.AddNewPoints.EvictedVoxelsByAge", num_evicted_by_age);
+  BENCHMARK_RECORD_VALUE("SM.UpdateLocalMap.AddNewPoints.EvictedVoxelsBySize",
+                         num_evicted_by_size);
+  return num_evicted_by_age + num_evicted_by_size;
 }
 
 template<_DVG_TEMPLATE_DECL_>
-inline std::vector<bool> DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::removeCentroids_(
-    VoxelCloud& target_cloud, std::vector<VoxelPointT*> to_remove) {
-  std::vector<bool> is_removed(target_cloud.size(), false);
-  if (to_remove.empty()) return is_removed;
+inline void DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::removeInactiveVoxels_(
+    std::vector<size_t>& centroid_indices) {
+  if (centroid_indices.empty()) return;
+
+  // Remove the centroids starting from the back, so that swapping a centroid with the last one
+  // never moves a centroid that still has to be removed. Voxels are marked by clearing their
+  // number of points, which is never zero for voxels in the grid.
+  std::sort(centroid_indices.begin(), centroid_indices.end(), std::greater<size_t>());
+  std::vector<IndexT> voxel_indices;
+  std::vector<IndexT> tile_indices;
+  voxel_indices.reserve(centroid_indices.size());
+  tile_indices.reserve(centroid_indices.size());
+  for (const size_t centroid_index : centroid_indices) {
+    VoxelEntry_* voxel_entry = inactive_voxels_[centroid_index];
+    voxel_entry->second.num_points = 0u;
+    voxel_indices.push_back(voxel_entry->first);
+    tile_indices.push_back(getTileIndexOf_(voxel_entry->first));
+    removeInactiveCentroid_(centroid_index);
+  }
 
-  size_t next_removal_index = 0u;
-  size_t centroid_index = 0u;
+  // Remove the marked voxels from their tiles, then erase them.
+  std::sort(tile_indices.begin(), tile_indices.end());
+  tile_indices.erase(std::unique(tile_indices.begin(), tile_indices.end()), tile_indices.end());
+  for (const IndexT tile_index : tile_indices) {
+    auto tile_it = tiles_.find(tile_index);
+    std::vector<VoxelEntry_*>& tile_voxels = tile_it->second;
+    tile_voxels.erase(std::remove_if(tile_voxels.begin(), tile_voxels.end(),
+                                     [](const VoxelEntry_* voxel_entry) {
+      return voxel_entry->second.num_points == 0u;
+    }), tile_voxels.end());
+    if (tile_voxels.empty()) tiles_.erase(tile_it);
+  }
+  for (const IndexT voxel_index : voxel_indices) voxels_.erase(voxel_index);
+}
 
-  // Push one more element so that we don't read past the end of the vector.
-  to_remove.push_back((VoxelPointT*)0);
+template<_DVG_TEMPLATE_DECL_>
+inline void DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::addInactiveCentroid_(
+    VoxelEntry_& voxel_entry, const VoxelPointT& centroid) {
+  voxel_entry.second.centroid_index = inactive_centroids_.size();
+  inactive_centroids_.push_back(centroid);
+  inactive_voxels_.push_back(&voxel_entry);
+  inactive_ages_.push_back(inactive_voxels_by_age_.insert(
+      inactive_voxels_by_age_.end(), InactiveVoxelAge_{ scans_count_, &voxel_entry }));
+}
 
-  // Remove the required centroids and keep track of their indices.
-  auto new_end = std::remove_if(target_cloud.begin(), target_cloud.end(),
-    [&](VoxelPointT & p){
-      const bool remove_p = (&p == to_remove[next_removal_index]);
-      if(remove_p) {
-        is_removed[centroid_index] = true;
-        ++next_removal_index;
-      }
-      ++centroid_index;
-      return remove_p;
-  });
-  target_cloud.erase(new_end, target_cloud.end());
+template<_DVG_TEMPLATE_DECL_>
+inline void DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::removeInactiveCentroid_(
+    const size_t centroid_index) {
+  inactive_voxels_by_age_.erase(inactive_ages_[centroid_index]);
+
+  // The order of the inactive centroids is not relevant, fill the gap with the last centroid.
+  const size_t last_index = inactive_centroids_.size() - 1u;
+  if (centroid_index != last_index) {
+    copyCentroid_(inactive_centroids_, last_index, centroid_index);
+    inactive_voxels_[centroid_index] = inactive_voxels_[last_index];
+    inactive_voxels_[centroid_index]->second.centroid_index = centroid_index;
+    inactive_ages_[centroid_index] = inactive_ages_[last_index];
+  }
+  inactive_centroids_.resize(last_index);
+  inactive_voxels_.pop_back();
+  inactive_ages_.pop_back();
+}
 
-  return is_removed;
+template<_DVG_TEMPLATE_DECL_>
+inline void DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::copyCentroid_(
+    VoxelCloud& centroids, const size_t from_index, const size_t to_index) {
+  centroids[to_index] = centroids[from_index];
+}
+
+template<_DVG_TEMPLATE_DECL_>
+inline void DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::copyCentroid_(
+    CentroidsCoordinates& centroids, const size_t from_index, const size_t to_index) {
+  centroids.x[to_index] = centroids.x[from_index];
+  centroids.y[to_index] = centroids.y[from_index];
+  centroids.z[to_index] = centroids.z[from_index];
+}
+
+template<_DVG_TEMPLATE_DECL_>
+inline IndexT DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::getTileIndexOf_(
+    const IndexT voxel_index) const {
+  const IndexT x = voxel_index & (n_voxels_x - 1u);
+  const IndexT y = (voxel_index >> bits_x) & (n_voxels_y - 1u);
+  const IndexT z = voxel_index >> (bits_x + bits_y);
+  return (x >> tile_bits) + ((y >> tile_bits) << bits_x) + ((z >> tile_bits) << (bits_x + bits_y));
+}
+
+template<_DVG_TEMPLATE_DECL_>
+inline void DynamicVoxelGrid<_DVG_TEMPLATE_SPEC_>::getTileBoundingSphere_(
+    const IndexT tile_index, Eigen::Vector3f& center, float& radius) const {
+  constexpr float kTileSize = static_cast<float>(1u << tile_bits);
+
+  // Center of the tile in grid coordinates.
+  const Eigen::Vector3f tile_coords(
+      static_cast<float>(tile_index & (n_voxels_x - 1u)),
+      static_cast<float>((tile_index >> bits_x) & (n_voxels_y - 1u)),
+      static_cast<float>(tile_index >> (bits_x + bits_y)));
+  const Eigen::Vector3f grid_coords = (tile_coords.array() + 0.5f) * kTileSize;
+
+  // Transform the center to world coordinates. The radius is slightly enlarged in order to
+  // account for rounding errors.
+  center = pose_transformation_.transform(grid_coords * resolution_ - indexing_offset_);
+  radius = 0.5f * std::sqrt(3.0f) * kTileSize * resolution_ * 1.01f;
 }
 
 } // namespace segmatch
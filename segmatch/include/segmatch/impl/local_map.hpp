@@ -7,8 +7,14 @@
 
 #include "segmatch/common.hpp"
 #include "segmatch/dynamic_voxel_grid.hpp"
+#include "segmatch/points_neighbors_providers/incremental_kdtree_points_neighbors_provider.hpp"
 #include "segmatch/points_neighbors_providers/kdtree_points_neighbors_provider.hpp"
 #include "segmatch/points_neighbors_providers/octree_points_neighbors_provider.hpp"
+#include "segmatch/points_neighbors_providers/voxel_hash_points_neighbors_provider.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 #include <opencv2/opencv.hpp>
 
@@ -24,12 +30,28 @@ extern template class LocalMap<PclPoint, MapPoint>;
 template<typename InputPointT, typename ClusteredPointT>
 LocalMap<InputPointT, ClusteredPointT>::LocalMap(
     const LocalMapParameters& params, std::unique_ptr<NormalEstimator> normal_estimator)
-  : voxel_grid_(params.voxel_size_m, params.min_points_per_voxel)
+  : voxel_grid_(new VoxelGrid(params.voxel_size_m, params.min_points_per_voxel))
   , radius_squared_m2_(pow(params.radius_m, 2.0))
   , min_vertical_distance_m_(params.min_vertical_distance_m)
   , max_vertical_distance_m_(params.max_vertical_distance_m)
+  , remove_ground_(params.remove_ground)
+  , ground_cell_size_m_(params.ground_cell_size_m)
+  , ground_max_height_m_(params.ground_max_height_m)
+  , ground_max_height_above_robot_m_(params.ground_max_height_above_robot_m)
   , normal_estimator_(std::move(normal_estimator)) {
 
+  // Configure the eviction of the inactive voxels.
+  CHECK_GE(params.inactive_voxels_max_age_scans, 0);
+  CHECK_GE(params.inactive_voxels_max_age_s, 0.0f);
+  CHECK_GE(params.max_voxels, 0);
+  typename VoxelGrid::EvictionParameters eviction_params;
+  eviction_params.max_inactive_age_scans = params.inactive_voxels_max_age_scans;
+  eviction_params.max_inactive_age_ns =
+      static_cast<int64_t>(static_cast<double>(params.inactive_voxels_max_age_s) * 1e9);
+  eviction_params.max_voxels = params.max_voxels;
+  voxel_grid_->setEvictionParameters(eviction_params);
+  if (remove_ground_) CHECK_GT(ground_cell_size_m_, 0.0f);
+
   // Create the points neighbors provider.
   if (params.neighbors_provider_type == "KdTree") {
     points_neighbors_provider_ = std::unique_ptr<PointsNeighborsProvider<ClusteredPointT>>(
@@ -37,6 +59,12 @@ LocalMap<InputPointT, ClusteredPointT>::LocalMap(
   } else if (params.neighbors_provider_type == "Octree") {
     points_neighbors_provider_ = std::unique_ptr<PointsNeighborsProvider<ClusteredPointT>>(
         new OctreePointsNeighborsProvider<ClusteredPointT>(params.voxel_size_m));
+  } else if (params.neighbors_provider_type == "IncrementalKdTree") {
+    points_neighbors_provider_ = std::unique_ptr<PointsNeighborsProvider<ClusteredPointT>>(
+        new IncrementalKdTreePointsNeighborsProvider<ClusteredPointT>());
+  } else if (params.neighbors_provider_type == "VoxelHash") {
+    points_neighbors_provider_ = std::unique_ptr<PointsNeighborsProvider<ClusteredPointT>>(
+        new VoxelHashPointsNeighborsProvider<InputPointT, ClusteredPointT>(*voxel_grid_));
   } else {
     LOG(ERROR) << "Invalid points neighbors provider type specified: "
         << params.neighbors_provider_type;
@@ -52,20 +80,68 @@ void LocalMap<InputPointT, ClusteredPointT>::updatePoseAndAddPoints(
     const laser_slam::Pose& pose) {
   BENCHMARK_BLOCK("SM.UpdateLocalMap");
 
+  applyPendingTransformations();
   std::vector<bool> is_point_removed = updatePose(pose);
-  std::vector<int> created_points_indices = addPointsAndGetCreatedVoxels(new_clouds);
+  std::vector<int> created_points_indices =
+      addPointsAndGetCreatedVoxels(new_clouds, pose.time_ns);
   std::vector<int> points_mapping = buildPointsMapping(is_point_removed, created_points_indices);
 
-  // Update the points neighbors provider.
+  // If required, flag the ground points so that they are not segmented. The ground points are
+  // not indexed by the points neighbors provider and are not used for estimating the normals,
+  // thus they must be detected first.
+  std::vector<bool> is_point_ground;
+  std::vector<int> new_ground_points_indices;
+  std::vector<int> former_ground_points_indices;
+  if (remove_ground_) {
+    detectGround(pose, points_mapping, created_points_indices, is_point_ground,
+                 new_ground_points_indices, former_ground_points_indices);
+  }
+
+  // Update the points neighbors provider. If the points have been moved, the mapping is not
+  // provided and the provider is rebuilt.
   BENCHMARK_START("SM.UpdateLocalMap.UpdatePointsNeighborsProvider");
-  getPointsNeighborsProvider().update(getFilteredPointsPtr(), {});
+  if (are_points_moved_) {
+    getPointsNeighborsProvider().update(getFilteredPointsPtr(), {}, is_point_ground);
+    are_points_moved_ = false;
+  } else {
+    getPointsNeighborsProvider().update(
+        getFilteredPointsPtr(), std::vector<int64_t>(points_mapping.begin(), points_mapping.end()),
+        is_point_ground);
+  }
   BENCHMARK_STOP("SM.UpdateLocalMap.UpdatePointsNeighborsProvider");
 
   // If required, update the normals.
   if (normal_estimator_ != nullptr) {
     BENCHMARK_BLOCK("SM.UpdateLocalMap.EstimateNormals");
-    is_normal_modified_since_last_update_ = normal_estimator_->updateNormals(
-        getFilteredPoints(), points_mapping, created_points_indices, getPointsNeighborsProvider());
+    if (remove_ground_) {
+      // Only the points that are not ground contribute to the normals. The contributions of the
+      // points that became ground are removed. The points that are not ground anymore are
+      // estimated from scratch and contribute again, as if they were removed and created again.
+      if (!new_ground_points_indices.empty())
+        normal_estimator_->notifyPointsExcluded(new_ground_points_indices);
+      std::vector<int> new_points_indices;
+      new_points_indices.reserve(created_points_indices.size() +
+                                 former_ground_points_indices.size());
+      for (const int point_index : created_points_indices) {
+        if (!is_point_ground[point_index]) new_points_indices.push_back(point_index);
+      }
+      if (!former_ground_points_indices.empty()) {
+        std::vector<bool> is_former_ground_point(is_point_ground.size(), false);
+        for (const int point_index : former_ground_points_indices) {
+          is_former_ground_point[point_index] = true;
+          new_points_indices.push_back(point_index);
+        }
+        for (int& new_point_index : points_mapping) {
+          if (new_point_index >= 0 && is_former_ground_point[new_point_index]) new_point_index = -1;
+        }
+      }
+      is_normal_modified_since_last_update_ = normal_estimator_->updateNormals(
+          getFilteredPoints(), points_mapping, new_points_indices, getPointsNeighborsProvider());
+    } else {
+      is_normal_modified_since_last_update_ = normal_estimator_->updateNormals(
+          getFilteredPoints(), points_mapping, created_points_indices,
+          getPointsNeighborsProvider());
+    }
   } else {
     is_normal_modified_since_last_update_ = std::vector<bool>(getFilteredPoints().size(), false);
   }
@@ -125,20 +201,34 @@ std::vector<bool> LocalMap<InputPointT, ClusteredPointT>::updatePose(const laser
   position.y = pose.T_w.getPosition()[1];
   position.z = pose.T_w.getPosition()[2];
 
+  // Only regions of the map crossing the boundary of the cylinder can contain points to be
+  // removed.
+  const float radius_m = std::sqrt(radius_squared_m2_);
+  auto may_remove_region = [&](const Eigen::Vector3f& center, const float radius) {
+    const float distance_xy = std::sqrt(std::pow(center.x() - position.x, 2.0f) +
+                                        std::pow(center.y() - position.y, 2.0f));
+    const float distance_z = center.z() - position.z;
+    return distance_xy + radius > radius_m
+        || distance_z - radius < min_vertical_distance_m_
+        || distance_z + radius > max_vertical_distance_m_;
+  };
+
   // Remove points according to a cylindrical filter predicate.
-  std::vector<bool> is_point_removed = voxel_grid_.removeIf([&](const ClusteredPointT& p) {
+  std::vector<bool> is_point_removed = voxel_grid_->removeIf([&](const ClusteredPointT& p) {
     float distance_xy_squared = pow(p.x - position.x, 2.0) + pow(p.y - position.y, 2.0);
     bool remove = distance_xy_squared > radius_squared_m2_
         || p.z - position.z < min_vertical_distance_m_
         || p.z - position.z > max_vertical_distance_m_;
     // TODO: Once we start supporting multiple segmenters working on the same cloud, we will need
     // one \c segment_ids_ vector per segmenter.
-    if (remove && p.ed_cluster_id != 0u)
+    if (remove && p.ed_cluster_id != 0u && p.ed_cluster_id != kGroundClusterId)
       segment_ids_[p.ed_cluster_id] = kInvId;
-    if (remove && p.sc_cluster_id != 0u)
+    if (remove && p.sc_cluster_id != 0u && p.sc_cluster_id != kGroundClusterId)
       segment_ids_[p.sc_cluster_id] = kInvId;
+    // The ground of the cells losing points must be detected again.
+    if (remove && remove_ground_) modified_ground_cells_.push_back(getGroundCellKey(p));
     return remove;
-  });
+  }, may_remove_region);
 
   std::vector<laser_slam_ros::VisualView> valid_vis_views;
   for(const auto &view : vis_views_){
@@ -162,7 +252,7 @@ std::vector<bool> LocalMap<InputPointT, ClusteredPointT>::updatePose(const laser
 
 template<typename InputPointT, typename ClusteredPointT>
 std::vector<int> LocalMap<InputPointT, ClusteredPointT>::addPointsAndGetCreatedVoxels(
-    const std::vector<InputCloud>& new_clouds) {
+    const std::vector<InputCloud>& new_clouds, const laser_slam::Time time_ns) {
   BENCHMARK_BLOCK("SM.UpdateLocalMap.AddNewPoints");
 
   // Reserve space for the new cloud.
@@ -173,14 +263,16 @@ std::vector<int> LocalMap<InputPointT, ClusteredPointT>::addPointsAndGetCreatedV
 
   // Accumulate clouds and insert them in the voxel grid.
   for (const auto& cloud : new_clouds) merged_cloud += cloud;
-  std::vector<int> created_points_indices = voxel_grid_.insert(merged_cloud);
+  std::vector<int> created_points_indices = voxel_grid_->insert(merged_cloud, time_ns);
 
   // Record local map metrics.
   BENCHMARK_RECORD_VALUE("SM.UpdateLocalMap.InsertedPoints", merged_cloud.size());
   BENCHMARK_RECORD_VALUE("SM.UpdateLocalMap.CreatedVoxels", created_points_indices.size());
   BENCHMARK_RECORD_VALUE("SM.UpdateLocalMap.ActiveVoxels", getFilteredPoints().size());
   BENCHMARK_RECORD_VALUE("SM.UpdateLocalMap.InactiveVoxels",
-                         voxel_grid_.getInactiveCentroids().size());
+                         voxel_grid_->getInactiveCentroids().size());
+  BENCHMARK_RECORD_VALUE("SM.UpdateLocalMap.ResidentMemoryBytes",
+                         voxel_grid_->getMemoryUsage());
 
   return created_points_indices;
 }
@@ -213,21 +305,134 @@ std::vector<int> LocalMap<InputPointT, ClusteredPointT>::buildPointsMapping(
   return mapping;
 }
 
+template<typename InputPointT, typename ClusteredPointT>
+void LocalMap<InputPointT, ClusteredPointT>::detectGround(
+    const laser_slam::Pose& pose, const std::vector<int>& points_mapping,
+    const std::vector<int>& created_points_indices, std::vector<bool>& is_point_ground,
+    std::vector<int>& new_ground_points_indices, std::vector<int>& former_ground_points_indices) {
+  BENCHMARK_BLOCK("SM.UpdateLocalMap.DetectGround");
+  ClusteredCloud& points = getFilteredPoints();
+  std::vector<bool> is_point_created(points.size(), false);
+  for (const int point_index : created_points_indices) is_point_created[point_index] = true;
+
+  // Find the cells whose points changed. If the points have been moved, they are assigned to the
+  // cells from scratch.
+  std::vector<uint64_t> cells_to_update;
+  if (are_points_moved_) {
+    ground_cells_.clear();
+    for (size_t i = 0u; i < points.size(); ++i) {
+      ground_cells_[getGroundCellKey(points[i])].push_back(i);
+    }
+    cells_to_update.reserve(ground_cells_.size());
+    for (const auto& cell : ground_cells_) cells_to_update.push_back(cell.first);
+  } else {
+    // Move the points of the cells to their new indices, dropping the removed ones, and add the
+    // created points.
+    for (auto& cell : ground_cells_) {
+      std::vector<int>& cell_points = cell.second;
+      size_t num_kept_points = 0u;
+      for (const int point_index : cell_points) {
+        if (points_mapping[point_index] >= 0)
+          cell_points[num_kept_points++] = points_mapping[point_index];
+      }
+      cell_points.resize(num_kept_points);
+    }
+    cells_to_update.swap(modified_ground_cells_);
+    for (const int point_index : created_points_indices) {
+      const uint64_t cell_key = getGroundCellKey(points[point_index]);
+      ground_cells_[cell_key].push_back(point_index);
+      cells_to_update.push_back(cell_key);
+    }
+    std::sort(cells_to_update.begin(), cells_to_update.end());
+    cells_to_update.erase(std::unique(cells_to_update.begin(), cells_to_update.end()),
+                          cells_to_update.end());
+  }
+  modified_ground_cells_.clear();
+
+  // Points close to the lowest point of their cell are ground, provided that the cell is not
+  // higher than the robot. Points that are not ground anymore become new points for the
+  // segmenter. Both the old points becoming ground and the points that are not ground anymore
+  // are reported, so that their contributions to the normals can be updated.
+  const float robot_z = pose.T_w.getPosition()[2];
+  for (const uint64_t cell_key : cells_to_update) {
+    const auto cell_it = ground_cells_.find(cell_key);
+    if (cell_it == ground_cells_.end()) continue;
+    const std::vector<int>& cell_points = cell_it->second;
+    if (cell_points.empty()) {
+      ground_cells_.erase(cell_it);
+      continue;
+    }
+
+    float min_z = std::numeric_limits<float>::infinity();
+    for (const int point_index : cell_points) min_z = std::min(min_z, points[point_index].z);
+    const bool can_contain_ground = min_z - robot_z <= ground_max_height_above_robot_m_;
+    for (const int point_index : cell_points) {
+      ClusteredPointT& p = points[point_index];
+      if (can_contain_ground && p.z - min_z <= ground_max_height_m_) {
+        if (p.sc_cluster_id != kGroundClusterId && !is_point_created[point_index])
+          new_ground_points_indices.push_back(point_index);
+        p.ed_cluster_id = kGroundClusterId;
+        p.sc_cluster_id = kGroundClusterId;
+      } else if (p.ed_cluster_id == kGroundClusterId || p.sc_cluster_id == kGroundClusterId) {
+        if (p.ed_cluster_id == kGroundClusterId) p.ed_cluster_id = 0u;
+        if (p.sc_cluster_id == kGroundClusterId) p.sc_cluster_id = 0u;
+        former_ground_points_indices.push_back(point_index);
+      }
+    }
+  }
+
+  is_point_ground.resize(points.size());
+  size_t num_ground_points = 0u;
+  for (size_t i = 0u; i < points.size(); ++i) {
+    is_point_ground[i] = points[i].sc_cluster_id == kGroundClusterId;
+    if (is_point_ground[i]) ++num_ground_points;
+  }
+
+  BENCHMARK_RECORD_VALUE("SM.UpdateLocalMap.UpdatedGroundCells", cells_to_update.size());
+  BENCHMARK_RECORD_VALUE("SM.UpdateLocalMap.GroundVoxels", num_ground_points);
+}
+
+template<typename InputPointT, typename ClusteredPointT>
+inline uint64_t LocalMap<InputPointT, ClusteredPointT>::getGroundCellKey(
+    const ClusteredPointT& point) const {
+  // The coordinates of the cell are stored in the two halves of the key.
+  const int32_t x = static_cast<int32_t>(std::floor(point.x / ground_cell_size_m_));
+  const int32_t y = static_cast<int32_t>(std::floor(point.y / ground_cell_size_m_));
+  return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32u) | static_cast<uint32_t>(y);
+}
+
 template<typename InputPointT, typename ClusteredPointT>
 void LocalMap<InputPointT, ClusteredPointT>::transform(
     const kindr::minimal::QuatTransformationTemplate<float>& transformation) {
   BENCHMARK_BLOCK("SM.TransformLocalMap");
-  voxel_grid_.transform(transformation);
+  voxel_grid_->transform(transformation);
+  are_points_moved_ = true;
 
+  // The normal estimator is notified with the next update.
   if (normal_estimator_ != nullptr) {
-    BENCHMARK_BLOCK("SM.TransformLocalMap.TransformNormals");
-    normal_estimator_->notifyPointsTransformed(transformation);
+    pending_normals_transformation_ = transformation * pending_normals_transformation_;
+    has_pending_normals_transformation_ = true;
   }
 }
 
+template<typename InputPointT, typename ClusteredPointT>
+void LocalMap<InputPointT, ClusteredPointT>::applyPendingTransformations() {
+  voxel_grid_->applyPendingTransformation();
+  if (!has_pending_normals_transformation_) return;
+  BENCHMARK_BLOCK("SM.TransformLocalMap.TransformNormals");
+  normal_estimator_->notifyPointsTransformed(pending_normals_transformation_);
+  pending_normals_transformation_.setIdentity();
+  has_pending_normals_transformation_ = false;
+}
+
 template<typename InputPointT, typename ClusteredPointT>
 void LocalMap<InputPointT, ClusteredPointT>::clear() {
-  voxel_grid_.clear();
+  voxel_grid_->clear();
+  ground_cells_.clear();
+  modified_ground_cells_.clear();
+  are_points_moved_ = true;
+  pending_normals_transformation_.setIdentity();
+  has_pending_normals_transformation_ = false;
   if (normal_estimator_ != nullptr)
     normal_estimator_->clear();
 }
@@ -1,6 +1,10 @@
 #ifndef SEGMATCH_LOCAL_MAP_HPP_
 #define SEGMATCH_LOCAL_MAP_HPP_
 
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
 #include <laser_slam/common.hpp>
 #include <laser_slam_ros/visual_view.hpp>
 #include <pcl/filters/voxel_grid.h>
@@ -27,8 +31,30 @@ struct LocalMapParameters {
   float min_vertical_distance_m;
   /// \brief Maximum vertical distance between a point and the robot.
   float max_vertical_distance_m;
-  /// \brief Type of the method used for querying nearest neighbors information.
+  /// \brief Type of the method used for querying nearest neighbors information: "KdTree",
+  /// "Octree", "IncrementalKdTree" or "VoxelHash". See VoxelHashPointsNeighborsProvider for when
+  /// the voxel hash is faster than the k-d trees.
   std::string neighbors_provider_type;
+  /// \brief Number of scans after which inactive voxels that received no points are evicted.
+  /// Zero disables the eviction.
+  int inactive_voxels_max_age_scans = 0;
+  /// \brief Time after which inactive voxels that received no points are evicted. Zero disables
+  /// the eviction.
+  float inactive_voxels_max_age_s = 0.0f;
+  /// \brief Maximum number of voxels in the local map. When exceeded, the least recently updated
+  /// inactive voxels are evicted. Zero disables the limit.
+  int max_voxels = 0;
+  /// \brief If true, the ground voxels are detected at every update and excluded from the
+  /// segmentation, from the points neighbors provider and from the normal estimation.
+  bool remove_ground = false;
+  /// \brief Size of the cells of the horizontal grid used for detecting the ground. The grid is
+  /// fixed in the world frame.
+  float ground_cell_size_m = 1.0f;
+  /// \brief Maximum height of a ground voxel above the lowest voxel of its cell.
+  float ground_max_height_m = 0.3f;
+  /// \brief Maximum height of the lowest voxel of a cell above the robot for the cell to contain
+  /// ground. The height of the robot is taken when the cell last changed.
+  float ground_max_height_above_robot_m = 0.0f;
 };
 
 /// \brief Manages the local point cloud of a robot. Provides methods for inserting, filtering and
@@ -55,8 +81,17 @@ class LocalMap {
     , radius_squared_m2_(other.radius_squared_m2_)
     , min_vertical_distance_m_(other.min_vertical_distance_m_)
     , max_vertical_distance_m_(other.max_vertical_distance_m_)
+    , remove_ground_(other.remove_ground_)
+    , ground_cell_size_m_(other.ground_cell_size_m_)
+    , ground_max_height_m_(other.ground_max_height_m_)
+    , ground_max_height_above_robot_m_(other.ground_max_height_above_robot_m_)
+    , ground_cells_(std::move(other.ground_cells_))
+    , modified_ground_cells_(std::move(other.modified_ground_cells_))
     , points_neighbors_provider_(std::move(other.points_neighbors_provider_))
-    , normal_estimator_(std::move(other.normal_estimator_)) {
+    , normal_estimator_(std::move(other.normal_estimator_))
+    , pending_normals_transformation_(std::move(other.pending_normals_transformation_))
+    , has_pending_normals_transformation_(other.has_pending_normals_transformation_)
+    , are_points_moved_(other.are_points_moved_) {
   };
 
   /// \brief Update the pose of the robot and add new points to the local map.
@@ -67,10 +102,18 @@ class LocalMap {
                               const laser_slam::Pose& pose);
 
   /// \brief Apply a pose transformation to the points contained in the local map.
+  /// The transformation of the points and of the normals is deferred until the next update or
+  /// call to applyPendingTransformations().
   /// \remark Multiple transformations are cumulative.
   /// \param transformation The transformation to be applied to the local map.
   void transform(const kindr::minimal::QuatTransformationTemplate<float>& transformation);
 
+  /// \brief Apply to the points and to the normals the transformations deferred by transform().
+  /// The points and the normals cannot be accessed until the pending transformations are applied.
+  /// \remark This modifies the local map, thus it requires the same synchronization as the
+  /// updates.
+  void applyPendingTransformations();
+
   /// \brief Clears the local map, removing all the points it contains.
   void clear();
 
@@ -79,7 +122,7 @@ class LocalMap {
   /// undefined behavior.
   /// \return Reference to the clustered cloud.
   ClusteredCloud& getFilteredPoints() const {
-    return voxel_grid_.getActiveCentroids();
+    return voxel_grid_->getActiveCentroids();
   }
 
   /// \brief Gets a filtered view of the points contained in the point cloud.
@@ -87,7 +130,7 @@ class LocalMap {
   /// undefined behavior.
   /// \return Pointer to the clustered cloud.
   typename ClusteredCloud::ConstPtr getFilteredPointsPtr() const {
-    return typename ClusteredCloud::ConstPtr(&voxel_grid_.getActiveCentroids(),
+    return typename ClusteredCloud::ConstPtr(&voxel_grid_->getActiveCentroids(),
                                              [](ClusteredCloud const* ptr) {});
   }
 
@@ -96,6 +139,8 @@ class LocalMap {
   /// \c estimate_normals option set to true. Otherwise, the normal cloud is empty.
   /// \return Normals of the points of the map.
   const PointNormals& getNormals() const {
+    CHECK(!has_pending_normals_transformation_) <<
+        "The pending transformations must be applied first.";
     if (normal_estimator_ != nullptr)
       return normal_estimator_->getNormals();
     else
@@ -128,20 +173,48 @@ class LocalMap {
 
  private:
   std::vector<bool> updatePose(const laser_slam::Pose& pose);
-  std::vector<int> addPointsAndGetCreatedVoxels(const std::vector<InputCloud>& new_clouds);
+  std::vector<int> addPointsAndGetCreatedVoxels(const std::vector<InputCloud>& new_clouds,
+                                                laser_slam::Time time_ns);
   std::vector<int> buildPointsMapping(const std::vector<bool>& is_point_removed,
                                       const std::vector<int>& new_points_indices);
+  void detectGround(const laser_slam::Pose& pose, const std::vector<int>& points_mapping,
+                    const std::vector<int>& created_points_indices,
+                    std::vector<bool>& is_point_ground,
+                    std::vector<int>& new_ground_points_indices,
+                    std::vector<int>& former_ground_points_indices);
+  uint64_t getGroundCellKey(const ClusteredPointT& point) const;
 
-  VoxelGrid voxel_grid_;
+  // The voxel grid is stored on the heap so that its address doesn't change when the local map
+  // is moved, since points neighbors providers can reference it.
+  std::unique_ptr<VoxelGrid> voxel_grid_;
 
   const float radius_squared_m2_;
   const float min_vertical_distance_m_;
   const float max_vertical_distance_m_;
 
+  // Parameters of the ground detection.
+  const bool remove_ground_;
+  const float ground_cell_size_m_;
+  const float ground_max_height_m_;
+  const float ground_max_height_above_robot_m_;
+
+  // Indices of the points contained in each cell of the ground detection grid, and keys of the
+  // cells from which points have been removed since the last ground detection.
+  std::unordered_map<uint64_t, std::vector<int>> ground_cells_;
+  std::vector<uint64_t> modified_ground_cells_;
+
   std::unique_ptr<PointsNeighborsProvider<ClusteredPointT>> points_neighbors_provider_;
   std::unique_ptr<NormalEstimator> normal_estimator_;
   PointNormals empty_normals_cloud_;
 
+  // Transformation that still has to be notified to the normal estimator.
+  kindr::minimal::QuatTransformationTemplate<float> pending_normals_transformation_;
+  bool has_pending_normals_transformation_ = false;
+
+  // True if the points have been moved since the last update of the points neighbors provider,
+  // which then needs to be rebuilt.
+  bool are_points_moved_ = true;
+
   // Variables needed for working with incremental updates.
   std::vector<Id> segment_ids_;
   std::vector<bool> is_normal_modified_since_last_update_;
@@ -0,0 +1,53 @@
+#ifndef SEGMATCH_MEMORY_MAPPED_FILE_HPP_
+#define SEGMATCH_MEMORY_MAPPED_FILE_HPP_
+
+#include <stddef.h>
+#include <string>
+
+namespace segmatch {
+
+/// \brief Read-only view of a file mapped in memory.
+/// The content of the file is paged in lazily by the operating system, so opening even large
+/// files is almost instantaneous.
+class MemoryMappedFile {
+ public:
+  MemoryMappedFile() = default;
+  ~MemoryMappedFile() { close(); }
+
+  // Prevent copy and assignment.
+  MemoryMappedFile(const MemoryMappedFile&) = delete;
+  MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+
+  /// \brief Map a file in memory. Any previously mapped file is unmapped.
+  /// \param filename Path of the file.
+  /// \returns True if the file could be mapped, false otherwise.
+  bool open(const std::string& filename);
+
+  /// \brief Unmap the file.
+  void close();
+
+  bool isOpen() const { return data_ != nullptr; }
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  /// \brief Gets a pointer to an array of \c count objects stored at \c offset bytes from the
+  /// beginning of the file.
+  /// \returns Pointer to the first object, or \c nullptr if the array does not fit in the file or
+  /// if it is not correctly aligned.
+  template <typename T>
+  const T* getArray(size_t offset, size_t count = 1u) const {
+    if (offset > size_ || count > (size_ - offset) / sizeof(T) ||
+        offset % alignof(T) != 0u) {
+      return nullptr;
+    }
+    return reinterpret_cast<const T*>(data_ + offset);
+  }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0u;
+}; // class MemoryMappedFile
+
+} // namespace segmatch
+
+#endif // SEGMATCH_MEMORY_MAPPED_FILE_HPP_
@@ -1,6 +1,8 @@
 #ifndef SEGMATCH_INCREMENTAL_NORMAL_ESTIMATOR_HPP_
 #define SEGMATCH_INCREMENTAL_NORMAL_ESTIMATOR_HPP_
 
+#include <functional>
+
 #define PCL_NO_PRECOMPILE
 #include <pcl/search/kdtree.h>
 
@@ -13,13 +15,22 @@ class IncrementalNormalEstimator : public NormalEstimator {
  public:
   /// \brief Initializes a new instance of the IncrementalNorminalEstimator class.
   /// \param search_radius The search radius used for estimating the normals.
-  IncrementalNormalEstimator(float search_radius);
+  /// \param num_threads Maximum number of threads used for updating the normals. The normals
+  /// are identical to the ones computed with a single thread.
+  IncrementalNormalEstimator(float search_radius, size_t num_threads = 1u);
 
   /// \brief Notifies the estimator that points have been transformed.
   /// \param transformation Linear transformation applied to the points.
   void notifyPointsTransformed(
       const kindr::minimal::QuatTransformationTemplate<float>& transformation) override;
 
+  /// \brief Notifies the estimator that points stop contributing to the normals of their
+  /// neighbors. Their contributions are subtracted from the neighbors that are not new at the next
+  /// update. Points contributing again later must be passed as new points.
+  /// \param points_indices Indices of the points in the cloud passed to the next call to
+  /// updateNormals().
+  void notifyPointsExcluded(const std::vector<int>& points_indices) override;
+
   /// \brief Clear all the normals and the associated information. Equivalent to removing all the
   /// points from the cloud.
   void clear() override;
@@ -49,19 +60,69 @@ class IncrementalNormalEstimator : public NormalEstimator {
       const MapCloud& points, const std::vector<int>& new_points_indices,
       PointsNeighborsProvider<MapPoint>& points_neighbors_provider);
 
+  // Subtract the contributions of the excluded points from the normals of the old points.
+  std::vector<bool> subtractNormalContributions(
+      const MapCloud& points, const std::vector<int>& new_points_indices,
+      PointsNeighborsProvider<MapPoint>& points_neighbors_provider);
+
+  // Parallel version of scatterNormalContributions(), in which each affected point gathers the
+  // contributions of the new points from the neighbors stored in neighbors_.
+  std::vector<bool> gatherNormalContributions(const MapCloud& points,
+                                              const std::vector<int>& new_points_indices);
+
   // Recompute the normals of the specified points.
   void recomputeNormals(const MapCloud& points, const std::vector<bool>& needs_recompute);
 
+  // Splits the range [0, num_items) in contiguous chunks and calls job(begin, end) on each chunk
+  // in a separate thread.
+  void runInParallel(size_t num_items, const std::function<void(size_t, size_t)>& job) const;
+
   PointNormals normals_;
   float search_radius_;
+  size_t num_threads_;
   pcl::search::KdTree<MapPoint>::Ptr kd_tree_;
 
-  // Partial covariance matrix information for incremental estimation.
-  // The covariance matrix is computed as
-  // C = E[X*X^t] - mu*mu^t = num_points_ * sum_X_Xt_ + num_points_^2 * sum_X_ * sum_X_^t
-  std::vector<Eigen::Matrix3f, Eigen::aligned_allocator<Eigen::Matrix3f>> sum_X_Xt_;
-  std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f>> sum_X_;
-  std::vector<size_t> num_points_;
+  // Buffers storing the neighbors of the new points, reused between updates.
+  PointsNeighborsBatch neighbors_;
+
+  // Indices of the points whose contributions are subtracted at the next update.
+  std::vector<int> excluded_points_indices_;
+
+  // Partial covariance matrix information for incremental estimation. For each point, the sums
+  // of D*D^t (symmetric, thus only 6 components), of D and the number of points X in the
+  // neighborhood are stored, where D = X - A are the coordinates of the neighbors relative to an
+  // anchor A. The anchor is the position of the point when it was added, so D is in the order of
+  // the search radius regardless of the distance from the origin and the covariance matrix
+  // C = E[D*D^t] - E[D]*E[D]^t = sum_D_Dt / n - sum_D * sum_D^t / n^2
+  // doesn't suffer from catastrophic cancellation in float.
+  enum Moment { kXX, kXY, kXZ, kYY, kYZ, kZZ, kX, kY, kZ, kN, kAnchorX, kAnchorY, kAnchorZ,
+                kNumMoments };
+
+  // Gets a pointer to the array containing the specified moment of every point.
+  float* getMoments(const Moment moment) {
+    return moments_.data() + moment * moments_stride_;
+  }
+  const float* getMoments(const Moment moment) const {
+    return moments_.data() + moment * moments_stride_;
+  }
+
+  // Ensures that the moments of at least the specified number of points can be stored.
+  void reserveMoments(size_t num_points);
+
+  // Adds the contribution of a point to the moments of the point with the specified index.
+  void addToMoments(size_t point_index, const Eigen::Vector3f& point);
+
+  // Removes the contribution of a point from the moments of the point with the specified index.
+  void subtractFromMoments(size_t point_index, const Eigen::Vector3f& point);
+
+  // Moves the moments and the normals in place according to a mapping. Points that are not the
+  // target of the mapping have their moments reset and are anchored at their current position.
+  void remapInPlace(const std::vector<int>& points_mapping, const MapCloud& points);
+
+  // The moments are stored in a structure of arrays: moment m of point i is at position
+  // m * moments_stride_ + i. The stride grows geometrically with the number of points.
+  std::vector<float> moments_;
+  size_t moments_stride_ = 0u;
 }; // class IncrementalNormalEstimator
 
 } // namespace segmatch
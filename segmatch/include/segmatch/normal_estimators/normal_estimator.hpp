@@ -21,6 +21,14 @@ class NormalEstimator {
   virtual void notifyPointsTransformed(
       const kindr::minimal::QuatTransformationTemplate<float>& transformation) = 0;
 
+  /// \brief Notifies the estimator that points stop contributing to the normals of their
+  /// neighbors, for example because they have been classified as ground.
+  /// \param points_indices Indices of the points in the cloud passed to the next call to
+  /// updateNormals(). The points neighbors provider passed to that call must exclude them.
+  /// \remarks updateNormals() must still be called so that the normal vectors actually reflect the
+  /// change.
+  virtual void notifyPointsExcluded(const std::vector<int>& points_indices) = 0;
+
   /// \brief Clear all the normals and the associated information. Equivalent to removing all the
   /// points from the cloud.
   virtual void clear() = 0;
@@ -45,8 +53,11 @@ class NormalEstimator {
   /// \brief Creates a normal estimator with the passed parameters.
   /// \param estimator_type Type of estimator. Can be "simple" or "incremental".
   /// \param radius_for_estimation_m The search radius used for the estimation of the normals.
+  /// \param num_threads Maximum number of threads used by the estimator. Only used by the
+  /// incremental estimator.
   static std::unique_ptr<NormalEstimator> create(const std::string& estimator_type,
-                                                 float radius_for_estimation_m);
+                                                 float radius_for_estimation_m,
+                                                 size_t num_threads = 1u);
 }; // class NormalEstimator
 
 } // namespace segmatch
@@ -20,6 +20,11 @@ class SimpleNormalEstimator : public NormalEstimator {
   void notifyPointsTransformed(
       const kindr::minimal::QuatTransformationTemplate<float>& transformation) override { }
 
+  /// \brief Notifies the estimator that points stop contributing to the normals of their
+  /// neighbors. The normals are always computed from scratch, thus this has no effect.
+  /// \param points_indices Indices of the excluded points.
+  void notifyPointsExcluded(const std::vector<int>& points_indices) override { }
+
   /// \brief Clear all the normals and the associated information. Equivalent to removing all the
   /// points from the cloud.
   void clear() override { }
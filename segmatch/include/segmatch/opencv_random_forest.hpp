@@ -1,9 +1,12 @@
 #ifndef SEGMATCH_OPENCV_RANDOM_FOREST_HPP_
 #define SEGMATCH_OPENCV_RANDOM_FOREST_HPP_
 
-#include <nabo/nabo.h>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include "segmatch/common.hpp"
+#include "segmatch/descriptor_indices/descriptor_index.hpp"
 #include "segmatch/parameters.hpp"
 #include "segmatch/segmented_cloud.hpp"
 
@@ -32,8 +35,17 @@ class OpenCvRandomForest {
 
   void load(const std::string& filename);
 
+  /// \brief Sets the target segments, comparing all of them with the current target.
+  /// \param target_cloud The target cloud.
   void setTarget(const SegmentedCloud& target_cloud);
 
+  /// \brief Updates the target after some of its segments were added, modified, renamed or
+  /// deleted. Only the specified segments are visited, the others must be unchanged.
+  /// \param target_cloud The target cloud.
+  /// \param changed_segment_ids IDs of the segments that changed since the last update. The
+  /// segments that are not in the target cloud anymore are removed from the target.
+  void updateTarget(const SegmentedCloud& target_cloud, const std::vector<Id>& changed_segment_ids);
+
   void resetParams(const ClassifierParams& params);
 
   void normalizeEigenFeatures(Eigen::MatrixXd* f);
@@ -41,15 +53,39 @@ class OpenCvRandomForest {
   void normalizeEigenFeatures(Eigen::MatrixXf* f);
 
  private:
-  std::vector<Id> target_segment_ids_;
-  std::vector<PclPoint> target_segment_centroids_;
-  std::vector<Eigen::MatrixXd> target_segment_features_;
-  std::vector<int64_t> target_segment_ts_;
-
-  SegmentedCloud target_cloud_;
-
-  Eigen::MatrixXf target_matrix_;
-  Nabo::NNSearchF* nns_ = NULL;
+  // Information about a target segment needed to build candidates.
+  struct TargetSegment {
+    PclPoint centroid;
+    int64_t timestamp_ns;
+    // Rotation invariant features.
+    Eigen::MatrixXd features;
+  };
+
+  // Add or update a segment of the target cloud. Returns true if its descriptor was inserted in
+  // the index.
+  bool updateTargetSegment(const Segment& segment);
+
+  // Remove a segment from the target and from the index, if present.
+  void removeTargetSegment(Id segment_id);
+
+  // Create an empty index for the descriptors of the target segments.
+  std::unique_ptr<DescriptorIndex> createKnnIndex() const;
+
+  // Get the descriptor used for the kNN search from the rotation invariant features.
+  Eigen::VectorXf computeKnnDescriptor(
+      const Eigen::Ref<const Eigen::RowVectorXd>& features) const;
+
+  // The target segments and the index of their descriptors. Both are updated incrementally
+  // when the target changes. The index may look up the descriptors of the segments it contains,
+  // so that their features must be set before inserting them and they must be removed from the
+  // index before being erased.
+  std::unordered_map<Id, TargetSegment> target_segments_;
+  std::unique_ptr<DescriptorIndex> knn_index_;
+
+  // Number of valid segments in the target cloud.
+  size_t n_target_segments_ = 0u;
+  // True if all the segments of the target cloud have been visited since the last reset.
+  bool is_target_set_ = false;
 
   Eigen::MatrixXd inverted_max_eigen_double_;
   Eigen::MatrixXf inverted_max_eigen_float_;
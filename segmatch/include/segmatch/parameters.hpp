@@ -44,6 +44,14 @@ struct SegmenterParameters {
   // Parameters specific for the SmoothnessConstraint growing policy.
   float sc_smoothness_threshold_deg;
   float sc_curvature_threshold;
+
+  // Number of threads used by the Euclidean and incremental segmenters, and tile size of the
+  // parallel region growing of the incremental segmenters.
+  int num_threads = 1;
+  float parallel_tile_size_m = 10.0f;
+
+  // Only update the segments of the clusters modified since the last segmentation.
+  bool update_only_modified_segments = false;
 }; // struct SegmenterParameters
 
 struct ClassifierParams {
@@ -71,6 +79,18 @@ struct ClassifierParams {
   bool apply_hard_threshold_on_feature_distance;
   double feature_distance_threshold;
 
+  // Nearest neighbours index of the target descriptors: "LogStructuredKdTree" (exact), "Hnsw"
+  // or "IvfPq" (approximate).
+  std::string knn_index_type = "LogStructuredKdTree";
+  int hnsw_max_links = 16;
+  int hnsw_ef_construction = 100;
+  int hnsw_ef_search = 64;
+  int ivfpq_num_lists = 64;
+  int ivfpq_num_probes = 8;
+  int ivfpq_num_subquantizers = 8;
+  // Number of threads searching the neighbours of the source segments.
+  int knn_num_threads = 1;
+
   bool normalize_eigen_for_knn;
   bool normalize_eigen_for_hard_threshold;
   std::vector<double> max_eigen_features_values;
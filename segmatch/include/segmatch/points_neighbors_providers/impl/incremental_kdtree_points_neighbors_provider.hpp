@@ -0,0 +1,350 @@
+#ifndef SEGMATCH_IMPL_INCREMENTAL_KDTREE_POINTS_NEIGHBORS_PROVIDER_HPP_
+#define SEGMATCH_IMPL_INCREMENTAL_KDTREE_POINTS_NEIGHBORS_PROVIDER_HPP_
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "segmatch/points_neighbors_providers/incremental_kdtree_points_neighbors_provider.hpp"
+
+namespace segmatch {
+
+// Force the compiler to reuse instantiations provided in
+// incremental_kdtree_points_neighbors_provider.cpp
+extern template class IncrementalKdTreePointsNeighborsProvider<MapPoint>;
+
+template<typename PointT>
+constexpr int IncrementalKdTreePointsNeighborsProvider<PointT>::kInvalidNode;
+template<typename PointT>
+constexpr float IncrementalKdTreePointsNeighborsProvider<PointT>::kMaxChildFraction;
+template<typename PointT>
+constexpr float IncrementalKdTreePointsNeighborsProvider<PointT>::kMaxDeletedFraction;
+template<typename PointT>
+constexpr uint32_t IncrementalKdTreePointsNeighborsProvider<PointT>::kMinSizeForRebuild;
+
+//=================================================================================================
+//    IncrementalKdTreePointsNeighborsProvider public methods implementation
+//=================================================================================================
+
+template<typename PointT>
+void IncrementalKdTreePointsNeighborsProvider<PointT>::update(
+    const typename pcl::PointCloud<PointT>::ConstPtr point_cloud,
+    const std::vector<int64_t>& points_mapping, const std::vector<bool>& excluded_points) {
+  CHECK(point_cloud != nullptr);
+  CHECK(excluded_points.empty() || excluded_points.size() == point_cloud->size());
+  point_cloud_ = point_cloud;
+  excluded_points_ = excluded_points;
+  is_pcl_search_object_valid_ = false;
+
+  // Without a mapping the points in the tree cannot be related to the new cloud.
+  if (points_mapping.empty() || root_ == kInvalidNode) {
+    rebuild_();
+    return;
+  }
+  CHECK_EQ(points_mapping.size(), node_of_point_.size());
+
+  // Delete the removed and the newly excluded points and move the remaining ones to their new
+  // position. The tree is not modified until all the points have been remapped, thus the subtrees
+  // containing too many deleted points are only collected.
+  std::vector<int> new_node_of_point(point_cloud_->size(), kInvalidNode);
+  std::vector<int> subtrees_to_rebuild;
+  for (size_t i = 0u; i < points_mapping.size(); ++i) {
+    if (node_of_point_[i] == kInvalidNode) {
+      // The point was excluded, it is inserted below if it is not excluded anymore.
+      continue;
+    } else if (points_mapping[i] < 0 || isExcluded_(points_mapping[i])) {
+      const int subtree = remove_(i);
+      if (subtree != kInvalidNode) subtrees_to_rebuild.push_back(subtree);
+    } else {
+      CHECK_LT(points_mapping[i], static_cast<int64_t>(point_cloud_->size()));
+      const int node_index = node_of_point_[i];
+      nodes_[node_index].point_index = points_mapping[i];
+      new_node_of_point[points_mapping[i]] = node_index;
+    }
+  }
+  node_of_point_.swap(new_node_of_point);
+  rebuildTopmostSubtrees_(subtrees_to_rebuild);
+
+  // Insert the points that are not part of the mapping and are not excluded.
+  for (size_t i = 0u; i < node_of_point_.size(); ++i) {
+    if (node_of_point_[i] == kInvalidNode && !isExcluded_(i)) insert_(i);
+  }
+}
+
+template<typename PointT>
+void IncrementalKdTreePointsNeighborsProvider<PointT>::appendNeighborsOf(
+    const size_t point_index, const float search_radius,
+    std::vector<int>& neighbors_indices) const {
+  CHECK(point_cloud_ != nullptr);
+  if (root_ == kInvalidNode) return;
+
+  const PointT& query_point = (*point_cloud_)[point_index];
+  const float query[3] = { query_point.x, query_point.y, query_point.z };
+  const float search_radius_squared = search_radius * search_radius;
+
+  // Visit the subtrees whose bounding box intersects the search sphere. The stack is owned by the
+  // calling thread to avoid allocating it for every query.
+  static thread_local std::vector<int> nodes_to_visit;
+  nodes_to_visit.assign(1u, root_);
+  while (!nodes_to_visit.empty()) {
+    const Node_& node = nodes_[nodes_to_visit.back()];
+    nodes_to_visit.pop_back();
+    if (node.num_deleted == node.size) continue;
+
+    float box_distance_squared = 0.0f;
+    float point_distance_squared = 0.0f;
+    for (size_t i = 0u; i < 3u; ++i) {
+      const float box_distance = std::max(0.0f, std::max(node.min_corner[i] - query[i],
+                                                         query[i] - node.max_corner[i]));
+      box_distance_squared += box_distance * box_distance;
+      point_distance_squared += (node.point[i] - query[i]) * (node.point[i] - query[i]);
+    }
+    if (box_distance_squared > search_radius_squared) continue;
+
+    if (!node.is_deleted && point_distance_squared <= search_radius_squared) {
+      neighbors_indices.push_back(node.point_index);
+    }
+    for (const int child : node.children) {
+      if (child != kInvalidNode) nodes_to_visit.push_back(child);
+    }
+  }
+}
+
+template<typename PointT>
+typename pcl::search::Search<PointT>::Ptr
+IncrementalKdTreePointsNeighborsProvider<PointT>::getPclSearchObject() {
+  CHECK(point_cloud_ != nullptr);
+  if (!is_pcl_search_object_valid_) {
+    pcl_kd_tree_.setInputCloud(point_cloud_, this->getIncludedPointsIndices(point_cloud_->size(),
+                                                                            excluded_points_));
+    is_pcl_search_object_valid_ = true;
+  }
+  return typename pcl::search::KdTree<PointT>::Ptr(&pcl_kd_tree_,
+                                                   [](pcl::search::KdTree<PointT>* ptr) {});
+}
+
+//=================================================================================================
+//    IncrementalKdTreePointsNeighborsProvider private methods implementation
+//=================================================================================================
+
+template<typename PointT>
+void IncrementalKdTreePointsNeighborsProvider<PointT>::rebuild_() {
+  nodes_.clear();
+  free_nodes_.clear();
+  node_of_point_.assign(point_cloud_->size(), kInvalidNode);
+
+  build_points_.clear();
+  for (size_t i = 0u; i < point_cloud_->size(); ++i) {
+    if (isExcluded_(i)) continue;
+    const PointT& point = (*point_cloud_)[i];
+    build_points_.push_back({ { point.x, point.y, point.z }, static_cast<int>(i) });
+  }
+  nodes_.reserve(build_points_.size());
+  root_ = buildSubtree_(build_points_.begin(), build_points_.end(), kInvalidNode);
+}
+
+template<typename PointT>
+int IncrementalKdTreePointsNeighborsProvider<PointT>::buildSubtree_(
+    const typename std::vector<BuildPoint_>::iterator begin,
+    const typename std::vector<BuildPoint_>::iterator end, const int parent) {
+  if (begin == end) return kInvalidNode;
+
+  // Split the points along the axis with the largest extent.
+  float min_corner[3] = { begin->point[0], begin->point[1], begin->point[2] };
+  float max_corner[3] = { begin->point[0], begin->point[1], begin->point[2] };
+  for (auto it = begin; it != end; ++it) {
+    for (size_t i = 0u; i < 3u; ++i) {
+      min_corner[i] = std::min(min_corner[i], it->point[i]);
+      max_corner[i] = std::max(max_corner[i], it->point[i]);
+    }
+  }
+  uint8_t axis = 0u;
+  for (uint8_t i = 1u; i < 3u; ++i) {
+    if (max_corner[i] - min_corner[i] > max_corner[axis] - min_corner[axis]) axis = i;
+  }
+  const auto median = begin + std::distance(begin, end) / 2;
+  std::nth_element(begin, median, end, [axis](const BuildPoint_& a, const BuildPoint_& b) {
+    return a.point[axis] < b.point[axis];
+  });
+
+  const int node_index = allocateNode_();
+  Node_& node = nodes_[node_index];
+  std::copy(median->point, median->point + 3, node.point);
+  std::copy(min_corner, min_corner + 3, node.min_corner);
+  std::copy(max_corner, max_corner + 3, node.max_corner);
+  node.point_index = median->point_index;
+  node.parent = parent;
+  node.size = std::distance(begin, end);
+  node.num_deleted = 0u;
+  node.axis = axis;
+  node.is_deleted = false;
+  node_of_point_[median->point_index] = node_index;
+
+  // Building the children can reallocate the nodes, don't keep references across the calls.
+  const int left_child = buildSubtree_(begin, median, node_index);
+  const int right_child = buildSubtree_(median + 1, end, node_index);
+  nodes_[node_index].children[0] = left_child;
+  nodes_[node_index].children[1] = right_child;
+  return node_index;
+}
+
+template<typename PointT>
+void IncrementalKdTreePointsNeighborsProvider<PointT>::rebuildSubtree_(const int node_index) {
+  const int parent = nodes_[node_index].parent;
+  const uint32_t num_deleted = nodes_[node_index].num_deleted;
+
+  build_points_.clear();
+  releaseSubtree_(node_index, build_points_);
+  const int new_node_index = buildSubtree_(build_points_.begin(), build_points_.end(), parent);
+
+  // Attach the new subtree and remove the deleted points from the counts of its ancestors.
+  if (parent == kInvalidNode) {
+    root_ = new_node_index;
+  } else {
+    Node_& parent_node = nodes_[parent];
+    parent_node.children[parent_node.children[0] == node_index ? 0 : 1] = new_node_index;
+  }
+  for (int ancestor = parent; ancestor != kInvalidNode; ancestor = nodes_[ancestor].parent) {
+    nodes_[ancestor].size -= num_deleted;
+    nodes_[ancestor].num_deleted -= num_deleted;
+  }
+}
+
+template<typename PointT>
+void IncrementalKdTreePointsNeighborsProvider<PointT>::releaseSubtree_(
+    const int node_index, std::vector<BuildPoint_>& points) {
+  std::vector<int> nodes_to_visit(1u, node_index);
+  while (!nodes_to_visit.empty()) {
+    const int current_index = nodes_to_visit.back();
+    nodes_to_visit.pop_back();
+    const Node_& node = nodes_[current_index];
+    if (!node.is_deleted) {
+      points.push_back({ { node.point[0], node.point[1], node.point[2] }, node.point_index });
+    }
+    for (const int child : node.children) {
+      if (child != kInvalidNode) nodes_to_visit.push_back(child);
+    }
+    free_nodes_.push_back(current_index);
+  }
+}
+
+template<typename PointT>
+void IncrementalKdTreePointsNeighborsProvider<PointT>::insert_(const int point_index) {
+  const PointT& point = (*point_cloud_)[point_index];
+  const float coords[3] = { point.x, point.y, point.z };
+
+  // Create the leaf node first, since allocating nodes can invalidate references.
+  const int leaf_index = allocateNode_();
+  Node_& leaf = nodes_[leaf_index];
+  std::copy(coords, coords + 3, leaf.point);
+  std::copy(coords, coords + 3, leaf.min_corner);
+  std::copy(coords, coords + 3, leaf.max_corner);
+  leaf.point_index = point_index;
+  leaf.children[0] = kInvalidNode;
+  leaf.children[1] = kInvalidNode;
+  leaf.size = 1u;
+  leaf.num_deleted = 0u;
+  leaf.axis = 0u;
+  leaf.is_deleted = false;
+  node_of_point_[point_index] = leaf_index;
+
+  if (root_ == kInvalidNode) {
+    leaf.parent = kInvalidNode;
+    root_ = leaf_index;
+    return;
+  }
+
+  // Descend the tree, updating the sizes and the bounding boxes of the visited subtrees.
+  int node_index = root_;
+  while (true) {
+    Node_& node = nodes_[node_index];
+    ++node.size;
+    for (size_t i = 0u; i < 3u; ++i) {
+      node.min_corner[i] = std::min(node.min_corner[i], coords[i]);
+      node.max_corner[i] = std::max(node.max_corner[i], coords[i]);
+    }
+    int& child = node.children[coords[node.axis] < node.point[node.axis] ? 0 : 1];
+    if (child == kInvalidNode) {
+      child = leaf_index;
+      nodes_[leaf_index].parent = node_index;
+      break;
+    }
+    node_index = child;
+  }
+
+  // Rebuild the topmost unbalanced subtree containing the new point.
+  int scapegoat = kInvalidNode;
+  for (int ancestor = nodes_[leaf_index].parent; ancestor != kInvalidNode;
+       ancestor = nodes_[ancestor].parent) {
+    if (isUnbalanced_(ancestor)) scapegoat = ancestor;
+  }
+  if (scapegoat != kInvalidNode) rebuildSubtree_(scapegoat);
+}
+
+template<typename PointT>
+int IncrementalKdTreePointsNeighborsProvider<PointT>::remove_(const int point_index) {
+  const int node_index = node_of_point_[point_index];
+  CHECK_NE(node_index, kInvalidNode);
+  nodes_[node_index].is_deleted = true;
+  int scapegoat = kInvalidNode;
+  for (int ancestor = node_index; ancestor != kInvalidNode; ancestor = nodes_[ancestor].parent) {
+    ++nodes_[ancestor].num_deleted;
+    if (isUnbalanced_(ancestor)) scapegoat = ancestor;
+  }
+  return scapegoat;
+}
+
+template<typename PointT>
+void IncrementalKdTreePointsNeighborsProvider<PointT>::rebuildTopmostSubtrees_(
+    std::vector<int>& subtrees) {
+  if (subtrees.empty()) return;
+  std::sort(subtrees.begin(), subtrees.end());
+  subtrees.erase(std::unique(subtrees.begin(), subtrees.end()), subtrees.end());
+
+  // Subtrees contained in another subtree are rebuilt together with it. The remaining subtrees
+  // are disjoint, thus rebuilding one of them doesn't invalidate the others.
+  std::vector<int> topmost_subtrees;
+  for (const int subtree : subtrees) {
+    bool is_topmost = true;
+    for (int ancestor = nodes_[subtree].parent; ancestor != kInvalidNode && is_topmost;
+         ancestor = nodes_[ancestor].parent) {
+      is_topmost = !std::binary_search(subtrees.begin(), subtrees.end(), ancestor);
+    }
+    if (is_topmost) topmost_subtrees.push_back(subtree);
+  }
+  for (const int subtree : topmost_subtrees) rebuildSubtree_(subtree);
+}
+
+template<typename PointT>
+int IncrementalKdTreePointsNeighborsProvider<PointT>::allocateNode_() {
+  if (free_nodes_.empty()) {
+    nodes_.emplace_back();
+    return nodes_.size() - 1u;
+  }
+  const int node_index = free_nodes_.back();
+  free_nodes_.pop_back();
+  return node_index;
+}
+
+template<typename PointT>
+inline bool IncrementalKdTreePointsNeighborsProvider<PointT>::isExcluded_(
+    const size_t point_index) const {
+  return !excluded_points_.empty() && excluded_points_[point_index];
+}
+
+template<typename PointT>
+bool IncrementalKdTreePointsNeighborsProvider<PointT>::isUnbalanced_(const int node_index) const {
+  const Node_& node = nodes_[node_index];
+  if (node.size < kMinSizeForRebuild) return false;
+  if (static_cast<float>(node.num_deleted) > kMaxDeletedFraction * node.size) return true;
+
+  uint32_t max_child_size = 0u;
+  for (const int child : node.children) {
+    if (child != kInvalidNode) max_child_size = std::max(max_child_size, nodes_[child].size);
+  }
+  return static_cast<float>(max_child_size) > kMaxChildFraction * node.size;
+}
+
+} // namespace segmatch
+
+#endif // SEGMATCH_IMPL_INCREMENTAL_KDTREE_POINTS_NEIGHBORS_PROVIDER_HPP_
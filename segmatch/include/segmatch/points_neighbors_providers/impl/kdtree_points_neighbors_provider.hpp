@@ -17,24 +17,26 @@ extern template class KdTreePointsNeighborsProvider<MapPoint>;
 template<typename PointT>
 void KdTreePointsNeighborsProvider<PointT>::update(
     const typename pcl::PointCloud<PointT>::ConstPtr point_cloud,
-    const std::vector<int64_t>& points_mapping) {
-  // Build k-d tree
+    const std::vector<int64_t>& points_mapping, const std::vector<bool>& excluded_points) {
+  // Build the k-d tree containing only the points that are not excluded.
   point_cloud_ = point_cloud;
-  kd_tree_.setInputCloud(point_cloud_);
+  kd_tree_.setInputCloud(point_cloud_,
+                         this->getIncludedPointsIndices(point_cloud_->size(), excluded_points));
 }
 
 template<typename PointT>
-const PointNeighbors KdTreePointsNeighborsProvider<PointT>::getNeighborsOf(
-    const size_t point_index, const float search_radius) {
+void KdTreePointsNeighborsProvider<PointT>::appendNeighborsOf(
+    const size_t point_index, const float search_radius,
+    std::vector<int>& neighbors_indices) const {
   CHECK(point_cloud_ != nullptr);
 
-  // Get the neighbors from the kd-tree.
-  std::vector<int> neighbors_indices;
-  std::vector<float> neighbors_distances;
-  kd_tree_.radiusSearch((*point_cloud_)[point_index], search_radius, neighbors_indices,
-                        neighbors_distances);
-
-  return neighbors_indices;
+  // Get the neighbors from the kd-tree. PCL overwrites its output vectors, thus the results are
+  // stored in buffers owned by the calling thread and then appended.
+  static thread_local std::vector<int> found_indices;
+  static thread_local std::vector<float> found_distances;
+  kd_tree_.radiusSearch((*point_cloud_)[point_index], search_radius, found_indices,
+                        found_distances);
+  neighbors_indices.insert(neighbors_indices.end(), found_indices.begin(), found_indices.end());
 }
 
 } // namespace segmatch
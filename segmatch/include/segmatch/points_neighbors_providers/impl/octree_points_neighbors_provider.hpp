@@ -17,24 +17,26 @@ extern template class OctreePointsNeighborsProvider<MapPoint>;
 template<typename PointT>
 void OctreePointsNeighborsProvider<PointT>::update(
     const typename pcl::PointCloud<PointT>::ConstPtr point_cloud,
-    const std::vector<int64_t>& points_mapping) {
-  // Build k-d tree
+    const std::vector<int64_t>& points_mapping, const std::vector<bool>& excluded_points) {
+  // Build the octree containing only the points that are not excluded.
   point_cloud_ = point_cloud;
-  octree_.setInputCloud(point_cloud_);
+  octree_.setInputCloud(point_cloud_,
+                        this->getIncludedPointsIndices(point_cloud_->size(), excluded_points));
 }
 
 template<typename PointT>
-const PointNeighbors OctreePointsNeighborsProvider<PointT>::getNeighborsOf(
-    const size_t point_index, const float search_radius) {
+void OctreePointsNeighborsProvider<PointT>::appendNeighborsOf(
+    const size_t point_index, const float search_radius,
+    std::vector<int>& neighbors_indices) const {
   CHECK(point_cloud_ != nullptr);
 
-  // Get the neighbors from the octree.
-  std::vector<int> neighbors_indices;
-  std::vector<float> neighbors_distances;
-  octree_.radiusSearch((*point_cloud_)[point_index], search_radius, neighbors_indices,
-                        neighbors_distances);
-
-  return neighbors_indices;
+  // Get the neighbors from the octree. PCL overwrites its output vectors, thus the results are
+  // stored in buffers owned by the calling thread and then appended.
+  static thread_local std::vector<int> found_indices;
+  static thread_local std::vector<float> found_distances;
+  octree_.radiusSearch((*point_cloud_)[point_index], search_radius, found_indices,
+                       found_distances);
+  neighbors_indices.insert(neighbors_indices.end(), found_indices.begin(), found_indices.end());
 }
 
 } // namespace segmatch
@@ -0,0 +1,292 @@
+#ifndef SEGMATCH_IMPL_VOXEL_HASH_POINTS_NEIGHBORS_PROVIDER_HPP_
+#define SEGMATCH_IMPL_VOXEL_HASH_POINTS_NEIGHBORS_PROVIDER_HPP_
+
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "segmatch/points_neighbors_providers/voxel_hash_points_neighbors_provider.hpp"
+
+namespace segmatch {
+
+// Force the compiler to reuse instantiations provided in voxel_hash_points_neighbors_provider.cpp
+extern template class VoxelHashPointsNeighborsProvider<PclPoint, MapPoint>;
+
+//=================================================================================================
+//    VoxelHashPointsNeighborsProvider public methods implementation
+//=================================================================================================
+
+template<typename InputPointT, typename PointT>
+void VoxelHashPointsNeighborsProvider<InputPointT, PointT>::update(
+    const typename pcl::PointCloud<PointT>::ConstPtr point_cloud,
+    const std::vector<int64_t>& points_mapping, const std::vector<bool>& excluded_points) {
+  CHECK(point_cloud != nullptr);
+  CHECK_EQ(point_cloud->size(), voxel_grid_.getActiveCentroids().size());
+  CHECK(excluded_points.empty() || excluded_points.size() == point_cloud->size());
+  point_cloud_ = point_cloud;
+  excluded_points_ = excluded_points;
+  is_pcl_search_object_valid_ = false;
+
+  // Without a mapping the points in the bricks cannot be related to the new cloud.
+  if (points_mapping.empty() || points_coordinates_.empty()) {
+    rebuild_();
+    return;
+  }
+  CHECK_EQ(points_mapping.size(), points_coordinates_.size());
+
+  // Remove the removed and the newly excluded points from the bricks and move the remaining ones
+  // to their new index. The positions are updated too, since the centroids move when their voxels
+  // receive new points.
+  std::vector<Eigen::Vector3i, Eigen::aligned_allocator<Eigen::Vector3i>> new_points_coordinates(
+      point_cloud_->size());
+  std::vector<bool> is_point_mapped(point_cloud_->size(), false);
+  for (size_t i = 0u; i < points_mapping.size(); ++i) {
+    if (points_mapping[i] < 0) continue;
+    CHECK_LT(points_mapping[i], static_cast<int64_t>(point_cloud_->size()));
+    new_points_coordinates[points_mapping[i]] = points_coordinates_[i];
+    is_point_mapped[points_mapping[i]] = true;
+  }
+  std::vector<bool> is_point_stored(point_cloud_->size(), false);
+  for (BrickPoint_& brick_point : sorted_points_) {
+    if (brick_point.point_index < 0) continue;
+    const int64_t new_point_index = points_mapping[brick_point.point_index];
+    if (new_point_index < 0 || isExcluded_(new_point_index)) {
+      const Eigen::Vector3i& coordinates = points_coordinates_[brick_point.point_index];
+      bricks_[findBrick_(getBrickKey_(coordinates)) * voxels_per_brick +
+              getVoxelInBrick_(coordinates)] = -1;
+      brick_point.point_index = -1;
+      ++num_removed_points_;
+    } else {
+      brick_point.position = (*point_cloud_)[new_point_index].getVector3fMap();
+      brick_point.point_index = new_point_index;
+      is_point_stored[new_point_index] = true;
+    }
+  }
+  points_coordinates_.swap(new_points_coordinates);
+
+  // Insert the points that are not part of the mapping and the points that are not excluded
+  // anymore.
+  for (size_t i = 0u; i < point_cloud_->size(); ++i) {
+    if (!is_point_mapped[i]) {
+      points_coordinates_[i] = voxel_grid_.getVoxelCoordinates(
+          voxel_grid_.getVoxelIndexOfActiveCentroid(i));
+    }
+    if (!is_point_stored[i] && !isExcluded_(i)) insert_(i);
+  }
+
+  // The inserted points are not contiguous to the other points of their bricks and the removed
+  // points leave holes. Rebuild the bricks when the holes take more space than the points.
+  if (2u * num_removed_points_ > sorted_points_.size()) rebuild_();
+}
+
+template<typename InputPointT, typename PointT>
+void VoxelHashPointsNeighborsProvider<InputPointT, PointT>::appendNeighborsOf(
+    const size_t point_index, const float search_radius,
+    std::vector<int>& neighbors_indices) const {
+  CHECK(point_cloud_ != nullptr);
+  const float search_radius_squared = search_radius * search_radius;
+  const Eigen::Vector3f query_point = (*point_cloud_)[point_index].getVector3fMap();
+
+  // Both points lie inside their voxels, so two points in voxels separated by an offset d are at
+  // least (|d| - 1) voxels apart along each axis. This bounds the voxels that must be visited.
+  const float radius_in_voxels = search_radius / voxel_grid_.getResolution();
+  const float radius_in_voxels_squared = radius_in_voxels * radius_in_voxels;
+  const int max_offset = static_cast<int>(std::floor(radius_in_voxels)) + 1;
+  const Eigen::Vector3i& coordinates = points_coordinates_[point_index];
+  const Eigen::Vector3i min_coordinates = (coordinates.array() - max_offset).max(0).matrix();
+  const Eigen::Vector3i max_coordinates = coordinates.array() + max_offset;
+
+  // Visit the voxels in range, brick by brick.
+  for (int brick_z = min_coordinates.z() >> brick_bits;
+       brick_z <= max_coordinates.z() >> brick_bits; ++brick_z) {
+    const int min_z = std::max(min_coordinates.z(), brick_z << brick_bits);
+    const int max_z = std::min(max_coordinates.z(), (brick_z << brick_bits) + brick_size - 1);
+    for (int brick_y = min_coordinates.y() >> brick_bits;
+         brick_y <= max_coordinates.y() >> brick_bits; ++brick_y) {
+      const int min_y = std::max(min_coordinates.y(), brick_y << brick_bits);
+      const int max_y = std::min(max_coordinates.y(), (brick_y << brick_bits) + brick_size - 1);
+      for (int brick_x = min_coordinates.x() >> brick_bits;
+           brick_x <= max_coordinates.x() >> brick_bits; ++brick_x) {
+        const int brick_index = findBrick_(getBrickKeyFromBrickCoordinates_(
+            Eigen::Vector3i(brick_x, brick_y, brick_z)));
+        if (brick_index < 0) continue;
+        const int min_x = std::max(min_coordinates.x(), brick_x << brick_bits);
+        const int max_x = std::min(max_coordinates.x(), (brick_x << brick_bits) + brick_size - 1);
+
+        const int* brick = &bricks_[brick_index * voxels_per_brick];
+        for (int z = min_z; z <= max_z; ++z) {
+          const int distance_z = std::max(0, std::abs(z - coordinates.z()) - 1);
+          for (int y = min_y; y <= max_y; ++y) {
+            const int distance_y = std::max(0, std::abs(y - coordinates.y()) - 1);
+            const float remaining_squared = radius_in_voxels_squared -
+                static_cast<float>(distance_y * distance_y + distance_z * distance_z);
+            if (remaining_squared < 0.0f) continue;
+            const int row_offset = static_cast<int>(std::sqrt(remaining_squared)) + 1;
+            const int* row = brick + ((((z & (brick_size - 1)) << brick_bits) +
+                (y & (brick_size - 1))) << brick_bits);
+            const int row_max_x = std::min(max_x, coordinates.x() + row_offset);
+            for (int x = std::max(min_x, coordinates.x() - row_offset); x <= row_max_x; ++x) {
+              const int sorted_index = row[x & (brick_size - 1)];
+              if (sorted_index >= 0 && (sorted_points_[sorted_index].position -
+                  query_point).squaredNorm() <= search_radius_squared) {
+                neighbors_indices.push_back(sorted_points_[sorted_index].point_index);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template<typename InputPointT, typename PointT>
+typename pcl::search::Search<PointT>::Ptr
+VoxelHashPointsNeighborsProvider<InputPointT, PointT>::getPclSearchObject() {
+  CHECK(point_cloud_ != nullptr);
+  if (!is_pcl_search_object_valid_) {
+    pcl_kd_tree_.setInputCloud(point_cloud_, this->getIncludedPointsIndices(point_cloud_->size(),
+                                                                            excluded_points_));
+    is_pcl_search_object_valid_ = true;
+  }
+  return typename pcl::search::KdTree<PointT>::Ptr(&pcl_kd_tree_,
+                                                   [](pcl::search::KdTree<PointT>* ptr) {});
+}
+
+//=================================================================================================
+//    VoxelHashPointsNeighborsProvider private methods implementation
+//=================================================================================================
+
+template<typename InputPointT, typename PointT>
+void VoxelHashPointsNeighborsProvider<InputPointT, PointT>::rebuild_() {
+  num_removed_points_ = 0u;
+  points_coordinates_.resize(point_cloud_->size());
+  for (size_t i = 0u; i < point_cloud_->size(); ++i) {
+    points_coordinates_[i] = voxel_grid_.getVoxelCoordinates(
+        voxel_grid_.getVoxelIndexOfActiveCentroid(i));
+  }
+
+  // Rebuild the hash table. There are at most as many bricks as points. The excluded points are
+  // not stored in the bricks, but their coordinates are kept for querying their neighbors.
+  slots_bits_ = 1u;
+  while ((size_t(1u) << slots_bits_) < 2u * point_cloud_->size()) ++slots_bits_;
+  slots_.assign(size_t(1u) << slots_bits_, { 0u, -1 });
+  const size_t slots_mask = slots_.size() - 1u;
+  std::vector<int> points_bricks(point_cloud_->size(), -1);
+  std::vector<int> bricks_offsets;
+  for (size_t i = 0u; i < point_cloud_->size(); ++i) {
+    if (isExcluded_(i)) continue;
+    const uint64_t brick_key = getBrickKey_(points_coordinates_[i]);
+    size_t slot = getSlot_(brick_key);
+    while (slots_[slot].brick_index >= 0 && slots_[slot].brick_key != brick_key)
+      slot = (slot + 1u) & slots_mask;
+    if (slots_[slot].brick_index < 0) {
+      slots_[slot] = { brick_key, static_cast<int>(bricks_offsets.size()) };
+      bricks_offsets.push_back(0);
+    }
+    points_bricks[i] = slots_[slot].brick_index;
+    ++bricks_offsets[points_bricks[i]];
+  }
+
+  // Sort the points by brick, so that the points of a brick are contiguous in memory.
+  int num_points = 0;
+  for (int& offset : bricks_offsets) {
+    const int num_brick_points = offset;
+    offset = num_points;
+    num_points += num_brick_points;
+  }
+  sorted_points_.resize(num_points);
+  bricks_.assign(bricks_offsets.size() * voxels_per_brick, -1);
+  for (size_t i = 0u; i < point_cloud_->size(); ++i) {
+    if (points_bricks[i] < 0) continue;
+    const int sorted_index = bricks_offsets[points_bricks[i]]++;
+    sorted_points_[sorted_index].position = (*point_cloud_)[i].getVector3fMap();
+    sorted_points_[sorted_index].point_index = i;
+    bricks_[points_bricks[i] * voxels_per_brick + getVoxelInBrick_(points_coordinates_[i])] =
+        sorted_index;
+  }
+}
+
+template<typename InputPointT, typename PointT>
+void VoxelHashPointsNeighborsProvider<InputPointT, PointT>::insert_(const size_t point_index) {
+  const Eigen::Vector3i& coordinates = points_coordinates_[point_index];
+  const uint64_t brick_key = getBrickKey_(coordinates);
+  int brick_index = findBrick_(brick_key);
+  if (brick_index < 0) {
+    brick_index = static_cast<int>(bricks_.size() / voxels_per_brick);
+    bricks_.resize(bricks_.size() + voxels_per_brick, -1);
+
+    // Keep at least twice as many slots as bricks, then add the brick to the hash table.
+    if (2u * bricks_.size() / voxels_per_brick > slots_.size()) {
+      std::vector<Slot_> old_slots(size_t(1u) << (slots_bits_ + 1u), { 0u, -1 });
+      old_slots.swap(slots_);
+      ++slots_bits_;
+      for (const Slot_& slot : old_slots) {
+        if (slot.brick_index >= 0) insertSlot_(slot);
+      }
+    }
+    insertSlot_({ brick_key, brick_index });
+  }
+
+  bricks_[brick_index * voxels_per_brick + getVoxelInBrick_(coordinates)] =
+      static_cast<int>(sorted_points_.size());
+  sorted_points_.push_back({ (*point_cloud_)[point_index].getVector3fMap(),
+                             static_cast<int>(point_index) });
+}
+
+template<typename InputPointT, typename PointT>
+inline uint64_t VoxelHashPointsNeighborsProvider<InputPointT, PointT>::getBrickKey_(
+    const Eigen::Vector3i& voxel_coordinates) {
+  return getBrickKeyFromBrickCoordinates_(Eigen::Vector3i(voxel_coordinates.x() >> brick_bits,
+                                                          voxel_coordinates.y() >> brick_bits,
+                                                          voxel_coordinates.z() >> brick_bits));
+}
+
+template<typename InputPointT, typename PointT>
+inline uint64_t
+VoxelHashPointsNeighborsProvider<InputPointT, PointT>::getBrickKeyFromBrickCoordinates_(
+    const Eigen::Vector3i& brick_coordinates) {
+  // Voxel coordinates are non-negative and fit in 21 bits, as do brick coordinates.
+  return static_cast<uint64_t>(brick_coordinates.x()) |
+      (static_cast<uint64_t>(brick_coordinates.y()) << 21u) |
+      (static_cast<uint64_t>(brick_coordinates.z()) << 42u);
+}
+
+template<typename InputPointT, typename PointT>
+inline size_t VoxelHashPointsNeighborsProvider<InputPointT, PointT>::getSlot_(
+    const uint64_t brick_key) const {
+  // Fibonacci hashing spreads neighboring brick keys over the whole table.
+  return (brick_key * 0x9E3779B97F4A7C15ull) >> (64u - slots_bits_);
+}
+
+template<typename InputPointT, typename PointT>
+inline int VoxelHashPointsNeighborsProvider<InputPointT, PointT>::findBrick_(
+    const uint64_t brick_key) const {
+  const size_t slots_mask = slots_.size() - 1u;
+  for (size_t slot = getSlot_(brick_key); slots_[slot].brick_index >= 0;
+       slot = (slot + 1u) & slots_mask) {
+    if (slots_[slot].brick_key == brick_key) return slots_[slot].brick_index;
+  }
+  return -1;
+}
+
+template<typename InputPointT, typename PointT>
+inline void VoxelHashPointsNeighborsProvider<InputPointT, PointT>::insertSlot_(
+    const Slot_& new_slot) {
+  const size_t slots_mask = slots_.size() - 1u;
+  size_t slot = getSlot_(new_slot.brick_key);
+  while (slots_[slot].brick_index >= 0) slot = (slot + 1u) & slots_mask;
+  slots_[slot] = new_slot;
+}
+
+template<typename InputPointT, typename PointT>
+inline int VoxelHashPointsNeighborsProvider<InputPointT, PointT>::getVoxelInBrick_(
+    const Eigen::Vector3i& voxel_coordinates) {
+  const Eigen::Vector3i cell = voxel_coordinates.unaryExpr(
+      [](int c) { return c & (brick_size - 1); });
+  return (((cell.z() << brick_bits) + cell.y()) << brick_bits) + cell.x();
+}
+
+} // namespace segmatch
+
+#endif // SEGMATCH_IMPL_VOXEL_HASH_POINTS_NEIGHBORS_PROVIDER_HPP_
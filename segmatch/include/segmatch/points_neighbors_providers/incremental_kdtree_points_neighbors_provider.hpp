@@ -0,0 +1,155 @@
+#ifndef SEGMATCH_INCREMENTAL_KDTREE_POINTS_NEIGHBORS_PROVIDER_HPP_
+#define SEGMATCH_INCREMENTAL_KDTREE_POINTS_NEIGHBORS_PROVIDER_HPP_
+
+#include <stdint.h>
+#include <vector>
+
+#include <pcl/search/impl/kdtree.hpp>
+#include <pcl/kdtree/impl/kdtree_flann.hpp>
+
+#include "segmatch/points_neighbors_providers/points_neighbors_provider.hpp"
+#include "segmatch/common.hpp"
+
+namespace segmatch {
+
+/// \brief Provides point neighborhood information of a point cloud by maintaining a dynamic k-d
+/// tree that is updated incrementally.
+///
+/// When a points mapping is provided, the removed points are deleted lazily from the tree and only
+/// the points that are not part of the mapping are inserted. Subtrees that become unbalanced or
+/// that contain too many deleted points are rebuilt, so the cost of an update depends on the
+/// number of changed points instead of the size of the cloud.
+/// \remark The tree stores a copy of the coordinates of the points. If the points are moved, the
+/// provider must be updated with an empty mapping, which rebuilds the whole tree.
+template<typename PointT>
+class IncrementalKdTreePointsNeighborsProvider : public PointsNeighborsProvider<PointT> {
+ public:
+  typedef pcl::PointCloud<PointT> PointCloud;
+
+  static_assert(pcl::traits::has_xyz<PointT>::value,
+                "IncrementalKdTreePointsNeighborsProvider requires PointT to contain XYZ "
+                "coordinates.");
+
+  /// \brief Initializes a new instance of the IncrementalKdTreePointsNeighborsProvider class.
+  IncrementalKdTreePointsNeighborsProvider()
+    : point_cloud_(nullptr), root_(kInvalidNode), is_pcl_search_object_valid_(false) {
+  }
+
+  /// \brief Update the points neighborhood provider.
+  /// \param point_cloud The new point cloud.
+  /// \param points_mapping Mapping from the points stored in the current cloud to the points of
+  /// the new point cloud. Point \c i is moved to position \c points_mapping[i]. Values smaller
+  /// than 0 indicate that the point has been removed. Points of the new cloud that are not the
+  /// target of the mapping are inserted in the tree. If empty, the tree is rebuilt.
+  /// \param excluded_points Flags of the points of the new cloud that are not indexed. If empty,
+  /// all the points are indexed.
+  /// \remarks point_cloud must remain a valid object during all the successive calls to
+  /// getNeighborsOf()
+  void update(const typename pcl::PointCloud<PointT>::ConstPtr point_cloud,
+              const std::vector<int64_t>& points_mapping = {},
+              const std::vector<bool>& excluded_points = {}) override;
+
+  /// \brief Appends the indexes of the neighbors of the point with the specified index to a
+  /// vector.
+  /// \param point_index Index of the query point.
+  /// \param search_radius The radius of the searched neighborhood.
+  /// \param neighbors_indices Vector to which the indices of the neighbor points are appended, in
+  /// no particular order.
+  void appendNeighborsOf(size_t point_index, float search_radius,
+                         std::vector<int>& neighbors_indices) const override;
+
+  /// \brief Returns the underlying PCL search object.
+  /// \remarks This function is present only for compatibility with the old segmenters and
+  /// should not be used in new code. The PCL k-d tree is built on demand from the current cloud.
+  /// \returns Pointer to the PCL search object.
+  typename pcl::search::Search<PointT>::Ptr getPclSearchObject() override;
+
+ private:
+  // A node of the tree. Each node stores one point and the bounding box of its subtree.
+  struct Node_ {
+    float point[3];
+    float min_corner[3];
+    float max_corner[3];
+    int point_index;
+    int parent;
+    int children[2];
+    // Number of points in the subtree, including the deleted ones.
+    uint32_t size;
+    uint32_t num_deleted;
+    uint8_t axis;
+    bool is_deleted;
+  };
+
+  // A point that has to be placed in a rebuilt subtree.
+  struct BuildPoint_ {
+    float point[3];
+    int point_index;
+  };
+
+  // Rebuild the whole tree from the current point cloud.
+  void rebuild_();
+
+  // Build a balanced subtree containing the points in the range [begin, end). Returns the index of
+  // the root node.
+  int buildSubtree_(typename std::vector<BuildPoint_>::iterator begin,
+                    typename std::vector<BuildPoint_>::iterator end, int parent);
+
+  // Replace a subtree with a balanced subtree containing only its valid points.
+  void rebuildSubtree_(int node_index);
+
+  // Collect the valid points of a subtree and release its nodes.
+  void releaseSubtree_(int node_index, std::vector<BuildPoint_>& points);
+
+  // Insert a point in the tree, rebuilding the topmost unbalanced subtree on the insertion path.
+  void insert_(int point_index);
+
+  // Mark the node containing a point as deleted. Returns the topmost subtree on the deletion path
+  // that must be rebuilt, or kInvalidNode if none.
+  int remove_(int point_index);
+
+  // Rebuild the specified subtrees, skipping the ones contained in another specified subtree.
+  void rebuildTopmostSubtrees_(std::vector<int>& subtrees);
+
+  // Get a free node.
+  int allocateNode_();
+
+  // Returns true if the point with the specified index in the current cloud is not indexed.
+  bool isExcluded_(size_t point_index) const;
+
+  // Returns true if the subtree rooted at the specified node must be rebuilt.
+  bool isUnbalanced_(int node_index) const;
+
+  // The current point cloud.
+  typename pcl::PointCloud<PointT>::ConstPtr point_cloud_;
+
+  // Flags of the points of the current cloud that are not stored in the tree.
+  std::vector<bool> excluded_points_;
+
+  // The nodes of the tree, the nodes that can be reused and the root node.
+  std::vector<Node_> nodes_;
+  std::vector<int> free_nodes_;
+  int root_;
+
+  // Index of the node containing each point of the cloud, or kInvalidNode for excluded points.
+  std::vector<int> node_of_point_;
+
+  // Buffer reused when building subtrees.
+  std::vector<BuildPoint_> build_points_;
+
+  // PCL k-d tree used only for compatibility with the old segmenters.
+  pcl::search::KdTree<PointT> pcl_kd_tree_;
+  bool is_pcl_search_object_valid_;
+
+  static constexpr int kInvalidNode = -1;
+
+  // A subtree is rebuilt if one of its children contains more than kMaxChildFraction of its
+  // points, or if more than kMaxDeletedFraction of its points are deleted. Small subtrees are
+  // never rebuilt.
+  static constexpr float kMaxChildFraction = 0.75f;
+  static constexpr float kMaxDeletedFraction = 0.5f;
+  static constexpr uint32_t kMinSizeForRebuild = 16u;
+}; // class IncrementalKdTreePointsNeighborsProvider
+
+} // namespace segmatch
+
+#endif // SEGMATCH_INCREMENTAL_KDTREE_POINTS_NEIGHBORS_PROVIDER_HPP_
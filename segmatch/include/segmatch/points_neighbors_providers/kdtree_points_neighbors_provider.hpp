@@ -32,16 +32,21 @@ class KdTreePointsNeighborsProvider : public PointsNeighborsProvider<PointT> {
   /// \param points_mapping Mapping from the points stored in the current cloud to the points of
   /// the new point cloud. Point \c i is moved to position \c points_mapping[i]. Values smaller
   /// than 0 indicate that the point has been removed.
+  /// \param excluded_points Flags of the points of the new cloud that are not indexed. If empty,
+  /// all the points are indexed.
   /// \remarks point_cloud must remain a valid object during all the successive calls to
   /// getNeighborsOf()
   void update(const typename pcl::PointCloud<PointT>::ConstPtr point_cloud,
-              const std::vector<int64_t>& points_mapping = {}) override;
+              const std::vector<int64_t>& points_mapping = {},
+              const std::vector<bool>& excluded_points = {}) override;
 
-  /// \brief Gets the indexes of the neighbors of the point with the specified index.
+  /// \brief Appends the indexes of the neighbors of the point with the specified index to a
+  /// vector.
   /// \param point_index Index of the query point.
   /// \param search_radius The radius of the searched neighborhood.
-  /// \return Vector containing the indices of the neighbor points.
-  const PointNeighbors getNeighborsOf(size_t point_index, float search_radius);
+  /// \param neighbors_indices Vector to which the indices of the neighbor points are appended.
+  void appendNeighborsOf(size_t point_index, float search_radius,
+                         std::vector<int>& neighbors_indices) const override;
 
   /// \brief Returns the underlying PCL search object.
   /// \remarks This function is present only for compatibility with the old segmenters and
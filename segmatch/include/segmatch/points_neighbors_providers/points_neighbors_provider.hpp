@@ -1,8 +1,11 @@
 #ifndef SEGMATCH_POINTS_NEIGHBORS_PROVIDER_HPP_
 #define SEGMATCH_POINTS_NEIGHBORS_PROVIDER_HPP_
 
+#include <algorithm>
+#include <thread>
 #include <vector>
 
+#include <glog/logging.h>
 #include <pcl/search/search.h>
 
 #include "segmatch/common.hpp"
@@ -12,6 +15,28 @@ namespace segmatch {
 /// \brief Indices of the neighbors of a point.
 typedef std::vector<int> PointNeighbors;
 
+/// \brief Indices of the neighbors of a batch of points, in compressed sparse row format. The
+/// neighbors of the i-th query point are stored in \c indices between positions \c offsets[i]
+/// and \c offsets[i + 1].
+/// \remark The buffers keep their capacity between queries, thus reusing the same object for
+/// successive queries avoids memory allocations.
+struct PointsNeighborsBatch {
+  std::vector<size_t> offsets;
+  std::vector<int> indices;
+
+  // Buffers in which each thread stores the neighbors it finds during parallel queries.
+  std::vector<std::vector<int>> threads_indices;
+
+  /// \brief Gets the number of query points in the batch.
+  size_t size() const { return offsets.empty() ? 0u : offsets.size() - 1u; }
+
+  /// \brief Gets a pointer to the first neighbor of the i-th query point.
+  const int* begin(const size_t i) const { return indices.data() + offsets[i]; }
+
+  /// \brief Gets a pointer past the last neighbor of the i-th query point.
+  const int* end(const size_t i) const { return indices.data() + offsets[i + 1u]; }
+};
+
 /// \brief Provides point neighborhood information of a point cloud.
 /// \remark The whole refactoring based on the PointsNeighborsProvider interface was meant
 /// especially for the caching of the nearest neighbors. Unfortunately this turned out to be too
@@ -29,16 +54,44 @@ class PointsNeighborsProvider {
   /// \param points_mapping Mapping from the points stored in the current cloud to the points of
   /// the new point cloud. Point \c i is moved to position \c points_mapping[i]. Values smaller
   /// than 0 indicate that the point has been removed.
+  /// \param excluded_points Flags of the points of the new cloud that are not indexed. Excluded
+  /// points are never returned as neighbors, but their neighbors can still be queried. If empty,
+  /// all the points are indexed.
   /// \remarks point_cloud must remain a valid object during all the successive calls to
   /// getNeighborsOf()
   virtual void update(const typename pcl::PointCloud<PointT>::ConstPtr point_cloud,
-                      const std::vector<int64_t>& points_mapping) = 0;
+                      const std::vector<int64_t>& points_mapping,
+                      const std::vector<bool>& excluded_points) = 0;
 
   /// \brief Gets the indexes of the neighbors of the point with the specified index.
   /// \param point_index Index of the query point.
   /// \param search_radius The radius of the searched neighborhood.
   /// \return Vector containing the indices of the neighbor points.
-  virtual const PointNeighbors getNeighborsOf(size_t point_index, float search_radius) = 0;
+  virtual const PointNeighbors getNeighborsOf(size_t point_index, float search_radius) {
+    PointNeighbors neighbors_indices;
+    appendNeighborsOf(point_index, search_radius, neighbors_indices);
+    return neighbors_indices;
+  }
+
+  /// \brief Appends the indexes of the neighbors of the point with the specified index to a
+  /// vector.
+  /// \param point_index Index of the query point.
+  /// \param search_radius The radius of the searched neighborhood.
+  /// \param neighbors_indices Vector to which the indices of the neighbor points are appended.
+  /// \remarks Implementations must not modify the provider, so that multiple threads can search
+  /// for neighbors at the same time.
+  virtual void appendNeighborsOf(size_t point_index, float search_radius,
+                                 std::vector<int>& neighbors_indices) const = 0;
+
+  /// \brief Gets the indexes of the neighbors of a batch of points.
+  /// \param query_indices Pointer to the indices of the query points.
+  /// \param num_queries Number of query points.
+  /// \param search_radius The radius of the searched neighborhood.
+  /// \param neighbors Caller owned buffers in which the neighbors of the query points are stored.
+  /// \param max_num_threads Maximum number of threads used for the search. Small batches are
+  /// searched with fewer threads.
+  void getNeighborsOfPoints(const int* query_indices, size_t num_queries, float search_radius,
+                            PointsNeighborsBatch& neighbors, size_t max_num_threads = 1u) const;
 
   /// \brief Returns the underlying PCL search object.
   /// \remarks This function is present only for compatibility with the old segmenters and
@@ -46,8 +99,79 @@ class PointsNeighborsProvider {
   /// \returns Pointer to the PCL search object. If the provider doesn't use PCL search objects
   /// this function returns null.
   virtual typename pcl::search::Search<PointT>::Ptr getPclSearchObject() = 0;
+
+ protected:
+  /// \brief Gets the indices of the points that are not excluded.
+  /// \param num_points Number of points in the cloud.
+  /// \param excluded_points Flags of the excluded points.
+  /// \returns The indices of the points that are not excluded, or null if no point is excluded.
+  static pcl::IndicesPtr getIncludedPointsIndices(size_t num_points,
+                                                  const std::vector<bool>& excluded_points);
 }; // class DynamicPointNeighborsProvider
 
+template<typename PointT>
+void PointsNeighborsProvider<PointT>::getNeighborsOfPoints(
+    const int* query_indices, const size_t num_queries, const float search_radius,
+    PointsNeighborsBatch& neighbors, const size_t max_num_threads) const {
+  constexpr size_t kMinQueriesPerThread = 512u;
+  neighbors.offsets.resize(num_queries + 1u);
+  neighbors.indices.clear();
+
+  const size_t num_threads = std::max<size_t>(1u, std::min<size_t>(
+      max_num_threads, num_queries / kMinQueriesPerThread));
+  if (num_threads == 1u) {
+    for (size_t i = 0u; i < num_queries; ++i) {
+      neighbors.offsets[i] = neighbors.indices.size();
+      appendNeighborsOf(query_indices[i], search_radius, neighbors.indices);
+    }
+    neighbors.offsets[num_queries] = neighbors.indices.size();
+    return;
+  }
+
+  // Each thread searches a contiguous chunk of queries, storing the offsets relative to the
+  // beginning of its own buffer.
+  const size_t chunk_size = (num_queries + num_threads - 1u) / num_threads;
+  neighbors.threads_indices.resize(num_threads);
+  auto search_chunk = [&](const size_t t) {
+    std::vector<int>& chunk_indices = neighbors.threads_indices[t];
+    chunk_indices.clear();
+    const size_t end = std::min(num_queries, (t + 1u) * chunk_size);
+    for (size_t i = t * chunk_size; i < end; ++i) {
+      neighbors.offsets[i] = chunk_indices.size();
+      appendNeighborsOf(query_indices[i], search_radius, chunk_indices);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1u);
+  for (size_t t = 1u; t < num_threads; ++t) threads.emplace_back(search_chunk, t);
+  search_chunk(0u);
+  for (auto& thread : threads) thread.join();
+
+  // Concatenate the neighbors found by the threads.
+  for (size_t t = 0u; t < num_threads; ++t) {
+    const size_t chunk_offset = neighbors.indices.size();
+    const size_t end = std::min(num_queries, (t + 1u) * chunk_size);
+    for (size_t i = t * chunk_size; i < end; ++i) neighbors.offsets[i] += chunk_offset;
+    neighbors.indices.insert(neighbors.indices.end(), neighbors.threads_indices[t].begin(),
+                             neighbors.threads_indices[t].end());
+  }
+  neighbors.offsets[num_queries] = neighbors.indices.size();
+}
+
+template<typename PointT>
+pcl::IndicesPtr PointsNeighborsProvider<PointT>::getIncludedPointsIndices(
+    const size_t num_points, const std::vector<bool>& excluded_points) {
+  if (excluded_points.empty()) return pcl::IndicesPtr();
+  CHECK_EQ(excluded_points.size(), num_points);
+  pcl::IndicesPtr indices(new std::vector<int>());
+  indices->reserve(num_points);
+  for (size_t i = 0u; i < num_points; ++i) {
+    if (!excluded_points[i]) indices->push_back(i);
+  }
+  return indices;
+}
+
 } // namespace segmatch
 
 #endif // SEGMATCH_POINTS_NEIGHBORS_PROVIDER_HPP_
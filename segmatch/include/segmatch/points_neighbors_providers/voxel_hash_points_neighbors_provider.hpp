@@ -0,0 +1,161 @@
+#ifndef SEGMATCH_VOXEL_HASH_POINTS_NEIGHBORS_PROVIDER_HPP_
+#define SEGMATCH_VOXEL_HASH_POINTS_NEIGHBORS_PROVIDER_HPP_
+
+#include <stdint.h>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+#include <pcl/search/impl/kdtree.hpp>
+#include <pcl/kdtree/impl/kdtree_flann.hpp>
+
+#include "segmatch/common.hpp"
+#include "segmatch/dynamic_voxel_grid.hpp"
+#include "segmatch/points_neighbors_providers/points_neighbors_provider.hpp"
+
+namespace segmatch {
+
+/// \brief Provides point neighborhood information of the centroids of a DynamicVoxelGrid by
+/// looking up the voxels surrounding each point.
+///
+/// Each active centroid lies inside its voxel, thus the neighbors of a point within a given radius
+/// can only be in the voxels at most <tt>floor(radius / resolution) + 1</tt> voxels away from the
+/// voxel of the point. On update, the points are stored in bricks of 4x4x4 voxels indexed by a
+/// flat open addressing hash table, so that the voxels surrounding a point are found with a few
+/// lookups and contiguous memory accesses. Building the table takes linear time.
+///
+/// If a points mapping is given, updates remap the stored points and only insert the new ones.
+/// Inserted points are appended after the points sorted by brick and removed points leave holes,
+/// thus the bricks are rebuilt when the holes outnumber the stored points. Without a mapping, for
+/// example after the map has been transformed, the bricks are rebuilt, which is several times
+/// faster than building a k-d tree but proportional to the size of the map. A query visits every voxel within the search
+/// radius, including the empty ones, thus its cost grows with the cube of the radius in voxels
+/// while the points of a local map lie on surfaces. On the street of
+/// points_neighbors_provider_benchmark, queries are as fast as the ones of the
+/// IncrementalKdTreePointsNeighborsProvider for radii of two voxels and slower for larger radii.
+/// Prefer this provider for radii up to two voxels and when large parts of the map change at every
+/// update, for example when the map is often transformed. Otherwise prefer the
+/// IncrementalKdTreePointsNeighborsProvider, which is faster for larger radii.
+/// \remark The provider references the voxel grid, which must outlive it. The point cloud passed
+/// to update() must be the active centroids of the grid.
+template<typename InputPointT, typename PointT>
+class VoxelHashPointsNeighborsProvider : public PointsNeighborsProvider<PointT> {
+ public:
+  typedef pcl::PointCloud<PointT> PointCloud;
+  typedef DynamicVoxelGrid<InputPointT, PointT> VoxelGrid;
+
+  /// \brief Initializes a new instance of the VoxelHashPointsNeighborsProvider class.
+  /// \param voxel_grid The voxel grid containing the points.
+  explicit VoxelHashPointsNeighborsProvider(const VoxelGrid& voxel_grid)
+    : voxel_grid_(voxel_grid), point_cloud_(nullptr), slots_bits_(0u), num_removed_points_(0u),
+      is_pcl_search_object_valid_(false) {
+  }
+
+  /// \brief Update the points neighborhood provider.
+  /// \param point_cloud The new point cloud. Must be the active centroids of the voxel grid.
+  /// \param points_mapping Mapping from the points stored in the current cloud to the points of
+  /// the new point cloud. If empty, the bricks are rebuilt from the voxel grid. The points that
+  /// are mapped must not have changed voxel.
+  /// \param excluded_points Flags of the points of the new cloud that are not indexed. If empty,
+  /// all the points are indexed.
+  /// \remarks point_cloud must remain a valid object during all the successive calls to
+  /// getNeighborsOf()
+  void update(const typename pcl::PointCloud<PointT>::ConstPtr point_cloud,
+              const std::vector<int64_t>& points_mapping = {},
+              const std::vector<bool>& excluded_points = {}) override;
+
+  /// \brief Appends the indexes of the neighbors of the point with the specified index to a
+  /// vector.
+  /// \param point_index Index of the query point.
+  /// \param search_radius The radius of the searched neighborhood.
+  /// \param neighbors_indices Vector to which the indices of the neighbor points are appended, in
+  /// no particular order.
+  void appendNeighborsOf(size_t point_index, float search_radius,
+                         std::vector<int>& neighbors_indices) const override;
+
+  /// \brief Returns the underlying PCL search object.
+  /// \remarks This function is present only for compatibility with the old segmenters and
+  /// should not be used in new code. The PCL k-d tree is built on demand from the current cloud.
+  /// \returns Pointer to the PCL search object.
+  typename pcl::search::Search<PointT>::Ptr getPclSearchObject() override;
+
+ private:
+  // A slot of the hash table, associating the key of a brick to its position.
+  struct Slot_ {
+    uint64_t brick_key;
+    int brick_index;
+  };
+
+  // Computes the key of the brick containing the voxel with the specified coordinates.
+  static uint64_t getBrickKey_(const Eigen::Vector3i& voxel_coordinates);
+
+  // Computes the key of the brick with the specified brick coordinates.
+  static uint64_t getBrickKeyFromBrickCoordinates_(const Eigen::Vector3i& brick_coordinates);
+
+  // Computes the index of a voxel inside its brick.
+  static int getVoxelInBrick_(const Eigen::Vector3i& voxel_coordinates);
+
+  // Computes the slot of a brick key in the hash table.
+  size_t getSlot_(uint64_t brick_key) const;
+
+  // Finds the brick with the specified key. Returns -1 if the brick doesn't exist.
+  int findBrick_(uint64_t brick_key) const;
+
+  // Adds a brick to the hash table. The table must have an empty slot.
+  void insertSlot_(const Slot_& new_slot);
+
+  // Rebuilds the bricks from the points of the current cloud.
+  void rebuild_();
+
+  // Stores a point in its brick, creating the brick if needed.
+  void insert_(size_t point_index);
+
+  inline bool isExcluded_(const size_t point_index) const {
+    return !excluded_points_.empty() && excluded_points_[point_index];
+  }
+
+  // The voxel grid containing the points.
+  const VoxelGrid& voxel_grid_;
+
+  // The current point cloud.
+  typename pcl::PointCloud<PointT>::ConstPtr point_cloud_;
+
+  // Flags of the points that are not stored in the bricks.
+  std::vector<bool> excluded_points_;
+
+  // Coordinates of the voxel of each point.
+  std::vector<Eigen::Vector3i, Eigen::aligned_allocator<Eigen::Vector3i>> points_coordinates_;
+
+  // The hash table of the bricks. Empty slots have a negative brick index. The number of slots is
+  // a power of two and at least twice the number of bricks.
+  std::vector<Slot_> slots_;
+  uint8_t slots_bits_;
+
+  // A point stored in the bricks.
+  struct BrickPoint_ {
+    Eigen::Vector3f position;
+    int point_index;
+  };
+
+  // The points sorted by brick, followed by the points inserted since the last rebuild. Removed
+  // points have a negative point index.
+  std::vector<BrickPoint_> sorted_points_;
+  size_t num_removed_points_;
+
+  // The index in sorted_points_ of the point contained in each voxel of the bricks, or -1 if the
+  // voxel is empty.
+  std::vector<int> bricks_;
+
+  // PCL k-d tree used only for compatibility with the old segmenters.
+  pcl::search::KdTree<PointT> pcl_kd_tree_;
+  bool is_pcl_search_object_valid_;
+
+  // Bricks contain 2^brick_bits voxels per side.
+  static constexpr int brick_bits = 2;
+  static constexpr int brick_size = 1 << brick_bits;
+  static constexpr int voxels_per_brick = brick_size * brick_size * brick_size;
+}; // class VoxelHashPointsNeighborsProvider
+
+} // namespace segmatch
+
+#endif // SEGMATCH_VOXEL_HASH_POINTS_NEIGHBORS_PROVIDER_HPP_
@@ -37,6 +37,8 @@ struct SegMatchParams {
   std::string normal_estimator_type;
   /// \brief Radius of the neighborhood considered for the estimation of the point normals.
   float radius_for_normal_estimation_m;
+  /// \brief Maximum number of threads used for the estimation of the point normals.
+  int normal_estimator_num_threads = 1;
 
   LocalMapParameters local_map_params;
   DescriptorsParameters descriptors_params;
@@ -69,6 +71,23 @@ class SegMatch {
   /// \brief Process a target cloud.
   void processAndSetAsTargetCloud(MapCloud& target_cloud);
 
+  /// \brief Load a segment map and set it as target cloud. This skips the segmentation and the
+  /// description of the target cloud.
+  /// \param filename Path of the segment map file.
+  /// \param target_cloud_filename Path of the cloud the segment map was computed from. The cloud
+  /// doesn't need to exist. Segment maps computed from a cloud with another path or with other
+  /// segmentation and description parameters are not loaded.
+  /// \returns True if the segment map has been loaded, false otherwise.
+  bool loadTargetSegmentMap(const std::string& filename,
+                            const std::string& target_cloud_filename);
+
+  /// \brief Save the target cloud as a segment map.
+  /// \param filename Path of the segment map file.
+  /// \param target_cloud_filename Path of the cloud the target was computed from.
+  /// \returns True if the segment map has been saved, false otherwise.
+  bool saveTargetSegmentMap(const std::string& filename,
+                            const std::string& target_cloud_filename) const;
+
   /// \brief Transfer the source cloud to the target cloud.
   void transferSourceToTarget(unsigned int track_id = 0u,
                               laser_slam::Time timestamp_ns = 0u);
@@ -194,8 +213,16 @@ class SegMatch {
  private:
   laser_slam::Time findTimeOfClosestSegmentationPose(const segmatch::Segment& segment) const;
 
+  // Describe the target cloud path and the parameters used to segment and describe it, so that
+  // stale segment maps can be detected.
+  std::string computeTargetSegmentMapFingerprint(const std::string& target_cloud_filename) const;
+
+  // Remove the segments that are too close to older segments. If specified, the IDs of the
+  // removed segments and of the segments whose features changed are appended to
+  // modified_segment_ids.
   void filterNearestSegmentsInCloud(SegmentedCloud& cloud, double minimum_distance_m,
-                                    unsigned int n_nearest_segments = 2u);
+                                    unsigned int n_nearest_segments = 2u,
+                                    std::vector<Id>* modified_segment_ids = NULL);
 
   SegMatchParams params_;
 
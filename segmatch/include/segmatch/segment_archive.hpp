@@ -0,0 +1,175 @@
+#ifndef SEGMATCH_SEGMENT_ARCHIVE_HPP_
+#define SEGMATCH_SEGMENT_ARCHIVE_HPP_
+
+#include <stdint.h>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "segmatch/memory_mapped_file.hpp"
+#include "segmatch/segmented_cloud.hpp"
+
+namespace segmatch {
+
+// A segment archive is a columnar binary file storing views of segments. All the sections start
+// at offsets that are multiple of 8 bytes:
+//  - Header
+//  - Points of all the views. Each view stores its points, the points to be published and the
+//    reconstruction contiguously, starting from SegmentArchiveRecord::first_point.
+//  - One SegmentArchiveRecord per view, sorted by segment ID and view index.
+//  - Descriptors of all the views, one row of FeatureValueType per record.
+//  - Descriptor schema: one "feature_name\tvalue_name\n" line per descriptor value.
+//  - Fingerprint: free text identifying how the archive was produced.
+// Points are streamed to the file while views are appended. The records, descriptors and schema
+// are kept in memory and written when the archive is closed.
+
+/// \brief Information about one view of a segment stored in a segment archive.
+struct SegmentArchiveRecord {
+  int64_t segment_id;
+  int64_t timestamp_ns;
+  double linkpose_position[3];
+  // Quaternion of the link pose, stored as (w, x, y, z).
+  double linkpose_rotation[4];
+  float centroid[3];
+  uint32_t view_index;
+  uint32_t semantic;
+  uint32_t track_id;
+  uint32_t n_occupied_voxels;
+  uint32_t n_points_when_last_described;
+  uint32_t has_descriptor;
+  uint32_t num_points;
+  uint32_t num_points_to_publish;
+  uint32_t num_reconstruction_points;
+  uint64_t first_point;
+};
+
+/// \brief A point stored in a segment archive.
+struct SegmentArchivePoint {
+  float x;
+  float y;
+  float z;
+};
+
+/// \brief Name of a feature and name of one of its values.
+typedef std::pair<std::string, std::string> DescriptorValueName;
+
+/// \brief Writes segment views to a segment archive.
+/// \remark All the views with features must have been described with the same descriptors.
+class SegmentArchiveWriter {
+ public:
+  SegmentArchiveWriter() = default;
+
+  /// \brief Closes the archive if it is still open.
+  ~SegmentArchiveWriter();
+
+  // Prevent copy and assignment.
+  SegmentArchiveWriter(const SegmentArchiveWriter&) = delete;
+  SegmentArchiveWriter& operator=(const SegmentArchiveWriter&) = delete;
+
+  /// \brief Create a new archive. Any existing file is overwritten.
+  /// \returns True if the file could be created, false otherwise.
+  bool open(const std::string& filename);
+
+  /// \brief Append one view of a segment to the archive.
+  /// \returns True if the view has been appended, false if it could not be written or if its
+  /// descriptors differ from the ones of the previous views.
+  bool appendView(const Segment& segment, size_t view_index);
+
+  /// \brief Append the views of a segment to the archive.
+  /// \param append_all_views If true, all the views are appended, otherwise only the last one.
+  bool appendSegment(const Segment& segment, bool append_all_views = true);
+
+  /// \brief Set the fingerprint stored in the archive when it is closed. It identifies the data
+  /// and the parameters the archive was produced from, so that stale archives can be detected.
+  void setFingerprint(const std::string& fingerprint) { fingerprint_ = fingerprint; }
+
+  /// \brief Write the index of the archive and close the file.
+  /// \returns True if the whole archive has been written successfully, false otherwise.
+  bool close();
+
+  bool isOpen() const { return output_file_.is_open(); }
+  size_t getNumberOfViews() const { return records_.size(); }
+
+ private:
+  void writePadding();
+
+  std::ofstream output_file_;
+  std::string filename_;
+  bool failed_ = false;
+
+  uint64_t points_offset_ = 0u;
+  uint64_t num_points_ = 0u;
+  std::vector<SegmentArchivePoint> points_buffer_;
+
+  std::vector<SegmentArchiveRecord> records_;
+  // Descriptors of the views, one row per record.
+  std::vector<FeatureValueType> descriptors_;
+  std::vector<DescriptorValueName> schema_;
+  bool schema_known_ = false;
+  std::string fingerprint_;
+}; // class SegmentArchiveWriter
+
+/// \brief Zero-copy reader of segment archives.
+/// The archive is memory mapped and all the accessors return pointers inside the mapping, which
+/// stay valid until the reader is closed or destroyed.
+class SegmentArchiveReader {
+ public:
+  SegmentArchiveReader() = default;
+
+  /// \brief Map a segment archive in memory and validate its index.
+  /// \returns True if the archive is valid, false otherwise.
+  bool open(const std::string& filename);
+
+  void close();
+
+  size_t getNumberOfViews() const { return num_views_; }
+  const SegmentArchiveRecord& getRecord(const size_t index) const { return records_[index]; }
+
+  /// \brief Get the points of a view. The number of points is given by the record.
+  const SegmentArchivePoint* getPoints(const size_t index) const {
+    return points_ + records_[index].first_point;
+  }
+  const SegmentArchivePoint* getPointsToPublish(const size_t index) const {
+    return getPoints(index) + records_[index].num_points;
+  }
+  const SegmentArchivePoint* getReconstruction(const size_t index) const {
+    return getPointsToPublish(index) + records_[index].num_points_to_publish;
+  }
+
+  /// \brief Get the descriptor of a view, or \c nullptr if the view has not been described.
+  /// The size of the descriptor is the size of the descriptor schema.
+  const FeatureValueType* getDescriptor(const size_t index) const {
+    return records_[index].has_descriptor ? descriptors_ + index * schema_.size() : nullptr;
+  }
+  const std::vector<DescriptorValueName>& getDescriptorSchema() const { return schema_; }
+  const std::string& getFingerprint() const { return fingerprint_; }
+
+  /// \brief Find the records of the views of a segment.
+  /// \returns True if the segment is in the archive. Its views are then the records in the
+  /// range [\c begin, \c end).
+  bool findSegmentViews(Id segment_id, size_t* begin, size_t* end) const;
+
+  /// \brief Copy a view out of the archive.
+  void getSegmentView(size_t index, SegmentView* view) const;
+
+  /// \brief Copy the segments of the archive in a segmented cloud.
+  /// \param read_all_views If true, all the views are read, otherwise only the last one.
+  /// \returns The largest segment ID in the archive.
+  Id readSegmentedCloud(SegmentedCloud* segmented_cloud, bool read_all_views = true) const;
+
+ private:
+  MemoryMappedFile file_;
+  size_t num_views_ = 0u;
+  const SegmentArchiveRecord* records_ = nullptr;
+  const SegmentArchivePoint* points_ = nullptr;
+  const FeatureValueType* descriptors_ = nullptr;
+  std::vector<DescriptorValueName> schema_;
+  // Layouts of the features of the schema, in order.
+  std::vector<const FeatureLayout*> descriptor_layouts_;
+  std::string fingerprint_;
+}; // class SegmentArchiveReader
+
+} // namespace segmatch
+
+#endif // SEGMATCH_SEGMENT_ARCHIVE_HPP_
@@ -0,0 +1,36 @@
+#ifndef SEGMATCH_SEGMENT_MAP_HPP_
+#define SEGMATCH_SEGMENT_MAP_HPP_
+
+#include <string>
+
+#include "segmatch/segmented_cloud.hpp"
+
+namespace segmatch {
+
+/// \brief Save the last view of the segments of a segmented cloud, together with their centroids,
+/// descriptors and semantics, in a segment map. A segment map is a segment archive containing
+/// only the last views (See segment_archive.hpp).
+/// Loading a segment map is much faster than segmenting and describing the original point cloud,
+/// which makes it the preferred way to store target maps used for localization.
+/// \remark All the segments with features must have been described with the same descriptors.
+/// \param filename Path of the segment map file.
+/// \param segmented_cloud The segmented cloud to be saved.
+/// \param fingerprint Identifies the cloud and the parameters the segments were computed from.
+/// \returns True if the segment map has been saved, false otherwise.
+bool saveSegmentMap(const std::string& filename, const SegmentedCloud& segmented_cloud,
+                    const std::string& fingerprint = "");
+
+/// \brief Load a segment map saved with \c saveSegmentMap().
+/// The segment ID counter is advanced past the IDs of the loaded segments so that new segments
+/// do not collide with them.
+/// \param filename Path of the segment map file.
+/// \param segmented_cloud Segmented cloud where the segments are stored. Its content is replaced.
+/// \param fingerprint Expected fingerprint of the segment map. Segment maps saved with a different
+/// fingerprint are stale and are not loaded.
+/// \returns True if the segment map has been loaded, false otherwise.
+bool loadSegmentMap(const std::string& filename, SegmentedCloud* segmented_cloud,
+                    const std::string& fingerprint = "");
+
+} // namespace segmatch
+
+#endif // SEGMATCH_SEGMENT_MAP_HPP_
@@ -1,6 +1,7 @@
 #ifndef SEGMATCH_SEGMENTED_CLOUD_HPP_
 #define SEGMATCH_SEGMENTED_CLOUD_HPP_
 
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include <unordered_map>
@@ -14,6 +15,7 @@
 #include <pcl/point_types.h>
 #include <pcl/segmentation/conditional_euclidean_clustering.h>
 
+#include "segmatch/batch_points_transformer.hpp"
 #include "segmatch/common.hpp"
 #include "segmatch/utilities.hpp"
 #include "segmatch/features.hpp"
@@ -120,6 +122,7 @@ class SegmentedCloud {
   bool empty() const { return getNumberOfValidSegments() == 0; }
   bool findValidSegmentById(const Id segment_id, Segment* result) const;
   bool findValidSegmentPtrById(const Id segment_id, Segment** result);
+  bool findValidSegmentPtrById(const Id segment_id, const Segment** result) const;
   void deleteSegmentsById(const std::vector<Id>& ids, size_t* n_removals=NULL);
 
   void deleteSegmentsExcept(const std::vector<Id>& segment_ids_to_keep);
@@ -128,14 +131,14 @@ class SegmentedCloud {
   void clear();
   void calculateSegmentCentroids();
   void transform(const Eigen::Matrix4f& transform_matrix) {
+    BatchPointsTransformer points_transformer;
     for (auto& id_segment : valid_segments_) {
       for (auto& view : id_segment.second.views) {
-        pcl::transformPointCloud(view.point_cloud, view.point_cloud,
-                                 transform_matrix);
-        pcl::transformPointCloud(view.reconstruction, view.reconstruction,
-                                 transform_matrix);
+        points_transformer.add(transform_matrix, view.point_cloud);
+        points_transformer.add(transform_matrix, view.reconstruction);
       }
     }
+    points_transformer.run();
     calculateSegmentCentroids(); // TODO: is transforming the centroids faster?
   }
   SegmentedCloud transformed(const Eigen::Matrix4f& transform_matrix) const {
@@ -195,6 +198,10 @@ class SegmentedCloud {
   /// \param new_id Value of the next ID that will be assigned to a segment.
   void resetSegmentIdCounter(const Id new_id = 1) { current_id_ = new_id - 1; }
 
+  /// \brief Make sure that the IDs assigned to new segments are larger than the specified ID.
+  /// \param id Largest ID that is already used by segments loaded from outside this process.
+  void reserveSegmentIdsUpTo(const Id id) { current_id_ = std::max(current_id_, id); }
+
   /// \brief Gets the number of segment pairs whose distance between centroids is less or equal
   /// \c max_distance.
   /// \param max_distance The maximum distance so that two segments can be considered close.
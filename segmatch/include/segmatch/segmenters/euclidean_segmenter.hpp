@@ -1,7 +1,11 @@
 #ifndef SEGMATCH_EUCLIDEAN_SEGMENTER_HPP_
 #define SEGMATCH_EUCLIDEAN_SEGMENTER_HPP_
 
+#include <stddef.h>
 #include <string>
+#include <vector>
+
+#include <pcl/PointIndices.h>
 
 #include "segmatch/parameters.hpp"
 #include "segmatch/common.hpp"
@@ -14,6 +18,10 @@ namespace segmatch {
 class SegmentedCloud;
 
 /// \brief Simple Euclidean segmenter.
+/// Clusters are the sets of points connected by chains of points closer than the growing radius.
+/// They are found by linking the points of neighboring voxels of a sparse voxel grid with a
+/// union-find, which gives the same clusters as \c pcl::extractEuclideanClusters() without
+/// radius searches.
 template<typename ClusteredPointT>
 class EuclideanSegmenter : public Segmenter<ClusteredPointT> {
  public:
@@ -34,7 +42,8 @@ class EuclideanSegmenter : public Segmenter<ClusteredPointT> {
   /// \param is_point_modified Indicates for each point if it has been modified such that its
   /// cluster assignment may change.
   /// \param cloud The point cloud that must be segmented.
-  /// \param points_neighbors_provider Object providing nearest neighbors information.
+  /// \param points_neighbors_provider Object providing nearest neighbors information. Unused, the
+  /// segmenter builds its own voxel grid.
   /// \param segmented_cloud Cloud to which the valid segments will be added.
   /// \param cluster_ids_to_segment_ids Mapping between cluster IDs and segment IDs. Cluster
   /// \c i generates segment \c cluster_ids_to_segments_ids[i]. If
@@ -50,11 +59,20 @@ class EuclideanSegmenter : public Segmenter<ClusteredPointT> {
                std::vector<std::pair<Id, Id>>& renamed_segments) override;
 
  private:
+  // Finds the clusters of the cloud. Clusters are ordered by their smallest point index and their
+  // indices are sorted, as in pcl::extractEuclideanClusters(). Non-finite points are ignored.
+  void extractClusters(const ClusteredCloud& cloud,
+                       std::vector<pcl::PointIndices>& clusters) const;
+
+  // Computes the key of the voxel with the specified coordinates.
+  static uint64_t getVoxelKey(const Eigen::Vector3i& voxel_coordinates);
+
   // Parameters and shortcuts.
   const SegmenterParameters params_;
   const int min_segment_size_;
   const int max_segment_size_;
   const float radius_for_growing_;
+  const size_t num_threads_;
 
 }; // class EuclideanSegmenter
 
@@ -5,8 +5,14 @@
 
 #include "segmatch/segmenters/euclidean_segmenter.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+#include <glog/logging.h>
 #include <laser_slam/benchmarker.hpp>
-#include <pcl/segmentation/extract_clusters.h>
 
 #include "segmatch/segmented_cloud.hpp"
 
@@ -24,7 +30,10 @@ EuclideanSegmenter<ClusteredPointT>::EuclideanSegmenter(
     const SegmenterParameters& params)
     : params_(params), min_segment_size_(params.min_cluster_size),
       max_segment_size_(params.max_cluster_size),
-      radius_for_growing_(params.radius_for_growing) { }
+      radius_for_growing_(params.radius_for_growing),
+      num_threads_(static_cast<size_t>(std::max(1, params.num_threads))) {
+  CHECK_GT(radius_for_growing_, 0.0f);
+}
 
 template<typename ClusteredPointT>
 void EuclideanSegmenter<ClusteredPointT>::segment(
@@ -38,9 +47,7 @@ void EuclideanSegmenter<ClusteredPointT>::segment(
   segmented_cloud.clear();
 
   std::vector<pcl::PointIndices> cluster_indices;
-  pcl::extractEuclideanClusters<ClusteredPointT>(
-      cloud, points_neighbors_provider.getPclSearchObject(), radius_for_growing_, cluster_indices,
-      min_segment_size_,max_segment_size_);
+  extractClusters(cloud, cluster_indices);
 
   for (const auto& point_indices : cluster_indices) {
     segmented_cloud.addSegment(point_indices, cloud);
@@ -50,6 +57,197 @@ void EuclideanSegmenter<ClusteredPointT>::segment(
         << " clusters ."<< std::endl;
 }
 
+//=================================================================================================
+//    EuclideanSegmenter private methods implementation
+//=================================================================================================
+
+template<typename ClusteredPointT>
+void EuclideanSegmenter<ClusteredPointT>::extractClusters(
+    const ClusteredCloud& cloud, std::vector<pcl::PointIndices>& clusters) const {
+  clusters.clear();
+  if (cloud.empty()) return;
+  CHECK_LT(cloud.size(), static_cast<size_t>(std::numeric_limits<int>::max()));
+
+  // Compute the coordinates of the voxels containing the points. With voxels as large as the
+  // growing radius, points closer than the radius are in the same voxel or in neighboring ones.
+  BENCHMARK_START("SM.Worker.Segmenter.BuildVoxels");
+  const float inv_voxel_size = 1.0f / radius_for_growing_;
+  std::vector<Eigen::Vector3i, Eigen::aligned_allocator<Eigen::Vector3i>> points_coordinates(
+      cloud.size());
+  std::vector<bool> is_point_finite(cloud.size());
+  Eigen::Vector3i min_coordinates = Eigen::Vector3i::Constant(std::numeric_limits<int>::max());
+  Eigen::Vector3i max_coordinates = Eigen::Vector3i::Constant(std::numeric_limits<int>::min());
+  for (size_t i = 0u; i < cloud.size(); ++i) {
+    const ClusteredPointT& point = cloud[i];
+    is_point_finite[i] = std::isfinite(point.x) && std::isfinite(point.y) &&
+        std::isfinite(point.z);
+    if (!is_point_finite[i]) continue;
+    points_coordinates[i] = (point.getVector3fMap() * inv_voxel_size).array().floor()
+        .template cast<int>();
+    min_coordinates = min_coordinates.cwiseMin(points_coordinates[i]);
+    max_coordinates = max_coordinates.cwiseMax(points_coordinates[i]);
+  }
+
+  // Voxel coordinates are made non-negative, so that they fit in the 21 bits of the keys.
+  CHECK_LT((max_coordinates - min_coordinates).maxCoeff(), (1 << 21) - 1)
+      << "The cloud is too large for the growing radius.";
+
+  // Sort the points by voxel key, keeping them in increasing index order inside each voxel.
+  std::vector<std::pair<uint64_t, int>> points_keys;
+  points_keys.reserve(cloud.size());
+  for (size_t i = 0u; i < cloud.size(); ++i) {
+    if (is_point_finite[i]) {
+      points_keys.emplace_back(getVoxelKey(points_coordinates[i] - min_coordinates), i);
+    }
+  }
+  std::sort(points_keys.begin(), points_keys.end());
+
+  // Build the sparse voxel grid, copying the positions of the points so that the points of a
+  // voxel are contiguous in memory.
+  const size_t num_sorted_points = points_keys.size();
+  std::vector<Eigen::Vector3f> sorted_points(num_sorted_points);
+  std::vector<int> points_sorted_indices(cloud.size(), -1);
+  std::vector<uint64_t> voxels_keys;
+  std::vector<size_t> voxels_offsets;
+  for (size_t i = 0u; i < num_sorted_points; ++i) {
+    if (i == 0u || points_keys[i].first != points_keys[i - 1u].first) {
+      voxels_keys.push_back(points_keys[i].first);
+      voxels_offsets.push_back(i);
+    }
+    points_sorted_indices[points_keys[i].second] = i;
+    sorted_points[i] = cloud[points_keys[i].second].getVector3fMap();
+  }
+  voxels_offsets.push_back(num_sorted_points);
+  const size_t num_voxels = voxels_keys.size();
+  BENCHMARK_STOP("SM.Worker.Segmenter.BuildVoxels");
+  BENCHMARK_RECORD_VALUE("SM.Worker.Segmenter.NumVoxels", num_voxels);
+
+  // Link the sorted points closer than the growing radius with a concurrent union-find. Roots are
+  // always linked to the root with the smaller index, so the clusters don't depend on the threads
+  // scheduling.
+  BENCHMARK_START("SM.Worker.Segmenter.LinkPoints");
+  std::vector<std::atomic<int>> parents(num_sorted_points);
+  for (size_t i = 0u; i < num_sorted_points; ++i) parents[i].store(i);
+  auto find_root = [&](int index) {
+    int parent = parents[index].load();
+    while (parent != index) {
+      // Path halving, skipped when the parent is the root to avoid useless atomic writes.
+      const int grandparent = parents[parent].load();
+      if (grandparent != parent) parents[index].compare_exchange_weak(parent, grandparent);
+      index = grandparent;
+      parent = parents[index].load();
+    }
+    return index;
+  };
+  auto link_points = [&](int root_1, int root_2) {
+    while (true) {
+      root_1 = find_root(root_1);
+      root_2 = find_root(root_2);
+      if (root_1 == root_2) break;
+      if (root_1 < root_2) std::swap(root_1, root_2);
+      int expected_parent = root_1;
+      if (parents[root_1].compare_exchange_strong(expected_parent, root_2)) break;
+    }
+  };
+
+  // Each pair of neighboring voxels of the 26-neighborhood is visited once, from the voxel with
+  // the smaller key. Since coordinates never reach the largest 21 bits value, the key of a
+  // neighbor is the key of the voxel plus a constant offset and neighbors are found by sweeping
+  // the sorted voxel keys, without any hashing.
+  std::vector<uint64_t> neighbor_key_offsets;
+  for (int dz = 0; dz <= 1; ++dz) {
+    for (int dy = dz == 0 ? 0 : -1; dy <= 1; ++dy) {
+      for (int dx = dz == 0 && dy == 0 ? 1 : -1; dx <= 1; ++dx) {
+        neighbor_key_offsets.push_back((int64_t(dz) << 42) + (int64_t(dy) << 21) + dx);
+      }
+    }
+  }
+  const float radius_squared = radius_for_growing_ * radius_for_growing_;
+  auto link_points_of_voxels = [&](const size_t voxel_1_index, const size_t voxel_2_index) {
+    for (size_t point_1 = voxels_offsets[voxel_1_index];
+         point_1 < voxels_offsets[voxel_1_index + 1u]; ++point_1) {
+      for (size_t point_2 = voxel_1_index == voxel_2_index ? point_1 + 1u :
+           voxels_offsets[voxel_2_index]; point_2 < voxels_offsets[voxel_2_index + 1u];
+           ++point_2) {
+        if ((sorted_points[point_1] - sorted_points[point_2]).squaredNorm() < radius_squared)
+          link_points(point_1, point_2);
+      }
+    }
+  };
+  auto link_voxels = [&](const size_t begin, const size_t end) {
+    if (begin >= end) return;
+
+    // Position of the next candidate neighbor for each offset, which only moves forward.
+    std::vector<size_t> neighbor_positions;
+    for (const auto key_offset : neighbor_key_offsets) {
+      neighbor_positions.push_back(std::lower_bound(voxels_keys.begin(), voxels_keys.end(),
+                                                    voxels_keys[begin] + key_offset) -
+                                   voxels_keys.begin());
+    }
+
+    for (size_t voxel_index = begin; voxel_index < end; ++voxel_index) {
+      link_points_of_voxels(voxel_index, voxel_index);
+      for (size_t i = 0u; i < neighbor_key_offsets.size(); ++i) {
+        const uint64_t neighbor_key = voxels_keys[voxel_index] + neighbor_key_offsets[i];
+        size_t& neighbor_position = neighbor_positions[i];
+        while (neighbor_position < num_voxels && voxels_keys[neighbor_position] < neighbor_key)
+          ++neighbor_position;
+        if (neighbor_position < num_voxels && voxels_keys[neighbor_position] == neighbor_key)
+          link_points_of_voxels(voxel_index, neighbor_position);
+      }
+    }
+  };
+
+  // Each thread processes a range of consecutive voxel keys, i.e. a slab of the cloud.
+  const size_t voxels_per_thread = (num_voxels + num_threads_ - 1u) / num_threads_;
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads_ - 1u);
+  for (size_t t = 1u; t < num_threads_; ++t) {
+    threads.emplace_back(link_voxels, std::min(num_voxels, t * voxels_per_thread),
+                         std::min(num_voxels, (t + 1u) * voxels_per_thread));
+  }
+  link_voxels(0u, std::min(num_voxels, voxels_per_thread));
+  for (auto& thread : threads) thread.join();
+  BENCHMARK_STOP("SM.Worker.Segmenter.LinkPoints");
+
+  // Create the clusters with valid size. Scanning the cloud in order, the first point found for
+  // each cluster is its smallest point index.
+  BENCHMARK_START("SM.Worker.Segmenter.ExtractClusters");
+  std::vector<int> sorted_points_roots(num_sorted_points);
+  std::vector<size_t> roots_sizes(num_sorted_points, 0u);
+  for (size_t i = 0u; i < num_sorted_points; ++i) {
+    sorted_points_roots[i] = find_root(i);
+    ++roots_sizes[sorted_points_roots[i]];
+  }
+  // Cluster index of each root, -1 if the cluster is not valid and -2 if not visited yet.
+  std::vector<int> roots_clusters(num_sorted_points, -2);
+  for (size_t i = 0u; i < cloud.size(); ++i) {
+    if (points_sorted_indices[i] < 0) continue;
+    const int root = sorted_points_roots[points_sorted_indices[i]];
+    if (roots_clusters[root] == -2) {
+      if (roots_sizes[root] >= static_cast<size_t>(min_segment_size_) &&
+          roots_sizes[root] <= static_cast<size_t>(max_segment_size_)) {
+        roots_clusters[root] = clusters.size();
+        clusters.emplace_back();
+        clusters.back().indices.reserve(roots_sizes[root]);
+      } else {
+        roots_clusters[root] = -1;
+      }
+    }
+    if (roots_clusters[root] >= 0) clusters[roots_clusters[root]].indices.push_back(i);
+  }
+  BENCHMARK_STOP("SM.Worker.Segmenter.ExtractClusters");
+}
+
+template<typename ClusteredPointT>
+inline uint64_t EuclideanSegmenter<ClusteredPointT>::getVoxelKey(
+    const Eigen::Vector3i& voxel_coordinates) {
+  // Voxel coordinates are non-negative and fit in 21 bits.
+  return static_cast<uint64_t>(voxel_coordinates.x()) |
+      (static_cast<uint64_t>(voxel_coordinates.y()) << 21u) |
+      (static_cast<uint64_t>(voxel_coordinates.z()) << 42u);
+}
+
 } // namespace segmatch
 
 #endif // SEGMATCH_IMPL_EUCLIDEAN_SEGMENTER_HPP_
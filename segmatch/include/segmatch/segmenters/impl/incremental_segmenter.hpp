@@ -4,6 +4,9 @@
 #include "segmatch/segmenters/incremental_segmenter.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
 
 #include <laser_slam/benchmarker.hpp>
 
@@ -28,11 +31,11 @@ void IncrementalSegmenter<ClusteredPointT, PolicyName>::segment(
   BENCHMARK_BLOCK("SM.Worker.Segmenter");
   renamed_segments.clear();
 
-  // Build partial cluster sets for the old clusters.
-  PartialClusters partial_clusters(cluster_ids_to_segment_ids.size());
-  for (size_t i = 0u; i < partial_clusters.size(); i++) {
-    partial_clusters[i].partial_clusters_set->partial_clusters_indices.insert(i);
-    partial_clusters[i].partial_clusters_set->segment_id = cluster_ids_to_segment_ids[i];
+  // Build partial clusters for the old clusters.
+  PartialClusters partial_clusters;
+  partial_clusters.reserve(cluster_ids_to_segment_ids.size());
+  for (size_t i = 0u; i < cluster_ids_to_segment_ids.size(); i++) {
+    partial_clusters.emplace_back(i, cluster_ids_to_segment_ids[i]);
   }
 
   // Find old clusters and new partial clusters.
@@ -73,37 +76,49 @@ inline std::pair<Id, Id> IncrementalSegmenter<ClusteredPointT, PolicyName>::merg
   }
 }
 
+template<typename ClusteredPointT, typename PolicyName>
+inline size_t IncrementalSegmenter<ClusteredPointT, PolicyName>::findRoot(
+    PartialClusters& partial_clusters, size_t partial_cluster_index) const {
+  while (partial_clusters[partial_cluster_index].parent != partial_cluster_index) {
+    const size_t parent_index = partial_clusters[partial_cluster_index].parent;
+    partial_clusters[partial_cluster_index].parent = partial_clusters[parent_index].parent;
+    partial_cluster_index = parent_index;
+  }
+  return partial_cluster_index;
+}
+
 template<typename ClusteredPointT, typename PolicyName>
 inline void IncrementalSegmenter<ClusteredPointT, PolicyName>::linkPartialClusters(
     const size_t partial_cluster_1_index, const size_t partial_cluster_2_index,
     PartialClusters& partial_clusters, std::vector<std::pair<Id, Id>>& renamed_segments) const {
-  // Get pointers to the partial cluster sets
-  PartialClustersSetPtr set_1 = partial_clusters[partial_cluster_1_index].partial_clusters_set;
-  PartialClustersSetPtr set_2 = partial_clusters[partial_cluster_2_index].partial_clusters_set;
+  size_t root_1_index = findRoot(partial_clusters, partial_cluster_1_index);
+  size_t root_2_index = findRoot(partial_clusters, partial_cluster_2_index);
 
-  // Both partial clusters belong to the same set. Nothing to do.
-  if (set_1 == set_2) return;
+  // Both partial clusters belong to the same cluster. Nothing to do.
+  if (root_1_index == root_2_index) return;
 
-  // Swap the partial cluster indices if it makes the merge operation faster.
-  if (set_1->partial_clusters_indices.size() < set_2->partial_clusters_indices.size()) {
-    std::swap(set_1, set_2);
+  // Attach the smaller tree to the root of the larger one.
+  if (partial_clusters[root_1_index].num_partial_clusters <
+      partial_clusters[root_2_index].num_partial_clusters) {
+    std::swap(root_1_index, root_2_index);
   }
+  PartialCluster& root_1 = partial_clusters[root_1_index];
+  PartialCluster& root_2 = partial_clusters[root_2_index];
+  root_2.parent = root_1_index;
+  root_1.num_partial_clusters += root_2.num_partial_clusters;
 
-  // Move the linked indices from set_2 to set_1 and determine the segment ID.
-  set_1->partial_clusters_indices.insert(set_2->partial_clusters_indices.begin(),
-                                         set_2->partial_clusters_indices.end());
+  // Append the list of the partial clusters of root_2 to the one of root_1.
+  partial_clusters[root_1.last].next = root_2_index;
+  root_1.last = root_2.last;
+
+  // Determine the segment ID.
   Id old_segment_id;
-  std::tie(old_segment_id, set_1->segment_id) = mergeSegmentIds(set_1->segment_id,
-                                                                set_2->segment_id);
+  std::tie(old_segment_id, root_1.segment_id) = mergeSegmentIds(root_1.segment_id,
+                                                                root_2.segment_id);
 
   // Detect if a segment renaming happened
   if (old_segment_id != kNoId && old_segment_id != kInvId)
-    renamed_segments.push_back({ old_segment_id, set_1->segment_id });
-
-  // Update all partial clusters contained in set_2 so that they point to set_1.
-  for (const auto partial_cluster_index : set_2->partial_clusters_indices) {
-    partial_clusters[partial_cluster_index].partial_clusters_set = set_1;
-  }
+    renamed_segments.push_back({ old_segment_id, root_1.segment_id });
 }
 
 template<typename ClusteredPointT, typename PolicyName>
@@ -111,50 +126,56 @@ inline void IncrementalSegmenter<ClusteredPointT, PolicyName>::growRegionFromSee
     const PointNormals& normals, const ClusteredCloud& cloud,
     PointsNeighborsProvider<ClusteredPointT>& points_neighbors_provider, const size_t seed_index,
     std::vector<bool>& processed, PartialClusters& partial_clusters,
-    std::vector<std::pair<Id, Id>>& renamed_segments) const {
+    std::vector<std::pair<Id, Id>>& renamed_segments, PointsNeighborsBatch& neighbors) const {
   // Create a new partial cluster.
-  partial_clusters.emplace_back();
+  const size_t partial_cluster_id = partial_clusters.size();
+  partial_clusters.emplace_back(partial_cluster_id);
   PartialCluster& partial_cluster = partial_clusters.back();
-  size_t partial_cluster_id = partial_clusters.size() - 1u;
-  partial_cluster.partial_clusters_set = std::make_shared<PartialClustersSet>();
-  partial_cluster.partial_clusters_set->partial_clusters_indices.insert(partial_cluster_id);
+  partial_cluster.is_modified = true;
 
   // Initialize the seeds queue.
   std::vector<size_t>& region_indices = partial_cluster.point_indices;
-  std::vector<size_t> seed_queue;
+  std::vector<int> seed_queue;
   size_t current_seed_index = 0u;
   seed_queue.push_back(seed_index);
   region_indices.push_back(seed_index);
 
   // Search for neighbors until there are no more seeds.
   while (current_seed_index < seed_queue.size()) {
-    // Search for points around the seed.
-    std::vector<int> neighbors_indices = points_neighbors_provider.getNeighborsOf(
-        seed_queue[current_seed_index], search_radius_);
+    // Search for points around all the seeds currently in the queue. The neighbors of a seed do
+    // not depend on the processing of the previous seeds, thus the order of the decisions is
+    // unchanged.
+    const size_t num_seeds = seed_queue.size() - current_seed_index;
+    points_neighbors_provider.getNeighborsOfPoints(&seed_queue[current_seed_index], num_seeds,
+                                                   search_radius_, neighbors);
 
     // Decide on which points should we continue the search and if we have to link partial
     // clusters.
-    for (const auto neighbor_index : neighbors_indices) {
-      if (neighbor_index != -1 && Policy::canGrowToPoint(
-          policy_params_, normals, seed_queue[current_seed_index], neighbor_index)) {
-        if (isPointAssignedToCluster(cloud[neighbor_index])) {
-          // If the search reaches an existing cluster we link to its partial clusters set.
-          if (partial_cluster_id != getClusterId(cloud[neighbor_index])) {
-            linkPartialClusters(partial_cluster_id, getClusterId(cloud[neighbor_index]),
-                                partial_clusters, renamed_segments);
-          }
-        } else if (!processed[neighbor_index]) {
-          // Determine if the point can be used as seed for the region.
-          if (Policy::canPointBeSeed(policy_params_, normals, neighbor_index)) {
-            seed_queue.push_back(neighbor_index);
+    for (size_t i = 0u; i < num_seeds; ++i, ++current_seed_index) {
+      const int current_seed = seed_queue[current_seed_index];
+      for (const int* neighbor_it = neighbors.begin(i); neighbor_it != neighbors.end(i);
+           ++neighbor_it) {
+        const int neighbor_index = *neighbor_it;
+        if (neighbor_index != -1 && !isPointGround(cloud[neighbor_index]) &&
+            Policy::canGrowToPoint(policy_params_, normals, current_seed, neighbor_index)) {
+          if (isPointAssignedToCluster(cloud[neighbor_index])) {
+            // If the search reaches an existing cluster we link to its partial clusters set.
+            if (partial_cluster_id != getClusterId(cloud[neighbor_index])) {
+              linkPartialClusters(partial_cluster_id, getClusterId(cloud[neighbor_index]),
+                                  partial_clusters, renamed_segments);
+            }
+          } else if (!processed[neighbor_index]) {
+            // Determine if the point can be used as seed for the region.
+            if (Policy::canPointBeSeed(policy_params_, normals, neighbor_index)) {
+              seed_queue.push_back(neighbor_index);
+            }
+            // Assign the point to the current partial cluster.
+            region_indices.push_back(neighbor_index);
+            processed[neighbor_index] = true;
           }
-          // Assign the point to the current partial cluster.
-          region_indices.push_back(neighbor_index);
-          processed[neighbor_index] = true;
         }
       }
     }
-    ++current_seed_index;
   }
 }
 
@@ -167,13 +188,20 @@ inline void IncrementalSegmenter<ClusteredPointT, PolicyName>::growRegions(
   BENCHMARK_BLOCK("SM.Worker.Segmenter.GrowRegions");
 
   std::vector<bool> processed(cloud.size(), false);
+  PointsNeighborsBatch neighbors;
   std::vector<size_t> new_points_indices;
   new_points_indices.reserve(cloud.size());
 
   for (size_t i = 0u; i < cloud.size(); ++i) {
-    if (isPointAssignedToCluster(cloud[i])) {
-      // No need to cluster points that are already assigned.
-      partial_clusters[getClusterId(cloud[i])].point_indices.push_back(i);
+    if (isPointGround(cloud[i])) {
+      // Ground points are never segmented.
+      continue;
+    } else if (isPointAssignedToCluster(cloud[i])) {
+      // No need to cluster points that are already assigned. Only count them and detect the
+      // clusters containing modified points.
+      PartialCluster& partial_cluster = partial_clusters[getClusterId(cloud[i])];
+      ++partial_cluster.num_assigned_points;
+      if (!is_point_modified.empty() && is_point_modified[i]) partial_cluster.is_modified = true;
     } else if (Policy::canPointBeSeed(policy_params_, normals, i)) {
       new_points_indices.emplace_back(i);
     }
@@ -182,6 +210,12 @@ inline void IncrementalSegmenter<ClusteredPointT, PolicyName>::growRegions(
   // Prepare the seed indices.
   Policy::prepareSeedIndices(normals, new_points_indices.begin(), new_points_indices.end());
 
+  if (num_threads_ > 1u) {
+    growRegionsInParallel(normals, cloud, points_neighbors_provider, new_points_indices,
+                          partial_clusters, renamed_segments);
+    return;
+  }
+
   // Process the new points.
   // TODO: The current implementation ignores any change in the normal/curvature of a point,
   // ignoring cases in which changes in the properties of a point would lead to different
@@ -191,25 +225,263 @@ inline void IncrementalSegmenter<ClusteredPointT, PolicyName>::growRegions(
       // Mark the point as processed and grow the cluster starting from it.
       processed[i] = true;
       growRegionFromSeed(normals, cloud, points_neighbors_provider, i, processed, partial_clusters,
-                         renamed_segments);
+                         renamed_segments, neighbors);
+    }
+  }
+}
+
+template<typename ClusteredPointT, typename PolicyName>
+inline void IncrementalSegmenter<ClusteredPointT, PolicyName>::growRegionsInTiles(
+    const PointNormals& normals, const ClusteredCloud& cloud,
+    const PointsNeighborsProvider<ClusteredPointT>& points_neighbors_provider,
+    const size_t thread_index, const std::vector<size_t>& seed_indices,
+    const std::vector<size_t>& seed_ranks, std::vector<int>& point_partial_clusters,
+    ThreadRegions& regions) const {
+  PointsNeighborsBatch neighbors;
+  std::vector<int> seed_queue;
+
+  for (const auto seed_rank : seed_ranks) {
+    const size_t seed_index = seed_indices[seed_rank];
+    if (point_partial_clusters[seed_index] != -1) continue;
+
+    // Create a new partial cluster.
+    const size_t partial_cluster_index = regions.partial_clusters_points.size();
+    regions.partial_clusters_points.emplace_back();
+    regions.partial_clusters_seed_ranks.push_back(seed_rank);
+    std::vector<size_t>& region_indices = regions.partial_clusters_points.back();
+    point_partial_clusters[seed_index] = partial_cluster_index;
+    region_indices.push_back(seed_index);
+    seed_queue.assign(1u, seed_index);
+    size_t current_seed_index = 0u;
+
+    // Search for neighbors until there are no more seeds. This follows growRegionFromSeed(),
+    // except that the points of other threads are only recorded as border links.
+    while (current_seed_index < seed_queue.size()) {
+      const size_t num_seeds = seed_queue.size() - current_seed_index;
+      points_neighbors_provider.getNeighborsOfPoints(&seed_queue[current_seed_index], num_seeds,
+                                                     search_radius_, neighbors);
+
+      for (size_t i = 0u; i < num_seeds; ++i, ++current_seed_index) {
+        const int current_seed = seed_queue[current_seed_index];
+        for (const int* neighbor_it = neighbors.begin(i); neighbor_it != neighbors.end(i);
+             ++neighbor_it) {
+          const int neighbor_index = *neighbor_it;
+          if (neighbor_index == -1 || isPointGround(cloud[neighbor_index]) ||
+              !Policy::canGrowToPoint(policy_params_, normals, current_seed, neighbor_index)) {
+            continue;
+          }
+
+          if (isPointAssignedToCluster(cloud[neighbor_index])) {
+            // Link to the existing cluster, skipping consecutive duplicate links.
+            const std::pair<size_t, ClusterId> link(partial_cluster_index,
+                                                    getClusterId(cloud[neighbor_index]));
+            if (regions.old_cluster_links.empty() || regions.old_cluster_links.back() != link)
+              regions.old_cluster_links.push_back(link);
+          } else if (getTileThread(cloud[neighbor_index]) != thread_index) {
+            regions.border_links.emplace_back(partial_cluster_index, neighbor_index);
+          } else if (!Policy::canPointBeSeed(policy_params_, normals, neighbor_index)) {
+            // The point is assigned once all the regions reaching it are known, skipping
+            // consecutive duplicate claims.
+            if (point_partial_clusters[neighbor_index] != partial_cluster_index) {
+              point_partial_clusters[neighbor_index] = partial_cluster_index;
+              regions.point_claims.emplace_back(partial_cluster_index, neighbor_index);
+            }
+          } else if (point_partial_clusters[neighbor_index] == -1) {
+            seed_queue.push_back(neighbor_index);
+            region_indices.push_back(neighbor_index);
+            point_partial_clusters[neighbor_index] = partial_cluster_index;
+          }
+        }
+      }
+    }
+  }
+}
+
+template<typename ClusteredPointT, typename PolicyName>
+inline void IncrementalSegmenter<ClusteredPointT, PolicyName>::growRegionsInParallel(
+    const PointNormals& normals, const ClusteredCloud& cloud,
+    const PointsNeighborsProvider<ClusteredPointT>& points_neighbors_provider,
+    const std::vector<size_t>& seed_indices, PartialClusters& partial_clusters,
+    std::vector<std::pair<Id, Id>>& renamed_segments) const {
+  // Distribute the seeds to the threads owning their tiles. Seeds are referenced by their rank in
+  // seed_indices, so that each thread processes them in the same order as the single-threaded
+  // segmentation.
+  std::vector<std::vector<size_t>> thread_seed_ranks(num_threads_);
+  for (size_t i = 0u; i < seed_indices.size(); ++i) {
+    thread_seed_ranks[getTileThread(cloud[seed_indices[i]])].push_back(i);
+  }
+
+  // Grow the regions. Each thread only writes the entries of point_partial_clusters
+  // corresponding to the points in its own tiles.
+  std::vector<int> point_partial_clusters(cloud.size(), -1);
+  std::vector<ThreadRegions> thread_regions(num_threads_);
+  auto grow_regions = [&](const size_t t) {
+    growRegionsInTiles(normals, cloud, points_neighbors_provider, t, seed_indices,
+                       thread_seed_ranks[t], point_partial_clusters, thread_regions[t]);
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads_ - 1u);
+  for (size_t t = 1u; t < num_threads_; ++t) threads.emplace_back(grow_regions, t);
+  grow_regions(0u);
+  for (auto& thread : threads) thread.join();
+
+  // Append the partial clusters of the threads ordered by the rank of their seeds. For
+  // symmetric policies, the first partial cluster of each cluster is then the one started by the
+  // single-threaded segmentation, and clusters get the same IDs.
+  std::vector<std::pair<size_t, std::pair<size_t, size_t>>> seed_ranks_to_partial_clusters;
+  std::vector<std::vector<size_t>> thread_partial_clusters_indices(num_threads_);
+  for (size_t t = 0u; t < num_threads_; ++t) {
+    const std::vector<size_t>& seed_ranks = thread_regions[t].partial_clusters_seed_ranks;
+    thread_partial_clusters_indices[t].resize(seed_ranks.size());
+    for (size_t i = 0u; i < seed_ranks.size(); ++i) {
+      seed_ranks_to_partial_clusters.push_back({ seed_ranks[i], { t, i } });
+    }
+  }
+  std::sort(seed_ranks_to_partial_clusters.begin(), seed_ranks_to_partial_clusters.end());
+  const size_t first_new_partial_cluster = partial_clusters.size();
+  for (const auto& seed_rank_to_partial_cluster : seed_ranks_to_partial_clusters) {
+    const size_t t = seed_rank_to_partial_cluster.second.first;
+    const size_t i = seed_rank_to_partial_cluster.second.second;
+    thread_partial_clusters_indices[t][i] = partial_clusters.size();
+    partial_clusters.emplace_back(partial_clusters.size());
+    partial_clusters.back().is_modified = true;
+    partial_clusters.back().point_indices =
+        std::move(thread_regions[t].partial_clusters_points[i]);
+  }
+
+  // Resolve the border links. Points that can be seeds have been reached by their own thread,
+  // so the two partial clusters must be joined. Points that cannot be seeds are claimed by the
+  // partial cluster.
+  std::vector<std::pair<uint32_t, uint32_t>> partial_clusters_links;
+  std::vector<std::pair<size_t, size_t>> point_claims;
+  for (size_t t = 0u; t < num_threads_; ++t) {
+    for (const auto& link : thread_regions[t].border_links) {
+      const size_t partial_cluster_index = thread_partial_clusters_indices[t][link.first];
+      const size_t point_index = link.second;
+      if (Policy::canPointBeSeed(policy_params_, normals, point_index)) {
+        const size_t other_index = thread_partial_clusters_indices[
+            getTileThread(cloud[point_index])][point_partial_clusters[point_index]];
+        partial_clusters_links.emplace_back(
+            partial_cluster_index - first_new_partial_cluster,
+            other_index - first_new_partial_cluster);
+      } else {
+        point_claims.emplace_back(point_index, partial_cluster_index - first_new_partial_cluster);
+      }
+    }
+    for (const auto& claim : thread_regions[t].point_claims) {
+      point_claims.emplace_back(claim.second, thread_partial_clusters_indices[t][claim.first] -
+                                first_new_partial_cluster);
+    }
+  }
+
+  // Join the linked partial clusters with a concurrent union-find. Roots are always linked to
+  // the root with the smaller index, so the result doesn't depend on the threads scheduling.
+  const size_t num_new_partial_clusters = partial_clusters.size() - first_new_partial_cluster;
+  std::vector<std::atomic<uint32_t>> parents(num_new_partial_clusters);
+  for (size_t i = 0u; i < num_new_partial_clusters; ++i) parents[i].store(i);
+  auto find_root = [&](uint32_t index) {
+    uint32_t parent = parents[index].load();
+    while (parent != index) {
+      // Path halving.
+      const uint32_t grandparent = parents[parent].load();
+      parents[index].compare_exchange_weak(parent, grandparent);
+      index = grandparent;
+      parent = parents[index].load();
+    }
+    return index;
+  };
+  auto join_links = [&](const size_t begin, const size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      uint32_t root_1 = partial_clusters_links[i].first;
+      uint32_t root_2 = partial_clusters_links[i].second;
+      while (true) {
+        root_1 = find_root(root_1);
+        root_2 = find_root(root_2);
+        if (root_1 == root_2) break;
+        if (root_1 < root_2) std::swap(root_1, root_2);
+        uint32_t expected_parent = root_1;
+        if (parents[root_1].compare_exchange_strong(expected_parent, root_2)) break;
+      }
+    }
+  };
+  const size_t links_per_thread = (partial_clusters_links.size() + num_threads_ - 1u) /
+      num_threads_;
+  threads.clear();
+  for (size_t t = 1u; t < num_threads_; ++t) {
+    threads.emplace_back(join_links, std::min(partial_clusters_links.size(),
+                                              t * links_per_thread),
+                         std::min(partial_clusters_links.size(), (t + 1u) * links_per_thread));
+  }
+  join_links(0u, std::min(partial_clusters_links.size(), links_per_thread));
+  for (auto& thread : threads) thread.join();
+
+  // Add the points that cannot be seeds to the cluster with the smallest root among the ones
+  // claiming them. The roots are the partial clusters with the smallest seed ranks, thus this is
+  // the cluster that reaches the point first in the single-threaded segmentation.
+  for (auto& claim : point_claims) claim.second = find_root(claim.second);
+  std::sort(point_claims.begin(), point_claims.end());
+  for (size_t i = 0u; i < point_claims.size(); ++i) {
+    if (i == 0u || point_claims[i].first != point_claims[i - 1u].first) {
+      partial_clusters[first_new_partial_cluster + point_claims[i].second].point_indices.push_back(
+          point_claims[i].first);
+    }
+  }
+
+  // New partial clusters don't have segment IDs, thus joining them doesn't rename segments.
+  for (size_t i = 0u; i < num_new_partial_clusters; ++i) {
+    const uint32_t root = find_root(i);
+    if (root != i) {
+      linkPartialClusters(first_new_partial_cluster + root, first_new_partial_cluster + i,
+                          partial_clusters, renamed_segments);
+    }
+  }
+
+  // Link to the existing clusters, following the order of the partial clusters.
+  std::vector<std::pair<size_t, ClusterId>> old_cluster_links;
+  for (size_t t = 0u; t < num_threads_; ++t) {
+    for (const auto& link : thread_regions[t].old_cluster_links) {
+      old_cluster_links.emplace_back(thread_partial_clusters_indices[t][link.first], link.second);
     }
   }
+  std::stable_sort(old_cluster_links.begin(), old_cluster_links.end(),
+                   [](const std::pair<size_t, ClusterId>& link_1,
+                      const std::pair<size_t, ClusterId>& link_2) {
+    return link_1.first < link_2.first;
+  });
+  for (const auto& link : old_cluster_links) {
+    linkPartialClusters(link.first, link.second, partial_clusters, renamed_segments);
+  }
+}
+
+template<typename ClusteredPointT, typename PolicyName>
+inline size_t IncrementalSegmenter<ClusteredPointT, PolicyName>::getTileThread(
+    const ClusteredPointT& point) const noexcept {
+  const int64_t tile_x = static_cast<int64_t>(std::floor(point.x / tile_size_));
+  const int64_t tile_y = static_cast<int64_t>(std::floor(point.y / tile_size_));
+  const uint64_t hash = static_cast<uint64_t>(tile_x) * 73856093u ^
+      static_cast<uint64_t>(tile_y) * 19349663u;
+  return static_cast<size_t>(hash % num_threads_);
 }
 
 template<typename ClusteredPointT, typename PolicyName>
 inline size_t IncrementalSegmenter<ClusteredPointT, PolicyName>::assignClusterIndices(
-    const PartialClusters& partial_clusters) const {
+    PartialClusters& partial_clusters) const {
   BENCHMARK_BLOCK("SM.Worker.Segmenter.AssignClusterIndices");
 
   // Assign cluster IDs.
   ClusterId next_cluster_id = 1u;
-  for (const auto& partial_cluster : partial_clusters) {
-    const PartialClustersSetPtr& partial_clusters_set = partial_cluster.partial_clusters_set;
-    if (!partial_cluster.point_indices.empty() &&
-        partial_clusters_set->cluster_id == kUnassignedClusterId) {
-      // Assign a cluster index only if the set didn't get one yet and the partial cluster
+  for (size_t i = 0u; i < partial_clusters.size(); ++i) {
+    // Link the partial cluster directly to its root, so that the following steps don't need to
+    // search for roots.
+    const size_t root_index = findRoot(partial_clusters, i);
+    partial_clusters[i].parent = root_index;
+    PartialCluster& root = partial_clusters[root_index];
+    const bool has_points = partial_clusters[i].num_assigned_points != 0u ||
+        !partial_clusters[i].point_indices.empty();
+    if (has_points && root.cluster_id == kUnassignedClusterId) {
+      // Assign a cluster index only if the cluster didn't get one yet and the partial cluster
       // contains at least one point.
-      partial_clusters_set->cluster_id = next_cluster_id;
+      root.cluster_id = next_cluster_id;
       ++next_cluster_id;
     }
   }
@@ -222,10 +494,20 @@ inline void IncrementalSegmenter<ClusteredPointT, PolicyName>::writeClusterIndic
     const PartialClusters& partial_clusters, ClusteredCloud& cloud) const {
   BENCHMARK_BLOCK("SM.Worker.Segmenter.WriteClusterIndices");
 
-  // Write cluster IDs in the point cloud.
+  // Write cluster IDs of the points that were already assigned. Their old cluster ID is the index
+  // of their partial cluster.
+  for (auto& point : cloud) {
+    if (isPointAssignedToCluster(point)) {
+      const size_t root_index = partial_clusters[getClusterId(point)].parent;
+      setClusterId(point, partial_clusters[root_index].cluster_id);
+    }
+  }
+
+  // Write cluster IDs of the new points.
   for (const auto& partial_cluster : partial_clusters) {
+    const ClusterId cluster_id = partial_clusters[partial_cluster.parent].cluster_id;
     for (const auto point_id : partial_cluster.point_indices) {
-      setClusterId(cloud[point_id], partial_cluster.partial_clusters_set->cluster_id);
+      setClusterId(cloud[point_id], cluster_id);
     }
   }
 }
@@ -243,38 +525,74 @@ inline void IncrementalSegmenter<ClusteredPointT, PolicyName>::addSegmentsToSegm
   if (!cluster_ids_to_segment_ids.empty()) cluster_ids_to_segment_ids[0] = kNoId;
 
   std::vector<Id> segment_ids_to_keep;
+  std::vector<std::pair<ClusterId, Id>> clusters_to_add;
+  std::vector<bool> is_cluster_added(num_clusters, false);
 
   for (size_t i = 0u; i < partial_clusters.size(); i++) {
-    const PartialClustersSetPtr& partial_clusters_set = partial_clusters[i].partial_clusters_set;
-    const ClusterId cluster_id = partial_clusters_set->cluster_id;
+    const size_t root_index = partial_clusters[i].parent;
+    const PartialCluster& root = partial_clusters[root_index];
+    const ClusterId cluster_id = root.cluster_id;
 
     // Only process clusters once.
     if (cluster_ids_to_segment_ids[cluster_id] != kUnassignedId) continue;
 
-    const Id old_segment_id = partial_clusters_set->segment_id;
+    const Id old_segment_id = root.segment_id;
     if (old_segment_id == kInvId) {
       // Skip invalidated segments
       cluster_ids_to_segment_ids[cluster_id] = kInvId;
     } else {
-      const size_t points_in_cluster = getClusterSize(partial_clusters, i);
+      const size_t points_in_cluster = getClusterSize(partial_clusters, root_index);
       if (points_in_cluster > max_segment_size_) {
         // Invalidate segments with too many points.
         cluster_ids_to_segment_ids[cluster_id] = kInvId;
+      } else if (update_only_modified_segments_ && old_segment_id != kNoId &&
+          !isClusterModified(partial_clusters, root_index, old_segment_id, segmented_cloud)) {
+        // Keep the segment as it is.
+        cluster_ids_to_segment_ids[cluster_id] = old_segment_id;
+        segment_ids_to_keep.push_back(old_segment_id);
       } else if (old_segment_id != kNoId || points_in_cluster >= min_segment_size_) {
-        // Create the segment, reusing the previous segment ID if present.
-        pcl::PointIndices point_indices;
-        point_indices.indices = getClusterIndices(partial_clusters, i);
-        cluster_ids_to_segment_ids[cluster_id] = segmented_cloud.addSegment(
-            point_indices, cloud, old_segment_id);
-
-        segment_ids_to_keep.push_back(cluster_ids_to_segment_ids[cluster_id]);
-        BENCHMARK_RECORD_VALUE("SM.SegmentSize", point_indices.indices.size());
+        // Create the segment once its points have been found, reusing the previous segment ID if
+        // present.
+        cluster_ids_to_segment_ids[cluster_id] = kNoId;
+        clusters_to_add.emplace_back(cluster_id, old_segment_id);
+        is_cluster_added[cluster_id] = true;
       } else {
         // The cluster doesn't have enough points, don't assign a segment yet.
         cluster_ids_to_segment_ids[cluster_id] = kNoId;
       }
     }
   }
+  BENCHMARK_RECORD_VALUE("SM.NumAddedSegments", clusters_to_add.size());
+
+  // Find the points of the clusters that must be added with a counting sort on their cluster IDs.
+  std::vector<size_t> clusters_offsets(num_clusters + 1u, 0u);
+  for (const auto& point : cloud) {
+    if (!isPointGround(point) && is_cluster_added[getClusterId(point)])
+      ++clusters_offsets[getClusterId(point) + 1u];
+  }
+  for (size_t i = 0u; i < num_clusters; ++i) clusters_offsets[i + 1u] += clusters_offsets[i];
+  std::vector<int> clusters_points_indices(clusters_offsets.back());
+  std::vector<size_t> next_point_positions(clusters_offsets.begin(), clusters_offsets.end() - 1u);
+  for (size_t i = 0u; i < cloud.size(); ++i) {
+    const ClusterId cluster_id = getClusterId(cloud[i]);
+    if (!isPointGround(cloud[i]) && is_cluster_added[cluster_id]) {
+      clusters_points_indices[next_point_positions[cluster_id]++] = i;
+    }
+  }
+
+  // Add the segments, in the same order in which the clusters have been found.
+  for (const auto& cluster_to_add : clusters_to_add) {
+    const ClusterId cluster_id = cluster_to_add.first;
+    pcl::PointIndices point_indices;
+    point_indices.indices.assign(
+        clusters_points_indices.begin() + clusters_offsets[cluster_id],
+        clusters_points_indices.begin() + clusters_offsets[cluster_id + 1u]);
+    cluster_ids_to_segment_ids[cluster_id] = segmented_cloud.addSegment(
+        point_indices, cloud, cluster_to_add.second);
+
+    segment_ids_to_keep.push_back(cluster_ids_to_segment_ids[cluster_id]);
+    BENCHMARK_RECORD_VALUE("SM.SegmentSize", point_indices.indices.size());
+  }
 
   // Delete the segments that we did not keep.
   segmented_cloud.deleteSegmentsExcept(segment_ids_to_keep);
@@ -282,36 +600,38 @@ inline void IncrementalSegmenter<ClusteredPointT, PolicyName>::addSegmentsToSegm
 
 template<typename ClusteredPointT, typename PolicyName>
 inline size_t IncrementalSegmenter<ClusteredPointT, PolicyName>::getClusterSize(
-    const PartialClusters& partial_clusters, const size_t partial_cluster_index) const {
+    const PartialClusters& partial_clusters, const size_t root_index) const {
   size_t points_in_cluster = 0u;
-  const PartialClustersSetPtr& partial_clusters_set =
-      partial_clusters[partial_cluster_index].partial_clusters_set;
-  for (const auto linked_partial_cluster_index : partial_clusters_set->partial_clusters_indices) {
-    points_in_cluster += partial_clusters[linked_partial_cluster_index].point_indices.size();
+  for (size_t i = root_index; i != kNoPartialCluster; i = partial_clusters[i].next) {
+    points_in_cluster += partial_clusters[i].num_assigned_points +
+        partial_clusters[i].point_indices.size();
   }
   return points_in_cluster;
 }
 
 template<typename ClusteredPointT, typename PolicyName>
-inline std::vector<int> IncrementalSegmenter<ClusteredPointT, PolicyName>::getClusterIndices(
-    const PartialClusters& partial_clusters, const size_t partial_cluster_index) const {
-  const PartialClustersSetPtr& partial_clusters_set =
-      partial_clusters[partial_cluster_index].partial_clusters_set;
-
-  std::vector<int> point_indices;
-  point_indices.reserve(getClusterSize(partial_clusters, partial_cluster_index));
-  for (const auto linked_partial_cluster_index : partial_clusters_set->partial_clusters_indices) {
-    point_indices.insert(point_indices.end(),
-                         partial_clusters[linked_partial_cluster_index].point_indices.begin(),
-                         partial_clusters[linked_partial_cluster_index].point_indices.end());
-  }
-  return point_indices;
+inline bool IncrementalSegmenter<ClusteredPointT, PolicyName>::isClusterModified(
+    const PartialClusters& partial_clusters, const size_t root_index, const Id segment_id,
+    SegmentedCloud& segmented_cloud) const {
+  const PartialCluster& root = partial_clusters[root_index];
+  if (root.num_partial_clusters != 1u || root.is_modified) return true;
+
+  // Without new or modified points, the cluster can only have lost points.
+  Segment* segment;
+  return !segmented_cloud.findValidSegmentPtrById(segment_id, &segment) || segment->empty() ||
+      segment->getLastView().point_cloud.size() != root.num_assigned_points;
 }
 
 template<typename ClusteredPointT, typename PolicyName>
 inline bool IncrementalSegmenter<ClusteredPointT, PolicyName>::isPointAssignedToCluster(
     const ClusteredPointT& point) const noexcept {
-  return getClusterId(point) != 0u;
+  return getClusterId(point) != 0u && getClusterId(point) != kGroundClusterId;
+}
+
+template<typename ClusteredPointT, typename PolicyName>
+inline bool IncrementalSegmenter<ClusteredPointT, PolicyName>::isPointGround(
+    const ClusteredPointT& point) const noexcept {
+  return getClusterId(point) == kGroundClusterId;
 }
 
 template<typename ClusteredPointT, typename PolicyName>
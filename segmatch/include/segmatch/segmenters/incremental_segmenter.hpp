@@ -1,11 +1,13 @@
 #ifndef SEGMATCH_INCREMENTAL_SEGMENTER_HPP_
 #define SEGMATCH_INCREMENTAL_SEGMENTER_HPP_
 
-#include <memory>
+#include <algorithm>
+#include <limits>
 #include <stddef.h>
-#include <unordered_set>
 #include <vector>
 
+#include <glog/logging.h>
+
 #include "segmatch/common.hpp"
 #include "segmatch/parameters.hpp"
 #include "segmatch/segmenters/region_growing_policy.hpp"
@@ -19,6 +21,13 @@ class SegmentedCloud;
 /// \brief Generic incremental region growing segmenter.
 /// Extract segments by growing regions in the point cloud according to a specific policy. Allows
 /// to update already segmented clouds by segmenting new points only.
+/// \remark With more than one thread, the seeds are partitioned in XY tiles which are assigned
+/// to the threads. Each thread grows regions inside its own tiles, and regions reaching each
+/// other across tile borders are stitched together afterwards. Cluster IDs may differ from the
+/// ones of the single-threaded segmentation, but segment IDs and renaming follow the same rules.
+/// \remark If \c update_only_modified_segments is set, segments whose cluster didn't get new or
+/// modified points and didn't lose points are left untouched in the segmented cloud: their points
+/// are not copied again and no view is added to them.
 template<typename ClusteredPointT, typename PolicyName>
 class IncrementalSegmenter : public Segmenter<ClusteredPointT> {
  public:
@@ -35,17 +44,22 @@ class IncrementalSegmenter : public Segmenter<ClusteredPointT> {
     , search_radius_(params.radius_for_growing)
     , min_segment_size_(params.min_cluster_size)
     , max_segment_size_(params.max_cluster_size)
+    , num_threads_(static_cast<size_t>(std::max(1, params.num_threads)))
+    , tile_size_(params.parallel_tile_size_m)
+    , update_only_modified_segments_(params.update_only_modified_segments)
     , policy_params_(Policy::createParameters(params)) {
+    CHECK_GT(params.parallel_tile_size_m, 0.0f);
   }
 
   /// \brief Cluster the given point cloud, writing the found segments in the segmented cloud. Only
   /// points that are not assigned to a cluster (have the PolicyName::getPointClusterId(point)
-  /// equal to zero) will be used as candidate seeds.
+  /// equal to zero) will be used as candidate seeds. Points with cluster ID equal to
+  /// \c kGroundClusterId are ground points and are ignored.
   /// If cluster IDs change, the \c cluster_ids_to_segment_ids mapping is updated accordingly.
   /// \param normals The normal vectors of the point cloud. This can be an empty cloud if the
   /// the segmenter doesn't require normals.
   /// \param is_point_modified Indicates for each point if it has been modified such that its
-  /// cluster assignment may change.
+  /// cluster assignment may change. This can be an empty vector if no point has been modified.
   /// \param cloud The point cloud that must be segmented.
   /// \param points_neighbors_provider Object providing nearest neighbors information.
   /// \param segmented_cloud Cloud to which the valid segments will be added.
@@ -66,41 +80,93 @@ class IncrementalSegmenter : public Segmenter<ClusteredPointT> {
  private:
   typedef uint32_t ClusterId;
 
-  // Helper data structures for discovering and linking partial clusters.
-  struct PartialClustersSet {
-    ClusterId cluster_id = kUnassignedClusterId;
-    Id segment_id = kNoId;
-    std::unordered_set<size_t> partial_clusters_indices;
-  };
-  typedef std::shared_ptr<PartialClustersSet> PartialClustersSetPtr;
-
+  // Helper data structure for discovering and linking partial clusters. Linked partial clusters
+  // form the trees of a disjoint-set forest stored in the partial clusters vector. The root of
+  // each tree holds the data of the cluster and is the head of an intrusive list of the partial
+  // clusters in the cluster.
   struct PartialCluster {
-    PartialCluster() : partial_clusters_set(new PartialClustersSet()) { }
+    explicit PartialCluster(const size_t index, const Id segment_id = kNoId)
+      : parent(index), last(index), segment_id(segment_id) { }
+    // Indices of the new points of the partial cluster.
     std::vector<size_t> point_indices;
-    PartialClustersSetPtr partial_clusters_set;
+    // Number of points already assigned to the cluster in the cloud. These points are not listed
+    // in point_indices, as they can be found through their cluster ID.
+    size_t num_assigned_points = 0u;
+    // Indicates if the partial cluster contains new or modified points.
+    bool is_modified = false;
+    // Parent of the partial cluster in the disjoint-set forest. Roots are their own parent.
+    size_t parent;
+    // Next partial cluster in the list of the cluster.
+    size_t next = kNoPartialCluster;
+    // Data of the cluster, only valid at the root.
+    size_t last;
+    size_t num_partial_clusters = 1u;
+    ClusterId cluster_id = kUnassignedClusterId;
+    Id segment_id;
   };
   typedef std::vector<PartialCluster> PartialClusters;
 
+  // Partial clusters found by one thread of the parallel region growing, with the rank of their
+  // seeds, their links to old clusters and to points owned by other threads, and the points that
+  // cannot be seeds that they reached. Partial clusters are referenced by their index in
+  // \c partial_clusters_points.
+  struct ThreadRegions {
+    std::vector<std::vector<size_t>> partial_clusters_points;
+    std::vector<size_t> partial_clusters_seed_ranks;
+    std::vector<std::pair<size_t, ClusterId>> old_cluster_links;
+    std::vector<std::pair<size_t, size_t>> border_links;
+    std::vector<std::pair<size_t, size_t>> point_claims;
+  };
+
   // Determine the ID of a segment created by the merging of segments with IDs \c id_1 and \c id_2.
   // In case two segments are merged, the first ID is the discarded ID, and the second ID is the
   // ID used for the merged segment. In the other cases the first ID specifies if one of the
   // segments was kInvId or kNoId.
   std::pair<Id, Id> mergeSegmentIds(Id id_1, Id id_2) const;
 
+  // Finds the root of the cluster containing the partial cluster at index
+  // \c partial_cluster_index, halving the path to it.
+  size_t findRoot(PartialClusters& partial_clusters, size_t partial_cluster_index) const;
+
   // Specifies that two partial clusters belong to the same cluster and must be linked. As a result
-  // of this operation, both partial clusters will point to the same partial clusters set.
+  // of this operation, both partial clusters will have the same root.
   void linkPartialClusters(size_t partial_cluster_1_index, size_t partial_cluster_2_index,
                            PartialClusters& partial_clusters,
                            std::vector<std::pair<Id, Id>>& renamed_segments) const;
 
   // Grows a region starting from the specified seed point. This finds all the new points belonging
   // to the same cluster and possibly links to existing clusters. The resulting partial cluster is
-  // added to the \c partial_clusters vector.
+  // added to the \c partial_clusters vector. \c neighbors provides the buffers used for the
+  // neighbors searches.
   void growRegionFromSeed(const PointNormals& normals, const ClusteredCloud& cloud,
                           PointsNeighborsProvider<ClusteredPointT>& points_neighbors_provider,
                           size_t seed_index, std::vector<bool>& processed,
                           PartialClusters& partial_clusters,
-                          std::vector<std::pair<Id, Id>>& renamed_segments) const;
+                          std::vector<std::pair<Id, Id>>& renamed_segments,
+                          PointsNeighborsBatch& neighbors) const;
+
+  // Grows regions from the seeds located in the tiles owned by thread \c thread_index, given by
+  // their ranks \c seed_ranks in \c seed_indices. Points owned by other threads are not added to
+  // the regions, but recorded as border links. Points that cannot be seeds are not added to the
+  // regions either, but recorded as claims.
+  // \c point_partial_clusters stores for each point owned by the thread the index of its
+  // partial cluster in \c regions, or -1 if the point has not been reached yet.
+  void growRegionsInTiles(const PointNormals& normals, const ClusteredCloud& cloud,
+                          const PointsNeighborsProvider<ClusteredPointT>& points_neighbors_provider,
+                          size_t thread_index, const std::vector<size_t>& seed_indices,
+                          const std::vector<size_t>& seed_ranks,
+                          std::vector<int>& point_partial_clusters, ThreadRegions& regions) const;
+
+  // Grows regions from the seeds on multiple threads and stitches the regions found by the
+  // threads, linking them to the existing partial clusters.
+  void growRegionsInParallel(
+      const PointNormals& normals, const ClusteredCloud& cloud,
+      const PointsNeighborsProvider<ClusteredPointT>& points_neighbors_provider,
+      const std::vector<size_t>& seed_indices, PartialClusters& partial_clusters,
+      std::vector<std::pair<Id, Id>>& renamed_segments) const;
+
+  // Gets the index of the thread owning the tile in which a point is located.
+  size_t getTileThread(const ClusteredPointT& point) const noexcept;
 
   // Clusters a point cloud. Only new or modified points are used as seeds.
   void growRegions(const PointNormals& normals, const std::vector<bool>& is_point_modified,
@@ -109,36 +175,41 @@ class IncrementalSegmenter : public Segmenter<ClusteredPointT> {
                    PartialClusters& partial_clusters,
                    std::vector<std::pair<Id, Id>>& renamed_segments) const;
 
-  // Assign cluster indices to the sets of partial clusters, so that linked clusters have the same
-  // cluster index and clusters use contiguous indices starting from 1. Returns the total number of
-  // clusters.
-  size_t assignClusterIndices(const PartialClusters& partial_clusters) const;
+  // Assign cluster indices to the roots of the partial clusters, so that linked clusters have the
+  // same cluster index and clusters use contiguous indices starting from 1. This also links each
+  // partial cluster directly to its root. Returns the total number of clusters.
+  size_t assignClusterIndices(PartialClusters& partial_clusters) const;
 
   // Write the cluster indices in the point cloud so that they can be reused in future
-  // segmentations.
+  // segmentations. Must be called after assignClusterIndices(), and before
+  // addSegmentsToSegmentedCloud() which finds the points of the clusters by their index.
   void writeClusterIndicesToCloud(const PartialClusters& partial_clusters,
                                   ClusteredCloud& cloud) const;
 
   // Adds the segments to a segmented cloud and updates \c cluster_ids_to_segment_ids to reflect
-  // the new mapping between cluster IDs and segment IDs.
+  // the new mapping between cluster IDs and segment IDs. Must be called after
+  // assignClusterIndices().
   void addSegmentsToSegmentedCloud(const ClusteredCloud& cloud,
                                    const PartialClusters& partial_clusters, size_t num_clusters,
                                    std::vector<Id>& cluster_ids_to_segment_ids,
                                    SegmentedCloud& segmented_cloud) const;
 
-  // Get the total number of points contained in the cluster of which the partial cluster at index
-  // \i partial_cluster_index is part.
-  size_t getClusterSize(const PartialClusters& partial_clusters,
-                        size_t partial_cluster_index) const;
+  // Get the total number of points contained in the cluster with root at index
+  // \i root_index.
+  size_t getClusterSize(const PartialClusters& partial_clusters, size_t root_index) const;
 
-  // Get the indices of the points contained in the cluster of which the partial cluster at index
-  // \i partial_cluster_index is part.
-  std::vector<int> getClusterIndices(const PartialClusters& partial_clusters,
-                                     size_t partial_cluster_index) const;
+  // Determines if the cluster with root at index \i root_index must be copied again to the
+  // segmented cloud, because it contains new or modified points, has been merged, or doesn't
+  // match its segment \c segment_id anymore.
+  bool isClusterModified(const PartialClusters& partial_clusters, size_t root_index,
+                         Id segment_id, SegmentedCloud& segmented_cloud) const;
 
   // Determines if a point is assigned to a cluster or not.
   bool isPointAssignedToCluster(const ClusteredPointT& point) const noexcept;
 
+  // Determines if a point has been flagged as ground by the local map.
+  bool isPointGround(const ClusteredPointT& point) const noexcept;
+
   // Gets the cluster ID of a point.
   ClusterId getClusterId(const ClusteredPointT& point) const noexcept;
 
@@ -150,9 +221,13 @@ class IncrementalSegmenter : public Segmenter<ClusteredPointT> {
   const double search_radius_;
   const int min_segment_size_;
   const int max_segment_size_;
+  const size_t num_threads_;
+  const float tile_size_;
+  const bool update_only_modified_segments_;
   typename Policy::PolicyParameters policy_params_;
 
   static constexpr ClusterId kUnassignedClusterId = 0u;
+  static constexpr size_t kNoPartialCluster = std::numeric_limits<size_t>::max();
 }; // class IncrementalSegmenter
 
 } // namespace segmatch
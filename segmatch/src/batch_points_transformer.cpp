@@ -0,0 +1,138 @@
+#include "segmatch/batch_points_transformer.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#include <glog/logging.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SEGMATCH_HAS_AVX2_KERNEL
+#endif
+
+namespace segmatch {
+
+constexpr size_t BatchPointsTransformer::kMinPointsPerThread;
+
+namespace {
+
+// Transforms points using Eigen. Used when AVX2 is not available.
+void transformPointsScalar(const Eigen::Matrix4f& transformation, float* points_data,
+                           const size_t num_points, const size_t stride) {
+  const Eigen::Matrix3f rotation = transformation.topLeftCorner<3, 3>();
+  const Eigen::Vector3f translation = transformation.topRightCorner<3, 1>();
+  for (size_t i = 0u; i < num_points; ++i) {
+    Eigen::Map<Eigen::Vector3f> point(points_data + i * stride);
+    point = rotation * point + translation;
+  }
+}
+
+#ifdef SEGMATCH_HAS_AVX2_KERNEL
+// Transforms points using AVX2 and FMA instructions, two points per iteration. Each point is
+// stored as [ x, y, z, _ ] and is transformed as x * c0 + y * c1 + z * c2 + c3, where ci are the
+// columns of the transformation matrix. The fourth component of the points is preserved.
+__attribute__((target("avx2,fma")))
+void transformPointsAvx2(const Eigen::Matrix4f& transformation, float* points_data,
+                         const size_t num_points, const size_t stride) {
+  const __m256 c0 = _mm256_broadcast_ps(
+      reinterpret_cast<const __m128*>(transformation.col(0).data()));
+  const __m256 c1 = _mm256_broadcast_ps(
+      reinterpret_cast<const __m128*>(transformation.col(1).data()));
+  const __m256 c2 = _mm256_broadcast_ps(
+      reinterpret_cast<const __m128*>(transformation.col(2).data()));
+  const __m256 c3 = _mm256_broadcast_ps(
+      reinterpret_cast<const __m128*>(transformation.col(3).data()));
+
+  size_t i = 0u;
+  for (; i + 1u < num_points; i += 2u) {
+    float* first = points_data + i * stride;
+    float* second = first + stride;
+    const __m256 points = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(first)), _mm_loadu_ps(second), 1);
+    __m256 result = _mm256_fmadd_ps(_mm256_permute_ps(points, 0xAA), c2, c3);
+    result = _mm256_fmadd_ps(_mm256_permute_ps(points, 0x55), c1, result);
+    result = _mm256_fmadd_ps(_mm256_permute_ps(points, 0x00), c0, result);
+    result = _mm256_blend_ps(result, points, 0x88);
+    _mm_storeu_ps(first, _mm256_castps256_ps128(result));
+    _mm_storeu_ps(second, _mm256_extractf128_ps(result, 1));
+  }
+
+  // Transform the last point if the number of points is odd.
+  if (i < num_points) {
+    transformPointsScalar(transformation, points_data + i * stride, 1u, stride);
+  }
+}
+
+bool isAvx2Supported() {
+  static const bool is_supported =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return is_supported;
+}
+#endif // SEGMATCH_HAS_AVX2_KERNEL
+
+} // namespace
+
+void BatchPointsTransformer::add(const Eigen::Matrix4f& transformation, float* points_data,
+                                 const size_t num_points, const size_t stride) {
+  CHECK_NOTNULL(points_data);
+  CHECK_EQ(stride % 4u, 0u);
+  if (num_points == 0u) return;
+
+  // Consecutive blocks often share the same transformation.
+  if (transformations_.empty() || transformations_.back() != transformation) {
+    transformations_.push_back(transformation);
+  }
+  jobs_.push_back({ transformations_.size() - 1u, points_data, num_points, stride });
+  num_points_ += num_points;
+}
+
+void BatchPointsTransformer::run() {
+  const size_t num_threads = std::max<size_t>(1u, std::min<size_t>(
+      std::thread::hardware_concurrency(), num_points_ / kMinPointsPerThread));
+
+  if (num_threads == 1u) {
+    for (const auto& job : jobs_) transformPoints_(job, 0u, job.num_points);
+  } else {
+    // Assign to each thread a contiguous range of points, possibly spanning multiple jobs.
+    const size_t points_per_thread = (num_points_ + num_threads - 1u) / num_threads;
+    auto transform_range = [&](const size_t first_point, const size_t last_point) {
+      size_t job_start = 0u;
+      for (const auto& job : jobs_) {
+        const size_t job_end = job_start + job.num_points;
+        const size_t begin = std::max(first_point, job_start);
+        const size_t end = std::min(last_point, job_end);
+        if (begin < end) transformPoints_(job, begin - job_start, end - job_start);
+        job_start = job_end;
+        if (job_start >= last_point) break;
+      }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1u);
+    for (size_t t = 1u; t < num_threads; ++t) {
+      threads.emplace_back(transform_range, t * points_per_thread,
+                           std::min(num_points_, (t + 1u) * points_per_thread));
+    }
+    transform_range(0u, points_per_thread);
+    for (auto& thread : threads) thread.join();
+  }
+
+  transformations_.clear();
+  jobs_.clear();
+  num_points_ = 0u;
+}
+
+void BatchPointsTransformer::transformPoints_(const Job_& job, const size_t begin,
+                                              const size_t end) const {
+  const Eigen::Matrix4f& transformation = transformations_[job.transformation_index];
+  float* points_data = job.points_data + begin * job.stride;
+#ifdef SEGMATCH_HAS_AVX2_KERNEL
+  if (!force_scalar_ && isAvx2Supported()) {
+    transformPointsAvx2(transformation, points_data, end - begin, job.stride);
+    return;
+  }
+#endif // SEGMATCH_HAS_AVX2_KERNEL
+  transformPointsScalar(transformation, points_data, end - begin, job.stride);
+}
+
+} // namespace segmatch
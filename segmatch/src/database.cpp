@@ -2,12 +2,15 @@
 
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <set>
 
 #include <boost/filesystem.hpp>
 #include <glog/logging.h>
 
 #include <opencv2/opencv.hpp>
 
+#include "segmatch/segment_archive.hpp"
 #include "segmatch/utilities.hpp"
 
 using std::cout;
@@ -658,5 +661,126 @@ bool importMatches(const std::string& filename, UniqueIdMatches* matches_ptr) {
   }
 }
 
+bool exportSegmentsArchive(const std::string& filename, const SegmentedCloud& segmented_cloud,
+                           const bool export_all_views) {
+  ensureDirectoryExistsForFilename(filename);
+  SegmentArchiveWriter writer;
+  if (!writer.open(filename)) return false;
+  for (const auto& id_segment : segmented_cloud) {
+    if (!writer.appendSegment(id_segment.second, export_all_views)) {
+      writer.close();
+      return false;
+    }
+  }
+  return writer.close();
+}
+
+bool importSegmentsArchive(const std::string& filename, SegmentedCloud* segmented_cloud_ptr) {
+  CHECK_NOTNULL(segmented_cloud_ptr);
+  SegmentArchiveReader reader;
+  if (!reader.open(filename)) return false;
+  reader.readSegmentedCloud(segmented_cloud_ptr);
+  LOG(INFO) << "Imported " << reader.getNumberOfViews() << " segment views from file " <<
+      filename;
+  return true;
+}
+
+bool convertSegmentsArchiveToCsv(const std::string& archive_filename,
+                                 const std::string& filename_prefix) {
+  SegmentedCloud segmented_cloud(false);
+  return importSegmentsArchive(archive_filename, &segmented_cloud) &&
+      exportSegments(filename_prefix + "_segments.csv", segmented_cloud, true) &&
+      exportFeatures(filename_prefix + "_features.csv", segmented_cloud, true) &&
+      exportSegmentsTimestamps(filename_prefix + "_timestamps.csv", segmented_cloud, true);
+}
+
+namespace {
+
+// The features CSV files only contain the names of the values. Get the name of the feature a value
+// belongs to from the value names used by the descriptors. Returns an empty name if the value is
+// unknown.
+std::string getFeatureNameOfValue(const std::string& value_name) {
+  static const std::set<std::string> kEigenvalueValueNames = {
+      "linearity", "planarity", "scattering", "omnivariance", "anisotropy", "eigen_entropy",
+      "change_of_curvature", "pointing_up" };
+  if (kEigenvalueValueNames.count(value_name) != 0u) return "eigenvalue";
+  if (value_name.compare(0u, 4u, "cnn_") == 0) return "cnn";
+  if (value_name.compare(0u, 4u, "esf_") == 0) return "ensemble_shape";
+  return "";
+}
+
+} // namespace
+
+bool convertCsvToSegmentsArchive(const std::string& filename_prefix,
+                                 const std::string& archive_filename) {
+  // Views indexed by segment id and view index.
+  std::map<Id, std::map<size_t, SegmentView>> views;
+  std::string line;
+
+  std::ifstream segments_file(filename_prefix + "_segments.csv");
+  if (!segments_file.good()) {
+    LOG(ERROR) << "Could not open file " << filename_prefix << "_segments.csv for conversion.";
+    return false;
+  }
+  while (getline(segments_file, line)) {
+    std::istringstream line_as_stream(line);
+    Id segment_id;
+    size_t view_index;
+    PclPoint point;
+    CHECK(line_as_stream >> segment_id >> view_index >> point.x >> point.y >> point.z) <<
+        "Could not read point of segment.";
+    views[segment_id][view_index].point_cloud.push_back(point);
+  }
+
+  std::ifstream features_file(filename_prefix + "_features.csv");
+  while (getline(features_file, line)) {
+    std::istringstream line_as_stream(line);
+    Id segment_id;
+    size_t view_index;
+    CHECK(line_as_stream >> segment_id >> view_index) << "Could not read Id.";
+    // Consecutive values belonging to the same feature are grouped in a named feature.
+    Features& features = views[segment_id][view_index].features;
+    Feature feature;
+    std::string name;
+    FeatureValueType value;
+    while (line_as_stream >> name >> value) {
+      const std::string feature_name = getFeatureNameOfValue(name);
+      if (feature.empty() || feature_name != feature.getName()) {
+        if (!feature.empty()) features.push_back(feature);
+        feature = Feature(feature_name);
+      }
+      feature.push_back(FeatureValue(name, value));
+    }
+    if (!feature.empty()) features.push_back(feature);
+  }
+
+  std::ifstream timestamps_file(filename_prefix + "_timestamps.csv");
+  while (getline(timestamps_file, line)) {
+    std::istringstream line_as_stream(line);
+    Id segment_id;
+    size_t view_index;
+    CHECK(line_as_stream >> segment_id >> view_index >>
+          views[segment_id][view_index].timestamp_ns) << "Could not read timestamp.";
+  }
+
+  ensureDirectoryExistsForFilename(archive_filename);
+  SegmentArchiveWriter writer;
+  if (!writer.open(archive_filename)) return false;
+  for (auto& id_views : views) {
+    Segment segment;
+    segment.segment_id = id_views.first;
+    segment.track_id = 0u;
+    for (auto& index_view : id_views.second) {
+      index_view.second.calculateCentroid();
+      segment.views.push_back(index_view.second);
+    }
+    if (!writer.appendSegment(segment)) {
+      writer.close();
+      return false;
+    }
+  }
+  return writer.close();
+}
+
 } // namespace database
 } // namespace segmatch
@@ -0,0 +1,62 @@
+#include "segmatch/descriptor_indices/descriptor_index.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <thread>
+
+#include <glog/logging.h>
+
+namespace segmatch {
+
+constexpr size_t DescriptorIndex::kMinQueriesPerThread;
+
+void DescriptorIndex::knnBatch(const Eigen::MatrixXf& queries, const size_t k,
+                               IdMatrix* segment_ids, Eigen::MatrixXf* squared_distances,
+                               const size_t max_num_threads) const {
+  CHECK_NOTNULL(segment_ids);
+  CHECK_NOTNULL(squared_distances);
+  CHECK_EQ(static_cast<size_t>(queries.rows()), getDimension());
+  const size_t num_queries = queries.cols();
+  segment_ids->setConstant(k, num_queries, kNoId);
+  squared_distances->setConstant(k, num_queries, std::numeric_limits<float>::infinity());
+
+  const size_t num_threads = std::max<size_t>(1u, std::min<size_t>(
+      max_num_threads, num_queries / kMinQueriesPerThread));
+  if (num_threads == 1u) {
+    knnRange(queries, k, 0u, num_queries, segment_ids, squared_distances);
+    return;
+  }
+
+  // Each thread searches a contiguous chunk of queries and writes to its own columns of the
+  // results.
+  const size_t chunk_size = (num_queries + num_threads - 1u) / num_threads;
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1u);
+  for (size_t t = 1u; t < num_threads; ++t) {
+    threads.emplace_back(&DescriptorIndex::knnRange, this, std::cref(queries), k, t * chunk_size,
+                         std::min(num_queries, (t + 1u) * chunk_size), segment_ids,
+                         squared_distances);
+  }
+  knnRange(queries, k, 0u, chunk_size, segment_ids, squared_distances);
+  for (auto& thread : threads) thread.join();
+}
+
+void DescriptorIndex::knnRange(const Eigen::MatrixXf& queries, const size_t k, const size_t begin,
+                               const size_t end, IdMatrix* segment_ids,
+                               Eigen::MatrixXf* squared_distances) const {
+  // The buffers are reused for all the queries of the range.
+  Eigen::VectorXf query(queries.rows());
+  std::vector<Id> neighbour_ids;
+  std::vector<float> neighbour_squared_distances;
+  for (size_t i = begin; i < end; ++i) {
+    query = queries.col(i);
+    const size_t num_neighbours = knn(query, k, &neighbour_ids, &neighbour_squared_distances);
+    for (size_t j = 0u; j < num_neighbours; ++j) {
+      (*segment_ids)(j, i) = neighbour_ids[j];
+      (*squared_distances)(j, i) = neighbour_squared_distances[j];
+    }
+  }
+}
+
+} // namespace segmatch
@@ -0,0 +1,40 @@
+#include "segmatch/descriptor_indices/descriptor_index_factory.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <glog/logging.h>
+
+#include "segmatch/descriptor_indices/hnsw_index.hpp"
+#include "segmatch/descriptor_indices/ivfpq_index.hpp"
+#include "segmatch/descriptor_indices/log_structured_kdtree_index.hpp"
+
+namespace segmatch {
+
+DescriptorIndexFactory::DescriptorIndexFactory(const ClassifierParams& params)
+  : params_(params) {
+}
+
+std::unique_ptr<DescriptorIndex> DescriptorIndexFactory::create(
+    const DescriptorLookup& descriptor_lookup) const {
+  if (params_.knn_index_type == "LogStructuredKdTree") {
+    return std::unique_ptr<DescriptorIndex>(
+        new LogStructuredKdTreeIndex(params_.knn_feature_dim));
+  } else if (params_.knn_index_type == "Hnsw") {
+    return std::unique_ptr<DescriptorIndex>(
+        new HnswIndex(params_.knn_feature_dim, params_.hnsw_max_links,
+                      params_.hnsw_ef_construction, params_.hnsw_ef_search));
+  } else if (params_.knn_index_type == "IvfPq") {
+    // The descriptors cannot be split in more parts than their dimension.
+    return std::unique_ptr<DescriptorIndex>(
+        new IvfPqIndex(params_.knn_feature_dim, params_.ivfpq_num_lists,
+                       params_.ivfpq_num_probes,
+                       std::min(params_.ivfpq_num_subquantizers, params_.knn_feature_dim),
+                       descriptor_lookup));
+  } else {
+    LOG(FATAL) << "Invalid kNN index type specified: " << params_.knn_index_type;
+    throw std::invalid_argument("Invalid kNN index type specified: " + params_.knn_index_type);
+  }
+}
+
+} // namespace segmatch
@@ -0,0 +1,245 @@
+#include "segmatch/descriptor_indices/hnsw_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+
+#include <glog/logging.h>
+
+namespace segmatch {
+
+namespace {
+
+// Marks the nodes visited during a search. Each thread reuses its own instance, which is cleared
+// in constant time by changing the tag of the visited nodes.
+class VisitedNodes {
+ public:
+  void reset(const size_t num_nodes) {
+    if (tags_.size() < num_nodes) tags_.resize(num_nodes, 0u);
+    if (++current_tag_ == 0u) {
+      std::fill(tags_.begin(), tags_.end(), 0u);
+      current_tag_ = 1u;
+    }
+  }
+
+  // Returns true if the node had not been visited yet.
+  bool visit(const size_t node) {
+    if (tags_[node] == current_tag_) return false;
+    tags_[node] = current_tag_;
+    return true;
+  }
+
+ private:
+  std::vector<uint32_t> tags_;
+  uint32_t current_tag_ = 0u;
+};
+
+} // namespace
+
+HnswIndex::HnswIndex(const size_t dimension, const size_t max_links,
+                     const size_t ef_construction, const size_t ef_search)
+  : dimension_(dimension), max_links_(max_links),
+    ef_construction_(std::max(ef_construction, max_links)), ef_search_(ef_search),
+    level_multiplier_(1.0 / std::log(static_cast<double>(max_links))), random_engine_(42u) {
+  CHECK_GT(dimension, 0u);
+  CHECK_GT(max_links, 1u);
+}
+
+void HnswIndex::insert(const Id segment_id, const Eigen::VectorXf& descriptor) {
+  CHECK_EQ(static_cast<size_t>(descriptor.size()), dimension_);
+  remove(segment_id);
+  addNode(segment_id, descriptor.data());
+}
+
+bool HnswIndex::remove(const Id segment_id) {
+  const auto node_it = node_of_segment_.find(segment_id);
+  if (node_it == node_of_segment_.end()) return false;
+  nodes_[node_it->second].segment_id = kNoId;
+  node_of_segment_.erase(node_it);
+  ++num_removed_;
+  if (2u * num_removed_ > nodes_.size()) rebuild();
+  return true;
+}
+
+void HnswIndex::clear() {
+  nodes_.clear();
+  descriptors_.clear();
+  node_of_segment_.clear();
+  num_removed_ = 0u;
+  entry_point_ = 0u;
+  top_layer_ = 0u;
+}
+
+float HnswIndex::computeSquaredDistance(const float* query, const NodeIndex node) const {
+  return (Eigen::Map<const Eigen::VectorXf>(query, dimension_) -
+      Eigen::Map<const Eigen::VectorXf>(getDescriptor(node), dimension_)).squaredNorm();
+}
+
+void HnswIndex::addNode(const Id segment_id, const float* descriptor) {
+  // Draw the top layer of the node from an exponentially decaying distribution.
+  std::uniform_real_distribution<double> distribution(0.0, 1.0);
+  const size_t layer = static_cast<size_t>(
+      -std::log(1.0 - distribution(random_engine_)) * level_multiplier_);
+
+  const NodeIndex node = nodes_.size();
+  nodes_.push_back({ segment_id, std::vector<std::vector<NodeIndex>>(layer + 1u) });
+  descriptors_.insert(descriptors_.end(), descriptor, descriptor + dimension_);
+  node_of_segment_[segment_id] = node;
+  if (node == 0u) {
+    entry_point_ = node;
+    top_layer_ = layer;
+    return;
+  }
+
+  // Link the node to its nearest neighbours in every layer it belongs to.
+  const float* query = getDescriptor(node);
+  NodeIndex entry_point = searchGreedy(query, std::min(layer, top_layer_));
+  for (size_t l = std::min(layer, top_layer_) + 1u; l-- > 0u;) {
+    const std::vector<Candidate> candidates = searchLayer(query, entry_point, ef_construction_, l);
+    nodes_[node].links[l] = selectNeighbours(candidates, max_links_);
+
+    for (const NodeIndex neighbour : nodes_[node].links[l]) {
+      std::vector<NodeIndex>& neighbour_links = nodes_[neighbour].links[l];
+      neighbour_links.push_back(node);
+      if (neighbour_links.size() > getMaxLinks(l)) {
+        std::vector<Candidate> neighbour_candidates;
+        neighbour_candidates.reserve(neighbour_links.size());
+        for (const NodeIndex link : neighbour_links) {
+          neighbour_candidates.emplace_back(
+              computeSquaredDistance(getDescriptor(neighbour), link), link);
+        }
+        std::sort(neighbour_candidates.begin(), neighbour_candidates.end());
+        neighbour_links = selectNeighbours(neighbour_candidates, getMaxLinks(l));
+      }
+    }
+    entry_point = candidates.front().second;
+  }
+
+  if (layer > top_layer_) {
+    entry_point_ = node;
+    top_layer_ = layer;
+  }
+}
+
+HnswIndex::NodeIndex HnswIndex::searchGreedy(const float* query,
+                                             const size_t target_layer) const {
+  NodeIndex current_node = entry_point_;
+  float current_distance = computeSquaredDistance(query, current_node);
+  for (size_t layer = top_layer_; layer > target_layer; --layer) {
+    bool improved = true;
+    while (improved) {
+      improved = false;
+      for (const NodeIndex neighbour : nodes_[current_node].links[layer]) {
+        const float distance = computeSquaredDistance(query, neighbour);
+        if (distance < current_distance) {
+          current_distance = distance;
+          current_node = neighbour;
+          improved = true;
+        }
+      }
+    }
+  }
+  return current_node;
+}
+
+std::vector<HnswIndex::Candidate> HnswIndex::searchLayer(const float* query,
+                                                         const NodeIndex entry_point,
+                                                         const size_t ef,
+                                                         const size_t layer) const {
+  thread_local VisitedNodes visited;
+  visited.reset(nodes_.size());
+
+  // Candidates still to be explored, nearest first, and nearest nodes found, farthest first.
+  std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> to_explore;
+  std::priority_queue<Candidate> nearest;
+  const Candidate start(computeSquaredDistance(query, entry_point), entry_point);
+  visited.visit(entry_point);
+  to_explore.push(start);
+  nearest.push(start);
+
+  while (!to_explore.empty()) {
+    const Candidate current = to_explore.top();
+    if (nearest.size() >= ef && current.first > nearest.top().first) break;
+    to_explore.pop();
+
+    for (const NodeIndex neighbour : nodes_[current.second].links[layer]) {
+      if (!visited.visit(neighbour)) continue;
+      const float distance = computeSquaredDistance(query, neighbour);
+      if (nearest.size() < ef || distance < nearest.top().first) {
+        to_explore.emplace(distance, neighbour);
+        nearest.emplace(distance, neighbour);
+        if (nearest.size() > ef) nearest.pop();
+      }
+    }
+  }
+
+  std::vector<Candidate> result(nearest.size());
+  for (size_t i = result.size(); i > 0u; --i) {
+    result[i - 1u] = nearest.top();
+    nearest.pop();
+  }
+  return result;
+}
+
+std::vector<HnswIndex::NodeIndex> HnswIndex::selectNeighbours(
+    const std::vector<Candidate>& candidates, const size_t max_links) const {
+  // A candidate is only selected if it is nearer to the query than to all the neighbours
+  // selected before it. This keeps links towards distant clusters.
+  std::vector<NodeIndex> selected;
+  selected.reserve(max_links);
+  for (const Candidate& candidate : candidates) {
+    if (selected.size() == max_links) break;
+    bool is_diverse = true;
+    for (const NodeIndex neighbour : selected) {
+      if (computeSquaredDistance(getDescriptor(candidate.second), neighbour) < candidate.first) {
+        is_diverse = false;
+        break;
+      }
+    }
+    if (is_diverse) selected.push_back(candidate.second);
+  }
+  return selected;
+}
+
+void HnswIndex::rebuild() {
+  std::vector<Node> old_nodes;
+  std::vector<float> old_descriptors;
+  old_nodes.swap(nodes_);
+  old_descriptors.swap(descriptors_);
+  clear();
+
+  nodes_.reserve(old_nodes.size() / 2u + 1u);
+  descriptors_.reserve(old_descriptors.size() / 2u + dimension_);
+  for (size_t i = 0u; i < old_nodes.size(); ++i) {
+    if (old_nodes[i].segment_id != kNoId) {
+      addNode(old_nodes[i].segment_id, old_descriptors.data() + i * dimension_);
+    }
+  }
+}
+
+size_t HnswIndex::knn(const Eigen::VectorXf& query, const size_t k,
+                      std::vector<Id>* segment_ids,
+                      std::vector<float>* squared_distances) const {
+  CHECK_NOTNULL(segment_ids)->clear();
+  CHECK_NOTNULL(squared_distances)->clear();
+  CHECK_EQ(static_cast<size_t>(query.size()), dimension_);
+  if (k == 0u || nodes_.empty()) return 0u;
+
+  // Like libnabo, ignore the descriptors that are identical to the query.
+  constexpr float kMinSquaredDistance = std::numeric_limits<float>::epsilon();
+  const NodeIndex entry_point = searchGreedy(query.data(), 0u);
+  const std::vector<Candidate> candidates = searchLayer(query.data(), entry_point,
+                                                        std::max(ef_search_, k + 1u), 0u);
+  for (const Candidate& candidate : candidates) {
+    const Id segment_id = nodes_[candidate.second].segment_id;
+    if (segment_id == kNoId || candidate.first <= kMinSquaredDistance) continue;
+    segment_ids->push_back(segment_id);
+    squared_distances->push_back(candidate.first);
+    if (segment_ids->size() == k) break;
+  }
+  return segment_ids->size();
+}
+
+} // namespace segmatch
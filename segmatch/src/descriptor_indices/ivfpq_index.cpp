@@ -0,0 +1,311 @@
+#include "segmatch/descriptor_indices/ivfpq_index.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <utility>
+
+#include <glog/logging.h>
+
+namespace segmatch {
+
+constexpr size_t IvfPqIndex::kUntrained;
+constexpr size_t IvfPqIndex::kNumCodewords;
+constexpr size_t IvfPqIndex::kNumKMeansIterations;
+constexpr size_t IvfPqIndex::kRetrainingGrowthFactor;
+constexpr size_t IvfPqIndex::kMaxNumRetrainingDescriptors;
+constexpr size_t IvfPqIndex::kNumReRankedCandidatesPerNeighbour;
+
+namespace {
+
+// Returns the index of the centroid nearest to a point.
+template <typename PointT>
+size_t findNearestCentroid(const Eigen::MatrixXf& centroids, const PointT& point) {
+  size_t nearest_centroid;
+  (centroids.colwise() - point).colwise().squaredNorm().minCoeff(&nearest_centroid);
+  return nearest_centroid;
+}
+
+// Cluster points stored in columns with Lloyd's algorithm. Returns the centroids, one per column.
+Eigen::MatrixXf computeKMeans(const Eigen::MatrixXf& points, const size_t num_clusters,
+                              const size_t num_iterations, std::mt19937& random_engine) {
+  const size_t num_points = points.cols();
+  CHECK_GE(num_points, num_clusters);
+
+  // Initialize the centroids with distinct random points.
+  std::vector<size_t> point_indices(num_points);
+  std::iota(point_indices.begin(), point_indices.end(), 0u);
+  std::shuffle(point_indices.begin(), point_indices.end(), random_engine);
+  Eigen::MatrixXf centroids(points.rows(), num_clusters);
+  for (size_t i = 0u; i < num_clusters; ++i) centroids.col(i) = points.col(point_indices[i]);
+
+  std::uniform_int_distribution<size_t> point_distribution(0u, num_points - 1u);
+  Eigen::MatrixXf sums(points.rows(), num_clusters);
+  std::vector<size_t> cluster_sizes(num_clusters);
+  for (size_t iteration = 0u; iteration < num_iterations; ++iteration) {
+    sums.setZero();
+    std::fill(cluster_sizes.begin(), cluster_sizes.end(), 0u);
+    for (size_t i = 0u; i < num_points; ++i) {
+      const size_t cluster = findNearestCentroid(centroids, points.col(i));
+      sums.col(cluster) += points.col(i);
+      ++cluster_sizes[cluster];
+    }
+    for (size_t i = 0u; i < num_clusters; ++i) {
+      // Move the centroids of empty clusters to random points.
+      if (cluster_sizes[i] == 0u) {
+        centroids.col(i) = points.col(point_distribution(random_engine));
+      } else {
+        centroids.col(i) = sums.col(i) / static_cast<float>(cluster_sizes[i]);
+      }
+    }
+  }
+  return centroids;
+}
+
+} // namespace
+
+IvfPqIndex::IvfPqIndex(const size_t dimension, const size_t num_lists, const size_t num_probes,
+                       const size_t num_subquantizers,
+                       const DescriptorLookup& descriptor_lookup)
+  : dimension_(dimension), num_lists_(num_lists), num_probes_(num_probes),
+    num_subquantizers_(num_subquantizers), descriptor_lookup_(descriptor_lookup),
+    num_training_descriptors_(std::max(4u * kNumCodewords, 16u * num_lists)) {
+  CHECK_GT(dimension, 0u);
+  CHECK_GT(num_lists, 0u);
+  CHECK_GT(num_subquantizers, 0u);
+  CHECK_LE(num_subquantizers, dimension);
+  for (size_t i = 0u; i <= num_subquantizers_; ++i) {
+    subspace_offsets_.push_back(i * dimension_ / num_subquantizers_);
+  }
+}
+
+void IvfPqIndex::insert(const Id segment_id, const Eigen::VectorXf& descriptor) {
+  CHECK_EQ(static_cast<size_t>(descriptor.size()), dimension_);
+  remove(segment_id);
+  if (is_trained_) {
+    add(segment_id, descriptor);
+    if (descriptor_lookup_ &&
+        size() >= kRetrainingGrowthFactor * num_descriptors_at_training_) {
+      retrain();
+    }
+  } else {
+    locations_[segment_id] = { kUntrained, untrained_segment_ids_.size() };
+    untrained_segment_ids_.push_back(segment_id);
+    untrained_descriptors_.push_back(descriptor);
+    if (untrained_segment_ids_.size() >= num_training_descriptors_) train();
+  }
+}
+
+bool IvfPqIndex::remove(const Id segment_id) {
+  const auto location_it = locations_.find(segment_id);
+  if (location_it == locations_.end()) return false;
+  const Location location = location_it->second;
+  locations_.erase(location_it);
+
+  // Move the last element of the list in place of the removed one.
+  if (location.list == kUntrained) {
+    const size_t last_position = untrained_segment_ids_.size() - 1u;
+    if (location.position != last_position) {
+      untrained_segment_ids_[location.position] = untrained_segment_ids_[last_position];
+      untrained_descriptors_[location.position].swap(untrained_descriptors_[last_position]);
+      locations_[untrained_segment_ids_[location.position]].position = location.position;
+    }
+    untrained_segment_ids_.pop_back();
+    untrained_descriptors_.pop_back();
+  } else {
+    InvertedList& list = lists_[location.list];
+    const size_t last_position = list.segment_ids.size() - 1u;
+    if (location.position != last_position) {
+      list.segment_ids[location.position] = list.segment_ids[last_position];
+      std::copy_n(list.codes.begin() + last_position * num_subquantizers_, num_subquantizers_,
+                  list.codes.begin() + location.position * num_subquantizers_);
+      locations_[list.segment_ids[location.position]].position = location.position;
+    }
+    list.segment_ids.pop_back();
+    list.codes.resize(list.codes.size() - num_subquantizers_);
+  }
+  return true;
+}
+
+void IvfPqIndex::clear() {
+  is_trained_ = false;
+  num_descriptors_at_training_ = 0u;
+  coarse_centroids_.resize(0, 0);
+  codebooks_.clear();
+  lists_.clear();
+  untrained_segment_ids_.clear();
+  untrained_descriptors_.clear();
+  locations_.clear();
+}
+
+void IvfPqIndex::train() {
+  const size_t num_descriptors = untrained_segment_ids_.size();
+  Eigen::MatrixXf descriptors(dimension_, num_descriptors);
+  for (size_t i = 0u; i < num_descriptors; ++i) descriptors.col(i) = untrained_descriptors_[i];
+  trainQuantizers(descriptors);
+
+  // Encode the descriptors used for training.
+  lists_.assign(num_lists_, InvertedList());
+  std::vector<Id> segment_ids;
+  segment_ids.swap(untrained_segment_ids_);
+  untrained_descriptors_.clear();
+  for (size_t i = 0u; i < num_descriptors; ++i) add(segment_ids[i], descriptors.col(i));
+  num_descriptors_at_training_ = num_descriptors;
+}
+
+void IvfPqIndex::retrain() {
+  std::vector<Id> segment_ids;
+  segment_ids.reserve(locations_.size());
+  for (const auto& id_location : locations_) segment_ids.push_back(id_location.first);
+
+  // Train on a random sample of the descriptors. Sort the IDs first, so that the sample does not
+  // depend on the order of the hash map.
+  std::sort(segment_ids.begin(), segment_ids.end());
+  std::mt19937 random_engine(42u);
+  std::shuffle(segment_ids.begin(), segment_ids.end(), random_engine);
+  const size_t num_samples = std::min(
+      segment_ids.size(), std::max(num_training_descriptors_, kMaxNumRetrainingDescriptors));
+  Eigen::MatrixXf descriptors(dimension_, num_samples);
+  for (size_t i = 0u; i < num_samples; ++i) {
+    descriptors.col(i) = descriptor_lookup_(segment_ids[i]);
+  }
+  trainQuantizers(descriptors);
+
+  // Encode all the descriptors again.
+  lists_.assign(num_lists_, InvertedList());
+  for (size_t i = 0u; i < segment_ids.size(); ++i) {
+    add(segment_ids[i], i < num_samples ? Eigen::VectorXf(descriptors.col(i)) :
+        descriptor_lookup_(segment_ids[i]));
+  }
+  num_descriptors_at_training_ = segment_ids.size();
+}
+
+void IvfPqIndex::trainQuantizers(const Eigen::MatrixXf& descriptors) {
+  const size_t num_descriptors = descriptors.cols();
+
+  // Train the coarse quantizer, then one quantizer per part of the residuals.
+  std::mt19937 random_engine(42u);
+  coarse_centroids_ = computeKMeans(descriptors, num_lists_, kNumKMeansIterations,
+                                    random_engine);
+  Eigen::MatrixXf residuals(dimension_, num_descriptors);
+  for (size_t i = 0u; i < num_descriptors; ++i) {
+    residuals.col(i) = descriptors.col(i) -
+        coarse_centroids_.col(findNearestCentroid(coarse_centroids_, descriptors.col(i)));
+  }
+  codebooks_.clear();
+  for (size_t j = 0u; j < num_subquantizers_; ++j) {
+    const size_t subspace_size = subspace_offsets_[j + 1u] - subspace_offsets_[j];
+    codebooks_.push_back(computeKMeans(residuals.middleRows(subspace_offsets_[j], subspace_size),
+                                       kNumCodewords, kNumKMeansIterations, random_engine));
+  }
+  is_trained_ = true;
+}
+
+void IvfPqIndex::add(const Id segment_id, const Eigen::VectorXf& descriptor) {
+  const size_t list_index = findNearestCentroid(coarse_centroids_, descriptor);
+  const Eigen::VectorXf residual = descriptor - coarse_centroids_.col(list_index);
+
+  InvertedList& list = lists_[list_index];
+  locations_[segment_id] = { list_index, list.segment_ids.size() };
+  list.segment_ids.push_back(segment_id);
+  for (size_t j = 0u; j < num_subquantizers_; ++j) {
+    list.codes.push_back(static_cast<uint8_t>(findNearestCentroid(
+        codebooks_[j], residual.segment(subspace_offsets_[j],
+                                        subspace_offsets_[j + 1u] - subspace_offsets_[j]))));
+  }
+}
+
+size_t IvfPqIndex::knn(const Eigen::VectorXf& query, const size_t k,
+                       std::vector<Id>* segment_ids,
+                       std::vector<float>* squared_distances) const {
+  CHECK_NOTNULL(segment_ids)->clear();
+  CHECK_NOTNULL(squared_distances)->clear();
+  CHECK_EQ(static_cast<size_t>(query.size()), dimension_);
+  if (k == 0u) return 0u;
+
+  // Like libnabo, ignore the descriptors that are identical to the query.
+  constexpr float kMinSquaredDistance = std::numeric_limits<float>::epsilon();
+  std::vector<std::pair<float, Id>> neighbours;
+
+  for (size_t i = 0u; i < untrained_segment_ids_.size(); ++i) {
+    const float squared_distance = (untrained_descriptors_[i] - query).squaredNorm();
+    if (squared_distance > kMinSquaredDistance) {
+      neighbours.emplace_back(squared_distance, untrained_segment_ids_[i]);
+    }
+  }
+
+  if (is_trained_) {
+    // Find the lists to visit.
+    const Eigen::VectorXf list_distances =
+        (coarse_centroids_.colwise() - query).colwise().squaredNorm().transpose();
+    std::vector<size_t> list_indices(num_lists_);
+    std::iota(list_indices.begin(), list_indices.end(), 0u);
+    const size_t num_probes = std::min(num_probes_, num_lists_);
+    std::partial_sort(list_indices.begin(), list_indices.begin() + num_probes, list_indices.end(),
+                      [&](const size_t a, const size_t b) {
+                        return list_distances[a] < list_distances[b];
+                      });
+
+    // Approximate distances of the candidates, with the list and the position of their
+    // descriptors.
+    struct Candidate {
+      float squared_distance;
+      size_t list;
+      size_t position;
+    };
+    std::vector<Candidate> candidates;
+    Eigen::MatrixXf distance_tables(kNumCodewords, num_subquantizers_);
+    for (size_t probe = 0u; probe < num_probes; ++probe) {
+      const InvertedList& list = lists_[list_indices[probe]];
+      if (list.segment_ids.empty()) continue;
+
+      // Squared distance between each part of the query residual and each codeword.
+      const Eigen::VectorXf residual = query - coarse_centroids_.col(list_indices[probe]);
+      for (size_t j = 0u; j < num_subquantizers_; ++j) {
+        distance_tables.col(j) = (codebooks_[j].colwise() - residual.segment(
+            subspace_offsets_[j], subspace_offsets_[j + 1u] - subspace_offsets_[j]))
+            .colwise().squaredNorm().transpose();
+      }
+
+      for (size_t i = 0u; i < list.segment_ids.size(); ++i) {
+        const uint8_t* code = list.codes.data() + i * num_subquantizers_;
+        float squared_distance = 0.0f;
+        for (size_t j = 0u; j < num_subquantizers_; ++j) {
+          squared_distance += distance_tables(code[j], j);
+        }
+        candidates.push_back({ squared_distance, list_indices[probe], i });
+      }
+    }
+
+    // Re-rank the best candidates with their exact distances if possible. The quantization
+    // errors make the approximate distances unreliable for both ordering and detecting identical
+    // descriptors.
+    const size_t num_candidates = std::min(
+        descriptor_lookup_ ? k * kNumReRankedCandidatesPerNeighbour : k, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + num_candidates, candidates.end(),
+                      [](const Candidate& a, const Candidate& b) {
+                        return a.squared_distance < b.squared_distance;
+                      });
+    for (size_t i = 0u; i < num_candidates; ++i) {
+      const Id segment_id = lists_[candidates[i].list].segment_ids[candidates[i].position];
+      const float squared_distance = descriptor_lookup_ ?
+          (descriptor_lookup_(segment_id) - query).squaredNorm() : candidates[i].squared_distance;
+      if (squared_distance > kMinSquaredDistance) {
+        neighbours.emplace_back(squared_distance, segment_id);
+      }
+    }
+  }
+
+  const size_t num_neighbours = std::min(k, neighbours.size());
+  std::partial_sort(neighbours.begin(), neighbours.begin() + num_neighbours, neighbours.end());
+  segment_ids->reserve(num_neighbours);
+  squared_distances->reserve(num_neighbours);
+  for (size_t i = 0u; i < num_neighbours; ++i) {
+    squared_distances->push_back(neighbours[i].first);
+    segment_ids->push_back(neighbours[i].second);
+  }
+  return num_neighbours;
+}
+
+} // namespace segmatch
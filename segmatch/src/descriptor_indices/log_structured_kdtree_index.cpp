@@ -0,0 +1,182 @@
+#include "segmatch/descriptor_indices/log_structured_kdtree_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include <glog/logging.h>
+
+namespace segmatch {
+
+constexpr int LogStructuredKdTreeIndex::kBufferLevel;
+constexpr size_t LogStructuredKdTreeIndex::kBufferCapacity;
+
+LogStructuredKdTreeIndex::LogStructuredKdTreeIndex(const size_t dimension)
+  : dimension_(dimension), buffer_(dimension, kBufferCapacity) {
+  CHECK_GT(dimension, 0u);
+  buffer_segment_ids_.reserve(kBufferCapacity);
+}
+
+void LogStructuredKdTreeIndex::insert(const Id segment_id, const Eigen::VectorXf& descriptor) {
+  CHECK_EQ(static_cast<size_t>(descriptor.size()), dimension_);
+
+  const auto location_it = locations_.find(segment_id);
+  if (location_it != locations_.end()) {
+    // Descriptors in the buffer can be replaced in place.
+    if (location_it->second.level == kBufferLevel) {
+      buffer_.col(location_it->second.column) = descriptor;
+      return;
+    }
+    remove(segment_id);
+  }
+
+  const size_t column = buffer_segment_ids_.size();
+  buffer_.col(column) = descriptor;
+  buffer_segment_ids_.push_back(segment_id);
+  locations_[segment_id] = { kBufferLevel, column };
+  if (buffer_segment_ids_.size() == kBufferCapacity) flushBuffer();
+}
+
+bool LogStructuredKdTreeIndex::remove(const Id segment_id) {
+  const auto location_it = locations_.find(segment_id);
+  if (location_it == locations_.end()) return false;
+  const Location location = location_it->second;
+  locations_.erase(location_it);
+
+  if (location.level == kBufferLevel) {
+    // Move the last descriptor of the buffer in place of the removed one.
+    const size_t last_column = buffer_segment_ids_.size() - 1u;
+    if (location.column != last_column) {
+      buffer_.col(location.column) = buffer_.col(last_column);
+      buffer_segment_ids_[location.column] = buffer_segment_ids_[last_column];
+      locations_[buffer_segment_ids_[location.column]].column = location.column;
+    }
+    buffer_segment_ids_.pop_back();
+  } else {
+    Level& level = *levels_[location.level];
+    level.segment_ids[location.column] = kNoId;
+    ++level.num_removed;
+    if (2u * level.num_removed > level.segment_ids.size()) compactLevel(location.level);
+  }
+  return true;
+}
+
+void LogStructuredKdTreeIndex::clear() {
+  buffer_segment_ids_.clear();
+  levels_.clear();
+  locations_.clear();
+}
+
+void LogStructuredKdTreeIndex::flushBuffer() {
+  // Find the first empty level. Since level i contains less than kBufferCapacity * 2^(i+1)
+  // descriptors, the buffer and all the levels before it fit in it.
+  size_t target_level = 0u;
+  size_t num_descriptors = buffer_segment_ids_.size();
+  while (target_level < levels_.size() &&
+         levels_[target_level]->segment_ids.size() > levels_[target_level]->num_removed) {
+    num_descriptors += levels_[target_level]->segment_ids.size() -
+        levels_[target_level]->num_removed;
+    ++target_level;
+  }
+  if (target_level == levels_.size()) levels_.emplace_back(new Level());
+
+  Eigen::MatrixXf descriptors(dimension_, num_descriptors);
+  std::vector<Id> segment_ids;
+  segment_ids.reserve(num_descriptors);
+  for (size_t i = 0u; i < target_level; ++i) {
+    const Level& level = *levels_[i];
+    for (size_t j = 0u; j < level.segment_ids.size(); ++j) {
+      if (level.segment_ids[j] == kNoId) continue;
+      descriptors.col(segment_ids.size()) = level.descriptors.col(j);
+      segment_ids.push_back(level.segment_ids[j]);
+    }
+    buildLevel(i, Eigen::MatrixXf(dimension_, 0), {});
+  }
+  for (size_t j = 0u; j < buffer_segment_ids_.size(); ++j) {
+    descriptors.col(segment_ids.size()) = buffer_.col(j);
+    segment_ids.push_back(buffer_segment_ids_[j]);
+  }
+  buffer_segment_ids_.clear();
+
+  buildLevel(target_level, std::move(descriptors), std::move(segment_ids));
+}
+
+void LogStructuredKdTreeIndex::buildLevel(const size_t level_index, Eigen::MatrixXf descriptors,
+                                          std::vector<Id> segment_ids) {
+  CHECK_EQ(static_cast<size_t>(descriptors.cols()), segment_ids.size());
+  Level& level = *levels_[level_index];
+
+  // The k-d tree references the descriptors, so it must be destroyed first.
+  level.kd_tree.reset();
+  level.descriptors = std::move(descriptors);
+  level.segment_ids = std::move(segment_ids);
+  level.num_removed = 0u;
+
+  for (size_t i = 0u; i < level.segment_ids.size(); ++i) {
+    locations_[level.segment_ids[i]] = { static_cast<int>(level_index), i };
+  }
+  if (!level.segment_ids.empty()) {
+    level.kd_tree.reset(Nabo::NNSearchF::createKDTreeLinearHeap(level.descriptors));
+  }
+}
+
+void LogStructuredKdTreeIndex::compactLevel(const size_t level_index) {
+  const Level& level = *levels_[level_index];
+  const size_t num_descriptors = level.segment_ids.size() - level.num_removed;
+  Eigen::MatrixXf descriptors(dimension_, num_descriptors);
+  std::vector<Id> segment_ids;
+  segment_ids.reserve(num_descriptors);
+  for (size_t i = 0u; i < level.segment_ids.size(); ++i) {
+    if (level.segment_ids[i] == kNoId) continue;
+    descriptors.col(segment_ids.size()) = level.descriptors.col(i);
+    segment_ids.push_back(level.segment_ids[i]);
+  }
+  buildLevel(level_index, std::move(descriptors), std::move(segment_ids));
+}
+
+size_t LogStructuredKdTreeIndex::knn(const Eigen::VectorXf& query, const size_t k,
+                                     std::vector<Id>* segment_ids,
+                                     std::vector<float>* squared_distances) const {
+  CHECK_NOTNULL(segment_ids)->clear();
+  CHECK_NOTNULL(squared_distances)->clear();
+  CHECK_EQ(static_cast<size_t>(query.size()), dimension_);
+  if (k == 0u) return 0u;
+
+  // Like libnabo, ignore the descriptors that are identical to the query.
+  constexpr float kMinSquaredDistance = std::numeric_limits<float>::epsilon();
+  std::vector<std::pair<float, Id>> neighbours;
+
+  for (size_t i = 0u; i < buffer_segment_ids_.size(); ++i) {
+    const float squared_distance = (buffer_.col(i) - query).squaredNorm();
+    if (squared_distance > kMinSquaredDistance) {
+      neighbours.emplace_back(squared_distance, buffer_segment_ids_[i]);
+    }
+  }
+
+  for (const auto& level : levels_) {
+    if (!level->kd_tree) continue;
+    // Search enough neighbours to find k of them even if the nearest ones have been removed.
+    const size_t level_k = std::min(k + level->num_removed, level->segment_ids.size());
+    Eigen::VectorXi indices(level_k);
+    Eigen::VectorXf dists2(level_k);
+    level->kd_tree->knn(query, indices, dists2, level_k, 0, Nabo::NNSearchF::SORT_RESULTS);
+    for (size_t i = 0u; i < level_k; ++i) {
+      if (!std::isfinite(dists2[i])) break;
+      const Id segment_id = level->segment_ids[indices[i]];
+      if (segment_id != kNoId) neighbours.emplace_back(dists2[i], segment_id);
+    }
+  }
+
+  const size_t num_neighbours = std::min(k, neighbours.size());
+  std::partial_sort(neighbours.begin(), neighbours.begin() + num_neighbours, neighbours.end());
+  segment_ids->reserve(num_neighbours);
+  squared_distances->reserve(num_neighbours);
+  for (size_t i = 0u; i < num_neighbours; ++i) {
+    squared_distances->push_back(neighbours[i].first);
+    segment_ids->push_back(neighbours[i].second);
+  }
+  return num_neighbours;
+}
+
+} // namespace segmatch
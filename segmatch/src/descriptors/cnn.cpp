@@ -440,22 +440,31 @@ void CNNDescriptor::describe(SegmentedCloud* segmented_cloud_ptr) {
 
     BENCHMARK_START("SM.Worker.Describe.SaveFeatures");
     // Write the features.
+    std::vector<FeatureValueType> cnn_feature;
     for (size_t i = 0u; i < described_segment_ids.size(); ++i) {
       Segment* segment;
       CHECK(segmented_cloud_ptr->findValidSegmentPtrById(described_segment_ids[i], &segment));
-      std::vector<float> nn_output = cnn_descriptors[i];
+      const std::vector<float>& nn_output = cnn_descriptors[i];
 
-      Feature cnn_feature("cnn");
-      for (size_t j = 0u; j < nn_output.size(); ++j) {
-        cnn_feature.push_back(FeatureValue("cnn_" + std::to_string(j), nn_output[j]));
+      // The layout only has to be looked up again if the size of the output changes.
+      if (feature_layout_ == nullptr || feature_layout_->size() != nn_output.size() + 3u) {
+        std::vector<std::string> value_names;
+        for (size_t j = 0u; j < nn_output.size(); ++j) {
+          value_names.push_back("cnn_" + std::to_string(j));
+        }
+        value_names.push_back("cnn_scale_x");
+        value_names.push_back("cnn_scale_y");
+        value_names.push_back("cnn_scale_z");
+        feature_layout_ = &FeatureLayout::get("cnn", value_names);
       }
 
+      cnn_feature.assign(nn_output.begin(), nn_output.end());
       // Push the scales.
-      cnn_feature.push_back(FeatureValue("cnn_scale_x", scales[i].x));
-      cnn_feature.push_back(FeatureValue("cnn_scale_y", scales[i].y));
-      cnn_feature.push_back(FeatureValue("cnn_scale_z", scales[i].z));
+      cnn_feature.push_back(scales[i].x);
+      cnn_feature.push_back(scales[i].y);
+      cnn_feature.push_back(scales[i].z);
 
-      segment->getLastView().features.replaceByName(cnn_feature);
+      segment->getLastView().features.setFeature(*feature_layout_, cnn_feature.data());
 
       std::vector<float> semantic_nn_output = semantics[i];
       segment->getLastView().semantic = std::distance(semantic_nn_output.begin(),
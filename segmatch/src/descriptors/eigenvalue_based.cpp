@@ -98,15 +98,20 @@ void EigenvalueBasedDescriptor::describe(const Segment& segment, Features* featu
 
   const double kNPointsMax = 13200 * kNormalizationPercentile;
 
-  Feature eigenvalue_feature("eigenvalue");
-  eigenvalue_feature.push_back(FeatureValue("linearity", (e1 - e2) / e1 / kLinearityMax));
-  eigenvalue_feature.push_back(FeatureValue("planarity", (e2 - e3) / e1 / kPlanarityMax));
-  eigenvalue_feature.push_back(FeatureValue("scattering", e3 / e1 / kScatteringMax));
-  eigenvalue_feature.push_back(FeatureValue("omnivariance", std::pow(e1 * e2 * e3, kOneThird) / kOmnivarianceMax));
-  eigenvalue_feature.push_back(FeatureValue("anisotropy", (e1 - e3) / e1 / kAnisotropyMax));
-  eigenvalue_feature.push_back(FeatureValue("eigen_entropy",
-                                            (e1 * std::log(e1)) + (e2 * std::log(e2)) + (e3 * std::log(e3)) / kEigenEntropyMax));
-  eigenvalue_feature.push_back(FeatureValue("change_of_curvature", e3 / sum_of_eigenvalues / kChangeOfCurvatureMax));
+  static const FeatureLayout& kLayout = FeatureLayout::get("eigenvalue", {
+      "linearity", "planarity", "scattering", "omnivariance", "anisotropy", "eigen_entropy",
+      "change_of_curvature", "pointing_up" });
+  CHECK_EQ(kLayout.size(), kDimension) << "Feature has the wrong dimension";
+
+  FeatureValueType eigenvalue_feature[kDimension];
+  eigenvalue_feature[0] = (e1 - e2) / e1 / kLinearityMax;
+  eigenvalue_feature[1] = (e2 - e3) / e1 / kPlanarityMax;
+  eigenvalue_feature[2] = e3 / e1 / kScatteringMax;
+  eigenvalue_feature[3] = std::pow(e1 * e2 * e3, kOneThird) / kOmnivarianceMax;
+  eigenvalue_feature[4] = (e1 - e3) / e1 / kAnisotropyMax;
+  eigenvalue_feature[5] =
+      (e1 * std::log(e1)) + (e2 * std::log(e2)) + (e3 * std::log(e3)) / kEigenEntropyMax;
+  eigenvalue_feature[6] = e3 / sum_of_eigenvalues / kChangeOfCurvatureMax;
 
   PclPoint point_min, point_max;
 
@@ -119,13 +124,12 @@ void EigenvalueBasedDescriptor::describe(const Segment& segment, Features* featu
   diff_z = point_max.z - point_min.z;
 
   if (diff_z < diff_x && diff_z < diff_y) {
-    eigenvalue_feature.push_back(FeatureValue("pointing_up", 0.2));
+    eigenvalue_feature[7] = 0.2;
   } else {
-    eigenvalue_feature.push_back(FeatureValue("pointing_up", 0.0));
+    eigenvalue_feature[7] = 0.0;
   }
 
-  CHECK_EQ(eigenvalue_feature.size(), kDimension) << "Feature has the wrong dimension";
-  features->replaceByName(eigenvalue_feature);
+  features->setFeature(kLayout, eigenvalue_feature);
 
   // Check that there were no overflows, underflows, or invalid float operations.
   if (std::fetestexcept(FE_OVERFLOW)) {
@@ -1,5 +1,7 @@
 #include "segmatch/descriptors/ensemble_shape_functions.hpp"
 
+#include <algorithm>
+
 #include <glog/logging.h>
 
 namespace segmatch {
@@ -18,12 +20,18 @@ void EnsembleShapeFunctions::describe(const Segment& segment, Features* features
   // After estimating the ensemble of shape functions, the signature should be of size 1.
   CHECK_EQ(signature->size(), 1u);
 
-  Feature feature("ensemble_shape");
-  for (unsigned int i = 0u; i < kSignatureDimension; ++i) {
-    feature.push_back(FeatureValue("esf_" + std::to_string(i), signature->points[0].histogram[i]));
-  }
-  CHECK_EQ(feature.size(), kSignatureDimension) << "Feature has the wrong dimension";
-  features->replaceByName(feature);
+  static const FeatureLayout& kLayout = []() -> const FeatureLayout& {
+    std::vector<std::string> value_names;
+    for (unsigned int i = 0u; i < kSignatureDimension; ++i) {
+      value_names.push_back("esf_" + std::to_string(i));
+    }
+    return FeatureLayout::get("ensemble_shape", value_names);
+  }();
+
+  FeatureValueType feature[kSignatureDimension];
+  std::copy(signature->points[0].histogram, signature->points[0].histogram + kSignatureDimension,
+            feature);
+  features->setFeature(kLayout, feature);
 }
 
 } // namespace segmatch
@@ -1,7 +1,69 @@
 #include "segmatch/features.hpp"
 
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
 namespace segmatch {
 
+namespace {
+
+bool isRotationInvariantValue(const std::string& name) {
+  return name != "scale_x" &&
+      name != "scale_y" &&
+      name != "scale_z" &&
+      name != "scale_sml" &&
+      name != "scale_med" &&
+      name != "scale_lrg" &&
+      name != "alignment" &&
+      name != "origin_dx" &&
+      name != "origin_dy";
+}
+
+} // namespace
+
+//=================================================================================================
+//    FeatureLayout
+//=================================================================================================
+
+FeatureLayout::FeatureLayout(const std::string& name, const std::vector<std::string>& value_names)
+  : name_(name), value_names_(value_names) {
+  for (size_t i = 0u; i < value_names_.size(); ++i) {
+    if (isRotationInvariantValue(value_names_[i])) rotation_invariant_indices_.push_back(i);
+  }
+}
+
+const FeatureLayout& FeatureLayout::get(const std::string& name,
+                                        const std::vector<std::string>& value_names) {
+  // Layouts are never removed, so that the references handed out stay valid. Several layouts
+  // can have the same name, e.g. if the size of the output of a network changes.
+  static std::mutex mutex;
+  static std::map<std::string, std::vector<std::unique_ptr<FeatureLayout>>> layouts;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<std::unique_ptr<FeatureLayout>>& layouts_with_name = layouts[name];
+  for (const auto& layout : layouts_with_name) {
+    if (layout->value_names_ == value_names) return *layout;
+  }
+  layouts_with_name.emplace_back(new FeatureLayout(name, value_names));
+  return *layouts_with_name.back();
+}
+
+bool FeatureLayout::findValueIndex(const std::string& value_name, size_t* index) const {
+  for (size_t i = 0u; i < value_names_.size(); ++i) {
+    if (value_names_[i] == value_name) {
+      if (index != NULL) *index = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+//=================================================================================================
+//    Feature
+//=================================================================================================
+
 bool Feature::findValueByName(const std::string& name, FeatureValue* value) const {
   for (size_t i = 0u; i < feature_values_.size(); ++i) {
     if (feature_values_.at(i).name == name) {
@@ -14,85 +76,159 @@ bool Feature::findValueByName(const std::string& name, FeatureValue* value) cons
   return false;
 }
 
-size_t Features::sizeWhenFlattened() const {
-  size_t result = 0u;
-  for (size_t i = 0u; i < size(); ++i) {
-    result += at(i).size();
-  }
-  return result;
+//=================================================================================================
+//    Features
+//=================================================================================================
+
+namespace {
+
+const FeatureLayout& getLayoutOf(const Feature& feature) {
+  std::vector<std::string> value_names;
+  value_names.reserve(feature.size());
+  for (size_t i = 0u; i < feature.size(); ++i) value_names.push_back(feature.at(i).name);
+  return FeatureLayout::get(feature.getName(), value_names);
 }
 
-std::vector<FeatureValueType> Features::asVectorOfValues() const {
-  std::vector<FeatureValueType> result;
-  for (size_t i = 0u; i < size(); ++i) {
-    for (size_t j = 0u; j < at(i).size(); j++) {
-      result.push_back(at(i).at(j).value);
-    }
-  }
-  return result;
+std::vector<FeatureValueType> getValuesOf(const Feature& feature) {
+  std::vector<FeatureValueType> values;
+  values.reserve(feature.size());
+  for (size_t i = 0u; i < feature.size(); ++i) values.push_back(feature.at(i).value);
+  return values;
 }
 
-Eigen::MatrixXd Features::asEigenMatrix() const {
-  std::vector<FeatureValueType> as_vector = asVectorOfValues();
-  Eigen::MatrixXd matrix(1, as_vector.size());
-  for (size_t i = 0u; i < as_vector.size(); ++i) {
-    matrix(0,i) = as_vector.at(i);
+} // namespace
+
+Features& Features::operator+= (const Features& rhs) {
+  const size_t offset = values_.size();
+  values_.insert(values_.end(), rhs.values_.begin(), rhs.values_.end());
+  for (const Slice& slice : rhs.slices_) {
+    slices_.push_back({ slice.layout, offset + slice.offset });
   }
-  return matrix;
+  updateRotationInvariantValues();
+  return *this;
 }
 
-Features Features::rotationInvariantFeaturesOnly() const {
-  Features result;
-  for (size_t i = 0u; i < size(); ++i) {
-    Feature feature;
-    for (size_t j = 0u; j < at(i).size(); j++) {
-      if (at(i).at(j).name != "scale_x" &&
-          at(i).at(j).name != "scale_y" &&
-          at(i).at(j).name != "scale_z" &&
-          at(i).at(j).name != "scale_sml" &&
-          at(i).at(j).name != "scale_med" &&
-          at(i).at(j).name != "scale_lrg" &&
-          at(i).at(j).name != "alignment" &&
-          at(i).at(j).name != "origin_dx" &&
-          at(i).at(j).name != "origin_dy") {
-        feature.push_back(at(i).at(j));
+void Features::setFeature(const FeatureLayout& layout, const FeatureValueType* values) {
+  CHECK(layout.size() == 0u || values != NULL);
+  for (size_t i = 0u; i < slices_.size(); ++i) {
+    if (slices_[i].layout != &layout && slices_[i].layout->getName() != layout.getName()) {
+      continue;
+    }
+
+    // Replace the feature in place, moving the following values if the size changed.
+    const size_t offset = slices_[i].offset;
+    const size_t old_size = slices_[i].layout->size();
+    if (layout.size() != old_size) {
+      values_.erase(values_.begin() + offset, values_.begin() + offset + old_size);
+      values_.insert(values_.begin() + offset, layout.size(), 0.0);
+      for (size_t j = i + 1u; j < slices_.size(); ++j) {
+        slices_[j].offset = slices_[j].offset + layout.size() - old_size;
       }
     }
-    if (!feature.empty()) { result.push_back(feature); }
+    slices_[i].layout = &layout;
+    std::copy(values, values + layout.size(), values_.begin() + offset);
+    updateRotationInvariantValues();
+    return;
   }
-  return result;
+
+  appendFeature(layout, values);
 }
 
-std::vector<std::string> Features::asVectorOfNames() const {
-  std::vector<std::string> result;
-  for (size_t i = 0u; i < size(); ++i) {
-    for (size_t j = 0u; j < at(i).size(); j++) {
-      result.push_back(at(i).at(j).name);
-    }
+void Features::appendFeature(const FeatureLayout& layout, const FeatureValueType* values) {
+  slices_.push_back({ &layout, values_.size() });
+  values_.insert(values_.end(), values, values + layout.size());
+  updateRotationInvariantValues();
+}
+
+void Features::push_back(const Feature& feature) {
+  const std::vector<FeatureValueType> values = getValuesOf(feature);
+  appendFeature(getLayoutOf(feature), values.data());
+}
+
+Feature Features::at(const size_t& index) const {
+  const Slice& slice = slices_.at(index);
+  const std::vector<std::string>& value_names = slice.layout->getValueNames();
+  Feature feature(slice.layout->getName());
+  for (size_t i = 0u; i < value_names.size(); ++i) {
+    feature.push_back(FeatureValue(value_names[i], values_[slice.offset + i]));
   }
-  return result;
+  return feature;
+}
+
+void Features::clear() {
+  slices_.clear();
+  values_.clear();
+  num_rotation_variant_values_ = 0u;
+  rotation_invariant_values_.clear();
+}
+
+void Features::eraseSlice(const size_t index) {
+  const size_t offset = slices_[index].offset;
+  const size_t size = slices_[index].layout->size();
+  values_.erase(values_.begin() + offset, values_.begin() + offset + size);
+  slices_.erase(slices_.begin() + index);
+  for (size_t i = index; i < slices_.size(); ++i) slices_[i].offset -= size;
 }
 
 void Features::clearByName(const std::string& name) {
-  auto removal_predicate = [&](const Feature& feature) {
-    return feature.getName() == name;
-  };
-  features_.erase(std::remove_if(features_.begin(), features_.end(), removal_predicate),
-                  features_.end());
+  for (size_t i = slices_.size(); i > 0u; --i) {
+    if (slices_[i - 1u].layout->getName() == name) eraseSlice(i - 1u);
+  }
+  updateRotationInvariantValues();
 }
 
 void Features::replaceByName(const Feature& new_feature) {
-  bool found = false;
-  for (auto& feature : features_) {
-    if (feature.getName() == new_feature.getName()) {
-      found = true;
-      feature = new_feature;
-      break;
+  const std::vector<FeatureValueType> values = getValuesOf(new_feature);
+  setFeature(getLayoutOf(new_feature), values.data());
+}
+
+void Features::updateRotationInvariantValues() {
+  num_rotation_variant_values_ = 0u;
+  for (const Slice& slice : slices_) {
+    num_rotation_variant_values_ +=
+        slice.layout->size() - slice.layout->getRotationInvariantIndices().size();
+  }
+
+  rotation_invariant_values_.clear();
+  if (num_rotation_variant_values_ == 0u) return;
+  rotation_invariant_values_.reserve(values_.size() - num_rotation_variant_values_);
+  for (const Slice& slice : slices_) {
+    for (const size_t index : slice.layout->getRotationInvariantIndices()) {
+      rotation_invariant_values_.push_back(values_[slice.offset + index]);
     }
   }
-  if (!found) features_.push_back(new_feature);
 }
 
+Eigen::MatrixXd Features::asEigenMatrix() const {
+  return Eigen::Map<const Eigen::MatrixXd>(values_.data(), 1, values_.size());
+}
+
+Features Features::rotationInvariantFeaturesOnly() const {
+  Features result;
+  for (size_t i = 0u; i < slices_.size(); ++i) {
+    const FeatureLayout& layout = *slices_[i].layout;
+    const FeatureValueType* values = values_.data() + slices_[i].offset;
+    if (layout.isRotationInvariant()) {
+      if (layout.size() != 0u) result.appendFeature(layout, values);
+    } else {
+      Feature feature(layout.getName());
+      for (const size_t index : layout.getRotationInvariantIndices()) {
+        feature.push_back(FeatureValue(layout.getValueNames()[index], values[index]));
+      }
+      if (!feature.empty()) { result.push_back(feature); }
+    }
+  }
+  return result;
+}
 
+std::vector<std::string> Features::asVectorOfNames() const {
+  std::vector<std::string> result;
+  result.reserve(values_.size());
+  for (const Slice& slice : slices_) {
+    result.insert(result.end(), slice.layout->getValueNames().begin(),
+                  slice.layout->getValueNames().end());
+  }
+  return result;
+}
 
 } // namespace segmatch
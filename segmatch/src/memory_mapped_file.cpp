@@ -0,0 +1,52 @@
+#include "segmatch/memory_mapped_file.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+namespace segmatch {
+
+bool MemoryMappedFile::open(const std::string& filename) {
+  close();
+
+  const int file_descriptor = ::open(filename.c_str(), O_RDONLY);
+  if (file_descriptor < 0) {
+    LOG(ERROR) << "Failed to open '" << filename << "': " << strerror(errno) << ".";
+    return false;
+  }
+
+  struct stat file_status;
+  if (fstat(file_descriptor, &file_status) != 0 || file_status.st_size <= 0) {
+    LOG(ERROR) << "Failed to get the size of '" << filename << "' or the file is empty.";
+    ::close(file_descriptor);
+    return false;
+  }
+
+  const size_t size = static_cast<size_t>(file_status.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+  // The mapping stays valid after closing the file descriptor.
+  ::close(file_descriptor);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "Failed to map '" << filename << "' in memory: " << strerror(errno) << ".";
+    return false;
+  }
+
+  data_ = static_cast<const char*>(data);
+  size_ = size;
+  return true;
+}
+
+void MemoryMappedFile::close() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0u;
+  }
+}
+
+} // namespace segmatch
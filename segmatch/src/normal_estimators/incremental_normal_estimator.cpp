@@ -1,56 +1,147 @@
 #include "segmatch/normal_estimators/incremental_normal_estimator.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+
 #include <laser_slam/benchmarker.hpp>
 #include <pcl/features/feature.h>
 #include <pcl/features/normal_3d.h>
 
 namespace segmatch {
 
-IncrementalNormalEstimator::IncrementalNormalEstimator(const float search_radius)
-  : search_radius_(search_radius), kd_tree_(new pcl::search::KdTree<MapPoint>) {
+// Computes the normal vector and the curvature of the plane fitting a neighborhood, given the
+// covariance matrix of the neighborhood packed as { xx, xy, xz, yy, yz, zz }. The smallest
+// eigenvalue is computed in closed form from the characteristic polynomial and the normal is the
+// normalized cross product of two rows of (C - lambda * I), as in pcl::eigen33().
+static void solvePlaneParameters(const float covariance[6], float& normal_x, float& normal_y,
+                                 float& normal_z, float& curvature) {
+  // Scale the matrix so that its entries are in [-1, 1], preventing overflows.
+  float scale = 0.0f;
+  for (size_t i = 0u; i < 6u; ++i) scale = std::max(scale, std::fabs(covariance[i]));
+  if (scale <= std::numeric_limits<float>::min()) scale = 1.0f;
+  const float inv_scale = 1.0f / scale;
+  const float m00 = covariance[0] * inv_scale, m01 = covariance[1] * inv_scale,
+      m02 = covariance[2] * inv_scale, m11 = covariance[3] * inv_scale,
+      m12 = covariance[4] * inv_scale, m22 = covariance[5] * inv_scale;
+
+  // Coefficients of the characteristic polynomial x^3 - c2*x^2 + c1*x - c0.
+  const float c0 = m00 * m11 * m22 + 2.0f * m01 * m02 * m12 - m00 * m12 * m12 - m11 * m02 * m02 -
+      m22 * m01 * m01;
+  const float c1 = m00 * m11 - m01 * m01 + m00 * m22 - m02 * m02 + m11 * m22 - m12 * m12;
+  const float c2 = m00 + m11 + m22;
+
+  // Smallest root of the polynomial. If c0 is zero the matrix is singular and the smallest
+  // eigenvalue is zero.
+  float eigenvalue = 0.0f;
+  if (std::fabs(c0) >= std::numeric_limits<float>::epsilon()) {
+    constexpr float kInv3 = 1.0f / 3.0f;
+    const float kSqrt3 = std::sqrt(3.0f);
+    const float c2_over_3 = c2 * kInv3;
+    const float a_over_3 = std::min(0.0f, (c1 - c2 * c2_over_3) * kInv3);
+    const float half_b = 0.5f * (c0 + c2_over_3 * (2.0f * c2_over_3 * c2_over_3 - c1));
+    const float q = std::min(0.0f, half_b * half_b + a_over_3 * a_over_3 * a_over_3);
+    const float rho = std::sqrt(-a_over_3);
+    const float theta = std::atan2(std::sqrt(-q), half_b) * kInv3;
+    const float cos_theta = std::cos(theta);
+    const float sin_theta = std::sin(theta);
+    eigenvalue = std::min(c2_over_3 + 2.0f * rho * cos_theta,
+                          std::min(c2_over_3 - rho * (cos_theta + kSqrt3 * sin_theta),
+                                   c2_over_3 - rho * (cos_theta - kSqrt3 * sin_theta)));
+    // Roots are non-negative for covariance matrices.
+    eigenvalue = std::max(0.0f, eigenvalue);
+  }
+
+  // The eigenvector is orthogonal to the rows of (C - lambda * I). Take the most stable cross
+  // product.
+  const Eigen::Vector3f row_0(m00 - eigenvalue, m01, m02);
+  const Eigen::Vector3f row_1(m01, m11 - eigenvalue, m12);
+  const Eigen::Vector3f row_2(m02, m12, m22 - eigenvalue);
+  const Eigen::Vector3f cross_01 = row_0.cross(row_1);
+  const Eigen::Vector3f cross_02 = row_0.cross(row_2);
+  const Eigen::Vector3f cross_12 = row_1.cross(row_2);
+  const float length_01 = cross_01.squaredNorm();
+  const float length_02 = cross_02.squaredNorm();
+  const float length_12 = cross_12.squaredNorm();
+  Eigen::Vector3f normal;
+  if (std::max(length_01, std::max(length_02, length_12)) <=
+      std::numeric_limits<float>::epsilon()) {
+    // The smallest eigenvalue is repeated, any vector orthogonal to the remaining row is valid.
+    const Eigen::Vector3f& row = row_0.squaredNorm() >= row_1.squaredNorm() ?
+        (row_0.squaredNorm() >= row_2.squaredNorm() ? row_0 : row_2) :
+        (row_1.squaredNorm() >= row_2.squaredNorm() ? row_1 : row_2);
+    normal = row.squaredNorm() > 0.0f ? row.unitOrthogonal() : Eigen::Vector3f::UnitZ();
+  } else if (length_01 >= length_02 && length_01 >= length_12) {
+    normal = cross_01 / std::sqrt(length_01);
+  } else if (length_02 >= length_01 && length_02 >= length_12) {
+    normal = cross_02 / std::sqrt(length_02);
+  } else {
+    normal = cross_12 / std::sqrt(length_12);
+  }
+  normal_x = normal.x();
+  normal_y = normal.y();
+  normal_z = normal.z();
+
+  // The sum of the eigenvalues is equal to the trace.
+  curvature = c2 != 0.0f ? std::fabs(eigenvalue / c2) : 0.0f;
+}
+
+IncrementalNormalEstimator::IncrementalNormalEstimator(const float search_radius,
+                                                       const size_t num_threads)
+  : search_radius_(search_radius), num_threads_(std::max<size_t>(1u, num_threads)),
+    kd_tree_(new pcl::search::KdTree<MapPoint>) {
 }
 
 void IncrementalNormalEstimator::notifyPointsTransformed(
       const kindr::minimal::QuatTransformationTemplate<float>& transformation) {
   BENCHMARK_BLOCK("SM.AddNewPoints.EstimateNormals.NotifyPointsTransformed");
-  // Rotate the components of the covariance matrix by rewriting the the points as X := R*X + T
-  // where R is the rotation matrix and T the translation vector of the transformation.
+  // The moments are relative to the anchors, thus only the anchors are affected by the
+  // translation. Rewriting the points as X := R*X + T, where R is the rotation matrix and T the
+  // translation vector of the transformation, the anchors become A := R*A + T and the relative
+  // coordinates D := R*D.
 
   // Get rotation and translation matrix.
   const EIGEN_ALIGN16 Eigen::Matrix3f R = transformation.getRotationMatrix();
   const EIGEN_ALIGN16 Eigen::Vector3f T = transformation.getPosition();
   const EIGEN_ALIGN16 Eigen::Matrix3f Rt = R.transpose();
-  const EIGEN_ALIGN16 Eigen::RowVector3f Tt = T.transpose();
 
+  float* xx = getMoments(kXX); float* xy = getMoments(kXY); float* xz = getMoments(kXZ);
+  float* yy = getMoments(kYY); float* yz = getMoments(kYZ); float* zz = getMoments(kZZ);
+  float* x = getMoments(kX); float* y = getMoments(kY); float* z = getMoments(kZ);
+  float* anchor_x = getMoments(kAnchorX); float* anchor_y = getMoments(kAnchorY);
+  float* anchor_z = getMoments(kAnchorZ);
   for (size_t i = 0u; i < normals_.size(); ++i) {
     pcl::Vector3fMap normal = normals_[i].getNormalVector3fMap();
-    Eigen::Matrix3f& sum_X_Xt = sum_X_Xt_[i];
-    Eigen::Vector3f& sum_X = sum_X_[i];
-    const float n = num_points_[i];
+    Eigen::Matrix3f sum_D_Dt;
+    sum_D_Dt << xx[i], xy[i], xz[i],
+                xy[i], yy[i], yz[i],
+                xz[i], yz[i], zz[i];
+    const Eigen::Vector3f sum_D(x[i], y[i], z[i]);
+    const Eigen::Vector3f anchor(anchor_x[i], anchor_y[i], anchor_z[i]);
 
     // Transform the components of the covariance
-    sum_X_Xt = R * sum_X_Xt * Rt + R * sum_X * Tt + T * sum_X.transpose() * Rt + n * T * Tt;
-    sum_X = n * T + R * sum_X;
+    sum_D_Dt = R * sum_D_Dt * Rt;
+    const Eigen::Vector3f R_sum_D = R * sum_D;
+    const Eigen::Vector3f new_anchor = R * anchor + T;
+    xx[i] = sum_D_Dt(0, 0); xy[i] = sum_D_Dt(0, 1); xz[i] = sum_D_Dt(0, 2);
+    yy[i] = sum_D_Dt(1, 1); yz[i] = sum_D_Dt(1, 2); zz[i] = sum_D_Dt(2, 2);
+    x[i] = R_sum_D.x(); y[i] = R_sum_D.y(); z[i] = R_sum_D.z();
+    anchor_x[i] = new_anchor.x(); anchor_y[i] = new_anchor.y(); anchor_z[i] = new_anchor.z();
     normal = transformation.getRotation().rotate(normal);
   }
 }
 
-void IncrementalNormalEstimator::clear() {
-  sum_X_Xt_.clear();
-  sum_X_.clear();
-  num_points_.clear();
-  normals_.clear();
+void IncrementalNormalEstimator::notifyPointsExcluded(const std::vector<int>& points_indices) {
+  excluded_points_indices_.insert(excluded_points_indices_.end(), points_indices.begin(),
+                                  points_indices.end());
 }
 
-// Auxiliary function for rearranging elements in a vector according to a mapping.
-template <typename Container, typename Element>
-void rearrangeElementsWithMapping(const std::vector<int>& mapping, const size_t new_size,
-                                  const Element& default_value, Container& container) {
-  Container new_container(new_size, default_value);
-  for (size_t i = 0u; i < mapping.size(); ++i) {
-    if (mapping[i] >= 0) new_container[mapping[i]] = std::move(container[i]);
-  }
-  container = std::move(new_container);
+void IncrementalNormalEstimator::clear() {
+  moments_.clear();
+  moments_stride_ = 0u;
+  normals_.clear();
+  excluded_points_indices_.clear();
 }
 
 std::vector<bool> IncrementalNormalEstimator::updateNormals(
@@ -59,15 +150,17 @@ std::vector<bool> IncrementalNormalEstimator::updateNormals(
     PointsNeighborsProvider<MapPoint>& points_neighbors_provider) {
 
   // Rearrange the cached information according to the mapping.
-  rearrangeElementsWithMapping(points_mapping, points.size(), Eigen::Matrix3f::Zero(), sum_X_Xt_);
-  rearrangeElementsWithMapping(points_mapping, points.size(), Eigen::Vector3f::Zero(), sum_X_);
-  rearrangeElementsWithMapping(points_mapping, points.size(), 0u, num_points_);
-  rearrangeElementsWithMapping(points_mapping, points.size(), PclNormal(), normals_.points);
-
-  // Scatter the contributions of the new points to the covariance matrices of each point's
-  // neighborhood.
-  const std::vector<bool> is_normal_affected = scatterNormalContributions(
+  remapInPlace(points_mapping, points);
+
+  // Remove the contributions of the excluded points, then scatter the contributions of the new
+  // points to the covariance matrices of each point's neighborhood.
+  const std::vector<bool> is_normal_affected_by_exclusion = subtractNormalContributions(
       points, new_points_indices, points_neighbors_provider);
+  std::vector<bool> is_normal_affected = scatterNormalContributions(
+      points, new_points_indices, points_neighbors_provider);
+  for (size_t i = 0u; i < is_normal_affected_by_exclusion.size(); ++i) {
+    if (is_normal_affected_by_exclusion[i]) is_normal_affected[i] = true;
+  }
 
   // Perform eigenvalues analysis on the affected point's covariances to determine their new
   // normals.
@@ -75,6 +168,39 @@ std::vector<bool> IncrementalNormalEstimator::updateNormals(
   return is_normal_affected;
 }
 
+std::vector<bool> IncrementalNormalEstimator::subtractNormalContributions(
+    const MapCloud& points, const std::vector<int>& new_points_indices,
+    PointsNeighborsProvider<MapPoint>& points_neighbors_provider) {
+  if (excluded_points_indices_.empty()) return std::vector<bool>();
+  BENCHMARK_BLOCK("SM.AddNewPoints.EstimateNormals.SubtractContributions");
+
+  std::vector<bool> is_new_point(points.size(), false);
+  for (auto point_index : new_points_indices) is_new_point[point_index] = true;
+
+  // The excluded points contributed to all their old neighbors, and these contributed to them.
+  // The new points never received their contributions, since the points neighbors provider
+  // doesn't return excluded points. The moments of the excluded points themselves are reset when
+  // they contribute again, as new points.
+  points_neighbors_provider.getNeighborsOfPoints(excluded_points_indices_.data(),
+                                                 excluded_points_indices_.size(), search_radius_,
+                                                 neighbors_, num_threads_);
+  std::vector<bool> is_normal_affected(points.size(), false);
+  for (size_t i = 0u; i < excluded_points_indices_.size(); ++i) {
+    const Eigen::Vector3f& source_point = points[excluded_points_indices_[i]].getVector3fMap();
+    for (const int* neighbor_it = neighbors_.begin(i); neighbor_it != neighbors_.end(i);
+         ++neighbor_it) {
+      if (is_new_point[*neighbor_it]) continue;
+      is_normal_affected[*neighbor_it] = true;
+      subtractFromMoments(*neighbor_it, source_point);
+    }
+  }
+
+  BENCHMARK_RECORD_VALUE("SM.AddNewPoints.EstimateNormals.ExcludedPoints",
+                         excluded_points_indices_.size());
+  excluded_points_indices_.clear();
+  return is_normal_affected;
+}
+
 std::vector<bool> IncrementalNormalEstimator::scatterNormalContributions(
     const MapCloud& points, const std::vector<int>& new_points_indices,
     PointsNeighborsProvider<MapPoint>& points_neighbors_provider) {
@@ -83,28 +209,29 @@ std::vector<bool> IncrementalNormalEstimator::scatterNormalContributions(
   std::vector<bool> is_new_point(points.size(), false);
   for (auto point_index : new_points_indices) is_new_point[point_index] = true;
 
+  // Find the neighbors of all the new points at once.
+  points_neighbors_provider.getNeighborsOfPoints(new_points_indices.data(),
+                                                 new_points_indices.size(), search_radius_,
+                                                 neighbors_, num_threads_);
+  if (num_threads_ > 1u) return gatherNormalContributions(points, new_points_indices);
+
   // Scatter information to all the points that are affected by the new points.
   std::vector<bool> is_normal_affected(points.size(), false);
-  for (auto point_index : new_points_indices) {
-    // Find neighbors.
-    std::vector<int> neighbors_indices = points_neighbors_provider.getNeighborsOf(point_index,
-                                                                                  search_radius_);
+  for (size_t i = 0u; i < new_points_indices.size(); ++i) {
+    const int point_index = new_points_indices[i];
     is_normal_affected[point_index] = true;
 
     const Eigen::Vector3f& source_point = points[point_index].getVector3fMap();
-    for (const auto neighbor_index : neighbors_indices) {
+    for (const int* neighbor_it = neighbors_.begin(i); neighbor_it != neighbors_.end(i);
+         ++neighbor_it) {
+      const int neighbor_index = *neighbor_it;
       // Add contribution to the neighbor point.
       is_normal_affected[neighbor_index] = true;
-      sum_X_Xt_[neighbor_index] += source_point * source_point.transpose();
-      sum_X_[neighbor_index] += source_point;
-      ++num_points_[neighbor_index];
+      addToMoments(neighbor_index, source_point);
 
       // If the neighbor is an old point, then it also contributes to the normal of the new point.
       if (!is_new_point[neighbor_index]) {
-        const Eigen::Vector3f& neighbor_point = points[neighbor_index].getVector3fMap();
-        sum_X_Xt_[point_index] += neighbor_point * neighbor_point.transpose();
-        sum_X_[point_index] += neighbor_point;
-        ++num_points_[point_index];
+        addToMoments(point_index, points[neighbor_index].getVector3fMap());
       }
     }
   }
@@ -112,40 +239,240 @@ std::vector<bool> IncrementalNormalEstimator::scatterNormalContributions(
   return is_normal_affected;
 }
 
+std::vector<bool> IncrementalNormalEstimator::gatherNormalContributions(
+    const MapCloud& points, const std::vector<int>& new_points_indices) {
+  // Position of each new point in new_points_indices, -1 for old points.
+  std::vector<int> new_point_positions(points.size(), -1);
+  for (size_t i = 0u; i < new_points_indices.size(); ++i)
+    new_point_positions[new_points_indices[i]] = i;
+
+  // Transpose the neighbors, so that each affected point knows the new points having it as
+  // neighbor. Sources are sorted by position in new_points_indices.
+  std::vector<size_t> sources_offsets(points.size() + 1u, 0u);
+  for (const int neighbor_index : neighbors_.indices) ++sources_offsets[neighbor_index + 1u];
+  for (size_t i = 0u; i < points.size(); ++i) sources_offsets[i + 1u] += sources_offsets[i];
+  std::vector<int> sources(neighbors_.indices.size());
+  std::vector<size_t> next_source(sources_offsets.begin(), sources_offsets.end() - 1u);
+  for (size_t i = 0u; i < new_points_indices.size(); ++i) {
+    for (const int* neighbor_it = neighbors_.begin(i); neighbor_it != neighbors_.end(i);
+         ++neighbor_it) {
+      sources[next_source[*neighbor_it]++] = i;
+    }
+  }
+
+  std::vector<bool> is_normal_affected(points.size(), false);
+  std::vector<int> affected_points_indices;
+  for (size_t i = 0u; i < points.size(); ++i) {
+    if (new_point_positions[i] >= 0 || sources_offsets[i] != sources_offsets[i + 1u]) {
+      is_normal_affected[i] = true;
+      affected_points_indices.push_back(i);
+    }
+  }
+
+  // Each affected point pulls its contributions in the same order in which the serial scatter
+  // pushes them, so that the sums are identical. The contributions of the neighbors of a new
+  // point are added when the new point itself is reached in the order of the sources.
+  runInParallel(affected_points_indices.size(), [&](const size_t begin, const size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const int point_index = affected_points_indices[i];
+      const int position = new_point_positions[point_index];
+
+      auto add_own_neighbors = [&]() {
+        for (const int* neighbor_it = neighbors_.begin(position);
+             neighbor_it != neighbors_.end(position); ++neighbor_it) {
+          if (*neighbor_it == point_index || new_point_positions[*neighbor_it] < 0) {
+            addToMoments(point_index, points[*neighbor_it].getVector3fMap());
+          }
+        }
+      };
+
+      bool are_own_neighbors_added = position < 0;
+      for (size_t j = sources_offsets[point_index]; j < sources_offsets[point_index + 1u]; ++j) {
+        if (!are_own_neighbors_added && sources[j] >= position) {
+          add_own_neighbors();
+          are_own_neighbors_added = true;
+        }
+        if (sources[j] == position) continue;
+        addToMoments(point_index, points[new_points_indices[sources[j]]].getVector3fMap());
+      }
+      if (!are_own_neighbors_added) add_own_neighbors();
+    }
+  });
+
+  return is_normal_affected;
+}
+
 void IncrementalNormalEstimator::recomputeNormals(const MapCloud& points,
                                                   const std::vector<bool>& needs_recompute) {
   BENCHMARK_BLOCK("SM.AddNewPoints.EstimateNormals.UpdateNormals");
 
-  CHECK(needs_recompute.size() == sum_X_Xt_.size());
-  CHECK(needs_recompute.size() == sum_X_.size());
-  CHECK(needs_recompute.size() == num_points_.size());
   CHECK(needs_recompute.size() == normals_.size());
+  CHECK(moments_stride_ >= normals_.size());
 
   // Only recompute normals for affected points.
-  size_t num_affected_normals = 0u;
-  for (size_t i = 0u; i < normals_.size(); ++i) {
-    if (needs_recompute[i]) {
-      ++num_affected_normals;
-      if (num_points_[i] >= 3u) {
-        // If there are at least three points in the neighborhood, the normal vector is equal to
-        // the eigenvector of the smallest eigenvalue.
-        const float norm_factor = 1.0f / static_cast<float>(num_points_[i]);
-        const EIGEN_ALIGN16 Eigen::Matrix3f covariance =
-            (sum_X_Xt_[i] * norm_factor - sum_X_[i] * norm_factor * sum_X_[i].transpose() * norm_factor);
-        pcl::solvePlaneParameters(covariance, normals_[i].normal_x, normals_[i].normal_y,
-                                  normals_[i].normal_z, normals_[i].curvature);
-        constexpr float view_point_component = std::numeric_limits<float>::max();
-        pcl::flipNormalTowardsViewpoint(points[i], view_point_component, view_point_component,
-                                        view_point_component, normals_[i].normal_x,
-                                        normals_[i].normal_y, normals_[i].normal_z);
-      } else {
-        // Otherwise we don't have enough data to estimate the normal. Just set it to NaN.
-        normals_[i].normal_x = normals_[i].normal_y = normals_[i].normal_z = normals_[i].curvature
-            = std::numeric_limits<float>::quiet_NaN();
+  const float* xx = getMoments(kXX); const float* xy = getMoments(kXY);
+  const float* xz = getMoments(kXZ); const float* yy = getMoments(kYY);
+  const float* yz = getMoments(kYZ); const float* zz = getMoments(kZZ);
+  const float* x = getMoments(kX); const float* y = getMoments(kY); const float* z = getMoments(kZ);
+  const float* n = getMoments(kN);
+  runInParallel(normals_.size(), [&](const size_t begin, const size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      if (needs_recompute[i]) {
+        if (n[i] >= 3.0f) {
+          // If there are at least three points in the neighborhood, the normal vector is equal to
+          // the eigenvector of the smallest eigenvalue.
+          const float norm_factor = 1.0f / n[i];
+          const float mean_x = x[i] * norm_factor;
+          const float mean_y = y[i] * norm_factor;
+          const float mean_z = z[i] * norm_factor;
+          const float covariance[6] = {
+            xx[i] * norm_factor - mean_x * mean_x, xy[i] * norm_factor - mean_x * mean_y,
+            xz[i] * norm_factor - mean_x * mean_z, yy[i] * norm_factor - mean_y * mean_y,
+            yz[i] * norm_factor - mean_y * mean_z, zz[i] * norm_factor - mean_z * mean_z };
+          solvePlaneParameters(covariance, normals_[i].normal_x, normals_[i].normal_y,
+                               normals_[i].normal_z, normals_[i].curvature);
+          constexpr float view_point_component = std::numeric_limits<float>::max();
+          pcl::flipNormalTowardsViewpoint(points[i], view_point_component, view_point_component,
+                                          view_point_component, normals_[i].normal_x,
+                                          normals_[i].normal_y, normals_[i].normal_z);
+        } else {
+          // Otherwise we don't have enough data to estimate the normal. Just set it to NaN.
+          normals_[i].normal_x = normals_[i].normal_y = normals_[i].normal_z =
+              normals_[i].curvature = std::numeric_limits<float>::quiet_NaN();
+        }
       }
     }
-  }
+  });
+
+  const size_t num_affected_normals = std::count(needs_recompute.begin(), needs_recompute.end(),
+                                                 true);
   BENCHMARK_RECORD_VALUE("SM.AddNewPoints.EstimateNormals.AffectedNormals", num_affected_normals);
 }
 
+void IncrementalNormalEstimator::reserveMoments(const size_t num_points) {
+  if (num_points <= moments_stride_) return;
+
+  // Grow the stride geometrically and move each array to its new position.
+  const size_t new_stride = std::max(num_points, moments_stride_ + moments_stride_ / 2u);
+  std::vector<float> new_moments(kNumMoments * new_stride, 0.0f);
+  for (size_t m = 0u; m < kNumMoments; ++m) {
+    std::copy(moments_.begin() + m * moments_stride_, moments_.begin() + (m + 1u) * moments_stride_,
+              new_moments.begin() + m * new_stride);
+  }
+  moments_ = std::move(new_moments);
+  moments_stride_ = new_stride;
+}
+
+inline void IncrementalNormalEstimator::addToMoments(const size_t point_index,
+                                                     const Eigen::Vector3f& point) {
+  float* moments = moments_.data() + point_index;
+  const float dx = point.x() - moments[kAnchorX * moments_stride_];
+  const float dy = point.y() - moments[kAnchorY * moments_stride_];
+  const float dz = point.z() - moments[kAnchorZ * moments_stride_];
+  moments[kXX * moments_stride_] += dx * dx;
+  moments[kXY * moments_stride_] += dx * dy;
+  moments[kXZ * moments_stride_] += dx * dz;
+  moments[kYY * moments_stride_] += dy * dy;
+  moments[kYZ * moments_stride_] += dy * dz;
+  moments[kZZ * moments_stride_] += dz * dz;
+  moments[kX * moments_stride_] += dx;
+  moments[kY * moments_stride_] += dy;
+  moments[kZ * moments_stride_] += dz;
+  moments[kN * moments_stride_] += 1.0f;
+}
+
+inline void IncrementalNormalEstimator::subtractFromMoments(const size_t point_index,
+                                                           const Eigen::Vector3f& point) {
+  float* moments = moments_.data() + point_index;
+  const float dx = point.x() - moments[kAnchorX * moments_stride_];
+  const float dy = point.y() - moments[kAnchorY * moments_stride_];
+  const float dz = point.z() - moments[kAnchorZ * moments_stride_];
+  moments[kXX * moments_stride_] -= dx * dx;
+  moments[kXY * moments_stride_] -= dx * dy;
+  moments[kXZ * moments_stride_] -= dx * dz;
+  moments[kYY * moments_stride_] -= dy * dy;
+  moments[kYZ * moments_stride_] -= dy * dz;
+  moments[kZZ * moments_stride_] -= dz * dz;
+  moments[kX * moments_stride_] -= dx;
+  moments[kY * moments_stride_] -= dy;
+  moments[kZ * moments_stride_] -= dz;
+  moments[kN * moments_stride_] -= 1.0f;
+}
+
+void IncrementalNormalEstimator::remapInPlace(const std::vector<int>& points_mapping,
+                                              const MapCloud& points) {
+  BENCHMARK_BLOCK("SM.AddNewPoints.EstimateNormals.Remap");
+  const size_t old_size = normals_.size();
+  const size_t new_size = points.size();
+  CHECK_EQ(points_mapping.size(), old_size);
+  const size_t work_size = std::max(old_size, new_size);
+  reserveMoments(work_size);
+  normals_.resize(work_size);
+
+  // Complete the mapping to a permutation of the work_size slots. The slots of the removed points
+  // and the unused slots are sent to the positions that are not the target of the mapping.
+  std::vector<int> targets(work_size, -1);
+  std::vector<bool> is_target(work_size, false);
+  for (size_t i = 0u; i < old_size; ++i) {
+    if (points_mapping[i] >= 0) {
+      targets[i] = points_mapping[i];
+      is_target[points_mapping[i]] = true;
+    }
+  }
+  size_t free_position = 0u;
+  for (size_t i = 0u; i < work_size; ++i) {
+    if (targets[i] < 0) {
+      while (is_target[free_position]) ++free_position;
+      targets[i] = free_position++;
+    }
+  }
+
+  // Apply the permutation with swaps. Each swap moves one element to its final position.
+  for (size_t i = 0u; i < work_size; ++i) {
+    while (static_cast<size_t>(targets[i]) != i) {
+      const size_t j = targets[i];
+      for (size_t m = 0u; m < kNumMoments; ++m) {
+        float* moments = getMoments(static_cast<Moment>(m));
+        std::swap(moments[i], moments[j]);
+      }
+      std::swap(normals_[i], normals_[j]);
+      std::swap(targets[i], targets[j]);
+    }
+  }
+
+  // Reset the positions of the new points and drop the removed ones.
+  for (size_t i = 0u; i < new_size; ++i) {
+    if (!is_target[i]) {
+      for (size_t m = 0u; m < kAnchorX; ++m) getMoments(static_cast<Moment>(m))[i] = 0.0f;
+      getMoments(kAnchorX)[i] = points[i].x;
+      getMoments(kAnchorY)[i] = points[i].y;
+      getMoments(kAnchorZ)[i] = points[i].z;
+      normals_[i] = PclNormal();
+    }
+  }
+  normals_.resize(new_size);
+}
+
+void IncrementalNormalEstimator::runInParallel(
+    const size_t num_items, const std::function<void(size_t, size_t)>& job) const {
+  constexpr size_t kMinItemsPerThread = 1024u;
+  const size_t num_threads = std::max<size_t>(1u, std::min<size_t>(
+      num_threads_, num_items / kMinItemsPerThread));
+  if (num_threads == 1u) {
+    job(0u, num_items);
+    return;
+  }
+
+  // Assign to each thread a contiguous range of items.
+  const size_t items_per_thread = (num_items + num_threads - 1u) / num_threads;
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1u);
+  for (size_t t = 1u; t < num_threads; ++t) {
+    threads.emplace_back(job, t * items_per_thread,
+                         std::min(num_items, (t + 1u) * items_per_thread));
+  }
+  job(0u, items_per_thread);
+  for (auto& thread : threads) thread.join();
+}
+
 } // namespace segmatch
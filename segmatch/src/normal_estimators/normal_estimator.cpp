@@ -8,13 +8,14 @@
 namespace segmatch {
 
 std::unique_ptr<NormalEstimator> NormalEstimator::create(
-    const std::string& estimator_type, const float radius_for_estimation_m) {
+    const std::string& estimator_type, const float radius_for_estimation_m,
+    const size_t num_threads) {
   if (estimator_type == "Simple") {
     return std::unique_ptr<NormalEstimator>(
         new SimpleNormalEstimator(radius_for_estimation_m));
   } else if (estimator_type == "Incremental") {
     return std::unique_ptr<NormalEstimator>(
-        new IncrementalNormalEstimator(radius_for_estimation_m));
+        new IncrementalNormalEstimator(radius_for_estimation_m, num_threads));
   } else {
     LOG(FATAL) << "Invalid normal estimator type specified: " << estimator_type;
     throw std::invalid_argument("Invalid normal estimator type specified: " + estimator_type);
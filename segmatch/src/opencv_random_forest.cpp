@@ -1,10 +1,12 @@
 #include "segmatch/opencv_random_forest.hpp"
 
+
 #include <laser_slam/benchmarker.hpp>
 #include <laser_slam/common.hpp>
 #include <ros/console.h>
 
-using namespace Nabo;
+#include "segmatch/descriptor_indices/descriptor_index_factory.hpp"
+
 using namespace Eigen;
 
 namespace segmatch {
@@ -19,6 +21,7 @@ OpenCvRandomForest::OpenCvRandomForest(const ClassifierParams& params)
     inverted_max_eigen_float_(0, i) = float(
         1.0 / params.max_eigen_features_values[i]);
   }
+  knn_index_ = createKnnIndex();
 }
 
 OpenCvRandomForest::~OpenCvRandomForest() {
@@ -29,10 +32,28 @@ void OpenCvRandomForest::resetParams(const ClassifierParams& params) {
   LOG(INFO) << "n_nearest_neighbours: " << params_.n_nearest_neighbours;
   LOG(INFO) << "enable_two_stage_retrieval: " << params_.enable_two_stage_retrieval;
   LOG(INFO) << "knn_feature_dim: " << params_.knn_feature_dim;
+  LOG(INFO) << "knn_index_type: " << params_.knn_index_type;
   LOG(INFO) << "threshold_to_accept_match: " << params_.threshold_to_accept_match;
   LOG(INFO) << "classifier_filename: " << params_.classifier_filename;
 
+  // The index has to be built again if the descriptors it contains or its type change.
+  const bool reset_target = params.knn_feature_dim != params_.knn_feature_dim ||
+      params.normalize_eigen_for_knn != params_.normalize_eigen_for_knn ||
+      params.do_not_use_cars != params_.do_not_use_cars ||
+      params.knn_index_type != params_.knn_index_type ||
+      params.hnsw_max_links != params_.hnsw_max_links ||
+      params.hnsw_ef_construction != params_.hnsw_ef_construction ||
+      params.hnsw_ef_search != params_.hnsw_ef_search ||
+      params.ivfpq_num_lists != params_.ivfpq_num_lists ||
+      params.ivfpq_num_probes != params_.ivfpq_num_probes ||
+      params.ivfpq_num_subquantizers != params_.ivfpq_num_subquantizers;
   params_ = params;
+  if (reset_target) {
+    target_segments_.clear();
+    knn_index_ = createKnnIndex();
+    n_target_segments_ = 0u;
+    is_target_set_ = false;
+  }
 }
 
 void histogramIntersection(const Eigen::MatrixXd& h1, const Eigen::MatrixXd& h2,
@@ -137,9 +158,7 @@ PairwiseMatches OpenCvRandomForest::findCandidates(
   PairwiseMatches candidates;
   PairwiseMatches candidates_after_first_stage;
 
-  if (target_cloud_.empty()
-      || target_cloud_.getNumberOfValidSegments()
-          < kMinNumberSegmentInTargetCloud) {
+  if (n_target_segments_ < kMinNumberSegmentInTargetCloud || target_segments_.size() < 2u) {
     return candidates;
   }
 
@@ -166,97 +185,60 @@ PairwiseMatches OpenCvRandomForest::findCandidates(
   }*/
 
   if (params_.n_nearest_neighbours > 0) {
-    static std::vector<int> first_matches;
-
-    for (std::unordered_map<Id, Segment>::const_iterator it_source = source_cloud.begin();
-        it_source != source_cloud.end(); ++it_source) {
-
+    // Gather the descriptors of the source segments, so that they can be searched in a single
+    // batch.
+    std::vector<const Segment*> source_segments;
+    source_segments.reserve(source_cloud.size());
+    for (const auto& id_segment : source_cloud) {
+      const Segment& source_segment = id_segment.second;
       if (params_.do_not_use_cars) {
-        if (it_source->second.empty()) continue;  
-        if (it_source->second.getLastView().semantic == 1u) continue;
+        if (source_segment.empty()) continue;
+        if (source_segment.getLastView().semantic == 1u) continue;
       }
-      if (it_source->second.getLastView().features.size() == 0) {
+      if (source_segment.getLastView().features.size() == 0) {
         continue;
       }
+      source_segments.push_back(&source_segment);
+    }
 
-      Segment source_segment = it_source->second;
-      Eigen::MatrixXd features_source = 
-          source_segment.getLastView().features.rotationInvariantFeaturesOnly().asEigenMatrix();
-
-      VectorXf q;
-      if (params_.normalize_eigen_for_knn) {
-        Eigen::MatrixXd features_source_normalized = features_source;
-        normalizeEigenFeatures(&features_source_normalized);
-        q = features_source_normalized.block(0, 0, 1, params_.knn_feature_dim)
-            .transpose().cast<float>();
-      } else {
-        q = features_source.block(0, 0, 1, params_.knn_feature_dim).transpose()
-            .cast<float>();
-      }
-
-      const unsigned int n_nearest_neighbours = std::min(
-          params_.n_nearest_neighbours, int(target_segment_ids_.size()) - 1);
-      VectorXi indices(n_nearest_neighbours);
-      VectorXf dists2(n_nearest_neighbours);
-      nns_->knn(q, indices, dists2, n_nearest_neighbours);
-
-      // bool found = false;
-      // int n_nn_inv = 0;
+    Eigen::MatrixXf queries(params_.knn_feature_dim, source_segments.size());
+    for (size_t i = 0u; i < source_segments.size(); ++i) {
+      queries.col(i) = computeKnnDescriptor(
+          source_segments[i]->getLastView().features.getRotationInvariantValues());
+    }
 
-      bool first = true;
-      for (size_t i = 0u; i < n_nearest_neighbours; ++i) {
-        if (indices[i] == 0) {
-          // TODO RD Sometimes all the indices are 0. Investigate this. 
-          break;
-        }
-        if (source_segment.segment_id != target_segment_ids_[indices[i]]) {
-          PairwiseMatch match(source_segment.segment_id,
-                              target_segment_ids_[indices[i]],
-                              source_segment.getLastView().timestamp_ns,
-                              target_segment_ts_[indices[i]],
-                              source_segment.getLastView().centroid,
-                              target_segment_centroids_[indices[i]], 1.0);
-          match.features1_ = features_source;
-          match.features2_ = target_segment_features_[indices[i]];
-
-          // if (!found && (source_segment.getLastView().centroid.getVector3fMap() -
-          //     target_segment_centroids_[indices[i]].getVector3fMap()).norm() < 2.0) {
-          //   if (std::abs(source_segment.getLastView().timestamp_ns - target_segment_ts_[indices[i]]) > 60000000000ll) {
-          //     first_matches.push_back(n_nn_inv);
-          //     found = true;
-          //   }
-          // }
-          // // count only not valid
-          // else {
-          //   ++n_nn_inv;
-          // }
-
-          if (first &&
-              std::abs(source_segment.getLastView().timestamp_ns - target_segment_ts_[indices[i]]) > 60000000000ll) {
-            first = false;
-            if(i < n_nearest_neighbours - 1 &&
-               1.2 * sqrt(dists2[i]) < sqrt(dists2[i + 1])) {
-              candidates_after_first_stage.push_back(match);
-            }
+    const size_t n_nearest_neighbours = std::min(
+        static_cast<size_t>(params_.n_nearest_neighbours), target_segments_.size() - 1u);
+    IdMatrix neighbour_ids;
+    Eigen::MatrixXf dists2;
+    knn_index_->knnBatch(queries, n_nearest_neighbours, &neighbour_ids, &dists2,
+                         std::max(params_.knn_num_threads, 1));
+
+    // Keep the nearest target segment observed at least one minute apart from the source
+    // segment, if it passes the ratio test with the next neighbour.
+    for (size_t j = 0u; j < source_segments.size(); ++j) {
+      const Segment& source_segment = *source_segments[j];
+      const SegmentView& source_view = source_segment.getLastView();
+      for (size_t i = 0u; i < n_nearest_neighbours && neighbour_ids(i, j) != kNoId; ++i) {
+        if (source_segment.segment_id == neighbour_ids(i, j)) continue;
+        const TargetSegment& target_segment = target_segments_.at(neighbour_ids(i, j));
+        if (std::abs(source_view.timestamp_ns - target_segment.timestamp_ns) > 60000000000ll) {
+          if (i + 1u < n_nearest_neighbours && neighbour_ids(i + 1u, j) != kNoId &&
+              1.2 * sqrt(dists2(i, j)) < sqrt(dists2(i + 1u, j))) {
+            PairwiseMatch match(source_segment.segment_id,
+                                neighbour_ids(i, j),
+                                source_view.timestamp_ns,
+                                target_segment.timestamp_ns,
+                                source_view.centroid,
+                                target_segment.centroid, 1.0);
+            match.features1_ = source_view.features.getRotationInvariantValues();
+            match.features2_ = target_segment.features;
+            candidates_after_first_stage.push_back(match);
           }
-          // candidates_after_first_stage.push_back(match);
+          break;
         }
       }
-      // if (!found) {
-      //   first_matches.push_back(params_.n_nearest_neighbours);
-      // }
-
     }
-    // {
-    //   std::vector<int> first_matches_hist(params_.n_nearest_neighbours + 1, 0);
-    //   for (auto &val : first_matches) {
-    //     ++first_matches_hist[val];
-    //   }
-    //   for (auto &val : first_matches_hist) {
-    //     std::cout << val << ", ";
-    //   }
-    //   std::cout << std::endl;
-    // }
 
     if (matches_after_first_stage != NULL) {
       *matches_after_first_stage = candidates_after_first_stage;
@@ -320,97 +302,103 @@ void OpenCvRandomForest::load(const std::string& filename) {
 
 void OpenCvRandomForest::setTarget(const SegmentedCloud& target_cloud) {
   BENCHMARK_BLOCK("SM.Worker.UpdateTarget.SetClassifierTarget");
-  if (target_cloud.empty()) {
+  const size_t n_target_segments = target_cloud.getNumberOfValidSegments();
+  if (n_target_segments == 0u) {
     return;
   }
+  n_target_segments_ = n_target_segments;
+  is_target_set_ = true;
 
-  target_cloud_ = target_cloud;
-
-  target_segment_ids_.clear();
-  target_segment_centroids_.clear();
-  target_segment_features_.clear();
-  target_segment_ts_.clear();
-
-  // TODO RD Solve the need for cleaning empty segments and clean here.
-  unsigned int n_non_empty_views = 0;
-  for (std::unordered_map<Id, Segment>::const_iterator it = target_cloud.begin();
-      it != target_cloud.end(); ++it)
-  {
-
-    // LOG(INFO) << "it->second.getLastView().features.size() = " << it->second.getLastView().features.size();
-    // LOG(INFO) << "it->second.getLastView().features.rotationInvariantFeaturesOnly().asEigenMatrix().size() = "
-    //           << it->second.getLastView().features.rotationInvariantFeaturesOnly().asEigenMatrix().size();
-    if (!it->second.empty() &&
-        it->second.getLastView().features.size() > 0)
-    {
-        ++n_non_empty_views;
+  // Remove the segments that have been deleted or renamed.
+  for (auto it = target_segments_.begin(); it != target_segments_.end();) {
+    if (target_cloud.contains(it->first)) {
+      ++it;
+    } else {
+      knn_index_->remove(it->first);
+      it = target_segments_.erase(it);
     }
   }
-  // LOG(INFO) << "Checked all segments for empty views and features";
-  // if (n_non_empty_views != target_cloud.getNumberOfValidSegments()) {
-  //     LOG(INFO) << "Some segments had empty views";
-  // }
-  
-  target_matrix_.resize(n_non_empty_views,
-                        params_.knn_feature_dim);
-
-  if (params_.do_not_use_cars) {
-    // Find the number of segments which do not represent cars.
-    unsigned int n_non_car = 0;
-    for (std::unordered_map<Id, Segment>::const_iterator it = target_cloud.begin();
-        it != target_cloud.end(); ++it) {
-        if (!it->second.empty()  &&
-            it->second.getLastView().features.size() > 0)
-        {
-            if(it->second.getLastView().semantic != 1u) {
-                ++n_non_car;
-            } 
-        }
-    }
-    target_matrix_.resize(n_non_car,
-                          params_.knn_feature_dim);
+
+  // Add the new segments and update the descriptors of the segments that have been described
+  // again.
+  size_t n_updated_descriptors = 0u;
+  for (const auto& id_segment : target_cloud) {
+    if (updateTargetSegment(id_segment.second)) ++n_updated_descriptors;
   }
+  BENCHMARK_RECORD_VALUE("SM.Worker.UpdateTarget.NumUpdatedDescriptors", n_updated_descriptors);
+
+  LOG(INFO) << "described target = " << (float)target_segments_.size() / target_cloud.size();
+}
 
-  // if no valid segment
-  if (target_matrix_.rows() == 0) {
+void OpenCvRandomForest::updateTarget(const SegmentedCloud& target_cloud,
+                                      const std::vector<Id>& changed_segment_ids) {
+  // The unchanged segments are missing if the target was never set or was reset.
+  if (!is_target_set_) {
+    setTarget(target_cloud);
     return;
   }
 
-  // LOG(INFO) << "\n";
-  unsigned int i = 0u;
-  for (std::unordered_map<Id, Segment>::const_iterator it = target_cloud.begin();
-      it != target_cloud.end(); ++it) {
-    Segment target_segment = it->second;
-    if (target_segment.empty()) continue;
-    if (params_.do_not_use_cars && target_segment.getLastView().semantic == 1u) continue;
-    if (target_segment.getLastView().features.size() == 0) continue;
-
-    target_matrix_.block(i, 0, 1, params_.knn_feature_dim) =
-        target_segment.getLastView().features.rotationInvariantFeaturesOnly().asEigenMatrix().block(
-            0, 0, 1, params_.knn_feature_dim).cast<float>();
-    target_segment_ids_.push_back(target_segment.segment_id);
-    target_segment_centroids_.push_back(target_segment.getLastView().centroid);
-    target_segment_features_.push_back(
-        target_segment.getLastView().features.rotationInvariantFeaturesOnly().asEigenMatrix());
-    target_segment_ts_.push_back(target_segment.getLastView().timestamp_ns);
-
-    // LOG(INFO) << "id = " << target_segment.segment_id;
-
-    ++i;
+  BENCHMARK_BLOCK("SM.Worker.UpdateTarget.SetClassifierTarget");
+  n_target_segments_ = target_cloud.getNumberOfValidSegments();
+
+  size_t n_updated_descriptors = 0u;
+  for (const Id segment_id : changed_segment_ids) {
+    const Segment* segment;
+    if (target_cloud.findValidSegmentPtrById(segment_id, &segment)) {
+      if (updateTargetSegment(*segment)) ++n_updated_descriptors;
+    } else {
+      removeTargetSegment(segment_id);
+    }
   }
+  BENCHMARK_RECORD_VALUE("SM.Worker.UpdateTarget.NumUpdatedDescriptors", n_updated_descriptors);
+}
 
-  if (params_.normalize_eigen_for_knn) {
-    normalizeEigenFeatures(&target_matrix_);
+bool OpenCvRandomForest::updateTargetSegment(const Segment& segment) {
+  // TODO RD Solve the need for cleaning empty segments and clean here.
+  if (segment.empty() || segment.getLastView().features.empty() ||
+      (params_.do_not_use_cars && segment.getLastView().semantic == 1u)) {
+    removeTargetSegment(segment.segment_id);
+    return false;
   }
 
-  LOG(INFO) << "described target = " << (float)target_matrix_.rows() / target_cloud.size();
-  // LOG(INFO) << "features mean = " << target_matrix_.colwise().mean();
-  // LOG(INFO) << "features stddev = " << ((target_matrix_.array().rowwise() - target_matrix_.array().colwise().mean()).square().colwise().mean()).sqrt();
+  const SegmentView& view = segment.getLastView();
+  const auto features = view.features.getRotationInvariantValues();
+  CHECK_GE(features.size(), params_.knn_feature_dim);
+  TargetSegment& target_segment = target_segments_[segment.segment_id];
+  target_segment.centroid = view.centroid;
+  target_segment.timestamp_ns = view.timestamp_ns;
+
+  // Only the segments whose features changed are inserted in the index again.
+  if (target_segment.features.rows() == 1 && target_segment.features.cols() == features.size() &&
+      target_segment.features == features) {
+    return false;
+  }
+  target_segment.features = features;
+  knn_index_->insert(segment.segment_id, computeKnnDescriptor(target_segment.features));
+  return true;
+}
 
-  target_matrix_.transposeInPlace();
-  nns_ = NNSearchF::createKDTreeLinearHeap(target_matrix_);
+void OpenCvRandomForest::removeTargetSegment(const Id segment_id) {
+  // The index may look up the descriptor of the segment, so it must be removed from the index
+  // first.
+  knn_index_->remove(segment_id);
+  target_segments_.erase(segment_id);
+}
 
-  // LOG(INFO) << "Added all features to target";
+std::unique_ptr<DescriptorIndex> OpenCvRandomForest::createKnnIndex() const {
+  // Indices compressing the descriptors get the exact ones from the target segments.
+  return DescriptorIndexFactory(params_).create([this](const Id segment_id) {
+    return computeKnnDescriptor(target_segments_.at(segment_id).features);
+  });
+}
+
+Eigen::VectorXf OpenCvRandomForest::computeKnnDescriptor(
+    const Eigen::Ref<const Eigen::RowVectorXd>& features) const {
+  Eigen::VectorXf descriptor = features.leftCols(params_.knn_feature_dim).transpose().cast<float>();
+  if (params_.normalize_eigen_for_knn) {
+    descriptor.head(7) = descriptor.head(7).cwiseProduct(inverted_max_eigen_float_.transpose());
+  }
+  return descriptor;
 }
 
 void OpenCvRandomForest::normalizeEigenFeatures(Eigen::MatrixXd* f) {
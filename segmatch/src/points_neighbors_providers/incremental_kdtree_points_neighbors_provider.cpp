@@ -0,0 +1,9 @@
+#include "segmatch/points_neighbors_providers/impl/incremental_kdtree_points_neighbors_provider.hpp"
+
+namespace segmatch {
+// Instantiate IncrementalKdTreePointsNeighborsProvider for the template parameters used in the
+// application.
+template class IncrementalKdTreePointsNeighborsProvider<MapPoint>;
+// Add any other required instantiation here or in a separate file and declare them in
+// segmatch/points_neighbors_providers/impl/incremental_kdtree_points_neighbors_provider.hpp.
+} // namespace segmatch
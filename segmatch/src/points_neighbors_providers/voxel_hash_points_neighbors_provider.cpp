@@ -0,0 +1,9 @@
+#include "segmatch/points_neighbors_providers/impl/voxel_hash_points_neighbors_provider.hpp"
+
+namespace segmatch {
+// Instantiate VoxelHashPointsNeighborsProvider for the template parameters used in the
+// application.
+template class VoxelHashPointsNeighborsProvider<PclPoint, MapPoint>;
+// Add any other required instantiation here or in a separate file and declare them in
+// segmatch/points_neighbors_providers/impl/voxel_hash_points_neighbors_provider.hpp.
+} // namespace segmatch
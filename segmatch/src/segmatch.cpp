@@ -2,12 +2,14 @@
 
 #include <algorithm>
 #include <limits>
+#include <sstream>
 
 #include <laser_slam/benchmarker.hpp>
 #include <laser_slam/common.hpp>
 
 #include "segmatch/points_neighbors_providers/kdtree_points_neighbors_provider.hpp"
 #include "segmatch/recognizers/correspondence_recognizer_factory.hpp"
+#include "segmatch/segment_map.hpp"
 #include "segmatch/segmenters/segmenter_factory.hpp"
 #include "segmatch/rviz_utilities.hpp"
 
@@ -129,17 +131,85 @@ void SegMatch::processAndSetAsTargetCloud(MapCloud& target_cloud) {
   classifier_->setTarget(segmented_target_cloud_);
 }
 
+bool SegMatch::loadTargetSegmentMap(const std::string& filename,
+                                    const std::string& target_cloud_filename) {
+  if (!loadSegmentMap(filename, &segmented_target_cloud_,
+                      computeTargetSegmentMapFingerprint(target_cloud_filename))) {
+    return false;
+  }
+
+  // Overwrite the old target.
+  classifier_->setTarget(segmented_target_cloud_);
+  return true;
+}
+
+bool SegMatch::saveTargetSegmentMap(const std::string& filename,
+                                    const std::string& target_cloud_filename) const {
+  return saveSegmentMap(filename, segmented_target_cloud_,
+                        computeTargetSegmentMapFingerprint(target_cloud_filename));
+}
+
+std::string SegMatch::computeTargetSegmentMapFingerprint(
+    const std::string& target_cloud_filename) const {
+  // Only the name of the target cloud is used, so that the segment map can be loaded when the
+  // cloud itself is not available. The descriptor schema is determined by the descriptor types
+  // and models.
+  std::ostringstream fingerprint;
+  fingerprint << "target_cloud_filename: " << target_cloud_filename << "\n";
+
+  const SegmenterParameters& segmenter_params = params_.segmenter_params;
+  fingerprint << "segmenter_type: " << segmenter_params.segmenter_type << "\n" <<
+      "min_cluster_size: " << segmenter_params.min_cluster_size << "\n" <<
+      "max_cluster_size: " << segmenter_params.max_cluster_size << "\n" <<
+      "radius_for_growing: " << segmenter_params.radius_for_growing << "\n" <<
+      "sc_smoothness_threshold_deg: " << segmenter_params.sc_smoothness_threshold_deg << "\n" <<
+      "sc_curvature_threshold: " << segmenter_params.sc_curvature_threshold << "\n" <<
+      "normal_estimator_type: " << params_.normal_estimator_type << "\n" <<
+      "radius_for_normal_estimation_m: " << params_.radius_for_normal_estimation_m << "\n" <<
+      "centroid_distance_threshold_m: " << params_.centroid_distance_threshold_m << "\n";
+
+  const DescriptorsParameters& descriptors_params = params_.descriptors_params;
+  fingerprint << "descriptor_types:";
+  for (const std::string& descriptor_type : descriptors_params.descriptor_types) {
+    fingerprint << " " << descriptor_type;
+  }
+  fingerprint << "\n" <<
+      "fast_point_feature_histograms_search_radius: " <<
+      descriptors_params.fast_point_feature_histograms_search_radius << "\n" <<
+      "fast_point_feature_histograms_normals_search_radius: " <<
+      descriptors_params.fast_point_feature_histograms_normals_search_radius << "\n" <<
+      "point_feature_histograms_search_radius: " <<
+      descriptors_params.point_feature_histograms_search_radius << "\n" <<
+      "point_feature_histograms_normals_search_radius: " <<
+      descriptors_params.point_feature_histograms_normals_search_radius << "\n" <<
+      "cnn_model_path: " << descriptors_params.cnn_model_path << "\n" <<
+      "semantics_nn_path: " << descriptors_params.semantics_nn_path << "\n" <<
+      "use_vis_views: " << descriptors_params.use_vis_views << "\n";
+  return fingerprint.str();
+}
+
 void SegMatch::transferSourceToTarget(unsigned int track_id,
                                       laser_slam::Time timestamp_ns) {
   BENCHMARK_BLOCK("SM.Worker.transferSourceToTarget");
+  // Collect the IDs of the target segments that are added, renamed, deleted or modified, so that
+  // only those are updated in the classifier.
+  std::vector<Id> changed_segment_ids;
+  for (const auto& id_segment : segmented_source_clouds_[track_id]) {
+    changed_segment_ids.push_back(id_segment.first);
+  }
+  for (const auto& renamed_segment : renamed_segments_[track_id]) {
+    changed_segment_ids.push_back(renamed_segment.first);
+    changed_segment_ids.push_back(renamed_segment.second);
+  }
+
   segmented_target_cloud_.addSegmentedCloud(segmented_source_clouds_[track_id],
                                             renamed_segments_[track_id]);
 
   filterNearestSegmentsInCloud(segmented_target_cloud_, params_.centroid_distance_threshold_m,
-                               5u);
+                               5u, &changed_segment_ids);
 
   // TODO Comment to speed up during dataset generation.
-  classifier_->setTarget(segmented_target_cloud_);
+  classifier_->updateTarget(segmented_target_cloud_, changed_segment_ids);
 }
 
 void SegMatch::processCloud(MapCloud& cloud,
@@ -157,7 +227,8 @@ void SegMatch::processCloud(MapCloud& cloud,
       params_.segmenter_params.segmenter_type == "IncrementalSmoothnessConstraints") {
     // Create normal estimator
     normal_estimator = NormalEstimator::create(
-        params_.normal_estimator_type, params_.radius_for_normal_estimation_m);
+        params_.normal_estimator_type, params_.radius_for_normal_estimation_m,
+        params_.normal_estimator_num_threads);
 
     // Estimate normals
     // All points are considered new points.
@@ -654,7 +725,8 @@ void SegMatch::alignTargetMap() {
 }
 
 void SegMatch::filterNearestSegmentsInCloud(SegmentedCloud& cloud, double minimum_distance_m,
-                                            unsigned int n_nearest_segments) {
+                                            unsigned int n_nearest_segments,
+                                            std::vector<Id>* modified_segment_ids) {
   std::vector<Id> duplicate_segments_ids;
   std::vector<Id> segment_ids;
 
@@ -717,6 +789,9 @@ void SegMatch::filterNearestSegmentsInCloud(SegmentedCloud& cloud, double minimu
 
                 }
                 other_segment->getLastView().features = it->second.getLastView().features;
+                if (modified_segment_ids != NULL) {
+                  modified_segment_ids->push_back(other_segment->segment_id);
+                }
                 break;
               } else {
                 if (it->second.track_id != other_segment->track_id &&
@@ -726,6 +801,9 @@ void SegMatch::filterNearestSegmentsInCloud(SegmentedCloud& cloud, double minimu
 
                 id_to_remove = other_segment->segment_id;
                 it->second.getLastView().features = other_segment->getLastView().features;
+                if (modified_segment_ids != NULL) {
+                  modified_segment_ids->push_back(it->second.segment_id);
+                }
               }
             } else if (it->second.getLastView().point_cloud.size()
                 > other_segment->getLastView().point_cloud.size()) {
@@ -754,6 +832,10 @@ void SegMatch::filterNearestSegmentsInCloud(SegmentedCloud& cloud, double minimu
   // Remove duplicates.
   size_t n_removals;
   cloud.deleteSegmentsById(duplicate_segments_ids, &n_removals);
+  if (modified_segment_ids != NULL) {
+    modified_segment_ids->insert(modified_segment_ids->end(), duplicate_segments_ids.begin(),
+                                 duplicate_segments_ids.end());
+  }
 }
 
 void SegMatch::displayTimings() const {
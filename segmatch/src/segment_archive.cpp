@@ -0,0 +1,444 @@
+#include "segmatch/segment_archive.hpp"
+
+#include <string.h>
+#include <algorithm>
+#include <limits>
+
+#include <glog/logging.h>
+
+namespace segmatch {
+
+namespace {
+
+constexpr char kSegmentArchiveMagic[8] = { 'S', 'E', 'G', 'A', 'R', 'C', 'H', '\0' };
+constexpr uint32_t kSegmentArchiveVersion = 2u;
+
+struct SegmentArchiveHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_descriptor_values;
+  uint64_t num_views;
+  uint64_t num_points;
+  uint64_t schema_size;
+  uint64_t points_offset;
+  uint64_t records_offset;
+  uint64_t descriptors_offset;
+  uint64_t schema_offset;
+  uint64_t fingerprint_size;
+  uint64_t fingerprint_offset;
+  // Zero until the archive has been closed successfully.
+  uint64_t file_size;
+};
+
+uint64_t alignOffset(const uint64_t offset) {
+  return (offset + 7u) & ~uint64_t(7u);
+}
+
+std::vector<DescriptorValueName> getDescriptorSchema(const Features& features) {
+  std::vector<DescriptorValueName> schema;
+  for (size_t i = 0u; i < features.size(); ++i) {
+    const FeatureLayout& layout = features.getLayout(i);
+    for (const std::string& value_name : layout.getValueNames()) {
+      schema.emplace_back(layout.getName(), value_name);
+    }
+  }
+  return schema;
+}
+
+bool matchesDescriptorSchema(const Features& features,
+                             const std::vector<DescriptorValueName>& schema) {
+  if (features.sizeWhenFlattened() != schema.size()) return false;
+  size_t schema_index = 0u;
+  for (size_t i = 0u; i < features.size(); ++i) {
+    const FeatureLayout& layout = features.getLayout(i);
+    for (size_t j = 0u; j < layout.size(); ++j, ++schema_index) {
+      if (layout.getName() != schema[schema_index].first ||
+          layout.getValueNames()[j] != schema[schema_index].second) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void writePoints(const PointCloud& point_cloud, std::vector<SegmentArchivePoint>& buffer,
+                 std::ofstream& output_file) {
+  buffer.clear();
+  for (const auto& point : point_cloud) buffer.push_back({ point.x, point.y, point.z });
+  output_file.write(reinterpret_cast<const char*>(buffer.data()),
+                    buffer.size() * sizeof(SegmentArchivePoint));
+}
+
+void readPoints(const SegmentArchivePoint* points, const size_t num_points,
+                PointCloud& point_cloud) {
+  point_cloud.resize(num_points);
+  for (size_t i = 0u; i < num_points; ++i) {
+    point_cloud.points[i] = PclPoint(points[i].x, points[i].y, points[i].z);
+  }
+}
+
+} // namespace
+
+//=================================================================================================
+//    SegmentArchiveWriter
+//=================================================================================================
+
+SegmentArchiveWriter::~SegmentArchiveWriter() {
+  if (isOpen()) close();
+}
+
+bool SegmentArchiveWriter::open(const std::string& filename) {
+  if (isOpen()) close();
+
+  filename_ = filename;
+  failed_ = false;
+  num_points_ = 0u;
+  records_.clear();
+  descriptors_.clear();
+  schema_.clear();
+  schema_known_ = false;
+
+  output_file_.open(filename, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+  if (!output_file_.is_open()) {
+    LOG(ERROR) << "Could not open file " << filename << " for writing the segment archive.";
+    return false;
+  }
+
+  // The header is completed when closing the archive.
+  SegmentArchiveHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kSegmentArchiveMagic, sizeof(header.magic));
+  header.version = kSegmentArchiveVersion;
+  output_file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  writePadding();
+  points_offset_ = static_cast<uint64_t>(output_file_.tellp());
+  return output_file_.good();
+}
+
+bool SegmentArchiveWriter::appendView(const Segment& segment, const size_t view_index) {
+  CHECK(isOpen());
+  CHECK_LT(view_index, segment.views.size());
+  CHECK(segment.hasValidId());
+  const SegmentView& view = segment.views[view_index];
+
+  // All the descriptors must have the same schema.
+  const bool has_descriptor = view.features.size() != 0u;
+  if (has_descriptor) {
+    if (!schema_known_) {
+      schema_ = getDescriptorSchema(view.features);
+      schema_known_ = true;
+      descriptors_.assign(records_.size() * schema_.size(), FeatureValueType(0));
+    } else if (!matchesDescriptorSchema(view.features, schema_)) {
+      LOG(ERROR) << "Segment " << segment.segment_id << " has been described with different "
+          "descriptors than the other segments. Cannot write it to " << filename_ << ".";
+      failed_ = true;
+      return false;
+    }
+  }
+
+  SegmentArchiveRecord record;
+  memset(&record, 0, sizeof(record));
+  record.segment_id = segment.segment_id;
+  record.timestamp_ns = view.timestamp_ns;
+  const SE3::Position position = view.T_w_linkpose.getPosition();
+  const SE3::Rotation::Implementation rotation =
+      view.T_w_linkpose.getRotation().toImplementation();
+  record.linkpose_position[0] = position.x();
+  record.linkpose_position[1] = position.y();
+  record.linkpose_position[2] = position.z();
+  record.linkpose_rotation[0] = rotation.w();
+  record.linkpose_rotation[1] = rotation.x();
+  record.linkpose_rotation[2] = rotation.y();
+  record.linkpose_rotation[3] = rotation.z();
+  record.centroid[0] = view.centroid.x;
+  record.centroid[1] = view.centroid.y;
+  record.centroid[2] = view.centroid.z;
+  record.view_index = view_index;
+  record.semantic = view.semantic;
+  record.track_id = segment.track_id;
+  record.n_occupied_voxels = view.n_occupied_voxels;
+  record.n_points_when_last_described = view.n_points_when_last_described;
+  record.has_descriptor = has_descriptor;
+  record.num_points = view.point_cloud.size();
+  record.num_points_to_publish = view.point_cloud_to_publish.size();
+  record.num_reconstruction_points = view.reconstruction.size();
+  record.first_point = num_points_;
+  records_.push_back(record);
+
+  writePoints(view.point_cloud, points_buffer_, output_file_);
+  writePoints(view.point_cloud_to_publish, points_buffer_, output_file_);
+  writePoints(view.reconstruction, points_buffer_, output_file_);
+  num_points_ += record.num_points + record.num_points_to_publish +
+      record.num_reconstruction_points;
+
+  if (has_descriptor) {
+    const std::vector<FeatureValueType>& values = view.features.getValues();
+    descriptors_.insert(descriptors_.end(), values.begin(), values.end());
+  } else {
+    descriptors_.resize(descriptors_.size() + schema_.size(), FeatureValueType(0));
+  }
+
+  if (!output_file_.good()) {
+    LOG(ERROR) << "Failed to write to segment archive " << filename_ << ".";
+    failed_ = true;
+  }
+  return !failed_;
+}
+
+bool SegmentArchiveWriter::appendSegment(const Segment& segment, const bool append_all_views) {
+  CHECK(!segment.empty());
+  const size_t first_view = append_all_views ? 0u : segment.views.size() - 1u;
+  for (size_t i = first_view; i < segment.views.size(); ++i) {
+    if (!appendView(segment, i)) return false;
+  }
+  return true;
+}
+
+bool SegmentArchiveWriter::close() {
+  if (!isOpen()) return false;
+  if (failed_) {
+    // Leave the header incomplete so that the archive cannot be read.
+    output_file_.close();
+    return false;
+  }
+
+  // Sort the records so that the views of a segment can be found with a binary search.
+  std::vector<size_t> order(records_.size());
+  for (size_t i = 0u; i < order.size(); ++i) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](const size_t a, const size_t b) {
+    return std::make_pair(records_[a].segment_id, records_[a].view_index) <
+        std::make_pair(records_[b].segment_id, records_[b].view_index);
+  });
+
+  SegmentArchiveHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kSegmentArchiveMagic, sizeof(header.magic));
+  header.version = kSegmentArchiveVersion;
+  header.num_descriptor_values = schema_.size();
+  header.num_views = records_.size();
+  header.num_points = num_points_;
+  header.points_offset = points_offset_;
+
+  writePadding();
+  header.records_offset = static_cast<uint64_t>(output_file_.tellp());
+  for (const size_t index : order) {
+    output_file_.write(reinterpret_cast<const char*>(&records_[index]),
+                       sizeof(SegmentArchiveRecord));
+  }
+
+  writePadding();
+  header.descriptors_offset = static_cast<uint64_t>(output_file_.tellp());
+  for (const size_t index : order) {
+    output_file_.write(reinterpret_cast<const char*>(descriptors_.data() +
+                                                     index * schema_.size()),
+                       schema_.size() * sizeof(FeatureValueType));
+  }
+
+  std::string schema_text;
+  for (const auto& value_name : schema_) {
+    schema_text += value_name.first + '\t' + value_name.second + '\n';
+  }
+  header.schema_offset = static_cast<uint64_t>(output_file_.tellp());
+  header.schema_size = schema_text.size();
+  output_file_.write(schema_text.data(), schema_text.size());
+  header.fingerprint_offset = static_cast<uint64_t>(output_file_.tellp());
+  header.fingerprint_size = fingerprint_.size();
+  output_file_.write(fingerprint_.data(), fingerprint_.size());
+  header.file_size = static_cast<uint64_t>(output_file_.tellp());
+
+  output_file_.seekp(0);
+  output_file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  output_file_.close();
+  if (output_file_.fail()) {
+    LOG(ERROR) << "Failed to write segment archive " << filename_ << ".";
+    return false;
+  }
+
+  LOG(INFO) << "Wrote " << records_.size() << " segment views to " << filename_ << ".";
+  return true;
+}
+
+void SegmentArchiveWriter::writePadding() {
+  static const char zeros[8] = { };
+  const uint64_t position = static_cast<uint64_t>(output_file_.tellp());
+  output_file_.write(zeros, alignOffset(position) - position);
+}
+
+//=================================================================================================
+//    SegmentArchiveReader
+//=================================================================================================
+
+bool SegmentArchiveReader::open(const std::string& filename) {
+  close();
+  if (!file_.open(filename)) return false;
+
+  const SegmentArchiveHeader* header = file_.getArray<SegmentArchiveHeader>(0u);
+  if (header == nullptr ||
+      memcmp(header->magic, kSegmentArchiveMagic, sizeof(header->magic)) != 0) {
+    LOG(ERROR) << filename << " is not a segment archive.";
+    close();
+    return false;
+  }
+  if (header->version != kSegmentArchiveVersion) {
+    LOG(ERROR) << "Unsupported version " << header->version << " of segment archive " <<
+        filename << ". Expected version " << kSegmentArchiveVersion << ".";
+    close();
+    return false;
+  }
+
+  const size_t num_views = header->num_views;
+  const size_t num_descriptor_values = header->num_descriptor_values;
+  const bool valid_descriptors_size = num_descriptor_values == 0u ||
+      num_views <= std::numeric_limits<size_t>::max() / num_descriptor_values;
+  const char* schema_text = file_.getArray<char>(header->schema_offset, header->schema_size);
+  const char* fingerprint = file_.getArray<char>(header->fingerprint_offset,
+                                                 header->fingerprint_size);
+  records_ = file_.getArray<SegmentArchiveRecord>(header->records_offset, num_views);
+  points_ = file_.getArray<SegmentArchivePoint>(header->points_offset, header->num_points);
+  descriptors_ = valid_descriptors_size ? file_.getArray<FeatureValueType>(
+      header->descriptors_offset, num_views * num_descriptor_values) : nullptr;
+  if (header->file_size != file_.size() || schema_text == nullptr || fingerprint == nullptr ||
+      records_ == nullptr || points_ == nullptr || descriptors_ == nullptr) {
+    LOG(ERROR) << "Segment archive " << filename << " is incomplete or corrupted.";
+    close();
+    return false;
+  }
+
+  fingerprint_.assign(fingerprint, header->fingerprint_size);
+
+  // Parse the descriptor schema.
+  const char* line_begin = schema_text;
+  const char* schema_end = schema_text + header->schema_size;
+  while (line_begin < schema_end) {
+    const char* line_end = std::find(line_begin, schema_end, '\n');
+    const char* separator = std::find(line_begin, line_end, '\t');
+    if (line_end == schema_end || separator == line_end) break;
+    schema_.emplace_back(std::string(line_begin, separator),
+                         std::string(separator + 1, line_end));
+    line_begin = line_end + 1;
+  }
+  if (schema_.size() != num_descriptor_values) {
+    LOG(ERROR) << "Invalid descriptor schema in segment archive " << filename << ".";
+    close();
+    return false;
+  }
+
+  // Group the values of the schema by feature, so that views can be copied without names.
+  for (size_t begin = 0u; begin < schema_.size();) {
+    size_t end = begin + 1u;
+    while (end < schema_.size() && schema_[end].first == schema_[begin].first) ++end;
+    std::vector<std::string> value_names;
+    for (size_t i = begin; i < end; ++i) value_names.push_back(schema_[i].second);
+    descriptor_layouts_.push_back(&FeatureLayout::get(schema_[begin].first, value_names));
+    begin = end;
+  }
+
+  // Validate the index so that the accessors do not need to.
+  for (size_t i = 0u; i < num_views; ++i) {
+    const SegmentArchiveRecord& record = records_[i];
+    const uint64_t record_num_points = static_cast<uint64_t>(record.num_points) +
+        record.num_points_to_publish + record.num_reconstruction_points;
+    const bool is_sorted = i == 0u ||
+        std::make_pair(records_[i - 1u].segment_id, records_[i - 1u].view_index) <=
+        std::make_pair(record.segment_id, record.view_index);
+    if (record.first_point > header->num_points ||
+        record_num_points > header->num_points - record.first_point ||
+        record.segment_id == kNoId || record.segment_id == kInvId || !is_sorted) {
+      LOG(ERROR) << "Invalid view of segment " << record.segment_id << " in segment archive " <<
+          filename << ".";
+      close();
+      return false;
+    }
+  }
+
+  num_views_ = num_views;
+  return true;
+}
+
+void SegmentArchiveReader::close() {
+  file_.close();
+  num_views_ = 0u;
+  records_ = nullptr;
+  points_ = nullptr;
+  descriptors_ = nullptr;
+  schema_.clear();
+  descriptor_layouts_.clear();
+  fingerprint_.clear();
+}
+
+bool SegmentArchiveReader::findSegmentViews(const Id segment_id, size_t* begin,
+                                            size_t* end) const {
+  CHECK_NOTNULL(begin);
+  CHECK_NOTNULL(end);
+  const SegmentArchiveRecord* records_end = records_ + num_views_;
+  *begin = std::lower_bound(records_, records_end, segment_id,
+      [](const SegmentArchiveRecord& record, const Id id) { return record.segment_id < id; }) -
+      records_;
+  *end = std::upper_bound(records_, records_end, segment_id,
+      [](const Id id, const SegmentArchiveRecord& record) { return id < record.segment_id; }) -
+      records_;
+  return *begin != *end;
+}
+
+void SegmentArchiveReader::getSegmentView(const size_t index, SegmentView* view) const {
+  CHECK_NOTNULL(view);
+  CHECK_LT(index, num_views_);
+  const SegmentArchiveRecord& record = records_[index];
+
+  readPoints(getPoints(index), record.num_points, view->point_cloud);
+  readPoints(getPointsToPublish(index), record.num_points_to_publish,
+             view->point_cloud_to_publish);
+  readPoints(getReconstruction(index), record.num_reconstruction_points, view->reconstruction);
+
+  view->centroid = PclPoint(record.centroid[0], record.centroid[1], record.centroid[2]);
+  view->timestamp_ns = record.timestamp_ns;
+  view->T_w_linkpose = SE3(
+      SE3::Position(record.linkpose_position[0], record.linkpose_position[1],
+                    record.linkpose_position[2]),
+      SE3::Rotation::Implementation(record.linkpose_rotation[0], record.linkpose_rotation[1],
+                                    record.linkpose_rotation[2], record.linkpose_rotation[3]));
+  view->n_occupied_voxels = record.n_occupied_voxels;
+  view->n_points_when_last_described = record.n_points_when_last_described;
+  view->semantic = record.semantic;
+
+  view->features.clear();
+  const FeatureValueType* descriptor = getDescriptor(index);
+  if (descriptor != nullptr) {
+    for (const FeatureLayout* layout : descriptor_layouts_) {
+      view->features.setFeature(*layout, descriptor);
+      descriptor += layout->size();
+    }
+  }
+}
+
+Id SegmentArchiveReader::readSegmentedCloud(SegmentedCloud* segmented_cloud,
+                                            const bool read_all_views) const {
+  CHECK_NOTNULL(segmented_cloud);
+  Id max_segment_id = 0;
+  size_t begin = 0u;
+  while (begin < num_views_) {
+    const Id segment_id = records_[begin].segment_id;
+    size_t end = begin + 1u;
+    while (end < num_views_ && records_[end].segment_id == segment_id) ++end;
+    if (!read_all_views) begin = end - 1u;
+
+    // Add the segment with an empty view and fill it in place to avoid copying the points.
+    Segment segment;
+    segment.segment_id = segment_id;
+    segment.track_id = records_[end - 1u].track_id;
+    segment.views.emplace_back();
+    segmented_cloud->addValidSegment(segment);
+    Segment* segment_in_cloud;
+    CHECK(segmented_cloud->findValidSegmentPtrById(segment_id, &segment_in_cloud));
+    segment_in_cloud->views.resize(end - begin);
+    for (size_t i = begin; i < end; ++i) {
+      getSegmentView(i, &segment_in_cloud->views[i - begin]);
+    }
+
+    max_segment_id = std::max(max_segment_id, segment_id);
+    begin = end;
+  }
+  return max_segment_id;
+}
+
+} // namespace segmatch
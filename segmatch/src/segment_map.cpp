@@ -0,0 +1,46 @@
+#include "segmatch/segment_map.hpp"
+
+#include <glog/logging.h>
+#include <laser_slam/benchmarker.hpp>
+
+#include "segmatch/segment_archive.hpp"
+
+namespace segmatch {
+
+bool saveSegmentMap(const std::string& filename, const SegmentedCloud& segmented_cloud,
+                    const std::string& fingerprint) {
+  BENCHMARK_BLOCK("SM.SaveSegmentMap");
+  SegmentArchiveWriter writer;
+  if (!writer.open(filename)) return false;
+  writer.setFingerprint(fingerprint);
+  for (const auto& id_segment : segmented_cloud) {
+    if (!writer.appendSegment(id_segment.second, false)) {
+      writer.close();
+      return false;
+    }
+  }
+  return writer.close();
+}
+
+bool loadSegmentMap(const std::string& filename, SegmentedCloud* segmented_cloud,
+                    const std::string& fingerprint) {
+  BENCHMARK_BLOCK("SM.LoadSegmentMap");
+  CHECK_NOTNULL(segmented_cloud)->clear();
+
+  SegmentArchiveReader reader;
+  if (!reader.open(filename)) return false;
+  if (reader.getFingerprint() != fingerprint) {
+    LOG(WARNING) << "Segment map " << filename << " was computed from a different cloud or " <<
+        "with different parameters. Its fingerprint is:\n" << reader.getFingerprint() <<
+        "\nExpected:\n" << fingerprint;
+    return false;
+  }
+  const Id max_segment_id = reader.readSegmentedCloud(segmented_cloud, false);
+  segmented_cloud->reserveSegmentIdsUpTo(max_segment_id);
+
+  LOG(INFO) << "Loaded " << segmented_cloud->size() << " segments from segment map " <<
+      filename << ".";
+  return true;
+}
+
+} // namespace segmatch
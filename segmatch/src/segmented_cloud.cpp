@@ -108,6 +108,14 @@ bool SegmentedCloud::findValidSegmentPtrById(const Id segment_id, Segment** resu
   return true;
 }
 
+bool SegmentedCloud::findValidSegmentPtrById(const Id segment_id,
+                                             const Segment** result) const {
+  const auto it = valid_segments_.find(segment_id);
+  if (it == valid_segments_.end()) { return false; }
+  if (result != NULL) { *result = &it->second; }
+  return true;
+}
+
 void SegmentedCloud::deleteSegmentsById(const std::vector<Id>& ids, size_t* n_removals) {
   if (n_removals != NULL) {
     *n_removals = 0;
@@ -265,16 +273,22 @@ void SegmentedCloud::setTrackId(unsigned int track_id) {
 }
 
 void SegmentedCloud::updateSegments(const std::vector<laser_slam::Trajectory>& trajectories) {
+  // The clouds of all the segments are transformed in a single batch.
+  BatchPointsTransformer points_transformer;
   for (auto& id_segment: valid_segments_) {
     SE3 new_pose = trajectories.at(id_segment.second.track_id).at(id_segment.second.getLastView().timestamp_ns);
 
     SE3 transformation = new_pose * id_segment.second.getLastView().T_w_linkpose.inverse();
+    const Eigen::Matrix4f transformation_matrix =
+        transformation.getTransformationMatrix().cast<float>();
     // Transform the point cloud.
-    transformPointCloud(transformation, &id_segment.second.getLastView().point_cloud);
+    points_transformer.add(transformation_matrix, id_segment.second.getLastView().point_cloud);
 
     // Transform the reconstruction.
-    transformPointCloud(transformation, &id_segment.second.getLastView().reconstruction);
-    transformPointCloud(transformation, &id_segment.second.getLastView().reconstruction_compressed);
+    points_transformer.add(transformation_matrix,
+                           id_segment.second.getLastView().reconstruction);
+    points_transformer.add(transformation_matrix,
+                           id_segment.second.getLastView().reconstruction_compressed);
 
     // Transform the segment centroid.
     transformPclPoint(transformation, &id_segment.second.getLastView().centroid);
@@ -282,6 +296,7 @@ void SegmentedCloud::updateSegments(const std::vector<laser_slam::Trajectory>& t
     // Update the link pose.
     id_segment.second.getLastView().T_w_linkpose = new_pose;
   }
+  points_transformer.run();
   // TODO Correct with proper value
   int track_id = 0;
   for (auto& view: vis_views_) {
@@ -0,0 +1,150 @@
+#include <random>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <Eigen/Geometry>
+#include <pcl/point_types.h>
+
+#include "segmatch/batch_points_transformer.hpp"
+#include "segmatch/common.hpp"
+
+using namespace segmatch;
+
+// Initialize common objects needed by multiple tests.
+class BatchPointsTransformerTest : public ::testing::Test {
+ protected:
+  Eigen::Matrix4f transformation_1_;
+  Eigen::Matrix4f transformation_2_;
+  std::mt19937 generator_;
+
+  BatchPointsTransformerTest()
+    : transformation_1_(Eigen::Matrix4f::Identity()),
+      transformation_2_(Eigen::Matrix4f::Identity()),
+      generator_(42) {
+  }
+
+  void SetUp() override {
+    transformation_1_.topLeftCorner<3, 3>() =
+        Eigen::AngleAxisf(0.7f, Eigen::Vector3f(1.0f, 0.5f, -0.7f).normalized()).matrix();
+    transformation_1_.topRightCorner<3, 1>() = Eigen::Vector3f(-1.4f, 1.3f, 0.2f);
+    transformation_2_.topLeftCorner<3, 3>() =
+        Eigen::AngleAxisf(-2.1f, Eigen::Vector3f::UnitZ()).matrix();
+    transformation_2_.topRightCorner<3, 1>() = Eigen::Vector3f(10.0f, -3.0f, 0.5f);
+  }
+
+  void TearDown() override {
+  }
+
+  // Create a cloud with random points.
+  template <typename PointT>
+  pcl::PointCloud<PointT> createRandomCloud(const size_t num_points) {
+    std::uniform_real_distribution<float> distribution(-50.0f, 50.0f);
+    pcl::PointCloud<PointT> cloud;
+    for (size_t i = 0u; i < num_points; ++i) {
+      PointT point;
+      point.x = distribution(generator_);
+      point.y = distribution(generator_);
+      point.z = distribution(generator_);
+      cloud.push_back(point);
+    }
+    return cloud;
+  }
+
+  // Check that a cloud is the transformed version of another cloud.
+  template <typename PointT>
+  static void expectTransformed(const Eigen::Matrix4f& transformation,
+                                const pcl::PointCloud<PointT>& original_cloud,
+                                const pcl::PointCloud<PointT>& transformed_cloud) {
+    ASSERT_EQ(original_cloud.size(), transformed_cloud.size());
+    for (size_t i = 0u; i < original_cloud.size(); ++i) {
+      const Eigen::Vector3f expected_point =
+          transformation.topLeftCorner<3, 3>() * original_cloud[i].getVector3fMap() +
+          transformation.topRightCorner<3, 1>();
+      EXPECT_NEAR(expected_point.x(), transformed_cloud[i].x, 1e-4f);
+      EXPECT_NEAR(expected_point.y(), transformed_cloud[i].y, 1e-4f);
+      EXPECT_NEAR(expected_point.z(), transformed_cloud[i].z, 1e-4f);
+      EXPECT_EQ(original_cloud[i].data[3], transformed_cloud[i].data[3]);
+    }
+  }
+};
+
+TEST_F(BatchPointsTransformerTest, test_empty_batch) {
+  BatchPointsTransformer transformer;
+  PointCloud cloud;
+  transformer.add(transformation_1_, cloud);
+  EXPECT_EQ(0u, transformer.getNumPoints());
+  transformer.run();
+}
+
+TEST_F(BatchPointsTransformerTest, test_multiple_clouds) {
+  // Arrange
+  const PointCloud original_cloud_1 = createRandomCloud<PclPoint>(17u);
+  const MapCloud original_cloud_2 = createRandomCloud<MapPoint>(1u);
+  const MapCloud original_cloud_3 = createRandomCloud<MapPoint>(1000u);
+  PointCloud cloud_1 = original_cloud_1;
+  MapCloud cloud_2 = original_cloud_2;
+  MapCloud cloud_3 = original_cloud_3;
+  cloud_3[5].ed_cluster_id = 3u;
+
+  // Act
+  BatchPointsTransformer transformer;
+  transformer.add(transformation_1_, cloud_1);
+  transformer.add(transformation_2_, cloud_2);
+  transformer.add(transformation_1_, cloud_3);
+  EXPECT_EQ(1018u, transformer.getNumPoints());
+  transformer.run();
+
+  // Assert
+  expectTransformed(transformation_1_, original_cloud_1, cloud_1);
+  expectTransformed(transformation_2_, original_cloud_2, cloud_2);
+  expectTransformed(transformation_1_, original_cloud_3, cloud_3);
+  EXPECT_EQ(3u, cloud_3[5].ed_cluster_id);
+  EXPECT_EQ(0u, transformer.getNumPoints());
+}
+
+TEST_F(BatchPointsTransformerTest, test_big_batch) {
+  // Arrange
+  std::vector<MapCloud> original_clouds;
+  for (size_t i = 0u; i < 8u; ++i) {
+    original_clouds.push_back(createRandomCloud<MapPoint>(40001u));
+  }
+  std::vector<MapCloud> clouds = original_clouds;
+
+  // Act
+  BatchPointsTransformer transformer;
+  for (size_t i = 0u; i < clouds.size(); ++i) {
+    transformer.add(i % 2u == 0u ? transformation_1_ : transformation_2_, clouds[i]);
+  }
+  transformer.run();
+
+  // Assert
+  for (size_t i = 0u; i < clouds.size(); ++i) {
+    expectTransformed(i % 2u == 0u ? transformation_1_ : transformation_2_, original_clouds[i],
+                      clouds[i]);
+  }
+}
+
+TEST_F(BatchPointsTransformerTest, test_simd_matches_scalar) {
+  // Arrange. The odd number of points also exercises the last point of the AVX2 kernel.
+  const MapCloud original_cloud = createRandomCloud<MapPoint>(1001u);
+  MapCloud simd_cloud = original_cloud;
+  MapCloud scalar_cloud = original_cloud;
+
+  // Act
+  BatchPointsTransformer simd_transformer;
+  simd_transformer.add(transformation_1_, simd_cloud);
+  simd_transformer.run();
+  BatchPointsTransformer scalar_transformer(true);
+  scalar_transformer.add(transformation_1_, scalar_cloud);
+  scalar_transformer.run();
+
+  // Assert. The kernels only differ by the rounding of the fused multiply-add.
+  ASSERT_EQ(scalar_cloud.size(), simd_cloud.size());
+  for (size_t i = 0u; i < scalar_cloud.size(); ++i) {
+    EXPECT_NEAR(scalar_cloud[i].x, simd_cloud[i].x, 1e-5f);
+    EXPECT_NEAR(scalar_cloud[i].y, simd_cloud[i].y, 1e-5f);
+    EXPECT_NEAR(scalar_cloud[i].z, simd_cloud[i].z, 1e-5f);
+    EXPECT_EQ(scalar_cloud[i].data[3], simd_cloud[i].data[3]);
+  }
+  expectTransformed(transformation_1_, original_cloud, scalar_cloud);
+}
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "segmatch/descriptor_indices/hnsw_index.hpp"
+#include "segmatch/descriptor_indices/ivfpq_index.hpp"
+#include "segmatch/descriptor_indices/log_structured_kdtree_index.hpp"
+
+using namespace segmatch;
+
+namespace {
+
+constexpr size_t kDimension = 16u;
+
+// Creation of the indices under test and minimum recall expected from them. The exact index
+// must find all the neighbours. After most descriptors are removed, the remaining ones are spread
+// over all the inverted lists, so that probing few lists misses more neighbours.
+template <typename IndexT>
+struct DescriptorIndexTraits;
+
+template <>
+struct DescriptorIndexTraits<LogStructuredKdTreeIndex> {
+  static std::unique_ptr<LogStructuredKdTreeIndex> create(const DescriptorLookup& lookup) {
+    return std::unique_ptr<LogStructuredKdTreeIndex>(new LogStructuredKdTreeIndex(kDimension));
+  }
+  static void increaseSearchEffort(LogStructuredKdTreeIndex* index) { }
+  static constexpr double kMinRecall = 1.0;
+  static constexpr double kMinRecallWithMoreEffort = 1.0;
+  static constexpr double kMinRecallAfterRemovals = 1.0;
+};
+
+template <>
+struct DescriptorIndexTraits<HnswIndex> {
+  static std::unique_ptr<HnswIndex> create(const DescriptorLookup& lookup) {
+    return std::unique_ptr<HnswIndex>(new HnswIndex(kDimension, 16u, 100u, 64u));
+  }
+  static void increaseSearchEffort(HnswIndex* index) { index->setEfSearch(200u); }
+  static constexpr double kMinRecall = 0.9;
+  static constexpr double kMinRecallWithMoreEffort = 0.95;
+  static constexpr double kMinRecallAfterRemovals = 0.9;
+};
+
+template <>
+struct DescriptorIndexTraits<IvfPqIndex> {
+  static std::unique_ptr<IvfPqIndex> create(const DescriptorLookup& lookup) {
+    return std::unique_ptr<IvfPqIndex>(new IvfPqIndex(kDimension, 16u, 4u, 8u, lookup));
+  }
+  static void increaseSearchEffort(IvfPqIndex* index) { index->setNumProbes(16u); }
+  static constexpr double kMinRecall = 0.65;
+  static constexpr double kMinRecallWithMoreEffort = 0.95;
+  static constexpr double kMinRecallAfterRemovals = 0.45;
+};
+
+constexpr double DescriptorIndexTraits<LogStructuredKdTreeIndex>::kMinRecall;
+constexpr double DescriptorIndexTraits<LogStructuredKdTreeIndex>::kMinRecallWithMoreEffort;
+constexpr double DescriptorIndexTraits<LogStructuredKdTreeIndex>::kMinRecallAfterRemovals;
+constexpr double DescriptorIndexTraits<HnswIndex>::kMinRecall;
+constexpr double DescriptorIndexTraits<HnswIndex>::kMinRecallWithMoreEffort;
+constexpr double DescriptorIndexTraits<HnswIndex>::kMinRecallAfterRemovals;
+constexpr double DescriptorIndexTraits<IvfPqIndex>::kMinRecall;
+constexpr double DescriptorIndexTraits<IvfPqIndex>::kMinRecallWithMoreEffort;
+constexpr double DescriptorIndexTraits<IvfPqIndex>::kMinRecallAfterRemovals;
+
+} // namespace
+
+// Initialize common objects needed by multiple tests.
+template <typename IndexT>
+class DescriptorIndexTest : public ::testing::Test {
+ protected:
+  typedef DescriptorIndexTraits<IndexT> Traits;
+
+  static constexpr size_t kNumNeighbours = 10u;
+  static constexpr size_t kNumQueries = 50u;
+
+  std::mt19937 random_engine_ = std::mt19937(42u);
+  std::unique_ptr<IndexT> index_ = Traits::create([this](const Id segment_id) {
+    return descriptors_.at(segment_id);
+  });
+  // The descriptors that should be in the index.
+  std::unordered_map<Id, Eigen::VectorXf> descriptors_;
+  // If false, the index may return approximate distances.
+  bool expect_exact_distances_ = true;
+
+  Eigen::VectorXf randomDescriptor() {
+    std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+    Eigen::VectorXf descriptor(kDimension);
+    for (size_t i = 0u; i < kDimension; ++i) descriptor[i] = distribution(random_engine_);
+    return descriptor;
+  }
+
+  void insert(const Id segment_id) {
+    descriptors_[segment_id] = randomDescriptor();
+    index_->insert(segment_id, descriptors_[segment_id]);
+  }
+
+  void remove(const Id segment_id) {
+    EXPECT_EQ(descriptors_.erase(segment_id) != 0u, index_->remove(segment_id));
+  }
+
+  // Compute the fraction of the true nearest neighbours found by the index. Also check that the
+  // index only returns segments that it contains, with their exact distances if expected.
+  double computeRecall() {
+    EXPECT_EQ(descriptors_.size(), index_->size());
+    size_t num_found = 0u;
+    size_t num_expected = 0u;
+    for (size_t query_index = 0u; query_index < kNumQueries; ++query_index) {
+      const Eigen::VectorXf query = randomDescriptor();
+      std::vector<std::pair<float, Id>> expected;
+      for (const auto& id_descriptor : descriptors_) {
+        expected.emplace_back((id_descriptor.second - query).squaredNorm(), id_descriptor.first);
+      }
+      std::sort(expected.begin(), expected.end());
+      expected.resize(std::min(expected.size(), kNumNeighbours));
+      num_expected += expected.size();
+
+      std::vector<Id> segment_ids;
+      std::vector<float> squared_distances;
+      const size_t num_neighbours =
+          index_->knn(query, kNumNeighbours, &segment_ids, &squared_distances);
+      EXPECT_EQ(num_neighbours, segment_ids.size());
+      EXPECT_LE(segment_ids.size(), kNumNeighbours);
+      EXPECT_EQ(segment_ids.size(), squared_distances.size());
+      EXPECT_TRUE(std::is_sorted(squared_distances.begin(), squared_distances.end()));
+      for (size_t i = 0u; i < segment_ids.size(); ++i) {
+        const auto descriptor_it = descriptors_.find(segment_ids[i]);
+        if (descriptor_it == descriptors_.end()) {
+          ADD_FAILURE() << "Segment " << segment_ids[i] << " is not in the index.";
+          continue;
+        }
+        if (expect_exact_distances_) {
+          EXPECT_FLOAT_EQ((descriptor_it->second - query).squaredNorm(), squared_distances[i]);
+        }
+      }
+      for (const auto& neighbour : expected) {
+        if (std::find(segment_ids.begin(), segment_ids.end(), neighbour.second) !=
+            segment_ids.end()) {
+          ++num_found;
+        }
+      }
+    }
+    return num_expected == 0u ? 1.0 :
+        static_cast<double>(num_found) / static_cast<double>(num_expected);
+  }
+};
+
+template <typename IndexT>
+constexpr size_t DescriptorIndexTest<IndexT>::kNumNeighbours;
+template <typename IndexT>
+constexpr size_t DescriptorIndexTest<IndexT>::kNumQueries;
+
+typedef ::testing::Types<LogStructuredKdTreeIndex, HnswIndex, IvfPqIndex> DescriptorIndexTypes;
+TYPED_TEST_CASE(DescriptorIndexTest, DescriptorIndexTypes);
+
+TYPED_TEST(DescriptorIndexTest, test_small_indices_are_exact) {
+  // Few descriptors are connected to each other in the graph, and are not compressed as the
+  // quantizers are not trained yet.
+  for (Id segment_id = 1; segment_id <= 5; ++segment_id) this->insert(segment_id);
+  EXPECT_DOUBLE_EQ(1.0, this->computeRecall());
+  for (Id segment_id = 6; segment_id <= 30; ++segment_id) this->insert(segment_id);
+  EXPECT_DOUBLE_EQ(1.0, this->computeRecall());
+}
+
+TYPED_TEST(DescriptorIndexTest, test_recall) {
+  typedef typename TestFixture::Traits Traits;
+  for (Id segment_id = 1; segment_id <= 5000; ++segment_id) this->insert(segment_id);
+  EXPECT_GE(this->computeRecall(), Traits::kMinRecall);
+
+  // Increasing the search effort increases the recall.
+  Traits::increaseSearchEffort(this->index_.get());
+  EXPECT_GE(this->computeRecall(), Traits::kMinRecallWithMoreEffort);
+}
+
+TYPED_TEST(DescriptorIndexTest, test_replace_and_remove) {
+  typedef typename TestFixture::Traits Traits;
+  for (Id segment_id = 1; segment_id <= 3000; ++segment_id) this->insert(segment_id);
+
+  // Describe some segments again and remove others, as after merging or filtering segments.
+  for (Id segment_id = 1; segment_id <= 3000; segment_id += 3) this->insert(segment_id);
+  for (Id segment_id = 2; segment_id <= 3000; segment_id += 3) this->remove(segment_id);
+  EXPECT_FALSE(this->index_->contains(2));
+  EXPECT_TRUE(this->index_->contains(3));
+  EXPECT_FALSE(this->index_->remove(2));
+  EXPECT_GE(this->computeRecall(), Traits::kMinRecall);
+
+  // Remove most segments so that the levels are compacted and the graph is rebuilt.
+  for (Id segment_id = 1; segment_id <= 2900; ++segment_id) this->remove(segment_id);
+  EXPECT_GE(this->computeRecall(), Traits::kMinRecallAfterRemovals);
+  for (Id segment_id = 3001; segment_id <= 3500; ++segment_id) this->insert(segment_id);
+  EXPECT_GE(this->computeRecall(), Traits::kMinRecallAfterRemovals);
+
+  this->index_->clear();
+  this->descriptors_.clear();
+  EXPECT_DOUBLE_EQ(1.0, this->computeRecall());
+}
+
+TYPED_TEST(DescriptorIndexTest, test_identical_descriptors_are_ignored) {
+  for (Id segment_id = 1; segment_id <= 3000; ++segment_id) this->insert(segment_id);
+  std::vector<Id> segment_ids;
+  std::vector<float> squared_distances;
+  this->index_->knn(this->descriptors_[7], TestFixture::kNumNeighbours, &segment_ids,
+                    &squared_distances);
+  EXPECT_EQ(TestFixture::kNumNeighbours, segment_ids.size());
+  EXPECT_EQ(segment_ids.end(), std::find(segment_ids.begin(), segment_ids.end(), 7));
+}
+
+TYPED_TEST(DescriptorIndexTest, test_batch_knn) {
+  constexpr size_t kNumNeighbours = TestFixture::kNumNeighbours;
+  for (Id segment_id = 1; segment_id <= 1000; ++segment_id) this->insert(segment_id);
+  constexpr size_t kNumQueries = 200u;
+  Eigen::MatrixXf queries(kDimension, kNumQueries);
+  for (size_t i = 0u; i < kNumQueries; ++i) queries.col(i) = this->randomDescriptor();
+  // One query is identical to an indexed descriptor, which must not be returned.
+  queries.col(0) = this->descriptors_[7];
+
+  IdMatrix segment_ids;
+  Eigen::MatrixXf squared_distances;
+  this->index_->knnBatch(queries, kNumNeighbours, &segment_ids, &squared_distances, 4u);
+  ASSERT_EQ(kNumNeighbours, static_cast<size_t>(segment_ids.rows()));
+  ASSERT_EQ(kNumQueries, static_cast<size_t>(segment_ids.cols()));
+  ASSERT_EQ(kNumNeighbours, static_cast<size_t>(squared_distances.rows()));
+  ASSERT_EQ(kNumQueries, static_cast<size_t>(squared_distances.cols()));
+
+  // The results must match the ones of the single query search.
+  std::vector<Id> expected_segment_ids;
+  std::vector<float> expected_squared_distances;
+  for (size_t i = 0u; i < kNumQueries; ++i) {
+    const Eigen::VectorXf query = queries.col(i);
+    ASSERT_EQ(kNumNeighbours, this->index_->knn(query, kNumNeighbours, &expected_segment_ids,
+                                                &expected_squared_distances));
+    for (size_t j = 0u; j < kNumNeighbours; ++j) {
+      EXPECT_EQ(expected_segment_ids[j], segment_ids(j, i));
+      EXPECT_FLOAT_EQ(expected_squared_distances[j], squared_distances(j, i));
+    }
+  }
+}
+
+class IvfPqIndexTest : public DescriptorIndexTest<IvfPqIndex> { };
+
+TEST_F(IvfPqIndexTest, test_search_without_descriptor_lookup) {
+  // Only the codes are available, so that the candidates cannot be re-ranked.
+  index_.reset(new IvfPqIndex(kDimension, 16u, 16u, 8u));
+  expect_exact_distances_ = false;
+  for (Id segment_id = 1; segment_id <= 5000; ++segment_id) insert(segment_id);
+  ASSERT_TRUE(index_->isTrained());
+  EXPECT_GE(computeRecall(), 0.75);
+}
+
+TEST_F(IvfPqIndexTest, test_quantizers_follow_the_descriptors) {
+  // Train the quantizers on descriptors concentrated in a corner of the descriptor space.
+  for (Id segment_id = 1; segment_id <= 1024; ++segment_id) {
+    descriptors_[segment_id] = 0.1f * randomDescriptor();
+    index_->insert(segment_id, descriptors_[segment_id]);
+  }
+  ASSERT_TRUE(index_->isTrained());
+
+  // The quantizers are trained again as the descriptors spread over the whole space.
+  for (Id segment_id = 1025; segment_id <= 5000; ++segment_id) insert(segment_id);
+  EXPECT_GE(computeRecall(), Traits::kMinRecall);
+}
@@ -1,3 +1,6 @@
+#include <map>
+#include <random>
+
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <pcl/point_types.h>
@@ -28,6 +31,10 @@ class DynamicVoxelGridTest : public ::testing::Test {
       InputPointT,
       VoxelPointT,
       IndexT, 20, 20, 20> VoxelGrid;
+  typedef DynamicVoxelGrid<
+      InputPointT,
+      VoxelPointT,
+      IndexT, 20, 20, 20, false> StdSortVoxelGrid;
   typedef DynamicVoxelGrid<
       InputPointT,
       VoxelPointT,
@@ -167,6 +174,86 @@ TEST_F(DynamicVoxelGridTest, test_two_insert) {
   EXPECT_EQ(1, created[0]);
 }
 
+TEST_F(DynamicVoxelGridTest, test_insert_preserves_centroids_order) {
+  shifted_grid_.insert(small_insert_1_);
+  shifted_grid_.insert(small_insert_2_);
+  const VoxelPointT first_centroid = shifted_grid_.getActiveCentroids()[0];
+  const VoxelPointT second_centroid = shifted_grid_.getActiveCentroids()[1];
+
+  SmallVoxelGrid::InputCloud insert;
+  insert.push_back(InputPointT(0.2f, 1.5f, 0.1f)); // Voxel 1
+  insert.push_back(InputPointT(1.3f, 0.1f,-1.2f)); // Voxel 4
+  auto created = shifted_grid_.insert(insert);
+
+  ASSERT_EQ(4, shifted_grid_.getActiveCentroids().size());
+  EXPECT_EQ(0, shifted_grid_.getInactiveCentroids().size());
+  EXPECT_EQ(std::vector<int>({ 2, 3 }), created);
+  EXPECT_EQ(first_centroid, shifted_grid_.getActiveCentroids()[0]);
+  EXPECT_EQ(second_centroid, shifted_grid_.getActiveCentroids()[1]);
+}
+
+TEST_F(DynamicVoxelGridTest, test_big_scan_insert) {
+  // Arrange
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> xy_distribution(-10.0f, 10.0f);
+  std::uniform_real_distribution<float> z_distribution(-2.0f, 2.0f);
+  VoxelGrid::InputCloud big_scan;
+  for (size_t i = 0u; i < 200000u; ++i) {
+    big_scan.push_back(InputPointT(xy_distribution(generator), xy_distribution(generator),
+                                   z_distribution(generator)));
+  }
+
+  // Insert the scan at once (radix sort) and in small chunks (comparison sort).
+  VoxelGrid chunked_grid(resolution_, 3);
+  for (size_t chunk_start = 0u; chunk_start < big_scan.size(); chunk_start += 1000u) {
+    VoxelGrid::InputCloud chunk;
+    chunk.insert(chunk.end(), big_scan.begin() + chunk_start,
+                 big_scan.begin() + chunk_start + 1000u);
+    chunked_grid.insert(chunk);
+  }
+
+  // Act
+  auto created = grid_.insert(big_scan);
+
+  // Assert
+  ASSERT_EQ(chunked_grid.getActiveCentroids().size(), grid_.getActiveCentroids().size());
+  EXPECT_EQ(chunked_grid.getInactiveCentroids().size(), grid_.getInactiveCentroids().size());
+  ASSERT_EQ(grid_.getActiveCentroids().size(), created.size());
+  std::map<IndexT, VoxelPointT> chunked_centroids;
+  for (const auto& centroid : chunked_grid.getActiveCentroids()) {
+    chunked_centroids[chunked_grid.getIndexOf(centroid)] = centroid;
+  }
+  for (size_t i = 0u; i < created.size(); ++i) {
+    ASSERT_EQ(i, created[i]);
+    const VoxelPointT& centroid = grid_.getActiveCentroids()[i];
+    EXPECT_EQ(chunked_centroids.at(grid_.getIndexOf(centroid)), centroid);
+  }
+}
+
+TEST_F(DynamicVoxelGridTest, test_radix_sort_matches_std_sort) {
+  // Arrange
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> distribution(-20.0f, 20.0f);
+  VoxelGrid::InputCloud big_scan;
+  for (size_t i = 0u; i < 100000u; ++i) {
+    big_scan.push_back(InputPointT(distribution(generator), distribution(generator),
+                                   distribution(generator) / 10.0f));
+  }
+
+  // Act
+  StdSortVoxelGrid std_sort_grid(resolution_, 3);
+  auto std_sort_created = std_sort_grid.insert(big_scan);
+  auto created = grid_.insert(big_scan);
+
+  // Assert
+  EXPECT_EQ(std_sort_created, created);
+  ASSERT_EQ(std_sort_grid.getActiveCentroids().size(), grid_.getActiveCentroids().size());
+  for (size_t i = 0u; i < grid_.getActiveCentroids().size(); ++i) {
+    EXPECT_EQ(std_sort_grid.getActiveCentroids()[i], grid_.getActiveCentroids()[i]);
+  }
+  EXPECT_EQ(std_sort_grid.getInactiveCentroids().size(), grid_.getInactiveCentroids().size());
+}
+
 TEST_F(DynamicVoxelGridTest, test_remove) {
   shifted_grid_.insert(small_insert_1_);
   shifted_grid_.insert(small_insert_2_);
@@ -182,6 +269,50 @@ TEST_F(DynamicVoxelGridTest, test_remove) {
   EXPECT_EQ(1, shifted_grid_.getInactiveCentroids().size());
 }
 
+TEST_F(DynamicVoxelGridTest, test_remove_with_region) {
+  // Arrange
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> distribution(-30.0f, 30.0f);
+  VoxelGrid::InputCloud cloud;
+  for (size_t i = 0u; i < 50000u; ++i) {
+    cloud.push_back(InputPointT(distribution(generator), distribution(generator),
+                                distribution(generator) / 10.0f));
+  }
+  VoxelGrid reference_grid(resolution_, 3);
+  reference_grid.insert(cloud);
+  grid_.insert(cloud);
+
+  const Eigen::Vector3f center(5.0f, -3.0f, 0.0f);
+  const float radius = 20.0f;
+  auto predicate = [&](const VoxelPointT& p) {
+    return (p.getVector3fMap() - center).head<2>().norm() > radius;
+  };
+  size_t num_regions_visited = 0u;
+  auto may_remove_region = [&](const Eigen::Vector3f& region_center, float region_radius) {
+    const bool may_remove = (region_center - center).head<2>().norm() + region_radius > radius;
+    if (may_remove) ++num_regions_visited;
+    return may_remove;
+  };
+
+  // Act
+  auto reference_removed = reference_grid.removeIf(predicate);
+  auto removed = grid_.removeIf(predicate, may_remove_region);
+
+  // Assert
+  EXPECT_EQ(reference_removed, removed);
+  ASSERT_EQ(reference_grid.getActiveCentroids().size(), grid_.getActiveCentroids().size());
+  EXPECT_EQ(reference_grid.getInactiveCentroids().size(), grid_.getInactiveCentroids().size());
+  for (size_t i = 0u; i < grid_.getActiveCentroids().size(); ++i) {
+    EXPECT_EQ(reference_grid.getActiveCentroids()[i], grid_.getActiveCentroids()[i]);
+  }
+
+  // Regions that cannot contain removed centroids are not visited.
+  num_regions_visited = 0u;
+  removed = grid_.removeIf(predicate, may_remove_region);
+  EXPECT_EQ(std::vector<bool>(grid_.getActiveCentroids().size(), false), removed);
+  EXPECT_LT(num_regions_visited, grid_.getActiveCentroids().size() / 8u);
+}
+
 TEST_F(DynamicVoxelGridTest, test_full) {
   grid_.insert(big_insert_1_);
   EXPECT_EQ(3, grid_.getActiveCentroids().size());
@@ -207,6 +338,108 @@ TEST_F(DynamicVoxelGridTest, test_full) {
   EXPECT_EQ(3, removed.size());
 }
 
+TEST_F(DynamicVoxelGridTest, test_evict_inactive_by_scans) {
+  // Arrange
+  SmallVoxelGrid::EvictionParameters eviction_params;
+  eviction_params.max_inactive_age_scans = 2u;
+  small_grid_.setEvictionParameters(eviction_params);
+
+  // Act
+  small_grid_.insert(small_insert_1_);
+  small_grid_.insert(small_insert_3_);
+  EXPECT_EQ(2, small_grid_.getInactiveCentroids().size());
+  small_grid_.insert(small_insert_3_);
+
+  // Assert
+  EXPECT_EQ(1, small_grid_.getActiveCentroids().size());
+  EXPECT_EQ(0, small_grid_.getInactiveCentroids().size());
+  EXPECT_EQ(1, small_grid_.getNumVoxels());
+
+  // Evicted voxels don't keep the points received before the eviction.
+  small_grid_.insert(small_insert_2_);
+  EXPECT_EQ(1, small_grid_.getActiveCentroids().size());
+  ASSERT_EQ(2, small_grid_.getInactiveCentroids().size());
+  std::vector<bool> is_found(2, false);
+  for (size_t i = 0u; i < 2u; ++i) {
+    const VoxelPointT centroid = small_grid_.getInactiveCentroids().getPoint(i);
+    if (centroid.getVector3fMap().isApprox(Eigen::Vector3f(1.3f, 0.3f, 1.6f))) is_found[0] = true;
+    if (centroid.getVector3fMap().isApprox(Eigen::Vector3f(1.3f, 0.1f, -1.2f))) is_found[1] = true;
+  }
+  EXPECT_EQ(std::vector<bool>({ true, true }), is_found);
+}
+
+TEST_F(DynamicVoxelGridTest, test_evict_inactive_by_time) {
+  // Arrange
+  SmallVoxelGrid::EvictionParameters eviction_params;
+  eviction_params.max_inactive_age_ns = 10;
+  small_grid_.setEvictionParameters(eviction_params);
+
+  // Act
+  small_grid_.insert(small_insert_1_, 0);
+  small_grid_.insert(small_insert_3_, 5);
+  small_grid_.insert(small_insert_3_, 10);
+  EXPECT_EQ(2, small_grid_.getInactiveCentroids().size());
+  small_grid_.insert(small_insert_3_, 11);
+
+  // Assert
+  EXPECT_EQ(1, small_grid_.getActiveCentroids().size());
+  EXPECT_EQ(0, small_grid_.getInactiveCentroids().size());
+  EXPECT_EQ(1, small_grid_.getNumVoxels());
+}
+
+TEST_F(DynamicVoxelGridTest, test_evict_inactive_by_size) {
+  // Arrange
+  SmallVoxelGrid::EvictionParameters eviction_params;
+  eviction_params.max_voxels = 3u;
+  small_grid_.setEvictionParameters(eviction_params);
+
+  // Act
+  small_grid_.insert(small_insert_1_);
+  EXPECT_EQ(3, small_grid_.getNumVoxels());
+  small_grid_.insert(small_insert_2_);
+
+  // Assert: the least recently hit inactive voxel is evicted.
+  EXPECT_EQ(3, small_grid_.getNumVoxels());
+  EXPECT_EQ(2, small_grid_.getActiveCentroids().size());
+  ASSERT_EQ(1, small_grid_.getInactiveCentroids().size());
+  EXPECT_TRUE(small_grid_.getInactiveCentroids().getPoint(0u).getVector3fMap().isApprox(
+      Eigen::Vector3f(1.3f, 0.1f, -1.2f)));
+  EXPECT_LT(0u, small_grid_.getMemoryUsage());
+
+  // Active voxels are never evicted.
+  eviction_params.max_voxels = 1u;
+  small_grid_.setEvictionParameters(eviction_params);
+  small_grid_.insert(small_insert_3_);
+  EXPECT_EQ(2, small_grid_.getActiveCentroids().size());
+  EXPECT_EQ(0, small_grid_.getInactiveCentroids().size());
+}
+
+TEST_F(DynamicVoxelGridTest, test_evict_least_recently_hit_inactive) {
+  // Arrange
+  VoxelGrid::InputCloud voxel_a, voxel_b, voxel_c, voxels_a_d;
+  voxel_a.push_back(InputPointT(0.5f, 0.5f, 0.5f));
+  voxel_b.push_back(InputPointT(1.5f, 0.5f, 0.5f));
+  voxel_c.push_back(InputPointT(2.5f, 0.5f, 0.5f));
+  voxels_a_d.push_back(InputPointT(0.6f, 0.5f, 0.5f));
+  voxels_a_d.push_back(InputPointT(3.5f, 0.5f, 0.5f));
+  grid_.insert(voxel_a);
+  grid_.insert(voxel_b);
+  grid_.insert(voxel_c);
+  VoxelGrid::EvictionParameters eviction_params;
+  eviction_params.max_voxels = 3u;
+  grid_.setEvictionParameters(eviction_params);
+
+  // Act: hitting voxel A again makes voxel B the least recently hit.
+  grid_.insert(voxels_a_d);
+
+  // Assert
+  EXPECT_EQ(3, grid_.getNumVoxels());
+  ASSERT_EQ(3, grid_.getInactiveCentroids().size());
+  for (size_t i = 0u; i < 3u; ++i) {
+    EXPECT_NE(1.5f, grid_.getInactiveCentroids().getPoint(i).x);
+  }
+}
+
 TEST_F(DynamicVoxelGridTest, test_clear) {
   // Arrange
   grid_.insert(big_insert_1_);
@@ -243,3 +476,59 @@ TEST_F(DynamicVoxelGridTest, test_transform) {
   // Assert
   EXPECT_EQ(original_point_index, transformed_point_index);
 }
+
+TEST_F(DynamicVoxelGridTest, test_transform_centroids) {
+  // Arrange
+  kindr::minimal::QuatTransformationTemplate<float> transformation(
+      kindr::minimal::QuatTransformationTemplate<float>::Position(-1.4f, 1.3f, 0.0f),
+      kindr::minimal::RotationQuaternionTemplate<float>(Eigen::Vector3f( 1.0f, 0.5f, -0.7f )));
+  shifted_grid_.insert(small_insert_1_);
+  ASSERT_EQ(1, shifted_grid_.getActiveCentroids().size());
+  ASSERT_EQ(2, shifted_grid_.getInactiveCentroids().size());
+  std::vector<VoxelPointT> expected_centroids;
+  expected_centroids.push_back(shifted_grid_.getActiveCentroids()[0]);
+  expected_centroids.push_back(shifted_grid_.getInactiveCentroids().getPoint(0u));
+  expected_centroids.push_back(shifted_grid_.getInactiveCentroids().getPoint(1u));
+  for (auto& centroid : expected_centroids) {
+    centroid.getVector3fMap() = transformation.transform(centroid.getVector3fMap());
+  }
+
+  // Act
+  shifted_grid_.transform(transformation);
+  EXPECT_TRUE(shifted_grid_.hasPendingTransformation());
+  shifted_grid_.applyPendingTransformation();
+
+  // Assert
+  EXPECT_FALSE(shifted_grid_.hasPendingTransformation());
+  EXPECT_EQ(expected_centroids[0], shifted_grid_.getActiveCentroids()[0]);
+  EXPECT_EQ(expected_centroids[1], shifted_grid_.getInactiveCentroids().getPoint(0u));
+  EXPECT_EQ(expected_centroids[2], shifted_grid_.getInactiveCentroids().getPoint(1u));
+}
+
+TEST_F(DynamicVoxelGridTest, test_multiple_transforms) {
+  // Arrange
+  kindr::minimal::QuatTransformationTemplate<float> transformation_1(
+      kindr::minimal::QuatTransformationTemplate<float>::Position(-1.4f, 1.3f, 0.0f),
+      kindr::minimal::RotationQuaternionTemplate<float>(Eigen::Vector3f( 1.0f, 0.5f, -0.7f )));
+  kindr::minimal::QuatTransformationTemplate<float> transformation_2(
+      kindr::minimal::QuatTransformationTemplate<float>::Position(0.3f, 0.0f, -2.1f),
+      kindr::minimal::RotationQuaternionTemplate<float>(Eigen::Vector3f( 0.0f, 0.0f, 0.4f )));
+  shifted_grid_.insert(small_insert_1_);
+  VoxelPointT expected_centroid = shifted_grid_.getActiveCentroids()[0];
+  expected_centroid.getVector3fMap() =
+      (transformation_2 * transformation_1).transform(expected_centroid.getVector3fMap());
+
+  // Act
+  shifted_grid_.transform(transformation_1);
+  shifted_grid_.transform(transformation_2);
+  InputPointT new_point;
+  new_point.getVector3fMap() = expected_centroid.getVector3fMap();
+  SmallVoxelGrid::InputCloud new_points;
+  new_points.push_back(new_point);
+  auto created = shifted_grid_.insert(new_points);
+
+  // Assert
+  EXPECT_TRUE(created.empty());
+  ASSERT_EQ(1, shifted_grid_.getActiveCentroids().size());
+  EXPECT_EQ(expected_centroid, shifted_grid_.getActiveCentroids()[0]);
+}
@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <random>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <pcl/segmentation/extract_clusters.h>
+
+#include "segmatch/common.hpp"
+#include "segmatch/points_neighbors_providers/kdtree_points_neighbors_provider.hpp"
+#include "segmatch/segmented_cloud.hpp"
+#include "segmatch/segmenters/euclidean_segmenter.hpp"
+
+using namespace segmatch;
+
+// Initialize common objects needed by multiple tests.
+class EuclideanSegmenterTest : public ::testing::Test {
+ protected:
+  MapCloud cloud_;
+  KdTreePointsNeighborsProvider<MapPoint> kdtree_;
+
+  void SetUp() override {
+    // Clumps of points of various sizes, some of them touching each other, plus isolated points.
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<float> center_distribution(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> offset_distribution(-0.5f, 0.5f);
+    std::uniform_int_distribution<int> size_distribution(1, 60);
+    for (size_t i = 0u; i < 150u; ++i) {
+      const Eigen::Vector3f center(center_distribution(generator),
+                                   center_distribution(generator),
+                                   center_distribution(generator) / 4.0f);
+      const int clump_size = size_distribution(generator);
+      for (int j = 0; j < clump_size; ++j) {
+        MapPoint point;
+        point.getVector3fMap() = center + Eigen::Vector3f(offset_distribution(generator),
+                                                          offset_distribution(generator),
+                                                          offset_distribution(generator));
+        cloud_.push_back(point);
+      }
+    }
+    std::shuffle(cloud_.begin(), cloud_.end(), generator);
+    kdtree_.update(MapCloud::ConstPtr(&cloud_, [](MapCloud const* ptr) {}), { });
+  }
+
+  void TearDown() override {
+  }
+
+  static SegmenterParameters createParameters(const int num_threads) {
+    SegmenterParameters parameters;
+    parameters.radius_for_growing = 0.3f;
+    parameters.min_cluster_size = 5;
+    parameters.max_cluster_size = 80;
+    parameters.num_threads = num_threads;
+    return parameters;
+  }
+};
+
+TEST_F(EuclideanSegmenterTest, test_same_clusters_as_pcl) {
+  const SegmenterParameters parameters = createParameters(1);
+  std::vector<pcl::PointIndices> expected_clusters;
+  pcl::extractEuclideanClusters<MapPoint>(
+      cloud_, kdtree_.getPclSearchObject(), parameters.radius_for_growing, expected_clusters,
+      parameters.min_cluster_size, parameters.max_cluster_size);
+  ASSERT_LT(1u, expected_clusters.size());
+
+  // The segments must be the same for any number of threads.
+  for (const int num_threads : { 1, 4 }) {
+    EuclideanSegmenter<MapPoint> segmenter(createParameters(num_threads));
+    SegmentedCloud segmented_cloud;
+    segmented_cloud.resetSegmentIdCounter();
+    std::vector<Id> cluster_ids_to_segment_ids;
+    std::vector<std::pair<Id, Id>> renamed_segments;
+    segmenter.segment({ }, { }, cloud_, kdtree_, segmented_cloud, cluster_ids_to_segment_ids,
+                      renamed_segments);
+
+    ASSERT_EQ(expected_clusters.size(), segmented_cloud.getNumberOfValidSegments());
+    for (size_t i = 0u; i < expected_clusters.size(); ++i) {
+      Segment segment;
+      ASSERT_TRUE(segmented_cloud.findValidSegmentById(i + 1u, &segment));
+      const auto& segment_points = segment.getLastView().point_cloud;
+      ASSERT_EQ(expected_clusters[i].indices.size(), segment_points.size());
+      for (size_t j = 0u; j < segment_points.size(); ++j) {
+        const MapPoint& expected_point = cloud_[expected_clusters[i].indices[j]];
+        EXPECT_EQ(expected_point.x, segment_points[j].x);
+        EXPECT_EQ(expected_point.y, segment_points[j].y);
+        EXPECT_EQ(expected_point.z, segment_points[j].z);
+      }
+    }
+  }
+}
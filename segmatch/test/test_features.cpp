@@ -0,0 +1,101 @@
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "segmatch/features.hpp"
+
+using namespace segmatch;
+
+// Initialize common objects needed by multiple tests.
+class FeaturesTest : public ::testing::Test {
+ protected:
+  const FeatureLayout& eigenvalue_layout_ =
+      FeatureLayout::get("test_eigenvalue", { "linearity", "planarity", "scattering" });
+  const FeatureLayout& shape_layout_ =
+      FeatureLayout::get("test_shape", { "scale_x", "width", "alignment" });
+  const std::vector<FeatureValueType> eigenvalue_values_ = { 0.1, 0.2, 0.3 };
+  const std::vector<FeatureValueType> shape_values_ = { 4.0, 5.0, 6.0 };
+};
+
+TEST_F(FeaturesTest, test_layouts_are_shared) {
+  EXPECT_EQ(&eigenvalue_layout_,
+            &FeatureLayout::get("test_eigenvalue", { "linearity", "planarity", "scattering" }));
+  EXPECT_NE(&eigenvalue_layout_, &FeatureLayout::get("test_eigenvalue", { "linearity" }));
+
+  EXPECT_TRUE(eigenvalue_layout_.isRotationInvariant());
+  EXPECT_FALSE(shape_layout_.isRotationInvariant());
+  ASSERT_EQ(1u, shape_layout_.getRotationInvariantIndices().size());
+  EXPECT_EQ(1u, shape_layout_.getRotationInvariantIndices()[0]);
+
+  size_t index;
+  ASSERT_TRUE(eigenvalue_layout_.findValueIndex("scattering", &index));
+  EXPECT_EQ(2u, index);
+  EXPECT_FALSE(eigenvalue_layout_.findValueIndex("width", &index));
+}
+
+TEST_F(FeaturesTest, test_set_feature) {
+  Features features;
+  features.setFeature(eigenvalue_layout_, eigenvalue_values_.data());
+  features.setFeature(shape_layout_, shape_values_.data());
+  ASSERT_EQ(2u, features.size());
+  EXPECT_EQ(6u, features.sizeWhenFlattened());
+  EXPECT_EQ(std::vector<FeatureValueType>({ 0.1, 0.2, 0.3, 4.0, 5.0, 6.0 }),
+            features.getValues());
+
+  // Replacing a feature with a layout of different size moves the following features.
+  const FeatureLayout& short_layout = FeatureLayout::get("test_eigenvalue", { "linearity" });
+  const FeatureValueType linearity = 0.7;
+  features.setFeature(short_layout, &linearity);
+  ASSERT_EQ(2u, features.size());
+  EXPECT_EQ(std::vector<FeatureValueType>({ 0.7, 4.0, 5.0, 6.0 }), features.getValues());
+  EXPECT_EQ(std::vector<std::string>({ "linearity", "scale_x", "width", "alignment" }),
+            features.asVectorOfNames());
+
+  features.clearByName("test_eigenvalue");
+  ASSERT_EQ(1u, features.size());
+  EXPECT_EQ(&shape_layout_, &features.getLayout(0u));
+  EXPECT_EQ(shape_values_, features.getValues());
+}
+
+TEST_F(FeaturesTest, test_rotation_invariant_values) {
+  Features features;
+  features.setFeature(eigenvalue_layout_, eigenvalue_values_.data());
+  EXPECT_EQ(features.getValues().data(), features.getRotationInvariantValues().data());
+
+  features.setFeature(shape_layout_, shape_values_.data());
+  const Eigen::MatrixXd expected = features.rotationInvariantFeaturesOnly().asEigenMatrix();
+  ASSERT_EQ(4, expected.cols());
+  EXPECT_EQ(5.0, expected(0, 3));
+  EXPECT_EQ(expected, Eigen::MatrixXd(features.getRotationInvariantValues()));
+
+  // The invariant values are updated when the features change.
+  const std::vector<FeatureValueType> new_shape_values = { 7.0, 8.0, 9.0 };
+  features.setFeature(shape_layout_, new_shape_values.data());
+  EXPECT_EQ(8.0, features.getRotationInvariantValues()(3));
+}
+
+TEST_F(FeaturesTest, test_compatibility_with_names) {
+  Feature feature("test_eigenvalue");
+  feature.push_back(FeatureValue("linearity", 0.1));
+  feature.push_back(FeatureValue("planarity", 0.2));
+  feature.push_back(FeatureValue("scattering", 0.3));
+
+  Features features;
+  features.push_back(feature);
+  EXPECT_EQ(&eigenvalue_layout_, &features.getLayout(0u));
+
+  const Feature copy = features.at(0u);
+  EXPECT_EQ("test_eigenvalue", copy.getName());
+  FeatureValue value;
+  ASSERT_TRUE(copy.findValueByName("planarity", &value));
+  EXPECT_EQ(0.2, value.value);
+
+  Features other_features;
+  other_features.setFeature(shape_layout_, shape_values_.data());
+  features += other_features;
+  EXPECT_EQ(2u, features.size());
+  EXPECT_EQ(6u, features.asEigenMatrix().cols());
+  EXPECT_EQ(4, features.getRotationInvariantValues().size());
+}
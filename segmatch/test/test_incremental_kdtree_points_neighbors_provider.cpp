@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <random>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "segmatch/points_neighbors_providers/incremental_kdtree_points_neighbors_provider.hpp"
+#include "segmatch/common.hpp"
+
+using namespace segmatch;
+
+// Initialize common objects needed by multiple tests.
+class IncrementalKdTreePointsNeighborsProviderTest : public ::testing::Test {
+ protected:
+  IncrementalKdTreePointsNeighborsProvider<MapPoint> provider_;
+  MapCloud points_;
+  typename MapCloud::ConstPtr points_ptr_;
+  std::mt19937 generator_;
+
+  IncrementalKdTreePointsNeighborsProviderTest()
+    : points_ptr_(&points_, [](MapCloud const* ptr) {}), generator_(42) {
+  }
+
+  void SetUp() override {
+  }
+
+  void TearDown() override {
+  }
+
+  // Create a random point.
+  MapPoint createRandomPoint() {
+    std::uniform_real_distribution<float> distribution(-10.0f, 10.0f);
+    MapPoint point;
+    point.x = distribution(generator_);
+    point.y = distribution(generator_);
+    point.z = distribution(generator_) / 4.0f;
+    return point;
+  }
+
+  // Remove random points from the cloud and append new ones, mimicking the local map. Returns the
+  // mapping from the old points to the new points.
+  std::vector<int64_t> removeAndAddRandomPoints(const float removal_probability,
+                                                const size_t num_new_points) {
+    std::bernoulli_distribution is_removed(removal_probability);
+    std::vector<int64_t> mapping(points_.size());
+    MapCloud new_points;
+    for (size_t i = 0u; i < points_.size(); ++i) {
+      if (is_removed(generator_)) {
+        mapping[i] = -1;
+      } else {
+        mapping[i] = new_points.size();
+        new_points.push_back(points_[i]);
+      }
+    }
+    for (size_t i = 0u; i < num_new_points; ++i) new_points.push_back(createRandomPoint());
+    points_ = new_points;
+    return mapping;
+  }
+
+  // Check the neighbors returned by the provider against an exhaustive search.
+  void expectCorrectNeighbors(const float search_radius,
+                              const std::vector<bool>& excluded_points = {}) {
+    for (size_t i = 0u; i < points_.size(); i += 7u) {
+      std::vector<int> expected_neighbors;
+      for (size_t j = 0u; j < points_.size(); ++j) {
+        if (!excluded_points.empty() && excluded_points[j]) continue;
+        if ((points_[i].getVector3fMap() - points_[j].getVector3fMap()).norm() <= search_radius)
+          expected_neighbors.push_back(j);
+      }
+      PointNeighbors neighbors = provider_.getNeighborsOf(i, search_radius);
+      std::sort(neighbors.begin(), neighbors.end());
+      ASSERT_EQ(expected_neighbors, neighbors);
+    }
+  }
+};
+
+TEST_F(IncrementalKdTreePointsNeighborsProviderTest, test_build) {
+  for (size_t i = 0u; i < 2000u; ++i) points_.push_back(createRandomPoint());
+
+  provider_.update(points_ptr_);
+
+  expectCorrectNeighbors(1.0f);
+  EXPECT_NE(nullptr, provider_.getPclSearchObject());
+}
+
+TEST_F(IncrementalKdTreePointsNeighborsProviderTest, test_incremental_updates) {
+  for (size_t i = 0u; i < 2000u; ++i) points_.push_back(createRandomPoint());
+  provider_.update(points_ptr_);
+
+  for (size_t update = 0u; update < 10u; ++update) {
+    // Alternate updates removing few and many points.
+    const float removal_probability = update % 2u == 0u ? 0.05f : 0.6f;
+    std::vector<int64_t> mapping = removeAndAddRandomPoints(removal_probability, 500u);
+    provider_.update(points_ptr_, mapping);
+    expectCorrectNeighbors(1.0f);
+  }
+}
+
+TEST_F(IncrementalKdTreePointsNeighborsProviderTest, test_batched_neighbors) {
+  for (size_t i = 0u; i < 4000u; ++i) points_.push_back(createRandomPoint());
+  provider_.update(points_ptr_);
+  std::vector<int> query_indices;
+  for (size_t i = 0u; i < points_.size(); i += 2u) query_indices.push_back(i);
+
+  // Batches searched with one or more threads must match the single point queries.
+  PointsNeighborsBatch neighbors;
+  for (const size_t max_num_threads : { 1u, 4u }) {
+    provider_.getNeighborsOfPoints(query_indices.data(), query_indices.size(), 1.0f, neighbors,
+                                   max_num_threads);
+    ASSERT_EQ(query_indices.size(), neighbors.size());
+    for (size_t i = 0u; i < query_indices.size(); ++i) {
+      EXPECT_EQ(provider_.getNeighborsOf(query_indices[i], 1.0f),
+                PointNeighbors(neighbors.begin(i), neighbors.end(i)));
+    }
+  }
+}
+
+TEST_F(IncrementalKdTreePointsNeighborsProviderTest, test_remove_all_points) {
+  for (size_t i = 0u; i < 100u; ++i) points_.push_back(createRandomPoint());
+  provider_.update(points_ptr_);
+
+  std::vector<int64_t> mapping = removeAndAddRandomPoints(1.0f, 0u);
+  provider_.update(points_ptr_, mapping);
+  ASSERT_TRUE(points_.empty());
+
+  mapping = removeAndAddRandomPoints(0.0f, 50u);
+  provider_.update(points_ptr_, mapping);
+  expectCorrectNeighbors(5.0f);
+}
+
+TEST_F(IncrementalKdTreePointsNeighborsProviderTest, test_remove_region) {
+  for (size_t i = 0u; i < 4000u; ++i) points_.push_back(createRandomPoint());
+  provider_.update(points_ptr_);
+
+  // Remove the points behind a moving boundary and add points ahead of it, as the local map does
+  // while the robot moves. The deleted points are concentrated in few subtrees.
+  std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+  for (size_t update = 0u; update < 10u; ++update) {
+    const float min_x = -10.0f + static_cast<float>(update + 1u);
+    std::vector<int64_t> mapping(points_.size());
+    MapCloud new_points;
+    for (size_t i = 0u; i < points_.size(); ++i) {
+      if (points_[i].x < min_x) {
+        mapping[i] = -1;
+      } else {
+        mapping[i] = new_points.size();
+        new_points.push_back(points_[i]);
+      }
+    }
+    for (size_t i = 0u; i < 200u; ++i) {
+      MapPoint point = createRandomPoint();
+      point.x = 10.0f + static_cast<float>(update) + distribution(generator_);
+      new_points.push_back(point);
+    }
+    points_ = new_points;
+    provider_.update(points_ptr_, mapping);
+    expectCorrectNeighbors(1.0f);
+  }
+}
+
+TEST_F(IncrementalKdTreePointsNeighborsProviderTest, test_excluded_points) {
+  for (size_t i = 0u; i < 2000u; ++i) points_.push_back(createRandomPoint());
+  std::vector<bool> excluded_points(points_.size());
+  for (size_t i = 0u; i < points_.size(); ++i) excluded_points[i] = points_[i].z < 0.0f;
+  provider_.update(points_ptr_, {}, excluded_points);
+  expectCorrectNeighbors(1.0f, excluded_points);
+
+  // Points enter and leave the set of excluded points while the cloud is updated, as the ground
+  // points of the local map.
+  std::bernoulli_distribution is_toggled(0.1f);
+  for (size_t update = 0u; update < 10u; ++update) {
+    const std::vector<int64_t> mapping = removeAndAddRandomPoints(0.1f, 300u);
+    std::vector<bool> new_excluded_points(points_.size());
+    for (size_t i = 0u; i < points_.size(); ++i) new_excluded_points[i] = points_[i].z < 0.0f;
+    for (size_t i = 0u; i < mapping.size(); ++i) {
+      if (mapping[i] >= 0) new_excluded_points[mapping[i]] = excluded_points[i];
+    }
+    for (size_t i = 0u; i < points_.size(); ++i) {
+      if (is_toggled(generator_)) new_excluded_points[i] = !new_excluded_points[i];
+    }
+    excluded_points.swap(new_excluded_points);
+    provider_.update(points_ptr_, mapping, excluded_points);
+    expectCorrectNeighbors(1.0f, excluded_points);
+  }
+
+  // Excluding all the points leaves the tree empty.
+  excluded_points.assign(points_.size(), true);
+  std::vector<int64_t> mapping(points_.size());
+  for (size_t i = 0u; i < mapping.size(); ++i) mapping[i] = i;
+  provider_.update(points_ptr_, mapping, excluded_points);
+  expectCorrectNeighbors(1.0f, excluded_points);
+}
@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <random>
+
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
@@ -110,3 +115,172 @@ TEST_F(IncrementalNormalEstimatorTest, test_incremental) {
   EXPECT_EQ(1.0f, estimator_.getNormals()[0].normal_y);
   EXPECT_EQ(0.0f, estimator_.getNormals()[0].normal_z);
 }
+
+TEST_F(IncrementalNormalEstimatorTest, test_multithreaded) {
+
+  // Arrange
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> distribution(-5.0f, 5.0f);
+  std::bernoulli_distribution is_removed(0.2);
+  for (size_t i = 0u; i < 6000u; ++i) {
+    points_.push_back(createMapPoint(distribution(generator), distribution(generator),
+                                     distribution(generator) / 10.0f));
+  }
+  std::vector<int> new_points_indices(points_.size());
+  std::iota(new_points_indices.begin(), new_points_indices.end(), 0);
+
+  std::vector<int> points_mapping;
+  for (size_t i = 0u; i < points_.size(); ++i) {
+    if (is_removed(generator)) {
+      points_mapping.push_back(-1);
+    } else {
+      points_mapping.push_back(updated_points_.size());
+      updated_points_.push_back(points_[i]);
+    }
+  }
+  std::vector<int> updated_new_points_indices;
+  for (size_t i = 0u; i < 3000u; ++i) {
+    updated_new_points_indices.push_back(updated_points_.size());
+    updated_points_.push_back(createMapPoint(distribution(generator), distribution(generator),
+                                            distribution(generator) / 10.0f));
+  }
+  IncrementalNormalEstimator multithreaded_estimator(0.5f, 4u);
+
+  // Act
+  kd_tree_.update(points_ptr_);
+  estimator_.updateNormals(points_, { }, new_points_indices, kd_tree_);
+  multithreaded_estimator.updateNormals(points_, { }, new_points_indices, kd_tree_);
+  kd_tree_.update(updated_points_ptr_);
+  const std::vector<bool> is_normal_affected = estimator_.updateNormals(
+      updated_points_, points_mapping, updated_new_points_indices, kd_tree_);
+  const std::vector<bool> multithreaded_is_normal_affected = multithreaded_estimator.updateNormals(
+      updated_points_, points_mapping, updated_new_points_indices, kd_tree_);
+
+  // Assert
+  // The normals must be bitwise identical, NaNs included.
+  EXPECT_EQ(is_normal_affected, multithreaded_is_normal_affected);
+  ASSERT_EQ(estimator_.getNormals().size(), multithreaded_estimator.getNormals().size());
+  for (size_t i = 0u; i < estimator_.getNormals().size(); ++i) {
+    const PclNormal& normal = estimator_.getNormals()[i];
+    const PclNormal& multithreaded_normal = multithreaded_estimator.getNormals()[i];
+    EXPECT_EQ(0, std::memcmp(&normal.normal_x, &multithreaded_normal.normal_x, 3u * sizeof(float)));
+    EXPECT_EQ(0, std::memcmp(&normal.curvature, &multithreaded_normal.curvature, sizeof(float)));
+  }
+}
+
+TEST_F(IncrementalNormalEstimatorTest, test_remapping) {
+
+  // Arrange
+  std::mt19937 generator(7);
+  std::uniform_real_distribution<float> distribution(-5.0f, 5.0f);
+  std::bernoulli_distribution is_removed(0.3);
+  for (size_t i = 0u; i < 4000u; ++i) {
+    points_.push_back(createMapPoint(distribution(generator), distribution(generator),
+                                     distribution(generator) / 10.0f));
+  }
+  std::vector<int> new_points_indices(points_.size());
+  std::iota(new_points_indices.begin(), new_points_indices.end(), 0);
+
+  // Shuffle the points that are kept, so that the cached moments must be permuted.
+  std::vector<int> kept_points_indices;
+  for (size_t i = 0u; i < points_.size(); ++i) {
+    if (!is_removed(generator)) kept_points_indices.push_back(i);
+  }
+  std::shuffle(kept_points_indices.begin(), kept_points_indices.end(), generator);
+  std::vector<int> points_mapping(points_.size(), -1);
+  for (const int point_index : kept_points_indices) {
+    points_mapping[point_index] = updated_points_.size();
+    updated_points_.push_back(points_[point_index]);
+  }
+  std::vector<int> updated_new_points_indices;
+  for (size_t i = 0u; i < 500u; ++i) {
+    updated_new_points_indices.push_back(updated_points_.size());
+    updated_points_.push_back(createMapPoint(distribution(generator), distribution(generator),
+                                             distribution(generator) / 10.0f));
+  }
+  IncrementalNormalEstimator batch_estimator(0.5f);
+  std::vector<int> all_points_indices(updated_points_.size());
+  std::iota(all_points_indices.begin(), all_points_indices.end(), 0);
+
+  // Act
+  kd_tree_.update(points_ptr_);
+  estimator_.updateNormals(points_, { }, new_points_indices, kd_tree_);
+  kd_tree_.update(updated_points_ptr_);
+  estimator_.updateNormals(updated_points_, points_mapping, updated_new_points_indices, kd_tree_);
+  batch_estimator.updateNormals(updated_points_, { }, all_points_indices, kd_tree_);
+
+  // Assert
+  // The incremental normals must match the normals estimated from scratch. The neighborhoods of
+  // the removed points are not updated, so only compare points that were not near any of them.
+  ASSERT_EQ(batch_estimator.getNormals().size(), estimator_.getNormals().size());
+  std::vector<bool> is_near_removed_point(updated_points_.size(), false);
+  for (size_t i = 0u; i < points_mapping.size(); ++i) {
+    if (points_mapping[i] >= 0) continue;
+    for (size_t j = 0u; j < updated_points_.size(); ++j) {
+      if ((updated_points_[j].getVector3fMap() - points_[i].getVector3fMap()).norm() <= 0.5f)
+        is_near_removed_point[j] = true;
+    }
+  }
+  size_t num_compared_normals = 0u;
+  for (size_t i = 0u; i < updated_points_.size(); ++i) {
+    if (is_near_removed_point[i]) continue;
+    const PclNormal& normal = estimator_.getNormals()[i];
+    const PclNormal& batch_normal = batch_estimator.getNormals()[i];
+    ASSERT_EQ(std::isnan(batch_normal.normal_x), std::isnan(normal.normal_x));
+    if (std::isnan(batch_normal.normal_x)) continue;
+    EXPECT_NEAR(1.0f, batch_normal.getNormalVector3fMap().dot(normal.getNormalVector3fMap()),
+                1e-3f);
+    ++num_compared_normals;
+  }
+  EXPECT_LT(0u, num_compared_normals);
+}
+
+TEST_F(IncrementalNormalEstimatorTest, test_far_from_origin) {
+
+  // Arrange
+  // Noisy samples of a tilted plane, close to the origin.
+  points_.clear();
+  updated_points_.clear();
+  std::mt19937 generator(3);
+  std::uniform_real_distribution<float> distribution(-3.0f, 3.0f);
+  std::normal_distribution<float> noise(0.0f, 0.01f);
+  for (size_t i = 0u; i < 3000u; ++i) {
+    const float x = distribution(generator);
+    const float y = distribution(generator);
+    points_.push_back(createMapPoint(x, y, 0.3f * x - 0.2f * y + noise(generator)));
+  }
+  std::vector<int> new_points_indices(points_.size());
+  std::iota(new_points_indices.begin(), new_points_indices.end(), 0);
+
+  // The same points, thousands of meters away from the origin.
+  const kindr::minimal::QuatTransformationTemplate<float> transformation(
+      kindr::minimal::QuatTransformationTemplate<float>::Position(4000.0f, -3000.0f, 100.0f),
+      kindr::minimal::RotationQuaternionTemplate<float>(Eigen::Vector3f(0.0f, 0.0f, 0.5f)));
+  for (const MapPoint& point : points_) {
+    updated_points_.push_back(createMapPoint(0.0f, 0.0f, 0.0f));
+    updated_points_.back().getVector3fMap() = transformation.transform(
+        Eigen::Vector3f(point.getVector3fMap()));
+  }
+  IncrementalNormalEstimator far_estimator(0.5f);
+
+  // Act
+  kd_tree_.update(points_ptr_);
+  estimator_.updateNormals(points_, { }, new_points_indices, kd_tree_);
+  estimator_.notifyPointsTransformed(transformation);
+  kd_tree_.update(updated_points_ptr_);
+  far_estimator.updateNormals(updated_points_, { }, new_points_indices, kd_tree_);
+
+  // Assert
+  // Both the normals estimated far from the origin and the transformed normals must be close to
+  // the normal of the plane.
+  const Eigen::Vector3f plane_normal = transformation.getRotation().rotate(
+      Eigen::Vector3f(-0.3f, 0.2f, 1.0f).normalized());
+  for (size_t i = 0u; i < updated_points_.size(); ++i) {
+    const PclNormal& normal = estimator_.getNormals()[i];
+    const PclNormal& far_normal = far_estimator.getNormals()[i];
+    if (std::isnan(far_normal.normal_x)) continue;
+    EXPECT_NEAR(1.0f, std::fabs(plane_normal.dot(far_normal.getNormalVector3fMap())), 0.02f);
+    EXPECT_NEAR(1.0f, std::fabs(plane_normal.dot(normal.getNormalVector3fMap())), 0.02f);
+    EXPECT_NEAR(normal.curvature, far_normal.curvature, 1e-3f);
+  }
+}
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <random>
+
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <segmatch/segmenters/region_growing_policy.hpp>
@@ -215,3 +218,268 @@ TEST_F(IncrementalEuclideanSegmenterTest, test_join_clusters) {
       { 0, 5, 0 },                             // Expected segments sizes
       { { 2, 1 } });                           // Expected renamed segments
 }
+
+TEST_F(IncrementalEuclideanSegmenterTest, test_skip_ground_points) {
+
+  // Arrange
+  Segmenter::ClusteredCloud cloud = createClusteredCloud({
+    {  0.0f,  0.0f,  0.0f },   // 1
+    {  1.5f,  0.0f,  0.0f },   // Ground, expect no join of 1 and 2
+    {  3.0f,  0.0f,  0.0f },   // 2
+    {  3.5f,  0.0f,  0.0f },   // 2
+    {  0.5f,  0.0f,  0.0f }    // 1
+  });
+  cloud[1].ed_cluster_id = kGroundClusterId;
+  const float kGround = static_cast<float>(kGroundClusterId);
+  std::vector<Id> segments { };
+  std::vector<std::pair<Id, Id>> renamed_segments;
+  kdtree_.update(typename MapCloud::Ptr(&cloud, [](MapCloud* ptr) {}), { });
+
+  // Act
+  segmenter_.segment({ }, { }, cloud, kdtree_, segmented_cloud_, segments, renamed_segments);
+
+  // Assert
+  verifySegmentationResult(
+      cloud, segments, renamed_segments,
+      { 1.0f, kGround, 2.0f, 2.0f, 1.0f },  // Expected clusters
+      { kNoId, 1, 2 },                      // Expected segments
+      { 0, 2, 2 },                          // Expected segments sizes
+      { });                                 // Expected renamed segments
+}
+
+TEST_F(IncrementalEuclideanSegmenterTest, test_join_cluster_chain) {
+
+  // Arrange
+  Segmenter::ClusteredCloud cloud = createClusteredCloud({
+    {   4.0f,  0.0f,  0.0f, 1.0f },   // 1
+    {   4.5f,  0.0f,  0.0f, 1.0f },   // 1
+    {   8.0f,  0.0f,  0.0f, 2.0f },   // 2
+    {   8.5f,  0.0f,  0.0f, 2.0f },   // 2
+    {  12.0f,  0.0f,  0.0f, 3.0f },   // 3
+    {  12.5f,  0.0f,  0.0f, 3.0f },   // 3
+    {  16.0f,  0.0f,  0.0f, 4.0f },   // 4
+    {  16.5f,  0.0f,  0.0f, 4.0f },   // 4
+    {  20.0f,  0.0f,  0.0f, 5.0f },   // 5
+    {  20.5f,  0.0f,  0.0f, 5.0f },   // 5
+    {  6.25f,  0.0f,  0.0f, 0.0f },   // Expect join 1 and 2
+    { 10.25f,  0.0f,  0.0f, 0.0f },   // Expect join 2 and 3
+    { 14.25f,  0.0f,  0.0f, 0.0f },   // Expect join 3 and 4
+    { 18.25f,  0.0f,  0.0f, 0.0f }    // Expect join 4 and 5
+  });
+  std::vector<Id> segments { kNoId, 1, 2, 3, 4, 5 };
+  std::vector<std::pair<Id, Id>> renamed_segments;
+  segmented_cloud_.resetSegmentIdCounter(6); // 5 is the last segment IDs used.
+  kdtree_.update(typename MapCloud::Ptr(&cloud, [](MapCloud* ptr) {}), { });
+
+  // Act
+  segmenter_.segment({ }, { }, cloud, kdtree_, segmented_cloud_, segments, renamed_segments);
+
+  // Assert
+  verifySegmentationResult(
+      cloud, segments, renamed_segments,
+      Indices(14u, 1.0f),                           // Expected clusters
+      { kNoId, 1 },                                 // Expected segments
+      { 0, 14 },                                    // Expected segments sizes
+      { { 2, 1 }, { 3, 1 }, { 4, 1 }, { 5, 1 } });  // Expected renamed segments
+}
+
+TEST_F(IncrementalEuclideanSegmenterTest, test_update_only_modified_segments) {
+
+  // Arrange
+  Segmenter::ClusteredCloud cloud = createClusteredCloud({
+    {  0.0f,  0.0f,  0.0f },   // 1
+    {  1.0f,  0.0f,  0.0f },   // 1
+    {  0.5f,  0.5f,  0.0f },   // 1
+    { 20.0f,  0.0f,  0.0f },   // 2
+    { 21.0f,  0.0f,  0.0f },   // 2
+    { 40.0f,  0.0f,  0.0f },   // 3
+    { 41.0f,  0.0f,  0.0f },   // 3
+    { 42.0f,  0.0f,  0.0f }    // 3
+  });
+  std::vector<Id> segments { };
+  std::vector<std::pair<Id, Id>> renamed_segments;
+  SegmentedCloud segmented_cloud(false);
+  SegmenterParameters parameters = createParameters(2.0f, 1000, 2);
+  parameters.update_only_modified_segments = true;
+  Segmenter segmenter(parameters);
+  kdtree_.update(typename MapCloud::Ptr(&cloud, [](MapCloud* ptr) {}), { });
+  segmenter.segment({ }, { }, cloud, kdtree_, segmented_cloud, segments, renamed_segments);
+
+  // Add a point to the first cluster and remove one from the third cluster.
+  cloud.erase(cloud.end() - 1u);
+  cloud.push_back(createClusteredPointT(2.0f, 0.0f, 0.0f));
+
+  // Act
+  kdtree_.update(typename MapCloud::Ptr(&cloud, [](MapCloud* ptr) {}), { });
+  segmenter.segment({ }, { }, cloud, kdtree_, segmented_cloud, segments, renamed_segments);
+
+  // Assert
+  // Only the modified segments get a new view.
+  EXPECT_EQ(std::vector<Id>({ kNoId, 1, 2, 3 }), segments);
+  Segment segment;
+  ASSERT_TRUE(segmented_cloud.findValidSegmentById(1, &segment));
+  EXPECT_EQ(2u, segment.views.size());
+  EXPECT_EQ(4u, segment.getLastView().point_cloud.size());
+  ASSERT_TRUE(segmented_cloud.findValidSegmentById(2, &segment));
+  EXPECT_EQ(1u, segment.views.size());
+  EXPECT_EQ(2u, segment.getLastView().point_cloud.size());
+  ASSERT_TRUE(segmented_cloud.findValidSegmentById(3, &segment));
+  EXPECT_EQ(2u, segment.views.size());
+  EXPECT_EQ(2u, segment.getLastView().point_cloud.size());
+}
+
+TEST_F(IncrementalEuclideanSegmenterTest, test_parallel_clustering) {
+
+  // Arrange
+  // Random clumps of points, with tiles much smaller than the clumps so that most clusters cross
+  // tile borders.
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> center_distribution(-40.0f, 40.0f);
+  std::normal_distribution<float> offset_distribution(0.0f, 1.5f);
+  Segmenter::ClusteredCloud cloud;
+  for (size_t i = 0u; i < 60u; ++i) {
+    const float x = center_distribution(generator);
+    const float y = center_distribution(generator);
+    const size_t num_points = 5u + generator() % 40u;
+    for (size_t j = 0u; j < num_points; ++j) {
+      cloud.push_back(createClusteredPointT(x + offset_distribution(generator),
+                                            y + offset_distribution(generator),
+                                            offset_distribution(generator)));
+    }
+  }
+  std::vector<Id> segments;
+  std::vector<std::pair<Id, Id>> renamed_segments;
+  kdtree_.update(typename MapCloud::Ptr(&cloud, [](MapCloud* ptr) {}), { });
+  segmenter_.segment({ }, { }, cloud, kdtree_, segmented_cloud_, segments, renamed_segments);
+
+  // Add new points between the existing clusters, joining some of them.
+  std::uniform_real_distribution<float> position_distribution(-45.0f, 45.0f);
+  for (size_t i = 0u; i < 600u; ++i) {
+    cloud.push_back(createClusteredPointT(position_distribution(generator),
+                                          position_distribution(generator),
+                                          offset_distribution(generator)));
+  }
+  Segmenter::ClusteredCloud parallel_cloud = cloud;
+  std::vector<Id> parallel_segments = segments;
+  SegmentedCloud parallel_segmented_cloud = segmented_cloud_;
+  std::vector<std::pair<Id, Id>> parallel_renamed_segments;
+  SegmenterParameters parallel_parameters = createParameters(2.0f, 1000, 2);
+  parallel_parameters.num_threads = 4;
+  parallel_parameters.parallel_tile_size_m = 3.0f;
+  Segmenter parallel_segmenter(parallel_parameters);
+  KdTreePointsNeighborsProvider<ClusteredPointT> parallel_kdtree;
+
+  // Act
+  kdtree_.update(typename MapCloud::Ptr(&cloud, [](MapCloud* ptr) {}), { });
+  segmenter_.segment({ }, { }, cloud, kdtree_, segmented_cloud_, segments, renamed_segments);
+  parallel_kdtree.update(typename MapCloud::Ptr(&parallel_cloud, [](MapCloud* ptr) {}), { });
+  parallel_segmenter.segment({ }, { }, parallel_cloud, parallel_kdtree, parallel_segmented_cloud,
+                             parallel_segments, parallel_renamed_segments);
+
+  // Assert
+  // The Euclidean distance policy is symmetric, thus the clusters and segments are the same.
+  EXPECT_EQ(getClusterIndices(cloud), getClusterIndices(parallel_cloud));
+  EXPECT_EQ(segments, parallel_segments);
+  EXPECT_EQ(segmented_cloud_.getNumberOfValidSegments(),
+            parallel_segmented_cloud.getNumberOfValidSegments());
+
+  // The same segments are renamed, possibly in a different order.
+  auto get_renamed_ids = [](const std::vector<std::pair<Id, Id>>& renamed_segments) {
+    std::vector<Id> renamed_ids;
+    for (const auto& renamed_segment : renamed_segments) {
+      renamed_ids.push_back(renamed_segment.first);
+    }
+    std::sort(renamed_ids.begin(), renamed_ids.end());
+    return renamed_ids;
+  };
+  EXPECT_FALSE(renamed_segments.empty());
+  EXPECT_EQ(get_renamed_ids(renamed_segments), get_renamed_ids(parallel_renamed_segments));
+}
+
+TEST(IncrementalSmoothnessConstraintsSegmenterTest, test_parallel_clustering) {
+  typedef IncrementalSegmenter<MapPoint, SmoothnessConstraints> Segmenter;
+
+  // Arrange
+  // Random planar patches, with tiles much smaller than the patches so that most clusters cross
+  // tile borders. A third of the points have a high curvature and cannot be seeds, thus they
+  // are often reached by multiple regions.
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> center_distribution(-40.0f, 40.0f);
+  std::normal_distribution<float> offset_distribution(0.0f, 1.5f);
+  std::normal_distribution<float> normal_noise_distribution(0.0f, 0.05f);
+  std::uniform_real_distribution<float> curvature_distribution(0.0f, 0.3f);
+  MapCloud cloud;
+  PointNormals normals;
+  auto add_point = [&](const float x, const float y, const Eigen::Vector3f& patch_normal) {
+    MapPoint point;
+    point.x = x;
+    point.y = y;
+    point.z = offset_distribution(generator) * 0.1f;
+    cloud.push_back(point);
+    PclNormal normal;
+    normal.getNormalVector3fMap() = (patch_normal + Eigen::Vector3f(
+        normal_noise_distribution(generator), normal_noise_distribution(generator),
+        normal_noise_distribution(generator))).normalized();
+    normal.curvature = curvature_distribution(generator);
+    normals.push_back(normal);
+  };
+  for (size_t i = 0u; i < 60u; ++i) {
+    const float x = center_distribution(generator);
+    const float y = center_distribution(generator);
+    const Eigen::Vector3f patch_normal = i % 2u == 0u ? Eigen::Vector3f::UnitZ() :
+        Eigen::Vector3f::UnitX();
+    const size_t num_points = 5u + generator() % 40u;
+    for (size_t j = 0u; j < num_points; ++j) {
+      add_point(x + offset_distribution(generator), y + offset_distribution(generator),
+                patch_normal);
+    }
+  }
+  SegmenterParameters parameters;
+  parameters.radius_for_growing = 2.0f;
+  parameters.max_cluster_size = 1000;
+  parameters.min_cluster_size = 2;
+  parameters.sc_smoothness_threshold_deg = 20.0f;
+  parameters.sc_curvature_threshold = 0.2f;
+  Segmenter segmenter(parameters);
+  SegmentedCloud segmented_cloud;
+  std::vector<Id> segments;
+  std::vector<std::pair<Id, Id>> renamed_segments;
+  KdTreePointsNeighborsProvider<MapPoint> kdtree;
+  kdtree.update(typename MapCloud::Ptr(&cloud, [](MapCloud* ptr) {}), { });
+  segmenter.segment(normals, { }, cloud, kdtree, segmented_cloud, segments, renamed_segments);
+
+  // Add new points between the existing clusters, joining some of them.
+  std::uniform_real_distribution<float> position_distribution(-45.0f, 45.0f);
+  for (size_t i = 0u; i < 1500u; ++i) {
+    add_point(position_distribution(generator), position_distribution(generator),
+              i % 2u == 0u ? Eigen::Vector3f::UnitZ() : Eigen::Vector3f::UnitX());
+  }
+  MapCloud parallel_cloud = cloud;
+  std::vector<Id> parallel_segments = segments;
+  SegmentedCloud parallel_segmented_cloud = segmented_cloud;
+  std::vector<std::pair<Id, Id>> parallel_renamed_segments;
+  SegmenterParameters parallel_parameters = parameters;
+  parallel_parameters.num_threads = 4;
+  parallel_parameters.parallel_tile_size_m = 3.0f;
+  Segmenter parallel_segmenter(parallel_parameters);
+  KdTreePointsNeighborsProvider<MapPoint> parallel_kdtree;
+
+  // Act
+  kdtree.update(typename MapCloud::Ptr(&cloud, [](MapCloud* ptr) {}), { });
+  segmenter.segment(normals, { }, cloud, kdtree, segmented_cloud, segments, renamed_segments);
+  parallel_kdtree.update(typename MapCloud::Ptr(&parallel_cloud, [](MapCloud* ptr) {}), { });
+  parallel_segmenter.segment(normals, { }, parallel_cloud, parallel_kdtree,
+                             parallel_segmented_cloud, parallel_segments,
+                             parallel_renamed_segments);
+
+  // Assert
+  // The points that cannot be seeds are assigned to the region with the smallest seed rank
+  // reaching them, as in the single-threaded segmentation.
+  ASSERT_EQ(cloud.size(), parallel_cloud.size());
+  for (size_t i = 0u; i < cloud.size(); ++i) {
+    EXPECT_EQ(cloud[i].sc_cluster_id, parallel_cloud[i].sc_cluster_id);
+  }
+  EXPECT_EQ(segments, parallel_segments);
+  EXPECT_EQ(segmented_cloud.getNumberOfValidSegments(),
+            parallel_segmented_cloud.getNumberOfValidSegments());
+}
@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <laser_slam/common.hpp>
+
+#include "segmatch/common.hpp"
+#include "segmatch/local_map.hpp"
+#include "segmatch/normal_estimators/incremental_normal_estimator.hpp"
+#include "segmatch/points_neighbors_providers/incremental_kdtree_points_neighbors_provider.hpp"
+
+using namespace segmatch;
+
+// Initialize common objects needed by multiple tests.
+class LocalMapTest : public ::testing::Test {
+ protected:
+  typedef LocalMap<PclPoint, MapPoint> LocalMapT;
+
+  static constexpr float kRobotHeight = 1.0f;
+  static constexpr float kNormalsSearchRadius = 0.5f;
+
+  LocalMapParameters params_;
+
+  LocalMapTest() {
+    params_.voxel_size_m = 0.1f;
+    params_.min_points_per_voxel = 1;
+    params_.radius_m = 6.0f;
+    params_.min_vertical_distance_m = -5.0f;
+    params_.max_vertical_distance_m = 5.0f;
+    params_.neighbors_provider_type = "IncrementalKdTree";
+    params_.remove_ground = true;
+    params_.ground_cell_size_m = 1.0f;
+    params_.ground_max_height_m = 0.3f;
+    params_.ground_max_height_above_robot_m = 0.0f;
+  }
+
+  void SetUp() override {
+  }
+
+  void TearDown() override {
+  }
+
+  // Create a pose of the robot at the specified position.
+  static laser_slam::Pose createPose(const double x, const double y,
+                                     const double z = kRobotHeight) {
+    laser_slam::Pose pose;
+    pose.T_w = laser_slam::SE3(laser_slam::SE3::Position(x, y, z), laser_slam::SE3::Rotation());
+    pose.time_ns = 0;
+    return pose;
+  }
+
+  // Add to a cloud one point in the center of each voxel of an horizontal rectangle.
+  static void addHorizontalRectangle(const float min_x, const float max_x, const float min_y,
+                                     const float max_y, const float z, PointCloud& cloud) {
+    for (float x = min_x + 0.05f; x < max_x; x += 0.1f) {
+      for (float y = min_y + 0.05f; y < max_y; y += 0.1f) cloud.push_back(PclPoint(x, y, z));
+    }
+  }
+
+  // Add to a cloud a vertical pole with a square section of 0.3 m.
+  static void addPole(const float x, const float y, const float height, PointCloud& cloud) {
+    for (float z = 0.05f; z < height; z += 0.1f)
+      addHorizontalRectangle(x, x + 0.3f, y, y + 0.3f, z, cloud);
+  }
+
+  // Check the ground flags against a detection on the whole local map.
+  void expectCorrectGround(LocalMapT& local_map) {
+    const MapCloud& points = local_map.getFilteredPoints();
+    ASSERT_LT(0u, points.size());
+    std::map<std::pair<int, int>, float> cells_min_z;
+    auto get_cell = [&](const MapPoint& point) {
+      return std::make_pair(static_cast<int>(std::floor(point.x / params_.ground_cell_size_m)),
+                            static_cast<int>(std::floor(point.y / params_.ground_cell_size_m)));
+    };
+    for (const MapPoint& point : points) {
+      const auto cell_it = cells_min_z.emplace(get_cell(point),
+                                               std::numeric_limits<float>::infinity()).first;
+      cell_it->second = std::min(cell_it->second, point.z);
+    }
+
+    std::vector<bool> is_ground(points.size());
+    for (size_t i = 0u; i < points.size(); ++i) {
+      const float min_z = cells_min_z[get_cell(points[i])];
+      is_ground[i] = min_z - kRobotHeight <= params_.ground_max_height_above_robot_m &&
+          points[i].z - min_z <= params_.ground_max_height_m;
+      ASSERT_EQ(is_ground[i], points[i].ed_cluster_id == kGroundClusterId) << "Point " << i;
+      ASSERT_EQ(is_ground[i], points[i].sc_cluster_id == kGroundClusterId) << "Point " << i;
+    }
+
+    // The ground points are not returned as neighbors.
+    const float search_radius = 0.25f;
+    for (size_t i = 0u; i < points.size(); i += 7u) {
+      std::vector<int> expected_neighbors;
+      for (size_t j = 0u; j < points.size(); ++j) {
+        if (!is_ground[j] && (points[i].getVector3fMap() - points[j].getVector3fMap()).norm() <=
+            search_radius)
+          expected_neighbors.push_back(j);
+      }
+      PointNeighbors neighbors = local_map.getPointsNeighborsProvider().getNeighborsOf(
+          i, search_radius);
+      std::sort(neighbors.begin(), neighbors.end());
+      ASSERT_EQ(expected_neighbors, neighbors) << "Point " << i;
+    }
+  }
+
+  // Check the normals of the points that are not ground against an estimation from scratch.
+  static void expectCorrectNormals(LocalMapT& local_map) {
+    const MapCloud& points = local_map.getFilteredPoints();
+    std::vector<bool> is_ground(points.size());
+    std::vector<int> non_ground_points_indices;
+    for (size_t i = 0u; i < points.size(); ++i) {
+      is_ground[i] = points[i].sc_cluster_id == kGroundClusterId;
+      if (!is_ground[i]) non_ground_points_indices.push_back(i);
+    }
+    ASSERT_LT(0u, non_ground_points_indices.size());
+    IncrementalKdTreePointsNeighborsProvider<MapPoint> kd_tree;
+    kd_tree.update(local_map.getFilteredPointsPtr(), { }, is_ground);
+    IncrementalNormalEstimator estimator(kNormalsSearchRadius);
+    estimator.updateNormals(points, { }, non_ground_points_indices, kd_tree);
+
+    const PointNormals& normals = local_map.getNormals();
+    const PointNormals& expected_normals = estimator.getNormals();
+    ASSERT_EQ(expected_normals.size(), normals.size());
+    for (const int i : non_ground_points_indices) {
+      if (std::isnan(expected_normals[i].curvature)) {
+        ASSERT_TRUE(std::isnan(normals[i].curvature)) << "Point " << i;
+        continue;
+      }
+      ASSERT_NEAR(expected_normals[i].curvature, normals[i].curvature, 1e-4) << "Point " << i;
+      ASSERT_NEAR(1.0f, std::fabs(expected_normals[i].getNormalVector3fMap().dot(
+          normals[i].getNormalVector3fMap())), 1e-4) << "Point " << i;
+    }
+  }
+};
+
+constexpr float LocalMapTest::kRobotHeight;
+constexpr float LocalMapTest::kNormalsSearchRadius;
+
+TEST_F(LocalMapTest, test_ground_detection) {
+  LocalMapT local_map(params_, nullptr);
+
+  // A flat ground with a pole standing on it and a plate above the robot, with no ground below.
+  PointCloud cloud;
+  addHorizontalRectangle(-5.0f, 5.0f, -5.0f, 2.0f, 0.05f, cloud);
+  addHorizontalRectangle(-5.0f, 0.0f, 2.0f, 5.0f, 0.05f, cloud);
+  addPole(-2.5f, -2.5f, 2.0f, cloud);
+  addHorizontalRectangle(1.0f, 3.0f, 3.0f, 4.0f, 1.55f, cloud);
+  local_map.updatePoseAndAddPoints({ cloud }, {}, createPose(0.0, 0.0));
+
+  const MapCloud& points = local_map.getFilteredPoints();
+  size_t num_ground_points = 0u;
+  for (const MapPoint& point : points) {
+    const bool is_ground = point.sc_cluster_id == kGroundClusterId;
+    if (point.z > 1.5f) {
+      // Neither the plate nor the top of the pole are ground.
+      EXPECT_FALSE(is_ground);
+    } else if (point.z < 0.1f) {
+      // The flat ground and the base of the pole are.
+      EXPECT_TRUE(is_ground);
+    }
+    if (is_ground) ++num_ground_points;
+  }
+  EXPECT_LT(0u, num_ground_points);
+  expectCorrectGround(local_map);
+}
+
+TEST_F(LocalMapTest, test_incremental_ground_detection) {
+  LocalMapT local_map(params_, nullptr);
+  PointCloud cloud;
+  addHorizontalRectangle(-5.0f, 5.0f, -5.0f, 5.0f, 0.05f, cloud);
+  addPole(-2.5f, -2.5f, 2.0f, cloud);
+  local_map.updatePoseAndAddPoints({ cloud }, {}, createPose(0.0, 0.0));
+  expectCorrectGround(local_map);
+
+  // A ditch appears in a cell. The flat ground around it is not ground anymore.
+  cloud.clear();
+  addHorizontalRectangle(0.0f, 0.2f, 0.4f, 0.6f, -0.45f, cloud);
+  local_map.updatePoseAndAddPoints({ cloud }, {}, createPose(0.0, 0.0));
+  expectCorrectGround(local_map);
+  const MapCloud& points = local_map.getFilteredPoints();
+  for (const MapPoint& point : points) {
+    if (point.x > 0.0f && point.x < 1.0f && point.y > 0.0f && point.y < 1.0f &&
+        point.z > 0.0f) {
+      EXPECT_EQ(0u, point.sc_cluster_id);
+    }
+  }
+
+  // The robot moves and part of the map is removed, including the ditch. The flat ground left in
+  // its cell is ground again.
+  cloud.clear();
+  addHorizontalRectangle(5.0f, 9.0f, -3.0f, 3.0f, 0.05f, cloud);
+  addPole(5.5f, 0.5f, 2.0f, cloud);
+  local_map.updatePoseAndAddPoints({ cloud }, {}, createPose(6.3, 0.0));
+  expectCorrectGround(local_map);
+  size_t num_ditch_cell_points = 0u;
+  for (const MapPoint& point : local_map.getFilteredPoints()) {
+    if (point.x > 0.0f && point.x < 1.0f && point.y > 0.0f && point.y < 1.0f) {
+      EXPECT_EQ(kGroundClusterId, point.sc_cluster_id);
+      ++num_ditch_cell_points;
+    }
+  }
+  EXPECT_LT(0u, num_ditch_cell_points);
+
+  // The ground is detected again after the local map is transformed.
+  local_map.transform(kindr::minimal::QuatTransformationTemplate<float>(
+      kindr::minimal::QuatTransformationTemplate<float>::Position(0.5f, 0.5f, 0.0f),
+      kindr::minimal::RotationQuaternionTemplate<float>()));
+  local_map.updatePoseAndAddPoints({}, {}, createPose(6.3, 0.0));
+  expectCorrectGround(local_map);
+}
+
+TEST_F(LocalMapTest, test_normals_after_ground_changes) {
+  LocalMapT local_map(params_, std::unique_ptr<NormalEstimator>(
+      new IncrementalNormalEstimator(kNormalsSearchRadius)));
+
+  // A flat ground with a wall standing on it. The voxels of the ground and of the base of the
+  // wall are ground.
+  PointCloud cloud;
+  addHorizontalRectangle(-3.0f, 3.0f, -3.0f, 3.0f, 0.05f, cloud);
+  for (float z = 0.15f; z < 2.0f; z += 0.1f)
+    addHorizontalRectangle(0.2f, 0.3f, -2.0f, 2.0f, z, cloud);
+  local_map.updatePoseAndAddPoints({ cloud }, {}, createPose(0.0, 0.0));
+  expectCorrectNormals(local_map);
+
+  // A ditch appears in a cell. The ground and the base of the wall in the cell are not ground
+  // anymore and contribute to the normals of the wall.
+  cloud.clear();
+  addHorizontalRectangle(0.6f, 0.8f, 0.4f, 0.6f, -0.45f, cloud);
+  local_map.updatePoseAndAddPoints({ cloud }, {}, createPose(0.0, 0.0));
+  expectCorrectNormals(local_map);
+  size_t num_former_ground_points = 0u;
+  for (const MapPoint& point : local_map.getFilteredPoints()) {
+    if (point.z > 0.0f && point.z < 0.1f && point.sc_cluster_id != kGroundClusterId)
+      ++num_former_ground_points;
+  }
+  EXPECT_LT(0u, num_former_ground_points);
+
+  // The robot moves up and the ditch is removed from the local map. The cell is ground again and
+  // its points don't contribute to the normals of the wall anymore.
+  local_map.updatePoseAndAddPoints({}, {}, createPose(0.0, 0.0, 5.0));
+  expectCorrectNormals(local_map);
+  for (const MapPoint& point : local_map.getFilteredPoints()) {
+    if (point.z < 0.1f) EXPECT_EQ(kGroundClusterId, point.sc_cluster_id);
+  }
+
+  // Repeat the changes, so that the same points leave and enter the ground a second time.
+  cloud.clear();
+  addHorizontalRectangle(0.6f, 0.8f, 0.4f, 0.6f, -0.45f, cloud);
+  local_map.updatePoseAndAddPoints({ cloud }, {}, createPose(0.0, 0.0));
+  expectCorrectNormals(local_map);
+  local_map.updatePoseAndAddPoints({}, {}, createPose(0.0, 0.0, 5.0));
+  expectCorrectNormals(local_map);
+}
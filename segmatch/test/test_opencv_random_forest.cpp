@@ -0,0 +1,132 @@
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "segmatch/common.hpp"
+#include "segmatch/opencv_random_forest.hpp"
+#include "segmatch/parameters.hpp"
+#include "segmatch/segmented_cloud.hpp"
+
+using namespace segmatch;
+
+// Initialize common objects needed by multiple tests.
+class OpenCvRandomForestTest : public ::testing::TestWithParam<std::string> {
+ protected:
+  // Number of segments in the target cloud. Candidates are only found in targets with at least
+  // 50 segments.
+  static constexpr Id kNumTargetSegments = 60;
+  // The source segments are observed long after the target segments, so that they can match.
+  static constexpr int64_t kSourceTimestampNs = 100000000000;
+
+  ClassifierParams params_;
+  SegmentedCloud target_cloud_;
+
+  OpenCvRandomForestTest() {
+    params_.n_nearest_neighbours = 2;
+    params_.enable_two_stage_retrieval = false;
+    params_.knn_feature_dim = 2;
+    params_.apply_hard_threshold_on_feature_distance = false;
+    params_.knn_index_type = GetParam();
+    params_.normalize_eigen_for_knn = false;
+    params_.normalize_eigen_for_hard_threshold = false;
+    params_.max_eigen_features_values.assign(7u, 1.0);
+    params_.do_not_use_cars = false;
+  }
+
+  void SetUp() override {
+    // Target segments 1, 2, ... with linearities 10, 20, ... so that queries close to a linearity
+    // pass the ratio test.
+    for (Id segment_id = 1; segment_id <= kNumTargetSegments; ++segment_id) {
+      target_cloud_.addValidSegment(createSegment(segment_id, 10.0 * segment_id, 0));
+    }
+  }
+
+  static Segment createSegment(const Id segment_id, const double linearity,
+                               const int64_t timestamp_ns) {
+    Segment segment;
+    segment.segment_id = segment_id;
+    segment.track_id = 0u;
+    SegmentView view;
+    view.point_cloud.push_back(PclPoint(linearity, 0.0f, 0.0f));
+    view.calculateCentroid();
+    view.timestamp_ns = timestamp_ns;
+    view.features.push_back(createFeature(linearity));
+    segment.views.push_back(view);
+    return segment;
+  }
+
+  static Feature createFeature(const double linearity) {
+    Feature feature("eigenvalue");
+    feature.push_back(FeatureValue("linearity", linearity));
+    feature.push_back(FeatureValue("planarity", 0.0));
+    return feature;
+  }
+
+  static void setLinearity(const Id segment_id, const double linearity, SegmentedCloud& cloud) {
+    Segment* segment;
+    ASSERT_TRUE(cloud.findValidSegmentPtrById(segment_id, &segment));
+    segment->getLastView().features.replaceByName(createFeature(linearity));
+  }
+
+  // Find the target segments matching source segments described by the given linearities. The
+  // result contains kNoId for the source segments without candidate.
+  static std::vector<Id> findMatchingTargetSegments(OpenCvRandomForest& classifier,
+                                                    const std::vector<double>& linearities) {
+    SegmentedCloud source_cloud;
+    for (size_t i = 0u; i < linearities.size(); ++i) {
+      source_cloud.addValidSegment(createSegment(1000 + i, linearities[i], kSourceTimestampNs));
+    }
+    std::vector<Id> target_segment_ids(linearities.size(), kNoId);
+    for (const auto& candidate : classifier.findCandidates(source_cloud)) {
+      target_segment_ids[candidate.ids_.first - 1000] = candidate.ids_.second;
+    }
+    return target_segment_ids;
+  }
+};
+
+TEST_P(OpenCvRandomForestTest, test_update_target) {
+  // Arrange
+  OpenCvRandomForest classifier(params_);
+  classifier.setTarget(target_cloud_);
+  const std::vector<double> queries = { 50.5, 70.5, 90.5, 2000.5, 300.5 };
+  ASSERT_EQ(std::vector<Id>({ 5, 7, 9, kNoId, 30 }),
+            findMatchingTargetSegments(classifier, queries));
+
+  // Act. Segment 5 is described again, segment 7 is renamed to 100 and segment 9 is deleted.
+  setLinearity(5, 2000.0, target_cloud_);
+  Segment renamed_segment;
+  ASSERT_TRUE(target_cloud_.findValidSegmentById(7, &renamed_segment));
+  renamed_segment.segment_id = 100;
+  target_cloud_.addValidSegment(renamed_segment);
+  target_cloud_.eraseSegmentById(7);
+  target_cloud_.eraseSegmentById(9);
+  classifier.updateTarget(target_cloud_, { 5, 7, 100, 9 });
+
+  // Assert. The linearities next to the deleted segment 9 and to the old linearity of segment 5
+  // are at the same distance from two segments and fail the ratio test. Segment 30 did not
+  // change.
+  const std::vector<Id> expected_target_segment_ids = { kNoId, 100, kNoId, 5, 30 };
+  EXPECT_EQ(expected_target_segment_ids, findMatchingTargetSegments(classifier, queries));
+
+  // Assert. The updated target matches a target set from scratch.
+  OpenCvRandomForest reference_classifier(params_);
+  reference_classifier.setTarget(target_cloud_);
+  EXPECT_EQ(expected_target_segment_ids,
+            findMatchingTargetSegments(reference_classifier, queries));
+}
+
+TEST_P(OpenCvRandomForestTest, test_update_target_before_set_target) {
+  // Arrange
+  OpenCvRandomForest classifier(params_);
+
+  // Act. The unchanged segments are added too.
+  classifier.updateTarget(target_cloud_, { 1 });
+
+  // Assert
+  EXPECT_EQ(std::vector<Id>({ 5, 30 }), findMatchingTargetSegments(classifier, { 50.5, 300.5 }));
+}
+
+INSTANTIATE_TEST_CASE_P(KnnIndexTypes, OpenCvRandomForestTest,
+                        ::testing::Values("LogStructuredKdTree", "Hnsw", "IvfPq"));
@@ -0,0 +1,175 @@
+#include <cstdio>
+#include <string>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "segmatch/common.hpp"
+#include "segmatch/database.hpp"
+#include "segmatch/segment_archive.hpp"
+#include "segmatch/segmented_cloud.hpp"
+
+using namespace segmatch;
+
+// Initialize common objects needed by multiple tests.
+class SegmentArchiveTest : public ::testing::Test {
+ protected:
+  const std::string filename_ = "/tmp/segmatch_test_segment_archive.bin";
+  const std::string csv_prefix_ = "/tmp/segmatch_test_segment_archive";
+  SegmentedCloud segmented_cloud_ = SegmentedCloud(false);
+
+  void SetUp() override {
+    // Segments 3 and 1 with four and two views of increasing size.
+    for (const Id segment_id : { 3, 1 }) {
+      Segment segment;
+      segment.segment_id = segment_id;
+      segment.track_id = 0u;
+      for (size_t i = 0u; i < static_cast<size_t>(segment_id) + 1u; ++i) {
+        SegmentView view;
+        for (size_t j = 0u; j < 10u * (i + 1u); ++j) {
+          view.point_cloud.push_back(PclPoint(segment_id, i, j));
+        }
+        view.calculateCentroid();
+        view.timestamp_ns = 1000u * i + segment_id;
+        view.n_occupied_voxels = 0u;
+        // Only the last view is described.
+        if (i == static_cast<size_t>(segment_id)) {
+          Feature feature("eigenvalue");
+          feature.push_back(FeatureValue("linearity", 0.5 * segment_id));
+          feature.push_back(FeatureValue("planarity", -0.5 * segment_id));
+          view.features.push_back(feature);
+        }
+        segment.views.push_back(view);
+      }
+      // Add the segment view by view as SegmentedCloud only accepts segments with one view.
+      Segment first_view = segment;
+      first_view.views.resize(1u);
+      segmented_cloud_.addValidSegment(first_view);
+      Segment* segment_in_cloud;
+      ASSERT_TRUE(segmented_cloud_.findValidSegmentPtrById(segment_id, &segment_in_cloud));
+      segment_in_cloud->views = segment.views;
+    }
+  }
+
+  void TearDown() override {
+    std::remove(filename_.c_str());
+    for (const std::string suffix : { "_segments.csv", "_features.csv", "_timestamps.csv" }) {
+      std::remove((csv_prefix_ + suffix).c_str());
+    }
+  }
+
+  void expectSameSegments(const SegmentedCloud& expected, const SegmentedCloud& actual) {
+    ASSERT_EQ(expected.size(), actual.size());
+    for (const auto& id_segment : expected) {
+      Segment segment;
+      ASSERT_TRUE(actual.findValidSegmentById(id_segment.first, &segment));
+      ASSERT_EQ(id_segment.second.views.size(), segment.views.size());
+      for (size_t i = 0u; i < segment.views.size(); ++i) {
+        const SegmentView& expected_view = id_segment.second.views[i];
+        const SegmentView& view = segment.views[i];
+        EXPECT_EQ(expected_view.timestamp_ns, view.timestamp_ns);
+        EXPECT_FLOAT_EQ(expected_view.centroid.z, view.centroid.z);
+        ASSERT_EQ(expected_view.point_cloud.size(), view.point_cloud.size());
+        for (size_t j = 0u; j < view.point_cloud.size(); ++j) {
+          EXPECT_EQ(expected_view.point_cloud[j].x, view.point_cloud[j].x);
+          EXPECT_EQ(expected_view.point_cloud[j].y, view.point_cloud[j].y);
+          EXPECT_EQ(expected_view.point_cloud[j].z, view.point_cloud[j].z);
+        }
+        EXPECT_EQ(expected_view.features.asVectorOfValues(), view.features.asVectorOfValues());
+        EXPECT_EQ(expected_view.features.asVectorOfNames(), view.features.asVectorOfNames());
+        ASSERT_EQ(expected_view.features.size(), view.features.size());
+        for (size_t j = 0u; j < view.features.size(); ++j) {
+          EXPECT_EQ(expected_view.features.at(j).getName(), view.features.at(j).getName());
+        }
+      }
+    }
+  }
+};
+
+TEST_F(SegmentArchiveTest, test_zero_copy_reader) {
+  ASSERT_TRUE(database::exportSegmentsArchive(filename_, segmented_cloud_));
+
+  SegmentArchiveReader reader;
+  ASSERT_TRUE(reader.open(filename_));
+  ASSERT_EQ(6u, reader.getNumberOfViews());
+  ASSERT_EQ(2u, reader.getDescriptorSchema().size());
+  EXPECT_EQ("eigenvalue", reader.getDescriptorSchema()[0].first);
+  EXPECT_EQ("planarity", reader.getDescriptorSchema()[1].second);
+
+  size_t begin, end;
+  ASSERT_TRUE(reader.findSegmentViews(3, &begin, &end));
+  ASSERT_EQ(4u, end - begin);
+  EXPECT_FALSE(reader.findSegmentViews(2, &begin, &end));
+
+  // The records are sorted by segment ID and view index.
+  ASSERT_TRUE(reader.findSegmentViews(1, &begin, &end));
+  ASSERT_EQ(0u, begin);
+  ASSERT_EQ(2u, end);
+  for (size_t i = begin; i < end; ++i) {
+    const SegmentArchiveRecord& record = reader.getRecord(i);
+    EXPECT_EQ(1, record.segment_id);
+    EXPECT_EQ(i, record.view_index);
+    EXPECT_EQ(1000u * i + 1u, record.timestamp_ns);
+    ASSERT_EQ(10u * (i + 1u), record.num_points);
+    const SegmentArchivePoint* points = reader.getPoints(i);
+    for (size_t j = 0u; j < record.num_points; ++j) {
+      EXPECT_EQ(1.0f, points[j].x);
+      EXPECT_EQ(static_cast<float>(i), points[j].y);
+      EXPECT_EQ(static_cast<float>(j), points[j].z);
+    }
+  }
+  EXPECT_EQ(nullptr, reader.getDescriptor(0u));
+  ASSERT_NE(nullptr, reader.getDescriptor(1u));
+  EXPECT_EQ(0.5, reader.getDescriptor(1u)[0]);
+  EXPECT_EQ(-0.5, reader.getDescriptor(1u)[1]);
+}
+
+TEST_F(SegmentArchiveTest, test_export_and_import) {
+  ASSERT_TRUE(database::exportSegmentsArchive(filename_, segmented_cloud_));
+  SegmentedCloud imported_cloud(false);
+  ASSERT_TRUE(database::importSegmentsArchive(filename_, &imported_cloud));
+  expectSameSegments(segmented_cloud_, imported_cloud);
+}
+
+TEST_F(SegmentArchiveTest, test_streaming_writer) {
+  SegmentArchiveWriter writer;
+  ASSERT_TRUE(writer.open(filename_));
+  for (const auto& id_segment : segmented_cloud_) {
+    for (size_t i = 0u; i < id_segment.second.views.size(); ++i) {
+      ASSERT_TRUE(writer.appendView(id_segment.second, i));
+    }
+  }
+  EXPECT_EQ(6u, writer.getNumberOfViews());
+
+  // The archive cannot be read before it is closed.
+  SegmentArchiveReader reader;
+  EXPECT_FALSE(reader.open(filename_));
+
+  ASSERT_TRUE(writer.close());
+  ASSERT_TRUE(reader.open(filename_));
+  SegmentedCloud imported_cloud(false);
+  reader.readSegmentedCloud(&imported_cloud);
+  expectSameSegments(segmented_cloud_, imported_cloud);
+}
+
+TEST_F(SegmentArchiveTest, test_convert_from_and_to_csv) {
+  // The segments are also described by a CNN, so that the values of the CSV files must be split
+  // between two features.
+  for (const Id segment_id : { 3, 1 }) {
+    Segment* segment;
+    ASSERT_TRUE(segmented_cloud_.findValidSegmentPtrById(segment_id, &segment));
+    Feature cnn_feature("cnn");
+    cnn_feature.push_back(FeatureValue("cnn_0", 0.25 * segment_id));
+    cnn_feature.push_back(FeatureValue("cnn_scale_x", 2.0));
+    segment->getLastView().features.push_back(cnn_feature);
+  }
+
+  ASSERT_TRUE(database::exportSegmentsArchive(filename_, segmented_cloud_));
+  ASSERT_TRUE(database::convertSegmentsArchiveToCsv(filename_, csv_prefix_));
+  std::remove(filename_.c_str());
+  ASSERT_TRUE(database::convertCsvToSegmentsArchive(csv_prefix_, filename_));
+
+  SegmentedCloud imported_cloud(false);
+  ASSERT_TRUE(database::importSegmentsArchive(filename_, &imported_cloud));
+  expectSameSegments(segmented_cloud_, imported_cloud);
+}
@@ -0,0 +1,146 @@
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "segmatch/common.hpp"
+#include "segmatch/segment_map.hpp"
+#include "segmatch/segmented_cloud.hpp"
+
+using namespace segmatch;
+
+// Initialize common objects needed by multiple tests.
+class SegmentMapTest : public ::testing::Test {
+ protected:
+  const std::string filename_ = "/tmp/segmatch_test_segment_map.bin";
+  SegmentedCloud segmented_cloud_;
+
+  void SetUp() override {
+    MapCloud cloud;
+    for (size_t i = 0u; i < 300u; ++i) {
+      MapPoint point;
+      point.x = static_cast<float>(i) * 0.1f;
+      point.y = static_cast<float>(i % 7u);
+      point.z = -static_cast<float>(i % 13u);
+      cloud.push_back(point);
+    }
+
+    segmented_cloud_.resetSegmentIdCounter(10);
+    for (size_t i = 0u; i < 3u; ++i) {
+      pcl::PointIndices indices;
+      for (size_t j = i * 100u; j < (i + 1u) * 100u - i * 10u; ++j) indices.indices.push_back(j);
+      const Id id = segmented_cloud_.addSegment(indices, cloud);
+
+      Segment* segment;
+      ASSERT_TRUE(segmented_cloud_.findValidSegmentPtrById(id, &segment));
+      segment->track_id = i;
+      SegmentView& view = segment->getLastView();
+      view.timestamp_ns = 1000u * i;
+      view.T_w_linkpose = SE3(SE3::Position(1.0, 2.0, i),
+                              SE3::Rotation::Implementation(0.5, 0.5, -0.5, 0.5));
+      view.semantic = i;
+      view.n_occupied_voxels = 5u * i;
+      // The last segment is not described.
+      if (i < 2u) {
+        Feature eigenvalues("eigenvalue");
+        eigenvalues.push_back(FeatureValue("linearity", 0.1 * i));
+        eigenvalues.push_back(FeatureValue("planarity", 0.2 * i));
+        Feature cnn("cnn");
+        cnn.push_back(FeatureValue("cnn_0", -1.0 * i));
+        view.features.push_back(eigenvalues);
+        view.features.push_back(cnn);
+      }
+    }
+  }
+
+  void TearDown() override {
+    std::remove(filename_.c_str());
+  }
+};
+
+TEST_F(SegmentMapTest, test_save_and_load) {
+  ASSERT_TRUE(saveSegmentMap(filename_, segmented_cloud_));
+
+  SegmentedCloud loaded_cloud;
+  loaded_cloud.resetSegmentIdCounter();
+  ASSERT_TRUE(loadSegmentMap(filename_, &loaded_cloud));
+  ASSERT_EQ(segmented_cloud_.size(), loaded_cloud.size());
+
+  for (const auto& id_segment : segmented_cloud_) {
+    const Segment& expected_segment = id_segment.second;
+    const SegmentView& expected_view = expected_segment.getLastView();
+    Segment segment;
+    ASSERT_TRUE(loaded_cloud.findValidSegmentById(id_segment.first, &segment));
+    ASSERT_EQ(1u, segment.views.size());
+    const SegmentView& view = segment.getLastView();
+
+    EXPECT_EQ(expected_segment.track_id, segment.track_id);
+    EXPECT_EQ(expected_view.timestamp_ns, view.timestamp_ns);
+    EXPECT_EQ(expected_view.semantic, view.semantic);
+    EXPECT_EQ(expected_view.n_occupied_voxels, view.n_occupied_voxels);
+    EXPECT_EQ(expected_view.centroid.x, view.centroid.x);
+    EXPECT_EQ(expected_view.centroid.y, view.centroid.y);
+    EXPECT_EQ(expected_view.centroid.z, view.centroid.z);
+    EXPECT_TRUE(expected_view.T_w_linkpose.getTransformationMatrix().isApprox(
+        view.T_w_linkpose.getTransformationMatrix()));
+
+    ASSERT_EQ(expected_view.point_cloud.size(), view.point_cloud.size());
+    for (size_t i = 0u; i < view.point_cloud.size(); ++i) {
+      EXPECT_EQ(expected_view.point_cloud[i].x, view.point_cloud[i].x);
+      EXPECT_EQ(expected_view.point_cloud[i].y, view.point_cloud[i].y);
+      EXPECT_EQ(expected_view.point_cloud[i].z, view.point_cloud[i].z);
+    }
+    EXPECT_EQ(expected_view.point_cloud_to_publish.size(), view.point_cloud_to_publish.size());
+
+    ASSERT_EQ(expected_view.features.size(), view.features.size());
+    EXPECT_EQ(expected_view.features.asVectorOfNames(), view.features.asVectorOfNames());
+    EXPECT_EQ(expected_view.features.asVectorOfValues(), view.features.asVectorOfValues());
+    for (size_t i = 0u; i < view.features.size(); ++i) {
+      EXPECT_EQ(expected_view.features.at(i).getName(), view.features.at(i).getName());
+    }
+  }
+
+  // New segments must not reuse the IDs of the loaded segments.
+  EXPECT_GT(loaded_cloud.getNextId(), 12);
+}
+
+TEST_F(SegmentMapTest, test_reject_invalid_files) {
+  SegmentedCloud loaded_cloud;
+  EXPECT_FALSE(loadSegmentMap(filename_, &loaded_cloud));
+
+  // Truncate a valid segment map.
+  ASSERT_TRUE(saveSegmentMap(filename_, segmented_cloud_));
+  std::string content;
+  {
+    std::ifstream input_file(filename_, std::ifstream::binary);
+    content.assign(std::istreambuf_iterator<char>(input_file), std::istreambuf_iterator<char>());
+  }
+  {
+    std::ofstream output_file(filename_, std::ofstream::binary | std::ofstream::trunc);
+    output_file.write(content.data(), content.size() / 2u);
+  }
+  EXPECT_FALSE(loadSegmentMap(filename_, &loaded_cloud));
+  EXPECT_TRUE(loaded_cloud.empty());
+}
+
+TEST_F(SegmentMapTest, test_reject_different_descriptors) {
+  Segment* segment;
+  ASSERT_TRUE(segmented_cloud_.findValidSegmentPtrById(10, &segment));
+  segment->getLastView().features.clearByName("cnn");
+  EXPECT_FALSE(saveSegmentMap(filename_, segmented_cloud_));
+}
+
+TEST_F(SegmentMapTest, test_reject_stale_segment_maps) {
+  const std::string fingerprint = "source: map.pcd\nsegmenter_type: IncrementalEuclideanDistance\n";
+  ASSERT_TRUE(saveSegmentMap(filename_, segmented_cloud_, fingerprint));
+
+  SegmentedCloud loaded_cloud;
+  EXPECT_FALSE(loadSegmentMap(filename_, &loaded_cloud));
+  EXPECT_FALSE(loadSegmentMap(filename_, &loaded_cloud, fingerprint + "min_cluster_size: 50\n"));
+  EXPECT_TRUE(loaded_cloud.empty());
+  ASSERT_TRUE(loadSegmentMap(filename_, &loaded_cloud, fingerprint));
+  EXPECT_EQ(segmented_cloud_.size(), loaded_cloud.size());
+}
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <random>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "segmatch/points_neighbors_providers/voxel_hash_points_neighbors_provider.hpp"
+#include "segmatch/common.hpp"
+#include "segmatch/dynamic_voxel_grid.hpp"
+
+using namespace segmatch;
+
+// Initialize common objects needed by multiple tests.
+class VoxelHashPointsNeighborsProviderTest : public ::testing::Test {
+ protected:
+  typedef DynamicVoxelGrid<PclPoint, MapPoint> VoxelGrid;
+
+  VoxelGrid voxel_grid_;
+  VoxelHashPointsNeighborsProvider<PclPoint, MapPoint> provider_;
+  std::mt19937 generator_;
+
+  VoxelHashPointsNeighborsProviderTest()
+    : voxel_grid_(0.1f, 2), provider_(voxel_grid_), generator_(42) {
+  }
+
+  void SetUp() override {
+    std::uniform_real_distribution<float> distribution(-2.0f, 2.0f);
+    PointCloud cloud;
+    for (size_t i = 0u; i < 20000u; ++i) {
+      cloud.push_back(PclPoint(distribution(generator_), distribution(generator_),
+                               distribution(generator_) / 4.0f));
+    }
+    voxel_grid_.insert(cloud);
+  }
+
+  void TearDown() override {
+  }
+
+  // Get a pointer to the active centroids of the grid.
+  MapCloud::ConstPtr getCentroidsPtr() {
+    return MapCloud::ConstPtr(&voxel_grid_.getActiveCentroids(), [](MapCloud const* ptr) {});
+  }
+
+  // Check the neighbors returned by the provider against an exhaustive search.
+  void expectCorrectNeighbors(const float search_radius,
+                              const std::vector<bool>& excluded_points = {}) {
+    const MapCloud& points = voxel_grid_.getActiveCentroids();
+    ASSERT_LT(0u, points.size());
+    for (size_t i = 0u; i < points.size(); i += 5u) {
+      std::vector<int> expected_neighbors;
+      for (size_t j = 0u; j < points.size(); ++j) {
+        if (!excluded_points.empty() && excluded_points[j]) continue;
+        if ((points[i].getVector3fMap() - points[j].getVector3fMap()).squaredNorm() <=
+            search_radius * search_radius)
+          expected_neighbors.push_back(j);
+      }
+      PointNeighbors neighbors = provider_.getNeighborsOf(i, search_radius);
+      std::sort(neighbors.begin(), neighbors.end());
+      ASSERT_EQ(expected_neighbors, neighbors);
+    }
+  }
+};
+
+TEST_F(VoxelHashPointsNeighborsProviderTest, test_neighbors) {
+  provider_.update(getCentroidsPtr());
+
+  expectCorrectNeighbors(0.1f);
+  expectCorrectNeighbors(0.25f);
+  EXPECT_NE(nullptr, provider_.getPclSearchObject());
+}
+
+TEST_F(VoxelHashPointsNeighborsProviderTest, test_neighbors_after_transform) {
+  kindr::minimal::QuatTransformationTemplate<float> transformation(
+      kindr::minimal::QuatTransformationTemplate<float>::Position(0.4f, -1.3f, 0.05f),
+      kindr::minimal::RotationQuaternionTemplate<float>(Eigen::Vector3f(0.1f, -0.3f, 0.7f)));
+  voxel_grid_.transform(transformation);
+  voxel_grid_.applyPendingTransformation();
+  provider_.update(getCentroidsPtr());
+
+  expectCorrectNeighbors(0.2f);
+}
+
+TEST_F(VoxelHashPointsNeighborsProviderTest, test_excluded_points) {
+  const MapCloud& points = voxel_grid_.getActiveCentroids();
+  std::vector<bool> excluded_points(points.size());
+  for (size_t i = 0u; i < points.size(); ++i) excluded_points[i] = points[i].z < 0.0f;
+  provider_.update(getCentroidsPtr(), {}, excluded_points);
+
+  // The neighbors of the excluded points can be queried too.
+  expectCorrectNeighbors(0.2f, excluded_points);
+}
+
+TEST_F(VoxelHashPointsNeighborsProviderTest, test_incremental_updates) {
+  const MapCloud& points = voxel_grid_.getActiveCentroids();
+  std::vector<bool> excluded_points(points.size(), false);
+  provider_.update(getCentroidsPtr(), {}, excluded_points);
+
+  std::uniform_real_distribution<float> distribution(-2.0f, 2.0f);
+  for (size_t iteration = 0u; iteration < 6u; ++iteration) {
+    // Remove the voxels in a slab and build the mapping of the remaining points.
+    const float slab_min_x = -1.5f + 0.5f * static_cast<float>(iteration);
+    const std::vector<bool> is_point_removed = voxel_grid_.removeIf(
+        [&](const MapPoint& point) { return point.x > slab_min_x && point.x < slab_min_x + 0.3f; });
+    std::vector<int64_t> points_mapping(is_point_removed.size());
+    int64_t new_point_index = 0;
+    for (size_t i = 0u; i < is_point_removed.size(); ++i) {
+      points_mapping[i] = is_point_removed[i] ? -1 : new_point_index++;
+    }
+
+    // Insert points that create voxels and move the centroids of existing ones. The created
+    // voxels are appended to the centroids.
+    PointCloud cloud;
+    for (size_t i = 0u; i < 5000u; ++i) {
+      cloud.push_back(PclPoint(distribution(generator_), distribution(generator_),
+                               distribution(generator_) / 4.0f));
+    }
+    voxel_grid_.insert(cloud);
+
+    // Exclude and include points again.
+    const float excluded_max_z = iteration % 2u == 0u ? -0.2f : 0.1f;
+    excluded_points.resize(points.size());
+    for (size_t i = 0u; i < points.size(); ++i) excluded_points[i] = points[i].z < excluded_max_z;
+    provider_.update(getCentroidsPtr(), points_mapping, excluded_points);
+
+    expectCorrectNeighbors(0.2f, excluded_points);
+  }
+
+  // Insert points far apart from each other, so that the hash table of the bricks grows.
+  std::vector<int64_t> points_mapping(points.size());
+  for (size_t i = 0u; i < points.size(); ++i) points_mapping[i] = i;
+  std::uniform_real_distribution<float> sparse_distribution(-20.0f, 20.0f);
+  PointCloud sparse_cloud;
+  for (size_t i = 0u; i < 10000u; ++i) {
+    const PclPoint point(sparse_distribution(generator_), sparse_distribution(generator_), 1.0f);
+    sparse_cloud.push_back(point);
+    sparse_cloud.push_back(point);
+  }
+  voxel_grid_.insert(sparse_cloud);
+  excluded_points.resize(points.size(), false);
+  provider_.update(getCentroidsPtr(), points_mapping, excluded_points);
+
+  expectCorrectNeighbors(0.2f, excluded_points);
+}
+
+TEST_F(VoxelHashPointsNeighborsProviderTest, test_batched_neighbors) {
+  provider_.update(getCentroidsPtr());
+  const float search_radius = 0.2f;
+  std::vector<int> query_indices;
+  for (size_t i = 0u; i < voxel_grid_.getActiveCentroids().size(); i += 3u)
+    query_indices.push_back(i);
+
+  // Batches searched with one or more threads must match the single point queries.
+  PointsNeighborsBatch neighbors;
+  for (const size_t max_num_threads : { 1u, 4u }) {
+    provider_.getNeighborsOfPoints(query_indices.data(), query_indices.size(), search_radius,
+                                   neighbors, max_num_threads);
+    ASSERT_EQ(query_indices.size(), neighbors.size());
+    for (size_t i = 0u; i < query_indices.size(); ++i) {
+      EXPECT_EQ(provider_.getNeighborsOf(query_indices[i], search_radius),
+                PointNeighbors(neighbors.begin(i), neighbors.end(i)));
+    }
+  }
+}
@@ -0,0 +1,43 @@
+// Converts the segments exported by the SegMatch worker between segment archives and the CSV files
+// read by segmappy.
+//
+// Usage: segment_archive_converter <input> <output>
+//  - input: Segment archive ("*.bin") or prefix of the CSV files written by
+//    segmatch::database::exportSegmentsAndFeatures() with all the views.
+//  - output: Prefix of the CSV files if the input is an archive, archive filename otherwise.
+
+#include <iostream>
+#include <string>
+
+#include <glog/logging.h>
+
+#include "segmatch/database.hpp"
+
+using namespace segmatch;
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = true;
+
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <segments.bin> <CSV prefix>" << std::endl <<
+        "       " << argv[0] << " <CSV prefix> <segments.bin>" << std::endl;
+    return 1;
+  }
+  const std::string input = argv[1];
+  const std::string output = argv[2];
+
+  const std::string kArchiveExtension = ".bin";
+  const bool input_is_archive = input.size() >= kArchiveExtension.size() &&
+      input.compare(input.size() - kArchiveExtension.size(), kArchiveExtension.size(),
+                    kArchiveExtension) == 0;
+  const bool converted = input_is_archive ?
+      database::convertSegmentsArchiveToCsv(input, output) :
+      database::convertCsvToSegmentsArchive(input, output);
+  if (!converted) {
+    LOG(ERROR) << "Failed to convert " << input << " to " << output << ".";
+    return 1;
+  }
+  LOG(INFO) << "Converted " << input << " to " << output << ".";
+  return 0;
+}
@@ -27,6 +27,12 @@ struct SegMatchWorkerParams {
   bool localize;
   bool close_loops;
   std::string target_cloud_filename;
+  // Segment map of the target cloud. If the file exists and was computed from a target cloud with
+  // the same path and with the same segmentation and description parameters, it is loaded instead
+  // of processing the target cloud, which then doesn't need to exist. Otherwise, it is created
+  // after processing the target cloud. The map must be deleted when the target cloud file is
+  // replaced.
+  std::string target_segment_map_filename = "";
   std::string world_frame;
 
   double distance_between_segmentations_m;
@@ -38,6 +44,11 @@ struct SegMatchWorkerParams {
   double ratio_of_points_to_keep_when_publishing;
 
   bool export_segments_and_matches = false;
+  // Export the segments as the CSV files read by segmappy. Otherwise they are exported as a
+  // segment archive, which is faster to write and smaller. Archives can be converted to the CSV
+  // files with:
+  //   rosrun segmatch segment_archive_converter run_<time>_segments.bin run_<time>
+  bool export_segments_as_csv = true;
 
   bool publish_predicted_segment_matches = false;
 
@@ -148,6 +159,8 @@ static segmatch::SegMatchParams getSegMatchParams(const ros::NodeHandle& nh,
               params.radius_for_normal_estimation_m);
   nh.getParam(ns + "/normal_estimator_type",
               params.normal_estimator_type);
+  nh.getParam(ns + "/normal_estimator_num_threads",
+              params.normal_estimator_num_threads);
 
   // Local map parameters.
   nh.getParam(ns + "/LocalMap/voxel_size_m",
@@ -162,6 +175,20 @@ static segmatch::SegMatchParams getSegMatchParams(const ros::NodeHandle& nh,
               params.local_map_params.max_vertical_distance_m);
   nh.getParam(ns + "/LocalMap/neighbors_provider_type",
               params.local_map_params.neighbors_provider_type);
+  nh.getParam(ns + "/LocalMap/inactive_voxels_max_age_scans",
+              params.local_map_params.inactive_voxels_max_age_scans);
+  nh.getParam(ns + "/LocalMap/inactive_voxels_max_age_s",
+              params.local_map_params.inactive_voxels_max_age_s);
+  nh.getParam(ns + "/LocalMap/max_voxels",
+              params.local_map_params.max_voxels);
+  nh.getParam(ns + "/LocalMap/remove_ground",
+              params.local_map_params.remove_ground);
+  nh.getParam(ns + "/LocalMap/ground_cell_size_m",
+              params.local_map_params.ground_cell_size_m);
+  nh.getParam(ns + "/LocalMap/ground_max_height_m",
+              params.local_map_params.ground_max_height_m);
+  nh.getParam(ns + "/LocalMap/ground_max_height_above_robot_m",
+              params.local_map_params.ground_max_height_above_robot_m);
 
   // Descriptors parameters.
   nh.getParam(ns + "/Descriptors/descriptor_types",
@@ -195,6 +222,12 @@ static segmatch::SegMatchParams getSegMatchParams(const ros::NodeHandle& nh,
               params.segmenter_params.sc_smoothness_threshold_deg);
   nh.getParam(ns + "/Segmenters/sc_curvature_threshold",
               params.segmenter_params.sc_curvature_threshold);
+  nh.getParam(ns + "/Segmenters/num_threads",
+              params.segmenter_params.num_threads);
+  nh.getParam(ns + "/Segmenters/parallel_tile_size_m",
+              params.segmenter_params.parallel_tile_size_m);
+  nh.getParam(ns + "/Segmenters/update_only_modified_segments",
+              params.segmenter_params.update_only_modified_segments);
 
   // Classifier parameters.
   nh.getParam(ns + "/Classifier/classifier_filename",
@@ -242,6 +275,23 @@ static segmatch::SegMatchParams getSegMatchParams(const ros::NodeHandle& nh,
   nh.getParam(ns + "/Classifier/feature_distance_threshold",
               params.classifier_params.feature_distance_threshold);
 
+  nh.getParam(ns + "/Classifier/knn_index_type",
+              params.classifier_params.knn_index_type);
+  nh.getParam(ns + "/Classifier/hnsw_max_links",
+              params.classifier_params.hnsw_max_links);
+  nh.getParam(ns + "/Classifier/hnsw_ef_construction",
+              params.classifier_params.hnsw_ef_construction);
+  nh.getParam(ns + "/Classifier/hnsw_ef_search",
+              params.classifier_params.hnsw_ef_search);
+  nh.getParam(ns + "/Classifier/ivfpq_num_lists",
+              params.classifier_params.ivfpq_num_lists);
+  nh.getParam(ns + "/Classifier/ivfpq_num_probes",
+              params.classifier_params.ivfpq_num_probes);
+  nh.getParam(ns + "/Classifier/ivfpq_num_subquantizers",
+              params.classifier_params.ivfpq_num_subquantizers);
+  nh.getParam(ns + "/Classifier/knn_num_threads",
+              params.classifier_params.knn_num_threads);
+
   nh.getParam(ns + "/Classifier/normalize_eigen_for_knn",
               params.classifier_params.normalize_eigen_for_knn);
   nh.getParam(ns + "/Classifier/normalize_eigen_for_hard_threshold",
@@ -279,8 +329,12 @@ static SegMatchWorkerParams getSegMatchWorkerParams(const ros::NodeHandle& nh,
   if (params.localize) {
     using namespace boost::filesystem;
     nh.getParam(ns + "/target_cloud_filename", params.target_cloud_filename);
+    nh.getParam(ns + "/target_segment_map_filename", params.target_segment_map_filename);
     path target_cloud_path(params.target_cloud_filename);
-    CHECK(exists(target_cloud_path)) << "Target cloud does not exist.";
+    path target_segment_map_path(params.target_segment_map_filename);
+    CHECK(exists(target_cloud_path) || (!params.target_segment_map_filename.empty() &&
+                                        exists(target_segment_map_path))) <<
+        "Target cloud does not exist.";
   }
 
   nh.getParam(ns +"/distance_between_segmentations_m",
@@ -295,6 +349,9 @@ static SegMatchWorkerParams getSegMatchWorkerParams(const ros::NodeHandle& nh,
   nh.getParam(ns +"/export_segments_and_matches",
               params.export_segments_and_matches);
 
+  nh.getParam(ns +"/export_segments_as_csv",
+              params.export_segments_as_csv);
+
   nh.getParam(ns +"/ratio_of_points_to_keep_when_publishing",
               params.ratio_of_points_to_keep_when_publishing);
 
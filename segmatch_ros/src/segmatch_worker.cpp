@@ -1,5 +1,6 @@
 #include "segmatch_ros/segmatch_worker.hpp"
 
+#include <boost/filesystem.hpp>
 #include <laser_slam/benchmarker.hpp>
 #include <laser_slam/common.hpp>
 #include <pcl/common/common.h>
@@ -93,11 +94,30 @@ void SegMatchWorker::init(ros::NodeHandle& nh, const SegMatchWorkerParams& param
 }
 
 void SegMatchWorker::loadTargetCloud() {
+  const std::string& segment_map_filename = params_.target_segment_map_filename;
+  if (!segment_map_filename.empty() && boost::filesystem::exists(segment_map_filename)) {
+    ROS_INFO("Loading target segment map.");
+    if (segmatch_.loadTargetSegmentMap(segment_map_filename, params_.target_cloud_filename)) {
+      target_cloud_loaded_ = true;
+      return;
+    }
+    ROS_WARN("Failed to load the target segment map or the map is stale. Processing the target "
+             "cloud instead.");
+  }
+
+  CHECK(boost::filesystem::exists(params_.target_cloud_filename)) <<
+      "Target cloud does not exist and no valid target segment map was found.";
   ROS_INFO("Loading target cloud.");
   segmatch::MapCloud target_cloud;
   segmatch::loadCloud(params_.target_cloud_filename, &target_cloud);
   segmatch_.processAndSetAsTargetCloud(target_cloud);
   target_cloud_loaded_ = true;
+
+  // Save the processed target so that the next start is faster.
+  if (!segment_map_filename.empty() &&
+      !segmatch_.saveTargetSegmentMap(segment_map_filename, params_.target_cloud_filename)) {
+    ROS_WARN("Failed to save the target segment map.");
+  }
 }
 
 bool SegMatchWorker::processLocalMap(
@@ -434,8 +454,13 @@ bool SegMatchWorker::exportRunServiceCall(std_srvs::Empty::Request& req,
     // TODO RD clean if not needed.
     // database::exportMatches("/tmp/online_matcher/run_" + acquisition_time + "_matches.csv",
     //                        matches_database_);
-    database::exportSegmentsAndFeatures("/tmp/online_matcher/run_" + acquisition_time,
-                                        segments_database_, true);
+    const std::string filename_prefix = "/tmp/online_matcher/run_" + acquisition_time;
+    if (params_.export_segments_as_csv) {
+      database::exportSegmentsAndFeatures(filename_prefix, segments_database_, true);
+    } else {
+      database::exportSegmentsArchive(filename_prefix + "_segments.bin", segments_database_, true);
+      database::exportVisualViews(filename_prefix + "_vis_views", segments_database_, true);
+    }
     database::exportPositions("/tmp/online_matcher/run_" + acquisition_time + "_positions.csv",
                               segments_database_, true);
     database::exportMergeEvents("/tmp/online_matcher/run_" + acquisition_time + "_merge_events.csv",